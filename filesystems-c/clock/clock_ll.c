@@ -7,6 +7,14 @@
   See the file COPYING.
 
   gcc -Wall `pkg-config fuse --cflags --libs` clock_ll.c -o clock_ll
+
+  /clock holds the time of day and changes every interval (-o interval=MS,
+  250 by default). How readers get to see the change is up to
+  -o mode=poll|inval|store; see pushfile.h. -o timeout=SECONDS sets the
+  attribute and entry timeouts in poll mode.
+
+  The daemon counts the requests it serves and prints the totals on the
+  way out, which clock_ll_bench uses to compare the modes.
 */
 
 #define FUSE_USE_VERSION 26
@@ -20,11 +28,34 @@
 #include <unistd.h>
 #include <assert.h>
 #include <pthread.h>
+#include <stddef.h>
 #include <sys/time.h>
+#include <time.h>
+
+#include "pushfile.h"
 
-static char clock_str[32] = "Hello World!\n";
 static const char *clock_name = "clock";
 
+static struct pushfile clock_file;
+
+static struct clock_options {
+	char *mode;
+	double timeout;
+	int interval;		/* ms */
+} options = { NULL, 1.0, 250 };
+
+enum {
+	COUNT_LOOKUP,
+	COUNT_GETATTR,
+	COUNT_OPEN,
+	COUNT_READ,
+	COUNT_MAX
+};
+
+static unsigned long counts[COUNT_MAX];
+
+#define COUNT(c) __sync_fetch_and_add(&counts[c], 1)
+
 static int hello_stat(fuse_ino_t ino, struct stat *stbuf)
 {
 	stbuf->st_ino = ino;
@@ -37,7 +68,7 @@ static int hello_stat(fuse_ino_t ino, struct stat *stbuf)
 	case 2:
 		stbuf->st_mode = S_IFREG | 0444;
 		stbuf->st_nlink = 1;
-		stbuf->st_size = strlen(clock_str);
+		stbuf->st_size = pushfile_size(&clock_file);
 		break;
 
 	default:
@@ -53,24 +84,28 @@ static void clock_ll_getattr(fuse_req_t req, fuse_ino_t ino,
 
 	(void) fi;
 
+	COUNT(COUNT_GETATTR);
+
 	memset(&stbuf, 0, sizeof(stbuf));
 	if (hello_stat(ino, &stbuf) == -1)
 		fuse_reply_err(req, ENOENT);
 	else
-		fuse_reply_attr(req, &stbuf, 1.0);
+		fuse_reply_attr(req, &stbuf, pushfile_timeout(&clock_file));
 }
 
 static void clock_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
 	struct fuse_entry_param e;
 
+	COUNT(COUNT_LOOKUP);
+
 	if (parent != 1 || strcmp(name, clock_name) != 0)
 		fuse_reply_err(req, ENOENT);
 	else {
 		memset(&e, 0, sizeof(e));
 		e.ino = 2;
-		e.attr_timeout = 1.0;
-		e.entry_timeout = 1.0;
+		e.attr_timeout = pushfile_timeout(&clock_file);
+		e.entry_timeout = pushfile_timeout(&clock_file);
 		hello_stat(e.ino, &e.attr);
 
 		fuse_reply_entry(req, &e);
@@ -134,21 +169,30 @@ static void clock_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
 static void clock_ll_open(fuse_req_t req, fuse_ino_t ino,
 			  struct fuse_file_info *fi)
 {
+	COUNT(COUNT_OPEN);
+
 	if (ino != 2)
 		fuse_reply_err(req, EISDIR);
 	else if ((fi->flags & 3) != O_RDONLY)
 		fuse_reply_err(req, EACCES);
-	else
+	else {
+		fi->keep_cache = pushfile_keep_cache(&clock_file);
 		fuse_reply_open(req, fi);
+	}
 }
 
 static void clock_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size,
 			  off_t off, struct fuse_file_info *fi)
 {
+	char buf[PUSHFILE_MAX];
+
 	(void) fi;
 
+	COUNT(COUNT_READ);
+
 	assert(ino == 2);
-	reply_buf_limited(req, clock_str, strlen(clock_str), off, size);
+	fuse_reply_buf(req, buf, pushfile_read(&clock_file, buf,
+					       min(size, sizeof(buf)), off));
 }
 
 static struct fuse_lowlevel_ops clock_ll_oper = {
@@ -159,33 +203,83 @@ static struct fuse_lowlevel_ops clock_ll_oper = {
 	.read		= clock_ll_read,
 };
 
+/* Fixed width, so that the size only changes if the format does. */
+static size_t clock_format(char *buf, size_t size)
+{
+	struct timeval tp;
+	struct tm t;
+
+	gettimeofday(&tp, 0);
+	localtime_r(&tp.tv_sec, &t);
+	return snprintf(buf, size, "%02d:%02d:%02d:%06d\n", t.tm_hour,
+			t.tm_min, t.tm_sec, (int)tp.tv_usec);
+}
+
 static void *clock_update(void *arg)
 {
 	struct fuse_session *se = (struct fuse_session *)arg;
 	struct fuse_chan *ch = fuse_session_next_chan(se, NULL);
+	struct timespec ts;
+	char buf[32];
+	size_t len;
 
-	struct timeval tp;
-	struct tm *t;
+	ts.tv_sec = options.interval / 1000;
+	ts.tv_nsec = (options.interval % 1000) * 1000000L;
 
 	while (!fuse_session_exited(se)) {
-		gettimeofday(&tp, 0);
-		t = localtime(&tp.tv_sec);
-		snprintf(clock_str, sizeof(clock_str), "%02d:%02d:%02d:%d\n", t->tm_hour, t->tm_min, t->tm_sec, tp.tv_usec);
-
-		fuse_lowlevel_notify_inval_inode(ch, 2, 0, 0);
-		usleep(250000);
+		len = clock_format(buf, sizeof(buf));
+		if (pushfile_update(&clock_file, ch, buf, len) != 0)
+			fprintf(stderr, "clock_ll: cannot notify the kernel\n");
+		nanosleep(&ts, NULL);
 	}
 
 	return NULL;
 }
 
+#define CLOCK_OPT(t, p, v) { t, offsetof(struct clock_options, p), v }
+
+static struct fuse_opt clock_opts[] = {
+	CLOCK_OPT("mode=%s",		mode,		0),
+	CLOCK_OPT("timeout=%lf",	timeout,	0),
+	CLOCK_OPT("interval=%d",	interval,	0),
+	FUSE_OPT_END
+};
+
 int main(int argc, char *argv[])
 {
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 	struct fuse_chan *ch;
 	char *mountpoint;
+	enum pushfile_mode mode;
+	char buf[32];
 	int err = 0;
 
+	if (fuse_opt_parse(&args, &options, clock_opts, NULL) == -1)
+		return 1;
+	if (!options.mode)
+#if FUSE_VERSION >= 29
+		mode = PUSHFILE_STORE;
+#else
+		mode = PUSHFILE_INVAL;
+#endif
+	else if (!strcmp(options.mode, "poll"))
+		mode = PUSHFILE_POLL;
+	else if (!strcmp(options.mode, "inval"))
+		mode = PUSHFILE_INVAL;
+	else if (!strcmp(options.mode, "store"))
+		mode = PUSHFILE_STORE;
+	else {
+		fprintf(stderr, "clock_ll: mode must be poll, inval or store\n");
+		return 1;
+	}
+	if (options.interval < 1 || options.timeout < 0) {
+		fprintf(stderr, "clock_ll: option out of range\n");
+		return 1;
+	}
+
+	pushfile_init(&clock_file, 2, mode, options.timeout);
+	pushfile_update(&clock_file, NULL, buf, clock_format(buf, sizeof(buf)));
+
 	if (fuse_parse_cmdline(&args, &mountpoint, NULL, NULL) != -1 &&
 	    (ch = fuse_mount(mountpoint, &args)) != NULL) {
 		struct fuse_session *se;
@@ -196,12 +290,12 @@ int main(int argc, char *argv[])
 			if (fuse_set_signal_handlers(se) != -1) {
 				fuse_session_add_chan(se, ch);
 
-				if (!err) {
-					pthread_t clock_thread;
-					err = pthread_create(&clock_thread, NULL, &clock_update, se);
-				}
+				pthread_t clock_thread;
+				err = pthread_create(&clock_thread, NULL, &clock_update, se);
 				if (!err) {
 					err = fuse_session_loop(se);
+					fuse_session_exit(se);
+					pthread_join(clock_thread, NULL);
 				}
 
 				fuse_remove_signal_handlers(se);
@@ -213,5 +307,9 @@ int main(int argc, char *argv[])
 	}
 	fuse_opt_free_args(&args);
 
+	fprintf(stderr, "clock_ll: served %lu lookup %lu getattr %lu open "
+		"%lu read\n", counts[COUNT_LOOKUP], counts[COUNT_GETATTR],
+		counts[COUNT_OPEN], counts[COUNT_READ]);
+
 	return err ? 1 : 0;
 }
@@ -0,0 +1,432 @@
+/*
+  clock_ll_bench: polling against pushed invalidation, as seen by readers
+
+  For each clock_ll mode (poll, inval, store) and each reader count, the
+  bench mounts "clock_ll -f -o mode=..." on MOUNTPOINT and lets N threads
+  read /clock as fast as they can, either as cat(1) would (open, read,
+  close) or with pread() on a descriptor kept open. Every read is parsed,
+  and its age is how far the time it holds lags behind the reader's clock.
+  With updates every interval, a coherent cache keeps the age under the
+  interval; anything above that is staleness. After each run the daemon
+  reports how many requests it served, which is the price of the
+  coherence.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define MAX_READERS	256
+#define MAX_SAMPLES	(1 << 20)	/* per reader */
+#define DAY_US		(86400LL * 1000000LL)
+
+static const char *program = "./clock_ll";
+static const char *mountpoint;
+static char clock_path[4096];
+static unsigned duration = 3;
+static int interval = 250;		/* ms */
+static const char *poll_timeout = "1.0";
+static int use_pread;
+
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static int started;
+static volatile int stopped;
+
+struct reader {
+	pthread_t thread;
+	uint64_t ops;
+	uint64_t errors;
+	uint32_t *latency;	/* ns, saturating */
+	uint32_t *age;		/* us, saturating */
+	size_t nsamples;
+	double elapsed;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Local time of day in microseconds, the way clock_ll writes it. */
+static int64_t time_of_day_us(void)
+{
+	struct timeval tv;
+	struct tm t;
+
+	gettimeofday(&tv, NULL);
+	localtime_r(&tv.tv_sec, &t);
+	return ((t.tm_hour * 60LL + t.tm_min) * 60 + t.tm_sec) * 1000000LL +
+	       tv.tv_usec;
+}
+
+static int parse_age(const char *buf, int64_t *age)
+{
+	int h, m, s, us;
+
+	if (sscanf(buf, "%2d:%2d:%2d:%6d", &h, &m, &s, &us) != 4)
+		return -1;
+	*age = time_of_day_us() - (((h * 60LL + m) * 60 + s) * 1000000LL + us);
+	if (*age < -DAY_US / 2)		/* midnight went by */
+		*age += DAY_US;
+	if (*age < 0)
+		*age = 0;
+	return 0;
+}
+
+static void *reader_main(void *arg)
+{
+	struct reader *r = arg;
+	int fd = -1;
+	char buf[64];
+
+	r->latency = malloc(MAX_SAMPLES * sizeof(uint32_t));
+	r->age = malloc(MAX_SAMPLES * sizeof(uint32_t));
+	if (!r->latency || !r->age) {
+		fprintf(stderr, "clock_ll_bench: out of memory\n");
+		exit(1);
+	}
+	if (use_pread && (fd = open(clock_path, O_RDONLY)) == -1) {
+		perror(clock_path);
+		exit(1);
+	}
+
+	pthread_mutex_lock(&start_lock);
+	while (!started)
+		pthread_cond_wait(&start_cond, &start_lock);
+	pthread_mutex_unlock(&start_lock);
+
+	uint64_t begin = now_ns();
+	while (!stopped) {
+		uint64_t t0 = now_ns();
+		ssize_t n;
+		int64_t age;
+
+		if (use_pread) {
+			n = pread(fd, buf, sizeof(buf) - 1, 0);
+		} else {
+			int cfd = open(clock_path, O_RDONLY);
+			n = (cfd == -1) ? -1 : read(cfd, buf, sizeof(buf) - 1);
+			if (cfd != -1)
+				close(cfd);
+		}
+		uint64_t t = now_ns() - t0;
+
+		r->ops++;
+		if (n <= 0) {
+			r->errors++;
+			continue;
+		}
+		buf[n] = '\0';
+		if (parse_age(buf, &age) != 0) {
+			r->errors++;
+			continue;
+		}
+		if (r->nsamples < MAX_SAMPLES) {
+			r->latency[r->nsamples] = t > UINT32_MAX ? UINT32_MAX : t;
+			r->age[r->nsamples] = age > UINT32_MAX ? UINT32_MAX : age;
+			r->nsamples++;
+		}
+	}
+	r->elapsed = (now_ns() - begin) / 1e9;
+
+	if (fd != -1)
+		close(fd);
+
+	return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static uint32_t pct(const uint32_t *v, size_t n, double p)
+{
+	return n ? v[(size_t)(p * (n - 1))] : 0;
+}
+
+static int is_mounted(void)
+{
+	struct stat st, parent;
+	char up[4096];
+
+	snprintf(up, sizeof(up), "%s/..", mountpoint);
+	return stat(mountpoint, &st) == 0 && stat(up, &parent) == 0 &&
+	       st.st_dev != parent.st_dev;
+}
+
+static pid_t mount_clock(const char *mode, int *errfd)
+{
+	char opts[128];
+	int pipefd[2];
+	pid_t pid;
+	int i;
+
+	snprintf(opts, sizeof(opts), "mode=%s,interval=%d,timeout=%s", mode,
+		 interval, poll_timeout);
+
+	if (pipe(pipefd) == -1 || (pid = fork()) == -1) {
+		perror("clock_ll_bench");
+		exit(1);
+	}
+	if (pid == 0) {
+		dup2(pipefd[1], STDERR_FILENO);
+		close(pipefd[0]);
+		close(pipefd[1]);
+		execl(program, program, "-f", "-o", opts, mountpoint,
+		      (char *)NULL);
+		perror(program);
+		_exit(127);
+	}
+	close(pipefd[1]);
+	*errfd = pipefd[0];
+
+	for (i = 0; i < 1000 && !is_mounted(); i++) {
+		if (waitpid(pid, NULL, WNOHANG) == pid) {
+			fprintf(stderr, "clock_ll_bench: %s exited before "
+				"mounting %s\n", program, mountpoint);
+			exit(1);
+		}
+		usleep(10000);
+	}
+	if (!is_mounted()) {
+		fprintf(stderr, "clock_ll_bench: %s did not mount\n", mountpoint);
+		kill(pid, SIGKILL);
+		exit(1);
+	}
+
+	return pid;
+}
+
+/*
+ * Stops the daemon and returns the number of requests it says it served;
+ * anything else it had to say is passed on.
+ */
+static unsigned long unmount_clock(pid_t pid, int errfd)
+{
+	unsigned long nlookup, ngetattr, nopen, nread, total = 0;
+	char out[4096], *line, *save = NULL;
+	size_t len = 0;
+	ssize_t n;
+	int i;
+
+	kill(pid, SIGTERM);
+	for (i = 0; i < 500; i++) {
+		if (waitpid(pid, NULL, WNOHANG) == pid)
+			break;
+		usleep(10000);
+	}
+	if (i == 500) {
+		fprintf(stderr, "clock_ll_bench: %s did not exit; killing it; "
+			"%s may need to be unmounted by hand\n", program,
+			mountpoint);
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+	}
+
+	while (len < sizeof(out) - 1 &&
+	       (n = read(errfd, out + len, sizeof(out) - 1 - len)) > 0)
+		len += n;
+	out[len] = '\0';
+	close(errfd);
+
+	for (line = strtok_r(out, "\n", &save); line;
+	     line = strtok_r(NULL, "\n", &save)) {
+		if (sscanf(line, "clock_ll: served %lu lookup %lu getattr "
+			   "%lu open %lu read", &nlookup, &ngetattr, &nopen,
+			   &nread) == 4)
+			total = nlookup + ngetattr + nopen + nread;
+		else
+			fprintf(stderr, "%s\n", line);
+	}
+
+	return total;
+}
+
+static void run(const char *mode, int nreaders)
+{
+	struct reader readers[MAX_READERS];
+	uint64_t ops = 0, errors = 0;
+	size_t nsamples = 0;
+	double elapsed = 0;
+	uint32_t *lat, *age;
+	unsigned long requests;
+	int errfd, i;
+	pid_t pid;
+
+	pid = mount_clock(mode, &errfd);
+
+	memset(readers, 0, sizeof(readers));
+	started = 0;
+	stopped = 0;
+
+	for (i = 0; i < nreaders; i++) {
+		if (pthread_create(&readers[i].thread, NULL, reader_main,
+				   &readers[i]) != 0) {
+			fprintf(stderr, "clock_ll_bench: cannot create thread\n");
+			exit(1);
+		}
+	}
+
+	pthread_mutex_lock(&start_lock);
+	started = 1;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&start_lock);
+
+	sleep(duration);
+	stopped = 1;
+
+	for (i = 0; i < nreaders; i++) {
+		pthread_join(readers[i].thread, NULL);
+		ops += readers[i].ops;
+		errors += readers[i].errors;
+		nsamples += readers[i].nsamples;
+		if (readers[i].elapsed > elapsed)
+			elapsed = readers[i].elapsed;
+	}
+
+	requests = unmount_clock(pid, errfd);
+
+	lat = malloc((nsamples ? nsamples : 1) * sizeof(uint32_t));
+	age = malloc((nsamples ? nsamples : 1) * sizeof(uint32_t));
+	if (!lat || !age) {
+		fprintf(stderr, "clock_ll_bench: out of memory\n");
+		exit(1);
+	}
+	nsamples = 0;
+	for (i = 0; i < nreaders; i++) {
+		memcpy(lat + nsamples, readers[i].latency,
+		       readers[i].nsamples * sizeof(uint32_t));
+		memcpy(age + nsamples, readers[i].age,
+		       readers[i].nsamples * sizeof(uint32_t));
+		nsamples += readers[i].nsamples;
+		free(readers[i].latency);
+		free(readers[i].age);
+	}
+	qsort(lat, nsamples, sizeof(uint32_t), cmp_u32);
+	qsort(age, nsamples, sizeof(uint32_t), cmp_u32);
+
+	if (elapsed <= 0)
+		elapsed = 1e-9;
+
+	printf("%-6s %7d %12.0f %8.1f %8.1f %9.1f %9.1f %9.1f %10.0f %7.3f "
+	       "%6" PRIu64 "\n", mode, nreaders, ops / elapsed,
+	       pct(lat, nsamples, 0.50) / 1000.0,
+	       pct(lat, nsamples, 0.99) / 1000.0,
+	       pct(age, nsamples, 0.50) / 1000.0,
+	       pct(age, nsamples, 0.99) / 1000.0,
+	       nsamples ? age[nsamples - 1] / 1000.0 : 0.0,
+	       requests / elapsed, ops ? (double)requests / ops : 0.0,
+	       errors);
+	fflush(stdout);
+
+	free(lat);
+	free(age);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+"usage: clock_ll_bench [-x clock_ll] [-m modes] [-r readers,...] [-d seconds]\n"
+"                      [-i interval] [-T timeout] [-p] MOUNTPOINT\n"
+"\n"
+"  -x  clock_ll to mount (default ./clock_ll)\n"
+"  -m  modes: any of poll,inval,store (default all)\n"
+"  -r  comma-separated reader counts (default 1,4,16)\n"
+"  -d  seconds per run (default 3)\n"
+"  -i  clock update interval in ms (default 250)\n"
+"  -T  attribute timeout in seconds for poll mode (default 1.0)\n"
+"  -p  pread() a descriptor kept open instead of open/read/close\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *modes = "poll,inval,store";
+	const char *counts = "1,4,16";
+	char *modev, *mode, *save = NULL;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "d:i:m:pr:T:x:")) != -1) {
+		switch (ch) {
+		case 'd':
+			duration = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'm':
+			modes = optarg;
+			break;
+		case 'p':
+			use_pread = 1;
+			break;
+		case 'r':
+			counts = optarg;
+			break;
+		case 'T':
+			poll_timeout = optarg;
+			break;
+		case 'x':
+			program = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 1 || duration == 0 || interval < 1)
+		usage();
+	mountpoint = argv[0];
+	snprintf(clock_path, sizeof(clock_path), "%s/clock", mountpoint);
+
+	printf("# clock_ll every %d ms, %s, %u s per run; latency in us, "
+	       "age in ms\n", interval,
+	       use_pread ? "pread on an open file" : "open/read/close",
+	       duration);
+	printf("%-6s %7s %12s %8s %8s %9s %9s %9s %10s %7s %6s\n", "mode",
+	       "readers", "reads/s", "lat p50", "lat p99", "age p50",
+	       "age p99", "age max", "fs reqs/s", "reqs/rd", "errors");
+
+	modev = strdup(modes);
+	for (mode = strtok_r(modev, ",", &save); mode;
+	     mode = strtok_r(NULL, ",", &save)) {
+		const char *p = counts;
+
+		if (strcmp(mode, "poll") && strcmp(mode, "inval") &&
+		    strcmp(mode, "store"))
+			usage();
+
+		while (*p) {
+			char *end;
+			long n = strtol(p, &end, 10);
+			if (end == p || n < 1 || n > MAX_READERS ||
+			    (*end && *end != ','))
+				usage();
+			run(mode, (int)n);
+			p = (*end == ',') ? end + 1 : end;
+		}
+	}
+	free(modev);
+
+	return 0;
+}
@@ -0,0 +1,155 @@
+/*
+  FUSE: Filesystem in Userspace
+  Copyright (C) 2001-2007  Miklos Szeredi <miklos@szeredi.hu>
+  Copyright (C) 2015  Benjamin Fleischer
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+
+  pushfile: small files whose content the file system changes by itself,
+  kept coherent in the kernel by pushing changes instead of having readers
+  poll with short timeouts.
+
+  A lowlevel file system keeps a struct pushfile per such file, answers
+  read with pushfile_read(), stat with pushfile_size(), and calls
+  pushfile_update() from whatever thread produces new content. Replies use
+  pushfile_timeout() for attr_timeout/entry_timeout, and open sets
+  fi->keep_cache = pushfile_keep_cache(). Depending on the mode:
+
+    PUSHFILE_POLL   nothing is pushed; readers see changes only once their
+                    cached attributes time out (the old clock_ll also
+                    invalidated the file on every tick, as INVAL does,
+                    only with the short timeouts kept)
+    PUSHFILE_INVAL  the kernel's cached data and attributes are dropped on
+                    every change, so the next read comes back to us
+    PUSHFILE_STORE  the new bytes are written straight into the kernel's
+                    cache (FUSE 2.9 and later); the next read never leaves
+                    the kernel. Without notify_store this acts as INVAL.
+
+  With INVAL and STORE, readers may cache for as long as they like.
+*/
+
+#ifndef PUSHFILE_H
+#define PUSHFILE_H
+
+#include <fuse_lowlevel.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#define PUSHFILE_MAX		256
+#define PUSHFILE_LONG_TIMEOUT	86400.0
+
+enum pushfile_mode {
+	PUSHFILE_POLL,
+	PUSHFILE_INVAL,
+	PUSHFILE_STORE,
+};
+
+struct pushfile {
+	fuse_ino_t ino;
+	enum pushfile_mode mode;
+	double poll_timeout;
+	pthread_mutex_t lock;
+	size_t size;
+	char data[PUSHFILE_MAX];
+};
+
+static inline void pushfile_init(struct pushfile *pf, fuse_ino_t ino,
+				 enum pushfile_mode mode, double poll_timeout)
+{
+	memset(pf, 0, sizeof(*pf));
+	pf->ino = ino;
+	pf->mode = mode;
+	pf->poll_timeout = poll_timeout;
+	pthread_mutex_init(&pf->lock, NULL);
+}
+
+static inline double pushfile_timeout(const struct pushfile *pf)
+{
+	return pf->mode == PUSHFILE_POLL ? pf->poll_timeout
+					 : PUSHFILE_LONG_TIMEOUT;
+}
+
+static inline int pushfile_keep_cache(const struct pushfile *pf)
+{
+	return pf->mode != PUSHFILE_POLL;
+}
+
+static inline size_t pushfile_size(struct pushfile *pf)
+{
+	size_t size;
+
+	pthread_mutex_lock(&pf->lock);
+	size = pf->size;
+	pthread_mutex_unlock(&pf->lock);
+
+	return size;
+}
+
+/* Copies out a consistent snapshot; returns the number of bytes copied. */
+static inline size_t pushfile_read(struct pushfile *pf, char *buf,
+				   size_t size, off_t off)
+{
+	size_t n = 0;
+
+	pthread_mutex_lock(&pf->lock);
+	if (off >= 0 && (size_t)off < pf->size) {
+		n = pf->size - off;
+		if (n > size)
+			n = size;
+		memcpy(buf, pf->data + off, n);
+	}
+	pthread_mutex_unlock(&pf->lock);
+
+	return n;
+}
+
+/*
+ * Replaces the content and tells the kernel. ch may be NULL before the
+ * session is up. An inode the kernel has not looked up yet is not an
+ * error (-ENOENT); neither is a kernel that cannot take notifications.
+ */
+static inline int pushfile_update(struct pushfile *pf, struct fuse_chan *ch,
+				  const char *data, size_t size)
+{
+	size_t oldsize;
+	int err = 0;
+
+	if (size > PUSHFILE_MAX)
+		size = PUSHFILE_MAX;
+
+	pthread_mutex_lock(&pf->lock);
+	oldsize = pf->size;
+	memcpy(pf->data, data, size);
+	pf->size = size;
+	pthread_mutex_unlock(&pf->lock);
+
+	if (!ch || pf->mode == PUSHFILE_POLL)
+		return 0;
+
+#if FUSE_VERSION >= 29
+	if (pf->mode == PUSHFILE_STORE) {
+		struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(size);
+
+		/* notify_store only grows a file; a shrink needs new attributes. */
+		if (size < oldsize)
+			err = fuse_lowlevel_notify_inval_inode(ch, pf->ino, -1, 0);
+		if (!err || err == -ENOENT) {
+			bufv.buf[0].mem = (void *)data;
+			err = fuse_lowlevel_notify_store(ch, pf->ino, 0, &bufv, 0);
+		}
+	} else
+#endif
+	{
+		(void) oldsize;
+		err = fuse_lowlevel_notify_inval_inode(ch, pf->ino, 0, 0);
+	}
+
+	if (err == -ENOENT || err == -ENOSYS)
+		err = 0;
+
+	return err;
+}
+
+#endif /* PUSHFILE_H */
@@ -6,6 +6,17 @@
   See the file COPYING.
 
   gcc -Wall `pkg-config fuse --cflags --libs` hello_ll.c -o hello_ll
+
+  With -o null=N, hello_ll is instead a "null" file system for measuring
+  the cost of a FUSE round trip: the root holds N empty files named 0 to
+  N-1, and every request is answered from a reply prepared in advance.
+  Entries are never cached and attributes fetched by getattr are never
+  cached, so each lookup, getattr, readdir and (direct_io) read issued
+  against the mount reaches the daemon. hello_ll_bench drives it.
+
+  -s selects the single-threaded loop; the default is the multithreaded
+  one. On Linux, -o clone_fd[,clone_threads=N] instead serves the mount
+  from N threads, each reading its own clone of the /dev/fuse descriptor.
 */
 
 #define FUSE_USE_VERSION 26
@@ -18,10 +29,60 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
 
 static const char *hello_str = "Hello World!\n";
 static const char *hello_name = "hello";
 
+static struct hello_options {
+	int null_entries;	/* -1 unless -o null=N */
+	int clone_fd;
+	int clone_threads;
+} options = { -1, 0, 4 };
+
+static struct stat null_root_attr;
+static struct fuse_entry_param null_entry;
+static pthread_mutex_t null_dir_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *null_dir;
+static size_t null_dir_size;
+
+static void null_init(void)
+{
+	null_root_attr.st_ino = 1;
+	null_root_attr.st_mode = S_IFDIR | 0755;
+	null_root_attr.st_nlink = 2;
+
+	/*
+	 * The attributes that come with an entry may be kept; the entry may
+	 * not. A stat of a name then costs exactly one lookup.
+	 */
+	null_entry.attr.st_mode = S_IFREG | 0444;
+	null_entry.attr.st_nlink = 1;
+	null_entry.attr_timeout = 3600.0;
+	null_entry.entry_timeout = 0.0;
+}
+
+/* Returns the inode of a synthetic file name, or 0. */
+static fuse_ino_t null_ino(const char *name)
+{
+	unsigned long n = 0;
+	const char *p = name;
+
+	if (*p == '\0' || (*p == '0' && p[1] != '\0'))
+		return 0;
+	for (; *p; p++) {
+		if (*p < '0' || *p > '9')
+			return 0;
+		n = n * 10 + (*p - '0');
+		if (n >= (unsigned long)options.null_entries)
+			return 0;
+	}
+	return n + 2;
+}
+
 static int hello_stat(fuse_ino_t ino, struct stat *stbuf)
 {
 	stbuf->st_ino = ino;
@@ -50,6 +111,17 @@ static void hello_ll_getattr(fuse_req_t req, fuse_ino_t ino,
 
 	(void) fi;
 
+	if (options.null_entries >= 0) {
+		if (ino == 1) {
+			fuse_reply_attr(req, &null_root_attr, 0.0);
+		} else {
+			stbuf = null_entry.attr;
+			stbuf.st_ino = ino;
+			fuse_reply_attr(req, &stbuf, 0.0);
+		}
+		return;
+	}
+
 	memset(&stbuf, 0, sizeof(stbuf));
 	if (hello_stat(ino, &stbuf) == -1)
 		fuse_reply_err(req, ENOENT);
@@ -61,6 +133,19 @@ static void hello_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
 	struct fuse_entry_param e;
 
+	if (options.null_entries >= 0) {
+		fuse_ino_t ino = (parent == 1) ? null_ino(name) : 0;
+		if (ino == 0) {
+			fuse_reply_err(req, ENOENT);
+		} else {
+			e = null_entry;
+			e.ino = ino;
+			e.attr.st_ino = ino;
+			fuse_reply_entry(req, &e);
+		}
+		return;
+	}
+
 	if (parent != 1 || strcmp(name, hello_name) != 0)
 		fuse_reply_err(req, ENOENT);
 	else {
@@ -109,12 +194,38 @@ static int reply_buf_limited(fuse_req_t req, const char *buf, size_t bufsize,
 		return fuse_reply_buf(req, NULL, 0);
 }
 
+/* The listing of the null root is put together once, on first use. */
+static void null_readdir(fuse_req_t req, size_t size, off_t off)
+{
+	pthread_mutex_lock(&null_dir_lock);
+	if (!null_dir) {
+		struct dirbuf b;
+		char name[16];
+		int i;
+
+		memset(&b, 0, sizeof(b));
+		dirbuf_add(req, &b, ".", 1);
+		dirbuf_add(req, &b, "..", 1);
+		for (i = 0; i < options.null_entries; i++) {
+			snprintf(name, sizeof(name), "%d", i);
+			dirbuf_add(req, &b, name, i + 2);
+		}
+		null_dir_size = b.size;
+		null_dir = b.p;
+	}
+	pthread_mutex_unlock(&null_dir_lock);
+
+	reply_buf_limited(req, null_dir, null_dir_size, off, size);
+}
+
 static void hello_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
 			     off_t off, struct fuse_file_info *fi)
 {
 	(void) fi;
 
-	if (ino != 1)
+	if (options.null_entries >= 0 && ino == 1)
+		null_readdir(req, size, off);
+	else if (ino != 1)
 		fuse_reply_err(req, ENOTDIR);
 	else {
 		struct dirbuf b;
@@ -131,6 +242,19 @@ static void hello_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
 static void hello_ll_open(fuse_req_t req, fuse_ino_t ino,
 			  struct fuse_file_info *fi)
 {
+	if (options.null_entries >= 0) {
+		if (ino == 1) {
+			fuse_reply_err(req, EISDIR);
+		} else if ((fi->flags & 3) != O_RDONLY) {
+			fuse_reply_err(req, EACCES);
+		} else {
+			/* So that every read is a request, if only an empty one. */
+			fi->direct_io = 1;
+			fuse_reply_open(req, fi);
+		}
+		return;
+	}
+
 	if (ino != 2)
 		fuse_reply_err(req, EISDIR);
 	else if ((fi->flags & 3) != O_RDONLY)
@@ -144,6 +268,11 @@ static void hello_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size,
 {
 	(void) fi;
 
+	if (options.null_entries >= 0) {
+		fuse_reply_buf(req, NULL, 0);
+		return;
+	}
+
 	assert(ino == 2);
 	reply_buf_limited(req, hello_str, strlen(hello_str), off, size);
 }
@@ -156,14 +285,209 @@ static struct fuse_lowlevel_ops hello_ll_oper = {
 	.read		= hello_ll_read,
 };
 
+#ifdef __linux__
+
+#include <sys/ioctl.h>
+
+#ifndef FUSE_DEV_IOC_CLONE
+#define FUSE_DEV_IOC_CLONE _IOR(229, 0, uint32_t)
+#endif
+
+/*
+ * FUSE 2 has no clone_fd option, so the clone loop is put together here:
+ * each worker opens /dev/fuse, attaches it to the mount with
+ * FUSE_DEV_IOC_CLONE and feeds whatever it reads to the session through a
+ * channel of its own, so replies go back on the descriptor the request
+ * came in on. The main thread keeps serving the original descriptor.
+ */
+struct clone_worker {
+	struct fuse_session *se;
+	struct fuse_chan *ch;
+	pthread_t thread;
+	volatile int done;
+};
+
+static int clone_chan_receive(struct fuse_chan **chp, char *buf, size_t size)
+{
+	struct clone_worker *w = fuse_chan_data(*chp);
+	ssize_t res;
+
+	do {
+		res = read(fuse_chan_fd(*chp), buf, size);
+	} while (res == -1 && errno == ENOENT);	/* request was interrupted */
+
+	if (fuse_session_exited(w->se))
+		return 0;
+	if (res == -1) {
+		if (errno == EINTR || errno == EAGAIN)
+			return -EINTR;
+		if (errno != ENODEV)
+			perror("hello_ll: clone read");
+		fuse_session_exit(w->se);
+		return errno == ENODEV ? 0 : -errno;
+	}
+	return res;
+}
+
+static int clone_chan_send(struct fuse_chan *ch, const struct iovec iov[],
+			   size_t count)
+{
+	if (writev(fuse_chan_fd(ch), iov, count) == -1 && errno != ENOENT)
+		return -errno;
+	return 0;
+}
+
+static void clone_chan_destroy(struct fuse_chan *ch)
+{
+	close(fuse_chan_fd(ch));
+}
+
+static struct fuse_chan_ops clone_chan_ops = {
+	.receive	= clone_chan_receive,
+	.send		= clone_chan_send,
+	.destroy	= clone_chan_destroy,
+};
+
+static void *clone_worker_loop(void *arg)
+{
+	struct clone_worker *w = arg;
+	size_t bufsize = fuse_chan_bufsize(w->ch);
+	char *buf = malloc(bufsize);
+
+	while (buf && !fuse_session_exited(w->se)) {
+		struct fuse_chan *ch = w->ch;
+		int res = fuse_chan_recv(&ch, buf, bufsize);
+		if (res == -EINTR)
+			continue;
+		if (res <= 0)
+			break;
+		fuse_session_process(w->se, buf, res, ch);
+	}
+	free(buf);
+	w->done = 1;
+
+	return NULL;
+}
+
+static void clone_wakeup(int sig)
+{
+	(void) sig;
+}
+
+static int clone_loop(struct fuse_session *se, struct fuse_chan *master)
+{
+	struct clone_worker *workers;
+	struct sigaction sa;
+	uint32_t masterfd = fuse_chan_fd(master);
+	int i, n = 0, err;
+
+	workers = calloc(options.clone_threads, sizeof(*workers));
+	if (!workers)
+		return -1;
+
+	/* Without SA_RESTART, so a blocked read can be made to return. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = clone_wakeup;
+	sigaction(SIGUSR1, &sa, NULL);
+
+	for (i = 0; i < options.clone_threads - 1; i++) {
+		struct clone_worker *w = &workers[n];
+		int fd = open("/dev/fuse", O_RDWR | O_CLOEXEC);
+		if (fd == -1 || ioctl(fd, FUSE_DEV_IOC_CLONE, &masterfd) == -1) {
+			perror("hello_ll: cannot clone /dev/fuse");
+			if (fd != -1)
+				close(fd);
+			break;
+		}
+		w->se = se;
+		w->ch = fuse_chan_new(&clone_chan_ops, fd,
+				      fuse_chan_bufsize(master), w);
+		if (!w->ch) {
+			close(fd);
+			break;
+		}
+		if (pthread_create(&w->thread, NULL, clone_worker_loop, w) != 0) {
+			fuse_chan_destroy(w->ch);
+			break;
+		}
+		n++;
+	}
+
+	err = fuse_session_loop(se);
+
+	/* Workers may sit in read(); nudge them until they all notice. */
+	fuse_session_exit(se);
+	for (i = 0; i < n; i++) {
+		while (!workers[i].done) {
+			pthread_kill(workers[i].thread, SIGUSR1);
+			usleep(1000);
+		}
+		pthread_join(workers[i].thread, NULL);
+		fuse_chan_destroy(workers[i].ch);
+	}
+	free(workers);
+
+	return err;
+}
+
+#endif /* __linux__ */
+
+enum {
+	KEY_HELP,
+};
+
+#define HELLO_OPT(t, p, v) { t, offsetof(struct hello_options, p), v }
+
+static struct fuse_opt hello_opts[] = {
+	HELLO_OPT("null=%d",		null_entries,	0),
+	HELLO_OPT("clone_fd",		clone_fd,	1),
+	HELLO_OPT("clone_threads=%d",	clone_threads,	0),
+	FUSE_OPT_KEY("-h",		KEY_HELP),
+	FUSE_OPT_KEY("--help",		KEY_HELP),
+	FUSE_OPT_END
+};
+
+static int hello_opt_proc(void *data, const char *arg, int key,
+			  struct fuse_args *outargs)
+{
+	(void) data;
+	(void) outargs;
+
+	if (key == KEY_HELP)
+		fprintf(stderr,
+"hello_ll options:\n"
+"    -o null=N              null file system with N empty files\n"
+"    -o clone_fd            serve from clones of the device (Linux)\n"
+"    -o clone_threads=N     number of clone_fd threads (4)\n"
+"\n");
+	return 1;
+}
+
 int main(int argc, char *argv[])
 {
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 	struct fuse_chan *ch;
 	char *mountpoint;
+	int multithreaded;
 	int err = -1;
 
-	if (fuse_parse_cmdline(&args, &mountpoint, NULL, NULL) != -1 &&
+	if (fuse_opt_parse(&args, &options, hello_opts, hello_opt_proc) == -1)
+		return 1;
+	if (options.null_entries > 10000000 || options.clone_threads < 1) {
+		fprintf(stderr, "hello_ll: option out of range\n");
+		return 1;
+	}
+#ifndef __linux__
+	if (options.clone_fd) {
+		fprintf(stderr, "hello_ll: clone_fd needs Linux; "
+			"using the multithreaded loop\n");
+		options.clone_fd = 0;
+	}
+#endif
+	if (options.null_entries >= 0)
+		null_init();
+
+	if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded, NULL) != -1 &&
 	    (ch = fuse_mount(mountpoint, &args)) != NULL) {
 		struct fuse_session *se;
 
@@ -172,7 +496,15 @@ int main(int argc, char *argv[])
 		if (se != NULL) {
 			if (fuse_set_signal_handlers(se) != -1) {
 				fuse_session_add_chan(se, ch);
-				err = fuse_session_loop(se);
+#ifdef __linux__
+				if (options.clone_fd)
+					err = clone_loop(se, ch);
+				else
+#endif
+				if (multithreaded)
+					err = fuse_session_loop_mt(se);
+				else
+					err = fuse_session_loop(se);
 				fuse_remove_signal_handlers(se);
 				fuse_session_remove_chan(ch);
 			}
@@ -181,6 +513,7 @@ int main(int argc, char *argv[])
 		fuse_unmount(mountpoint, ch);
 	}
 	fuse_opt_free_args(&args);
+	free(null_dir);
 
 	return err ? 1 : 0;
 }
@@ -0,0 +1,480 @@
+/*
+  hello_ll_bench: FUSE round-trip latency against hello_ll's null mode
+
+  For each session loop (single-threaded, multithreaded, clone_fd) the
+  bench mounts "hello_ll -f -o null=N" on MOUNTPOINT, then, for each client
+  thread count, times:
+
+    lookup   stat() of the synthetic names, round robin (one LOOKUP each)
+    getattr  fstat() of the root directory (one GETATTR each)
+    readdir  opendir(), readdir() to the end, closedir() of the root
+    read     1-byte pread() of an open file (one empty READ each)
+
+  and prints ops/s with latency percentiles. With -M it instead measures
+  whatever is already mounted on MOUNTPOINT, so the same numbers can be
+  taken on a UnixFS mount and set against the null baseline; there the
+  kernel may well answer some of the requests from its caches.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+#define _GNU_SOURCE	/* asprintf */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MAX_THREADS	256
+#define MAX_SAMPLES	(1 << 20)	/* per thread */
+
+enum workload { W_LOOKUP, W_GETATTR, W_READDIR, W_READ, W_COUNT };
+
+static const char *workload_names[W_COUNT] = {
+	"lookup", "getattr", "readdir", "read"
+};
+
+static const char *program = "./hello_ll";
+static const char *mountpoint;
+static int nentries = 100;
+static unsigned duration = 3;
+static int use_mounted;
+
+static char **names;		/* paths of the entries in the root */
+static int nnames;
+static char *read_path;		/* first regular file, for W_READ */
+
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static int started;
+static volatile int stopped;
+
+struct client {
+	pthread_t thread;
+	enum workload w;
+	int index;
+	uint64_t ops;
+	uint64_t errors;
+	uint32_t *samples;	/* ns, saturating */
+	size_t nsamples;
+	double elapsed;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int one_op(struct client *c, int rootfd, int filefd, uint64_t i)
+{
+	struct stat st;
+	char b;
+
+	switch (c->w) {
+	case W_LOOKUP:
+		return stat(names[i % nnames], &st);
+	case W_GETATTR:
+		return fstat(rootfd, &st);
+	case W_READDIR: {
+		DIR *d = opendir(mountpoint);
+		if (!d)
+			return -1;
+		while (readdir(d) != NULL)
+			;
+		return closedir(d);
+	}
+	case W_READ:
+		return pread(filefd, &b, 1, 0) < 0 ? -1 : 0;
+	default:
+		return -1;
+	}
+}
+
+static void *client_main(void *arg)
+{
+	struct client *c = arg;
+	int rootfd = open(mountpoint, O_RDONLY);
+	int filefd = read_path ? open(read_path, O_RDONLY) : -1;
+	uint64_t i = (uint64_t)c->index * 7919;	/* spread the names */
+
+	c->samples = malloc(MAX_SAMPLES * sizeof(uint32_t));
+	if (!c->samples || rootfd == -1) {
+		fprintf(stderr, "hello_ll_bench: client setup failed\n");
+		exit(1);
+	}
+
+	pthread_mutex_lock(&start_lock);
+	while (!started)
+		pthread_cond_wait(&start_cond, &start_lock);
+	pthread_mutex_unlock(&start_lock);
+
+	uint64_t begin = now_ns();
+	while (!stopped) {
+		uint64_t t0 = now_ns();
+		if (one_op(c, rootfd, filefd, i++) != 0)
+			c->errors++;
+		uint64_t t = now_ns() - t0;
+		if (c->nsamples < MAX_SAMPLES)
+			c->samples[c->nsamples++] = t > UINT32_MAX ? UINT32_MAX : t;
+		c->ops++;
+	}
+	c->elapsed = (now_ns() - begin) / 1e9;
+
+	if (filefd != -1)
+		close(filefd);
+	close(rootfd);
+
+	return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static double pct(const uint32_t *v, size_t n, double p)
+{
+	if (n == 0)
+		return 0;
+	size_t k = (size_t)(p * (n - 1));
+	return v[k] / 1000.0;
+}
+
+static void run(const char *loop, enum workload w, int nthreads)
+{
+	struct client clients[MAX_THREADS];
+	uint64_t ops = 0, errors = 0;
+	size_t nsamples = 0;
+	double elapsed = 0;
+	uint32_t *all;
+	int i;
+
+	if (w == W_READ && !read_path)
+		return;
+
+	memset(clients, 0, sizeof(clients));
+	started = 0;
+	stopped = 0;
+
+	for (i = 0; i < nthreads; i++) {
+		clients[i].w = w;
+		clients[i].index = i;
+		if (pthread_create(&clients[i].thread, NULL, client_main,
+				   &clients[i]) != 0) {
+			fprintf(stderr, "hello_ll_bench: cannot create thread\n");
+			exit(1);
+		}
+	}
+
+	pthread_mutex_lock(&start_lock);
+	started = 1;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&start_lock);
+
+	sleep(duration);
+	stopped = 1;
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(clients[i].thread, NULL);
+		ops += clients[i].ops;
+		errors += clients[i].errors;
+		nsamples += clients[i].nsamples;
+		if (clients[i].elapsed > elapsed)
+			elapsed = clients[i].elapsed;
+	}
+
+	all = malloc((nsamples ? nsamples : 1) * sizeof(uint32_t));
+	if (!all) {
+		fprintf(stderr, "hello_ll_bench: out of memory\n");
+		exit(1);
+	}
+	nsamples = 0;
+	for (i = 0; i < nthreads; i++) {
+		memcpy(all + nsamples, clients[i].samples,
+		       clients[i].nsamples * sizeof(uint32_t));
+		nsamples += clients[i].nsamples;
+		free(clients[i].samples);
+	}
+	qsort(all, nsamples, sizeof(uint32_t), cmp_u32);
+
+	printf("%-8s %7d %-8s %12.0f %9.1f %9.1f %9.1f %9.1f %7" PRIu64 "\n",
+	       loop, nthreads, workload_names[w],
+	       elapsed > 0 ? ops / elapsed : 0.0,
+	       pct(all, nsamples, 0.50), pct(all, nsamples, 0.90),
+	       pct(all, nsamples, 0.99),
+	       nsamples ? all[nsamples - 1] / 1000.0 : 0.0, errors);
+	fflush(stdout);
+
+	free(all);
+}
+
+static void scan_root(void)
+{
+	DIR *d = opendir(mountpoint);
+	struct dirent *de;
+	struct stat st;
+
+	if (!d) {
+		perror(mountpoint);
+		exit(1);
+	}
+
+	for (int i = 0; i < nnames; i++)
+		free(names[i]);
+	free(names);
+	free(read_path);
+	names = NULL;
+	nnames = 0;
+	read_path = NULL;
+
+	while ((de = readdir(d)) != NULL) {
+		char *path;
+
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+		if (asprintf(&path, "%s/%s", mountpoint, de->d_name) == -1 ||
+		    !(names = realloc(names, (nnames + 1) * sizeof(char *)))) {
+			fprintf(stderr, "hello_ll_bench: out of memory\n");
+			exit(1);
+		}
+		names[nnames++] = path;
+		if (!read_path && stat(path, &st) == 0 && S_ISREG(st.st_mode))
+			read_path = strdup(path);
+	}
+	closedir(d);
+
+	if (nnames == 0) {
+		fprintf(stderr, "hello_ll_bench: %s is empty\n", mountpoint);
+		exit(1);
+	}
+}
+
+static int is_mounted(void)
+{
+	struct stat st, parent;
+	char *up;
+
+	if (asprintf(&up, "%s/..", mountpoint) == -1)
+		return 0;
+	int mounted = stat(mountpoint, &st) == 0 && stat(up, &parent) == 0 &&
+		      st.st_dev != parent.st_dev;
+	free(up);
+	return mounted;
+}
+
+static pid_t mount_null(const char *loop, int threads)
+{
+	char opts[64];
+	pid_t pid;
+	int i;
+
+	if (!strcmp(loop, "clone_fd"))
+		snprintf(opts, sizeof(opts), "null=%d,clone_fd,clone_threads=%d",
+			 nentries, threads);
+	else
+		snprintf(opts, sizeof(opts), "null=%d", nentries);
+
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0) {
+		if (!strcmp(loop, "single"))
+			execl(program, program, "-f", "-s", "-o", opts,
+			      mountpoint, (char *)NULL);
+		else
+			execl(program, program, "-f", "-o", opts,
+			      mountpoint, (char *)NULL);
+		perror(program);
+		_exit(127);
+	}
+
+	for (i = 0; i < 1000 && !is_mounted(); i++) {
+		if (waitpid(pid, NULL, WNOHANG) == pid) {
+			fprintf(stderr, "hello_ll_bench: %s exited before "
+				"mounting %s\n", program, mountpoint);
+			exit(1);
+		}
+		usleep(10000);
+	}
+	if (!is_mounted()) {
+		fprintf(stderr, "hello_ll_bench: %s did not mount\n", mountpoint);
+		kill(pid, SIGKILL);
+		exit(1);
+	}
+
+	return pid;
+}
+
+/* hello_ll unmounts itself on the way out of its session loop. */
+static void unmount_null(pid_t pid)
+{
+	int i;
+
+	kill(pid, SIGTERM);
+	for (i = 0; i < 500; i++) {
+		if (waitpid(pid, NULL, WNOHANG) == pid)
+			return;
+		usleep(10000);
+	}
+	fprintf(stderr, "hello_ll_bench: %s did not exit; killing it; "
+		"%s may need to be unmounted by hand\n", program, mountpoint);
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+}
+
+static int in_list(const char *list, const char *word)
+{
+	size_t len = strlen(word);
+
+	while (*list) {
+		if (!strncmp(list, word, len) &&
+		    (list[len] == ',' || list[len] == '\0'))
+			return 1;
+		list = strchr(list, ',');
+		if (!list)
+			break;
+		list++;
+	}
+	return 0;
+}
+
+static int parse_list(const char *s, int *out, int max)
+{
+	int n = 0;
+
+	while (*s && n < max) {
+		char *end;
+		long v = strtol(s, &end, 10);
+		if (end == s || v < 1 || v > MAX_THREADS ||
+		    (*end && *end != ','))
+			return -1;
+		out[n++] = (int)v;
+		s = (*end == ',') ? end + 1 : end;
+	}
+	return n;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+"usage: hello_ll_bench [-x hello_ll] [-n entries] [-t threads,...]\n"
+"                      [-l loops] [-d seconds] [-w workloads] [-M] MOUNTPOINT\n"
+"\n"
+"  -x  hello_ll to mount (default ./hello_ll)\n"
+"  -n  synthetic entries in the root (default 100)\n"
+"  -t  comma-separated client thread counts (default 1,4)\n"
+"  -l  session loops: any of single,mt,clone_fd (default all%s)\n"
+"  -d  seconds per measurement (default 3)\n"
+"  -w  workloads: any of lookup,getattr,readdir,read (default all)\n"
+"  -M  measure the file system already mounted on MOUNTPOINT\n",
+#ifdef __linux__
+		""
+#else
+		" but clone_fd"
+#endif
+		);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	int counts[MAX_THREADS];
+	int ncounts, maxthreads = 0, i, w, ch;
+	const char *threads = "1,4";
+#ifdef __linux__
+	const char *loops = "single,mt,clone_fd";
+#else
+	const char *loops = "single,mt";
+#endif
+	const char *workloads = "lookup,getattr,readdir,read";
+
+	while ((ch = getopt(argc, argv, "d:l:Mn:t:w:x:")) != -1) {
+		switch (ch) {
+		case 'd':
+			duration = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			loops = optarg;
+			break;
+		case 'M':
+			use_mounted = 1;
+			break;
+		case 'n':
+			nentries = atoi(optarg);
+			break;
+		case 't':
+			threads = optarg;
+			break;
+		case 'w':
+			workloads = optarg;
+			break;
+		case 'x':
+			program = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 1 || duration == 0 || nentries < 1)
+		usage();
+	mountpoint = argv[0];
+
+	if ((ncounts = parse_list(threads, counts, MAX_THREADS)) <= 0)
+		usage();
+	for (i = 0; i < ncounts; i++)
+		if (counts[i] > maxthreads)
+			maxthreads = counts[i];
+
+	if (use_mounted)
+		loops = "mounted";
+
+	printf("# %s, %u s per measurement, latencies in us\n",
+	       use_mounted ? mountpoint : "hello_ll -o null", duration);
+	printf("%-8s %7s %-8s %12s %9s %9s %9s %9s %7s\n", "loop", "threads",
+	       "op", "ops/s", "p50", "p90", "p99", "max", "errors");
+
+	char *loopv = strdup(loops), *save = NULL, *loop;
+	for (loop = strtok_r(loopv, ",", &save); loop;
+	     loop = strtok_r(NULL, ",", &save)) {
+		pid_t pid = -1;
+
+		if (!use_mounted) {
+			if (strcmp(loop, "single") && strcmp(loop, "mt") &&
+			    strcmp(loop, "clone_fd"))
+				usage();
+			pid = mount_null(loop, maxthreads);
+		}
+		scan_root();
+
+		for (w = 0; w < W_COUNT; w++) {
+			if (!in_list(workloads, workload_names[w]))
+				continue;
+			for (i = 0; i < ncounts; i++)
+				run(loop, w, counts[i]);
+		}
+
+		if (pid != -1)
+			unmount_null(pid);
+	}
+	free(loopv);
+
+	return 0;
+}
@@ -0,0 +1,2917 @@
+/*
+  FUSE: Filesystem in Userspace
+  Copyright (C) 2001-2007  Miklos Szeredi <miklos@szeredi.hu>
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+
+*/
+
+/*
+ * Loopback file system for Linux. Uses the lowlevel FUSE 3 API.
+ *
+ * loopback.c hands every operation a full path and has the host resolve it
+ * again from the top. Here an inode is an O_PATH descriptor on the backing
+ * object, opened when the kernel looks the name up and kept until the
+ * kernel forgets it. Operations work relative to that descriptor, or to
+ * the parent's plus one name (fstatat, openat, mkdirat, renameat2, ...), so
+ * what a metadata operation costs no longer depends on how deep the file
+ * is. Inodes are found again by (st_dev, st_ino), so hard links share one.
+ *
+ *   ./loopback_ll -o source=/tmp/dir /mnt/loop
+ */
+
+#define FUSE_USE_VERSION 34
+
+#define _GNU_SOURCE
+
+#include <fuse_lowlevel.h>
+#include "loopback_ll_cache.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#include <time.h>
+
+#define LOOPBACK_TABLE_MIN 1024
+#define LOOPBACK_WATCH_BUCKETS 4096
+#define LOOPBACK_TIMEOUT 1.0
+#define LOOPBACK_WATCH_TIMEOUT 86400.0
+
+struct loopback_inode {
+    struct loopback_inode *next; /* hash chain */
+    int fd;                      /* O_PATH */
+    mode_t type;                 /* S_IFMT bits */
+    dev_t dev;
+    ino_t ino;
+    uint64_t nlookup;            /* protected by loopback.mutex */
+    unsigned nopen;              /* ditto; with -o passthrough or cache_dir */
+    int backing_id;              /* ditto; or LOOPBACK_BACKING_BUSY */
+    int wd;                      /* ditto; inotify watch, or -1 */
+    struct loopback_inode *wd_next;
+    struct loopback_xattr *xattrs; /* ditto */
+    unsigned xattr_gen;          /* ditto */
+    struct loopback_names *names; /* ditto; with -o case_insensitive */
+    int cache_fd;                /* ditto; with -o cache_dir, or -1 */
+    int cache_stale;             /* ditto */
+    int cache_dirty;             /* ditto */
+    struct loopback_cache_key cache_key; /* ditto */
+    struct loopback_cache_key cache_want; /* ditto; after our writes */
+    unsigned cache_gen;          /* ditto; bumped by every invalidation */
+};
+
+/* A remembered getxattr() result: a short value, or an error. */
+struct loopback_xattr {
+    struct loopback_xattr *next;
+    struct timespec expires;     /* CLOCK_MONOTONIC */
+    int err;                     /* ENODATA, ENOTSUP, or 0 */
+    size_t size;
+    char *value;                 /* points into name[] past the NUL */
+    char name[];
+};
+
+struct loopback {
+    char *source;
+    double timeout;
+    int splice;
+    int passthrough;
+    int writeback;
+    int direct_io;
+    int parallel_direct_writes;
+    int watch;
+    int nosecurity_xattrs;
+    int case_insensitive;
+    int readdirplus;
+    char *cache_dir;
+    unsigned long cache_size;    /* MB */
+    int cache_write_through;
+
+    pthread_mutex_t mutex;
+    struct loopback_inode root;
+    struct loopback_inode **table;
+    size_t table_size;           /* a power of two */
+    size_t ninodes;
+
+    struct fuse_session *se;
+    int inotify_fd;
+    pthread_t watcher;
+    struct loopback_inode *watches[LOOPBACK_WATCH_BUCKETS];
+};
+
+static struct loopback loopback;
+
+static inline struct loopback_inode *
+loopback_inode(fuse_ino_t ino)
+{
+    if (ino == FUSE_ROOT_ID) {
+        return &loopback.root;
+    }
+
+    return (struct loopback_inode *)(uintptr_t)ino;
+}
+
+static inline int
+loopback_fd(fuse_ino_t ino)
+{
+    return loopback_inode(ino)->fd;
+}
+
+/*
+ * An O_PATH descriptor can be stat'ed and used as a directory for *at
+ * calls, but not read, chmod'ed or asked for xattrs. For those, the
+ * object is reached again through /proc, which costs the same at any
+ * depth.
+ */
+#define LOOPBACK_PROCNAME_MAX 32
+
+static inline void
+loopback_procname(int fd, char *buf)
+{
+    snprintf(buf, LOOPBACK_PROCNAME_MAX, "/proc/self/fd/%d", fd);
+}
+
+static inline size_t
+loopback_hash(dev_t dev, ino_t ino)
+{
+    uint64_t h = ((uint64_t)ino ^ ((uint64_t)dev << 32)) *
+                 0x9e3779b97f4a7c15ULL;
+
+    return (size_t)(h >> 32) & (loopback.table_size - 1);
+}
+
+/* Called with loopback.mutex held. Failing to grow is not an error. */
+static void
+loopback_table_grow(void)
+{
+    size_t i, oldsize = loopback.table_size;
+    struct loopback_inode **oldtable = loopback.table;
+    struct loopback_inode **table;
+
+    table = calloc(oldsize * 2, sizeof(struct loopback_inode *));
+    if (table == NULL) {
+        return;
+    }
+
+    loopback.table = table;
+    loopback.table_size = oldsize * 2;
+
+    for (i = 0; i < oldsize; i++) {
+        struct loopback_inode *inode = oldtable[i];
+        while (inode) {
+            struct loopback_inode *next = inode->next;
+            size_t h = loopback_hash(inode->dev, inode->ino);
+            inode->next = table[h];
+            table[h] = inode;
+            inode = next;
+        }
+    }
+
+    free(oldtable);
+}
+
+/*
+ * The kernel asks for security.capability before every write that might
+ * have to drop it, and for POSIX ACLs on many permission checks, and the
+ * answer is nearly always ENODATA. getxattr() results are remembered per
+ * inode, as long as attributes are (loopback.timeout), so only the first
+ * probe reaches the source. Values in the security namespace are changed
+ * by the kernel itself on write and chown, so only their absence is
+ * kept. Anything that could change attributes through the mount flushes
+ * the inode's entries, as does a change seen with -o watch.
+ */
+#define LOOPBACK_XATTR_VALUE_MAX 256
+#define LOOPBACK_XATTR_ENTRIES   8
+
+static void
+loopback_xattr_free(struct loopback_xattr *xa)
+{
+    struct loopback_xattr *next;
+
+    for (; xa; xa = next) {
+        next = xa->next;
+        free(xa);
+    }
+}
+
+static void
+loopback_xattr_flush(struct loopback_inode *inode)
+{
+    struct loopback_xattr *xa;
+
+    pthread_mutex_lock(&loopback.mutex);
+    xa = inode->xattrs;
+    inode->xattrs = NULL;
+    inode->xattr_gen++;
+    pthread_mutex_unlock(&loopback.mutex);
+
+    loopback_xattr_free(xa);
+}
+
+/*
+ * With -o case_insensitive, names are matched without regard to case, as
+ * on the file systems Windows and macOS software expects. The source is
+ * case-sensitive, so a name that is not there as given is looked for in
+ * an index of the directory's names by their folded form, built on the
+ * first miss or change in the directory. Operations through the mount
+ * keep the index up to date; a change from outside shows as a new
+ * modification time on the directory, and the index is built again. A
+ * change from outside landing between our check and our own change in
+ * the same directory can go unseen until the directory changes again.
+ *
+ * Timestamps are coarse, so a second change within the same tick leaves
+ * the modification time as it was. An index whose time was that recent
+ * when it was last brought in step is trusted only until the tick is
+ * surely over (LOOPBACK_NAMES_TICK), and is then built once more. With
+ * -o watch, any entry event drops the index outright.
+ *
+ * Folding is ASCII only; other bytes must match exactly. A name found
+ * only by folding is not cached by the kernel as an entry, so renaming or
+ * removing the object under its real name leaves no stale alias behind.
+ */
+struct loopback_name {
+    struct loopback_name *next;
+    uint32_t hash;
+    char name[];
+};
+
+struct loopback_names {
+    struct timespec mtime;       /* of the directory, when last in step */
+    int racy;                    /* mtime was then within the last tick */
+    size_t size;                 /* buckets; a power of two */
+    size_t count;
+    struct loopback_name **buckets;
+};
+
+#define LOOPBACK_NAMES_MIN 64
+#define LOOPBACK_NAMES_TICK 2    /* s; FAT's timestamps are the coarsest */
+
+static uint32_t
+loopback_fold_hash(const char *name)
+{
+    uint32_t h = 2166136261u;
+    unsigned char c;
+
+    while ((c = (unsigned char)*name++)) {
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        h = (h ^ c) * 16777619u;
+    }
+
+    return h;
+}
+
+static void
+loopback_names_free(struct loopback_names *names)
+{
+    struct loopback_name *n, *next;
+    size_t i;
+
+    if (names == NULL) {
+        return;
+    }
+
+    for (i = 0; i < names->size; i++) {
+        for (n = names->buckets[i]; n; n = next) {
+            next = n->next;
+            free(n);
+        }
+    }
+    free(names->buckets);
+    free(names);
+}
+
+static struct loopback_names *
+loopback_names_new(size_t size)
+{
+    struct loopback_names *names;
+
+    names = calloc(1, sizeof(*names));
+    if (names == NULL) {
+        return NULL;
+    }
+
+    names->size = size;
+    names->buckets = calloc(size, sizeof(struct loopback_name *));
+    if (names->buckets == NULL) {
+        free(names);
+        return NULL;
+    }
+
+    return names;
+}
+
+/* Failing to add a name only costs the index its next check. */
+static int
+loopback_names_add(struct loopback_names *names, const char *name)
+{
+    size_t len = strlen(name) + 1;
+    struct loopback_name *n, **buckets;
+    size_t i, size;
+    uint32_t hash;
+
+    if (names->count >= names->size) {
+        size = names->size * 2;
+        buckets = calloc(size, sizeof(struct loopback_name *));
+        if (buckets) {
+            for (i = 0; i < names->size; i++) {
+                while ((n = names->buckets[i])) {
+                    names->buckets[i] = n->next;
+                    n->next = buckets[n->hash & (size - 1)];
+                    buckets[n->hash & (size - 1)] = n;
+                }
+            }
+            free(names->buckets);
+            names->buckets = buckets;
+            names->size = size;
+        }
+    }
+
+    hash = loopback_fold_hash(name);
+    for (n = names->buckets[hash & (names->size - 1)]; n; n = n->next) {
+        if (n->hash == hash && strcmp(n->name, name) == 0) {
+            return 0;
+        }
+    }
+
+    n = malloc(sizeof(*n) + len);
+    if (n == NULL) {
+        return -1;
+    }
+
+    n->hash = hash;
+    memcpy(n->name, name, len);
+    n->next = names->buckets[n->hash & (names->size - 1)];
+    names->buckets[n->hash & (names->size - 1)] = n;
+    names->count++;
+
+    return 0;
+}
+
+static void
+loopback_names_remove(struct loopback_names *names, const char *name)
+{
+    uint32_t hash = loopback_fold_hash(name);
+    struct loopback_name **pp, *n;
+
+    for (pp = &names->buckets[hash & (names->size - 1)]; (n = *pp);
+         pp = &n->next) {
+        if (n->hash == hash && strcmp(n->name, name) == 0) {
+            *pp = n->next;
+            names->count--;
+            free(n);
+            return;
+        }
+    }
+}
+
+/* The name as spelled if it is there, else any spelling of it. */
+static struct loopback_name *
+loopback_names_find(struct loopback_names *names, const char *name)
+{
+    uint32_t hash = loopback_fold_hash(name);
+    struct loopback_name *n, *found = NULL;
+
+    for (n = names->buckets[hash & (names->size - 1)]; n; n = n->next) {
+        if (n->hash == hash && strcasecmp(n->name, name) == 0) {
+            if (strcmp(n->name, name) == 0) {
+                return n;
+            }
+            if (found == NULL) {
+                found = n;
+            }
+        }
+    }
+
+    return found;
+}
+
+/* Whether a change within the same tick could still leave mtime as is. */
+static int
+loopback_names_recent(const struct timespec *mtime)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return now.tv_sec - mtime->tv_sec < LOOPBACK_NAMES_TICK;
+}
+
+static struct loopback_names *
+loopback_names_build(struct loopback_inode *dir, const struct timespec *mtime)
+{
+    struct loopback_names *names;
+    struct dirent *entry;
+    DIR *dp;
+    int fd;
+
+    fd = openat(dir->fd, ".", O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    dp = fdopendir(fd);
+    if (dp == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    names = loopback_names_new(LOOPBACK_NAMES_MIN);
+    if (names == NULL) {
+        closedir(dp);
+        return NULL;
+    }
+    names->mtime = *mtime;
+    names->racy = loopback_names_recent(mtime);
+
+    while ((entry = readdir(dp))) {
+        if (strcmp(entry->d_name, ".") == 0 ||
+            strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (loopback_names_add(names, entry->d_name) == -1) {
+            loopback_names_free(names);
+            names = NULL;
+            break;
+        }
+    }
+
+    closedir(dp);
+
+    return names;
+}
+
+static inline int
+loopback_timespec_equal(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+/*
+ * Looks name up in dir's index, bringing the index up to date first.
+ * Returns 1 and the name as it is in the source in real if there is any
+ * spelling of it. *mtime is the directory's modification time the answer
+ * is good for, to be handed to loopback_names_changed().
+ */
+static int
+loopback_names_resolve(struct loopback_inode *dir, const char *name,
+                       char *real, struct timespec *mtime)
+{
+    struct loopback_names *names, *old = NULL;
+    struct loopback_name *n;
+    struct stat st;
+    int found = 0;
+
+    /* Never the stamp of an index, should there be no answer. */
+    mtime->tv_sec = 0;
+    mtime->tv_nsec = -1;
+
+    if (fstatat(dir->fd, "", &st, AT_EMPTY_PATH) == -1) {
+        return 0;
+    }
+    *mtime = st.st_mtim;
+
+    pthread_mutex_lock(&loopback.mutex);
+    names = dir->names;
+    if (names == NULL || !loopback_timespec_equal(&names->mtime, mtime) ||
+        (names->racy && !loopback_names_recent(mtime))) {
+        pthread_mutex_unlock(&loopback.mutex);
+        names = loopback_names_build(dir, mtime);
+        if (names == NULL) {
+            return 0;
+        }
+        pthread_mutex_lock(&loopback.mutex);
+        old = dir->names;
+        dir->names = names;
+    }
+
+    n = loopback_names_find(names, name);
+    if (n) {
+        strcpy(real, n->name);
+        found = 1;
+    }
+    pthread_mutex_unlock(&loopback.mutex);
+
+    loopback_names_free(old);
+
+    return found;
+}
+
+/*
+ * Brings dir's index in step with a change made through the mount, as
+ * long as it was in step before (at mtime).
+ */
+static void
+loopback_names_changed(struct loopback_inode *dir,
+                       const struct timespec *mtime, const char *added,
+                       const char *removed)
+{
+    struct loopback_names *names, *old = NULL;
+    struct stat st;
+
+    if (fstatat(dir->fd, "", &st, AT_EMPTY_PATH) == -1) {
+        return;
+    }
+
+    pthread_mutex_lock(&loopback.mutex);
+    names = dir->names;
+    if (names && loopback_timespec_equal(&names->mtime, mtime)) {
+        if (removed) {
+            loopback_names_remove(names, removed);
+        }
+        if (added && loopback_names_add(names, added) == -1) {
+            old = names;
+            dir->names = NULL;
+        } else {
+            names->mtime = st.st_mtim;
+            names->racy = loopback_names_recent(&st.st_mtim);
+        }
+    }
+    pthread_mutex_unlock(&loopback.mutex);
+
+    loopback_names_free(old);
+}
+
+/*
+ * With -o watch, every directory the kernel holds an inode for is watched
+ * with inotify, and changes made to the source behind the mount's back
+ * are pushed to the kernel as invalidations (loopback_watch_main()). The
+ * kernel can then be told to cache entries and attributes for a day
+ * instead of a second. A directory's watch reports on its entries too, so
+ * the parent's watch covers a file's attributes. Changes inotify cannot
+ * see, such as those made on another NFS client, are not caught.
+ */
+#define LOOPBACK_WATCH_MASK \
+    (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+     IN_MODIFY | IN_CLOSE_WRITE | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+static void
+loopback_watch_failed(int err)
+{
+    static int warned;
+
+    /* Names under an unwatched directory could go stale for a day. */
+    loopback.timeout = LOOPBACK_TIMEOUT;
+    if (!warned) {
+        warned = 1;
+        fprintf(stderr, "loopback_ll: cannot watch a directory (%s); "
+                "caching for %.0f s from now on", strerror(err),
+                LOOPBACK_TIMEOUT);
+        if (err == ENOSPC) {
+            fprintf(stderr, "; raise fs.inotify.max_user_watches");
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+static void
+loopback_watch(struct loopback_inode *inode)
+{
+    char procname[LOOPBACK_PROCNAME_MAX];
+    struct loopback_inode *other;
+    int wd;
+
+    if (!loopback.watch || inode->type != S_IFDIR) {
+        return;
+    }
+
+    loopback_procname(inode->fd, procname);
+    wd = inotify_add_watch(loopback.inotify_fd, procname, LOOPBACK_WATCH_MASK);
+    if (wd == -1) {
+        loopback_watch_failed(errno);
+        return;
+    }
+
+    pthread_mutex_lock(&loopback.mutex);
+    for (other = loopback.watches[wd % LOOPBACK_WATCH_BUCKETS]; other;
+         other = other->wd_next) {
+        if (other->wd == wd) {
+            break;
+        }
+    }
+    /* A directory reached twice (a bind mount) keeps its first inode. */
+    if (other == NULL) {
+        inode->wd = wd;
+        inode->wd_next = loopback.watches[wd % LOOPBACK_WATCH_BUCKETS];
+        loopback.watches[wd % LOOPBACK_WATCH_BUCKETS] = inode;
+    }
+    pthread_mutex_unlock(&loopback.mutex);
+}
+
+/* Called with loopback.mutex held. */
+static void
+loopback_unwatch_locked(struct loopback_inode *inode)
+{
+    struct loopback_inode **pp;
+
+    pp = &loopback.watches[inode->wd % LOOPBACK_WATCH_BUCKETS];
+    while (*pp != inode) {
+        pp = &(*pp)->wd_next;
+    }
+    *pp = inode->wd_next;
+    inode->wd = -1;
+}
+
+/*
+ * Returns the inode for the object fd refers to, with one more lookup
+ * counted against it. The inode keeps fd if it is new; otherwise fd is
+ * closed. Returns NULL, with fd closed, if out of memory.
+ */
+static struct loopback_inode *
+loopback_inode_get(int fd, const struct stat *st)
+{
+    struct loopback_inode *inode;
+    size_t h;
+
+    pthread_mutex_lock(&loopback.mutex);
+
+    h = loopback_hash(st->st_dev, st->st_ino);
+    for (inode = loopback.table[h]; inode; inode = inode->next) {
+        if (inode->ino == st->st_ino && inode->dev == st->st_dev) {
+            inode->nlookup++;
+            pthread_mutex_unlock(&loopback.mutex);
+            close(fd);
+            return inode;
+        }
+    }
+
+    inode = calloc(1, sizeof(struct loopback_inode));
+    if (inode == NULL) {
+        pthread_mutex_unlock(&loopback.mutex);
+        close(fd);
+        return NULL;
+    }
+
+    inode->fd = fd;
+    inode->type = st->st_mode & S_IFMT;
+    inode->dev = st->st_dev;
+    inode->ino = st->st_ino;
+    inode->nlookup = 1;
+    inode->wd = -1;
+    inode->cache_fd = -1;
+    inode->next = loopback.table[h];
+    loopback.table[h] = inode;
+
+    if (++loopback.ninodes > loopback.table_size) {
+        loopback_table_grow();
+    }
+
+    pthread_mutex_unlock(&loopback.mutex);
+
+    /* The reply is not out yet, so the kernel cannot forget it meanwhile. */
+    loopback_watch(inode);
+
+    return inode;
+}
+
+static void
+loopback_inode_put(struct loopback_inode *inode, uint64_t nlookup)
+{
+    struct loopback_inode **pp;
+
+    if (inode == &loopback.root) {
+        return;
+    }
+
+    pthread_mutex_lock(&loopback.mutex);
+
+    assert(inode->nlookup >= nlookup);
+    inode->nlookup -= nlookup;
+    if (inode->nlookup) {
+        pthread_mutex_unlock(&loopback.mutex);
+        return;
+    }
+
+    pp = &loopback.table[loopback_hash(inode->dev, inode->ino)];
+    while (*pp != inode) {
+        pp = &(*pp)->next;
+    }
+    *pp = inode->next;
+    loopback.ninodes--;
+
+    /*
+     * Before the unlock: a lookup may make a new inode for the directory
+     * as soon as this one is out of the table, and inotify would give its
+     * watch the same wd.
+     */
+    if (inode->wd != -1) {
+        inotify_rm_watch(loopback.inotify_fd, inode->wd);
+        loopback_unwatch_locked(inode);
+    }
+
+    pthread_mutex_unlock(&loopback.mutex);
+
+    loopback_xattr_free(inode->xattrs);
+    loopback_names_free(inode->names);
+    close(inode->fd);
+    free(inode);
+}
+
+static inline fuse_ino_t
+loopback_ino(struct loopback_inode *inode)
+{
+    return inode == &loopback.root ? FUSE_ROOT_ID : (uintptr_t)inode;
+}
+
+/*
+ * The watcher holds a lookup of its own on an inode while it works on it,
+ * so the kernel forgetting it meanwhile does not free it.
+ */
+static struct loopback_inode *
+loopback_watch_find(int wd)
+{
+    struct loopback_inode *inode;
+
+    pthread_mutex_lock(&loopback.mutex);
+    for (inode = loopback.watches[wd % LOOPBACK_WATCH_BUCKETS]; inode;
+         inode = inode->wd_next) {
+        if (inode->wd == wd) {
+            inode->nlookup++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&loopback.mutex);
+
+    return inode;
+}
+
+/* The inode for dir/name, if the kernel has one for it, held as above. */
+static struct loopback_inode *
+loopback_inode_child(struct loopback_inode *dir, const char *name)
+{
+    struct loopback_inode *inode;
+    struct stat st;
+
+    if (fstatat(dir->fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&loopback.mutex);
+    for (inode = loopback.table[loopback_hash(st.st_dev, st.st_ino)]; inode;
+         inode = inode->next) {
+        if (inode->ino == st.st_ino && inode->dev == st.st_dev) {
+            inode->nlookup++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&loopback.mutex);
+
+    return inode;
+}
+
+/*
+ * Our own changes through the mount come back as events too. Invalidating
+ * what the kernel just learned from us costs it a lookup or getattr more,
+ * which is cheap next to missing a change from outside. Only attributes
+ * are dropped for a modified file; its data is checked again on open, as
+ * it always is (no keep_cache).
+ *
+ * The kernel may have to wait for a request in that directory to finish
+ * before it can drop an entry, so no notification is sent with
+ * loopback.mutex held.
+ */
+static void
+loopback_watch_event(const struct inotify_event *ev)
+{
+    struct loopback_inode *dir, *child;
+    struct loopback_names *names = NULL;
+    fuse_ino_t parent;
+
+    dir = loopback_watch_find(ev->wd);
+    if (dir == NULL) {
+        return;
+    }
+    parent = loopback_ino(dir);
+
+    if (ev->mask & IN_IGNORED) {
+        /* The directory is gone, or its file system was unmounted. */
+        pthread_mutex_lock(&loopback.mutex);
+        if (dir->wd == ev->wd) {
+            loopback_unwatch_locked(dir);
+        }
+        pthread_mutex_unlock(&loopback.mutex);
+    } else if (ev->len == 0) {
+        if (ev->mask & IN_ATTRIB) {
+            loopback_xattr_flush(dir);
+            fuse_lowlevel_notify_inval_inode(loopback.se, parent, -1, 0);
+        }
+    } else {
+        if (ev->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) {
+            pthread_mutex_lock(&loopback.mutex);
+            names = dir->names;
+            dir->names = NULL;
+            pthread_mutex_unlock(&loopback.mutex);
+            fuse_lowlevel_notify_inval_entry(loopback.se, parent, ev->name,
+                                             strlen(ev->name));
+            fuse_lowlevel_notify_inval_inode(loopback.se, parent, 0, 0);
+        }
+        if (ev->mask & (IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE |
+                        IN_MOVED_TO)) {
+            child = loopback_inode_child(dir, ev->name);
+            if (child) {
+                if (ev->mask & IN_ATTRIB) {
+                    loopback_xattr_flush(child);
+                }
+                fuse_lowlevel_notify_inval_inode(loopback.se,
+                                                 loopback_ino(child), -1, 0);
+                loopback_inode_put(child, 1);
+            }
+        }
+    }
+
+    loopback_names_free(names);
+    loopback_inode_put(dir, 1);
+}
+
+static void *
+loopback_watch_main(void *arg)
+{
+    char buf[64 * 1024]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev;
+    ssize_t n;
+    char *p;
+
+    (void)arg;
+
+    /* Stopped with pthread_cancel(), but only while waiting for events. */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    for (;;) {
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        n = read(loopback.inotify_fd, buf, sizeof(buf));
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "loopback_ll: inotify: %s\n", strerror(errno));
+            break;
+        }
+
+        for (p = buf; p < buf + n; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *)p;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                fprintf(stderr, "loopback_ll: inotify queue overflowed; "
+                        "some changes to the source may not show for up to "
+                        "%.0f s\n", loopback.timeout);
+                continue;
+            }
+            loopback_watch_event(ev);
+        }
+    }
+
+    return NULL;
+}
+
+/* Returns 0 or an errno value. */
+static int
+loopback_do_lookup(fuse_ino_t parent, const char *name,
+                   struct fuse_entry_param *e)
+{
+    struct loopback_inode *inode;
+    char real[NAME_MAX + 1];
+    struct timespec mtime;
+    int fd, saverr;
+
+    memset(e, 0, sizeof(*e));
+    e->attr_timeout = loopback.timeout;
+    e->entry_timeout = loopback.timeout;
+
+    fd = openat(loopback_fd(parent), name, O_PATH | O_NOFOLLOW);
+    if (fd == -1 && errno == ENOENT && loopback.case_insensitive) {
+        if (!loopback_names_resolve(loopback_inode(parent), name, real,
+                                    &mtime)) {
+            return ENOENT;
+        }
+        /* Only the real name may be cached as an entry. */
+        e->entry_timeout = 0;
+        fd = openat(loopback_fd(parent), real, O_PATH | O_NOFOLLOW);
+    }
+    if (fd == -1) {
+        return errno;
+    }
+
+    if (fstatat(fd, "", &e->attr, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW) == -1) {
+        saverr = errno;
+        close(fd);
+        return saverr;
+    }
+
+    inode = loopback_inode_get(fd, &e->attr);
+    if (inode == NULL) {
+        return ENOMEM;
+    }
+
+    e->ino = (uintptr_t)inode;
+
+    return 0;
+}
+
+static void
+loopback_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    struct fuse_entry_param e;
+    int err;
+
+    err = loopback_do_lookup(parent, name, &e);
+    if (err) {
+        fuse_reply_err(req, err);
+    } else {
+        fuse_reply_entry(req, &e);
+    }
+}
+
+static void
+loopback_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup)
+{
+    loopback_inode_put(loopback_inode(ino), nlookup);
+    fuse_reply_none(req);
+}
+
+static void
+loopback_forget_multi(fuse_req_t req, size_t count,
+                      struct fuse_forget_data *forgets)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        loopback_inode_put(loopback_inode(forgets[i].ino), forgets[i].nlookup);
+    }
+    fuse_reply_none(req);
+}
+
+static void
+loopback_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct stat stbuf;
+    int res;
+
+    /*
+     * An open file's own descriptor gives the size and mtime the backing
+     * file has right now. With -o writeback the kernel keeps its own for
+     * a file it caches dirty pages of, and pushes its mtime back to us
+     * through setattr once the pages are written.
+     */
+    if (fi) {
+        res = fstat(fi->fh, &stbuf);
+    } else {
+        res = fstatat(loopback_fd(ino), "", &stbuf,
+                      AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW);
+    }
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    fuse_reply_attr(req, &stbuf, loopback.timeout);
+}
+
+static int
+loopback_utimens(struct loopback_inode *inode, const struct timespec tv[2],
+                 struct fuse_file_info *fi)
+{
+    char procname[LOOPBACK_PROCNAME_MAX];
+    int res;
+
+    if (fi) {
+        return futimens(fi->fh, tv);
+    }
+
+    if (inode->type == S_IFLNK) {
+        res = utimensat(inode->fd, "", tv, AT_EMPTY_PATH);
+        if (res == -1 && errno == EINVAL) {
+            /* Kernels without AT_EMPTY_PATH here cannot reach the link. */
+            errno = EPERM;
+        }
+        return res;
+    }
+
+    loopback_procname(inode->fd, procname);
+
+    return utimensat(AT_FDCWD, procname, tv, 0);
+}
+
+/*
+ * With -o cache_dir, the first open of a regular file looks for a copy of
+ * it, as it is now, in the read cache (loopback_ll_cache.h). Reads go to
+ * the copy while the file is open; if there is none, they go to the
+ * source, and one is made in the background for next time. A change made
+ * to the source from outside while the file is open is not seen before
+ * it is opened again, much as with NFS.
+ *
+ * Writing through the mount drops the copy (write-around), or with
+ * -o cache_write_through, writes it too and files it under the new
+ * version of the file at the last release, provided the file is then
+ * still what those writes made it. Changes of size, including opens with
+ * O_TRUNC, fallocate and copies into the file always drop it.
+ */
+static void
+loopback_cache_attach(struct loopback_inode *inode, int fd)
+{
+    char procname[LOOPBACK_PROCNAME_MAX];
+    struct loopback_cache_key key;
+    struct stat st;
+    int first, cfd, src;
+    unsigned gen;
+
+    if (loopback.cache_dir == NULL || inode->type != S_IFREG) {
+        return;
+    }
+
+    pthread_mutex_lock(&loopback.mutex);
+    first = inode->nopen++ == 0;
+    gen = inode->cache_gen;
+    pthread_mutex_unlock(&loopback.mutex);
+
+    if (!first || fstat(fd, &st) == -1) {
+        return;
+    }
+
+    key.dev = st.st_dev;
+    key.ino = st.st_ino;
+    key.mtime = st.st_mtim;
+    key.size = st.st_size;
+
+    cfd = loopback_cache_lookup(&key);
+    if (cfd == -1) {
+        loopback_procname(inode->fd, procname);
+        src = open(procname, O_RDONLY | O_CLOEXEC);
+        if (src != -1) {
+            loopback_cache_fill(&key, src);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&loopback.mutex);
+    /*
+     * Closed, or closed and opened again, meanwhile; or written through
+     * another handle since key was taken, while there was no copy to drop.
+     */
+    if (inode->nopen == 0 || inode->cache_fd != -1 ||
+        inode->cache_gen != gen) {
+        pthread_mutex_unlock(&loopback.mutex);
+        close(cfd);
+        return;
+    }
+    inode->cache_key = key;
+    inode->cache_want = key;
+    inode->cache_stale = 0;
+    inode->cache_dirty = 0;
+    __atomic_store_n(&inode->cache_fd, cfd, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&loopback.mutex);
+}
+
+static void
+loopback_cache_detach(struct loopback_inode *inode)
+{
+    struct loopback_cache_key key, want;
+    int cfd = -1, update = 0;
+    struct stat st;
+
+    if (loopback.cache_dir == NULL || inode->type != S_IFREG) {
+        return;
+    }
+
+    pthread_mutex_lock(&loopback.mutex);
+    if (--inode->nopen == 0 && inode->cache_fd != -1) {
+        cfd = inode->cache_fd;
+        inode->cache_fd = -1;
+        key = inode->cache_key;
+        want = inode->cache_want;
+        update = inode->cache_dirty && !inode->cache_stale;
+    }
+    pthread_mutex_unlock(&loopback.mutex);
+
+    if (cfd == -1) {
+        return;
+    }
+
+    if (update) {
+        /* Changed from outside since our last write: the copy is not it. */
+        if (fstatat(inode->fd, "", &st,
+                    AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW) == 0 &&
+            st.st_size == want.size &&
+            st.st_mtim.tv_sec == want.mtime.tv_sec &&
+            st.st_mtim.tv_nsec == want.mtime.tv_nsec) {
+            loopback_cache_rekey(&key, &want);
+        } else {
+            loopback_cache_drop(&key);
+        }
+    }
+    close(cfd);
+}
+
+/* The copy to read from, or -1. */
+static inline int
+loopback_cache_fd(struct loopback_inode *inode)
+{
+    if (__atomic_load_n(&inode->cache_stale, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+
+    return __atomic_load_n(&inode->cache_fd, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Stops reading from the copy and drops it. The descriptor stays open
+ * until the last release, since a read may be using it.
+ */
+static void
+loopback_cache_invalidate(struct loopback_inode *inode)
+{
+    struct loopback_cache_key key;
+
+    if (loopback.cache_dir == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&loopback.mutex);
+    /* Also keeps a copy being attached (loopback_cache_attach()) out. */
+    inode->cache_gen++;
+    if (inode->cache_fd == -1 || inode->cache_stale) {
+        pthread_mutex_unlock(&loopback.mutex);
+        return;
+    }
+    __atomic_store_n(&inode->cache_stale, 1, __ATOMIC_RELEASE);
+    key = inode->cache_key;
+    pthread_mutex_unlock(&loopback.mutex);
+
+    loopback_cache_drop(&key);
+}
+
+/*
+ * The data of a write, if it came in one piece of memory. With
+ * -o cache_write_through, loopback_init() sees to it that it does.
+ */
+static inline const char *
+loopback_write_mem(const struct fuse_bufvec *in_buf)
+{
+    const struct fuse_buf *b = &in_buf->buf[in_buf->idx];
+
+    if (in_buf->count - in_buf->idx != 1 || (b->flags & FUSE_BUF_IS_FD)) {
+        return NULL;
+    }
+
+    return (const char *)b->mem + in_buf->off;
+}
+
+/*
+ * After a write of size bytes of mem at offset through fd: with -o
+ * cache_write_through, the same data goes to the copy, and the size and
+ * modification time the file now has are remembered as the version the
+ * copy is of. A size other than our writes account for means the file
+ * was changed from outside too.
+ */
+static void
+loopback_cache_write(struct loopback_inode *inode, int fd, const char *mem,
+                     off_t offset, size_t size)
+{
+    int cfd = loopback_cache_fd(inode);
+    struct stat st;
+    int ok = 0;
+
+    if (cfd == -1) {
+        /* A copy may be on its way in, as of before this write. */
+        loopback_cache_invalidate(inode);
+        return;
+    }
+
+    if (mem && pwrite(cfd, mem, size, offset) == (ssize_t)size &&
+        fstat(fd, &st) == 0) {
+        pthread_mutex_lock(&loopback.mutex);
+        if (inode->cache_want.size < offset + (off_t)size) {
+            inode->cache_want.size = offset + size;
+        }
+        if (st.st_size == inode->cache_want.size) {
+            inode->cache_want.mtime = st.st_mtim;
+            inode->cache_dirty = 1;
+            ok = 1;
+        }
+        pthread_mutex_unlock(&loopback.mutex);
+    }
+
+    if (!ok) {
+        loopback_cache_invalidate(inode);
+    }
+}
+
+static void
+loopback_getxattr_cache_stats(fuse_req_t req, size_t size)
+{
+    char buf[512];
+    int len;
+
+    len = loopback_cache_stats(buf, sizeof(buf));
+    if (size == 0) {
+        fuse_reply_xattr(req, len);
+    } else if (size < (size_t)len) {
+        fuse_reply_err(req, ERANGE);
+    } else {
+        fuse_reply_buf(req, buf, len);
+    }
+}
+
+/* chmod rewrites the ACL, and chown drops file capabilities. */
+static void
+loopback_setattr_flush(struct loopback_inode *inode, int valid)
+{
+    if (valid & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+        loopback_xattr_flush(inode);
+    }
+}
+
+static void
+loopback_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+                 int valid, struct fuse_file_info *fi)
+{
+    struct loopback_inode *inode = loopback_inode(ino);
+    char procname[LOOPBACK_PROCNAME_MAX];
+    int res;
+
+    loopback_procname(inode->fd, procname);
+
+    if (valid & FUSE_SET_ATTR_MODE) {
+        if (fi) {
+            res = fchmod(fi->fh, attr->st_mode);
+        } else {
+            res = chmod(procname, attr->st_mode);
+        }
+        if (res == -1) {
+            goto out_err;
+        }
+    }
+
+    if (valid & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+        uid_t uid = (valid & FUSE_SET_ATTR_UID) ? attr->st_uid : (uid_t)-1;
+        gid_t gid = (valid & FUSE_SET_ATTR_GID) ? attr->st_gid : (gid_t)-1;
+
+        res = fchownat(inode->fd, "", uid, gid,
+                       AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW);
+        if (res == -1) {
+            goto out_err;
+        }
+    }
+
+    if (valid & FUSE_SET_ATTR_SIZE) {
+        loopback_cache_invalidate(inode);
+        if (fi) {
+            res = ftruncate(fi->fh, attr->st_size);
+        } else {
+            res = truncate(procname, attr->st_size);
+        }
+        if (res == -1) {
+            goto out_err;
+        }
+    }
+
+    if (valid & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME)) {
+        struct timespec tv[2];
+
+        tv[0].tv_sec = 0;
+        tv[1].tv_sec = 0;
+        tv[0].tv_nsec = UTIME_OMIT;
+        tv[1].tv_nsec = UTIME_OMIT;
+
+        if (valid & FUSE_SET_ATTR_ATIME_NOW) {
+            tv[0].tv_nsec = UTIME_NOW;
+        } else if (valid & FUSE_SET_ATTR_ATIME) {
+            tv[0] = attr->st_atim;
+        }
+
+        if (valid & FUSE_SET_ATTR_MTIME_NOW) {
+            tv[1].tv_nsec = UTIME_NOW;
+        } else if (valid & FUSE_SET_ATTR_MTIME) {
+            tv[1] = attr->st_mtim;
+        }
+
+        res = loopback_utimens(inode, tv, fi);
+        if (res == -1) {
+            goto out_err;
+        }
+    }
+
+    loopback_setattr_flush(inode, valid);
+    loopback_getattr(req, ino, fi);
+    return;
+
+out_err:
+    res = errno;
+    loopback_setattr_flush(inode, valid);
+    fuse_reply_err(req, res);
+}
+
+static void
+loopback_readlink(fuse_req_t req, fuse_ino_t ino)
+{
+    char buf[PATH_MAX + 1];
+    ssize_t res;
+
+    res = readlinkat(loopback_fd(ino), "", buf, sizeof(buf));
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    if (res == sizeof(buf)) {
+        fuse_reply_err(req, ENAMETOOLONG);
+        return;
+    }
+
+    buf[res] = '\0';
+    fuse_reply_readlink(req, buf);
+}
+
+/* With -o case_insensitive, a new name must be new in any spelling. */
+static int
+loopback_names_check_new(struct loopback_inode *dir, const char *name,
+                         struct timespec *mtime)
+{
+    char real[NAME_MAX + 1];
+
+    if (loopback.case_insensitive &&
+        loopback_names_resolve(dir, name, real, mtime)) {
+        return EEXIST;
+    }
+
+    return 0;
+}
+
+/* mknod, mkdir and symlink: make the object, then look it up. */
+static void
+loopback_make(fuse_req_t req, fuse_ino_t parent, const char *name,
+              mode_t mode, dev_t rdev, const char *link)
+{
+    struct loopback_inode *dir = loopback_inode(parent);
+    struct fuse_entry_param e;
+    struct timespec mtime;
+    int dirfd = dir->fd;
+    int res, err;
+
+    err = loopback_names_check_new(dir, name, &mtime);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+
+    if (S_ISDIR(mode)) {
+        res = mkdirat(dirfd, name, mode);
+    } else if (S_ISLNK(mode)) {
+        res = symlinkat(link, dirfd, name);
+    } else {
+        res = mknodat(dirfd, name, mode, rdev);
+    }
+
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    if (loopback.case_insensitive) {
+        loopback_names_changed(dir, &mtime, name, NULL);
+    }
+
+    err = loopback_do_lookup(parent, name, &e);
+    if (err) {
+        fuse_reply_err(req, err);
+    } else {
+        fuse_reply_entry(req, &e);
+    }
+}
+
+static void
+loopback_mknod(fuse_req_t req, fuse_ino_t parent, const char *name,
+               mode_t mode, dev_t rdev)
+{
+    loopback_make(req, parent, name, mode, rdev, NULL);
+}
+
+static void
+loopback_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name,
+               mode_t mode)
+{
+    loopback_make(req, parent, name, S_IFDIR | mode, 0, NULL);
+}
+
+static void
+loopback_symlink(fuse_req_t req, const char *link, fuse_ino_t parent,
+                 const char *name)
+{
+    loopback_make(req, parent, name, S_IFLNK, 0, link);
+}
+
+static void
+loopback_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent,
+              const char *newname)
+{
+    struct loopback_inode *inode = loopback_inode(ino);
+    struct loopback_inode *newdir = loopback_inode(newparent);
+    char procname[LOOPBACK_PROCNAME_MAX];
+    struct fuse_entry_param e;
+    struct timespec mtime;
+    int res;
+
+    res = loopback_names_check_new(newdir, newname, &mtime);
+    if (res) {
+        fuse_reply_err(req, res);
+        return;
+    }
+
+    loopback_procname(inode->fd, procname);
+
+    res = linkat(AT_FDCWD, procname, newdir->fd, newname, AT_SYMLINK_FOLLOW);
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    if (loopback.case_insensitive) {
+        loopback_names_changed(newdir, &mtime, newname, NULL);
+    }
+
+    memset(&e, 0, sizeof(e));
+    e.attr_timeout = loopback.timeout;
+    e.entry_timeout = loopback.timeout;
+
+    res = fstatat(inode->fd, "", &e.attr, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW);
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    pthread_mutex_lock(&loopback.mutex);
+    inode->nlookup++;
+    pthread_mutex_unlock(&loopback.mutex);
+
+    e.ino = ino;
+    fuse_reply_entry(req, &e);
+}
+
+/* unlink and rmdir */
+static void
+loopback_remove(fuse_req_t req, fuse_ino_t parent, const char *name,
+                int flags)
+{
+    struct loopback_inode *dir = loopback_inode(parent);
+    char real[NAME_MAX + 1];
+    struct timespec mtime;
+    int res;
+
+    if (loopback.case_insensitive &&
+        loopback_names_resolve(dir, name, real, &mtime)) {
+        name = real;
+    }
+
+    res = unlinkat(dir->fd, name, flags);
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    if (loopback.case_insensitive) {
+        loopback_names_changed(dir, &mtime, NULL, name);
+    }
+    fuse_reply_err(req, 0);
+}
+
+static void
+loopback_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    loopback_remove(req, parent, name, 0);
+}
+
+static void
+loopback_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    loopback_remove(req, parent, name, AT_REMOVEDIR);
+}
+
+static void
+loopback_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+                fuse_ino_t newparent, const char *newname, unsigned int flags)
+{
+    struct loopback_inode *dir = loopback_inode(parent);
+    struct loopback_inode *newdir = loopback_inode(newparent);
+    char real[NAME_MAX + 1], newreal[NAME_MAX + 1];
+    struct timespec mtime, newmtime;
+    int res;
+
+    if (loopback.case_insensitive) {
+        if (loopback_names_resolve(dir, name, real, &mtime)) {
+            name = real;
+        }
+        /*
+         * Another spelling of the new name is the entry replaced, unless
+         * it is the one moving: then only the case changes.
+         */
+        if (loopback_names_resolve(newdir, newname, newreal, &newmtime) &&
+            !(dir == newdir && strcmp(newreal, name) == 0)) {
+            newname = newreal;
+        }
+    }
+
+    /* RENAME_NOREPLACE and RENAME_EXCHANGE pass straight through. */
+    res = renameat2(dir->fd, name, newdir->fd, newname, flags);
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    if (loopback.case_insensitive) {
+        if (flags & RENAME_EXCHANGE) {
+            name = newname = NULL;
+        }
+        if (dir == newdir) {
+            loopback_names_changed(dir, &mtime, newname, name);
+        } else {
+            loopback_names_changed(dir, &mtime, NULL, name);
+            loopback_names_changed(newdir, &newmtime, newname, NULL);
+        }
+    }
+    fuse_reply_err(req, 0);
+}
+
+/*
+ * Directories are read with getdents64() straight into a buffer kept
+ * with the handle, big enough for a few thousand names a call, and the
+ * reply is put together in another. The offset of an entry is the d_off
+ * the source file system gave it, so a seek is an lseek().
+ *
+ * With readdirplus (the default when the kernel offers it), every entry
+ * is looked up as it goes out and comes with its attributes, so ls -l
+ * or find -ls need not send a lookup for each name afterwards.
+ */
+#define LOOPBACK_DIRBUF_SIZE (128 * 1024)
+
+struct loopback_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct loopback_dirp {
+    int fd;
+    off_t offset;                /* of the next entry, in d_off terms */
+    char *buf;                   /* LOOPBACK_DIRBUF_SIZE */
+    size_t pos, len;             /* unread entries in buf */
+    char *reply;
+    size_t replysize;
+};
+
+static inline struct loopback_dirp *
+get_dirp(struct fuse_file_info *fi)
+{
+    return (struct loopback_dirp *)(uintptr_t)fi->fh;
+}
+
+static void
+loopback_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct loopback_dirp *d;
+    int err;
+
+    d = calloc(1, sizeof(struct loopback_dirp));
+    if (d == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    d->fd = openat(loopback_fd(ino), ".", O_RDONLY | O_DIRECTORY);
+    if (d->fd == -1) {
+        err = errno;
+        free(d);
+        fuse_reply_err(req, err);
+        return;
+    }
+
+    fi->fh = (uintptr_t)d;
+    fuse_reply_open(req, fi);
+}
+
+static inline int
+loopback_is_dot(const char *name)
+{
+    return name[0] == '.' &&
+           (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+static void
+loopback_do_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+                    off_t offset, struct fuse_file_info *fi, int plus)
+{
+    struct loopback_dirp *d = get_dirp(fi);
+    size_t rem = size;
+    ssize_t n;
+    char *p;
+    int err = 0;
+
+    if (d->buf == NULL) {
+        d->buf = malloc(LOOPBACK_DIRBUF_SIZE);
+        if (d->buf == NULL) {
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
+    }
+
+    if (size > d->replysize) {
+        p = realloc(d->reply, size);
+        if (p == NULL) {
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
+        d->reply = p;
+        d->replysize = size;
+    }
+    p = d->reply;
+
+    if (offset != d->offset) {
+        if (lseek(d->fd, offset, SEEK_SET) == -1) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+        d->pos = d->len = 0;
+        d->offset = offset;
+    }
+
+    while (1) {
+        struct loopback_dirent64 *de;
+        struct fuse_entry_param e;
+        size_t entsize;
+
+        if (d->pos == d->len) {
+            n = syscall(SYS_getdents64, d->fd, d->buf, LOOPBACK_DIRBUF_SIZE);
+            if (n <= 0) {
+                err = n == -1 ? errno : 0;
+                break;
+            }
+            d->pos = 0;
+            d->len = n;
+        }
+
+        de = (struct loopback_dirent64 *)(d->buf + d->pos);
+
+        if (plus) {
+            /*
+             * . and .. go out without an inode (ino 0), as does a name
+             * that went away meanwhile; the kernel looks those up itself.
+             */
+            if (loopback_is_dot(de->d_name) ||
+                loopback_do_lookup(ino, de->d_name, &e)) {
+                memset(&e, 0, sizeof(e));
+                e.attr.st_ino = de->d_ino;
+                e.attr.st_mode = de->d_type << 12;
+            }
+            entsize = fuse_add_direntry_plus(req, p, rem, de->d_name, &e,
+                                             de->d_off);
+            if (entsize > rem) {
+                if (e.ino) {
+                    loopback_inode_put(loopback_inode(e.ino), 1);
+                }
+                break;
+            }
+        } else {
+            memset(&e.attr, 0, sizeof(e.attr));
+            e.attr.st_ino = de->d_ino;
+            e.attr.st_mode = de->d_type << 12;
+            entsize = fuse_add_direntry(req, p, rem, de->d_name, &e.attr,
+                                        de->d_off);
+            if (entsize > rem) {
+                break;
+            }
+        }
+
+        p += entsize;
+        rem -= entsize;
+        d->pos += de->d_reclen;
+        d->offset = de->d_off;
+    }
+
+    /* An error after some entries is reported on the next call. */
+    if (err && rem == size) {
+        fuse_reply_err(req, err);
+    } else {
+        fuse_reply_buf(req, d->reply, size - rem);
+    }
+}
+
+static void
+loopback_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+                 struct fuse_file_info *fi)
+{
+    loopback_do_readdir(req, ino, size, offset, fi, 0);
+}
+
+static void
+loopback_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size,
+                     off_t offset, struct fuse_file_info *fi)
+{
+    loopback_do_readdir(req, ino, size, offset, fi, 1);
+}
+
+static void
+loopback_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct loopback_dirp *d = get_dirp(fi);
+
+    (void)ino;
+
+    close(d->fd);
+    free(d->buf);
+    free(d->reply);
+    free(d);
+    fuse_reply_err(req, 0);
+}
+
+static void
+loopback_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync,
+                  struct fuse_file_info *fi)
+{
+    int fd = get_dirp(fi)->fd;
+    int res;
+
+    (void)ino;
+
+    res = datasync ? fdatasync(fd) : fsync(fd);
+    fuse_reply_err(req, res == -1 ? errno : 0);
+}
+
+#ifdef FUSE_CAP_PASSTHROUGH
+
+/*
+ * With -o passthrough, the kernel sends reads and writes of a regular file
+ * straight to a backing file registered with it, and they never reach the
+ * daemon. The kernel allows one backing file per inode at a time, so the
+ * first open of an inode registers one and later opens share it until the
+ * last release. It is opened read-write if possible, since those later
+ * opens may write. If registering fails, the inode's opens are served
+ * here as usual until it is closed.
+ *
+ * Registering takes an open() and an ioctl, so it is done without
+ * loopback.mutex. Opens that come while it is under way (backing_id is
+ * LOOPBACK_BACKING_BUSY) register a backing file of their own rather than
+ * wait; the first to finish publishes its id, and the others close theirs.
+ */
+#define LOOPBACK_BACKING_BUSY (-1)
+
+static int
+loopback_backing_open(fuse_req_t req, struct loopback_inode *inode, int fd)
+{
+    char procname[LOOPBACK_PROCNAME_MAX];
+    static int warned;
+    int rwfd, id;
+
+    loopback_procname(inode->fd, procname);
+    rwfd = open(procname, O_RDWR);
+
+    /* The kernel keeps its own reference to the file. */
+    id = fuse_passthrough_open(req, rwfd == -1 ? fd : rwfd);
+    if (rwfd != -1) {
+        close(rwfd);
+    }
+
+    if (id <= 0) {
+        if (!__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED)) {
+            fprintf(stderr, "loopback_ll: cannot register a backing file "
+                    "(%s); serving file I/O here\n", strerror(-id));
+        }
+        return 0;
+    }
+
+    return id;
+}
+
+static void
+loopback_passthrough_open(fuse_req_t req, struct loopback_inode *inode,
+                          struct fuse_file_info *fi)
+{
+    int id;
+
+    if (!loopback.passthrough || inode->type != S_IFREG) {
+        return;
+    }
+
+    pthread_mutex_lock(&loopback.mutex);
+    if (inode->nopen++ == 0) {
+        inode->backing_id = LOOPBACK_BACKING_BUSY;
+    } else if (inode->backing_id != LOOPBACK_BACKING_BUSY) {
+        fi->backing_id = inode->backing_id;
+        pthread_mutex_unlock(&loopback.mutex);
+        return;
+    }
+    pthread_mutex_unlock(&loopback.mutex);
+
+    id = loopback_backing_open(req, inode, fi->fh);
+
+    pthread_mutex_lock(&loopback.mutex);
+    /* Busy, or failed for an open that finished first. */
+    if (inode->backing_id <= 0) {
+        if (id > 0 || inode->backing_id == LOOPBACK_BACKING_BUSY) {
+            inode->backing_id = id;
+        }
+        id = 0;
+    }
+    fi->backing_id = inode->backing_id;
+    pthread_mutex_unlock(&loopback.mutex);
+
+    /* Lost the race. */
+    if (id > 0) {
+        fuse_passthrough_close(req, id);
+    }
+}
+
+static void
+loopback_passthrough_release(fuse_req_t req, struct loopback_inode *inode)
+{
+    int id = 0;
+
+    if (!loopback.passthrough || inode->type != S_IFREG) {
+        return;
+    }
+
+    pthread_mutex_lock(&loopback.mutex);
+    if (--inode->nopen == 0) {
+        id = inode->backing_id;
+        inode->backing_id = 0;
+    }
+    pthread_mutex_unlock(&loopback.mutex);
+
+    if (id > 0) {
+        fuse_passthrough_close(req, id);
+    }
+}
+
+#else
+
+#define loopback_passthrough_open(req, inode, fi)  do { } while (0)
+#define loopback_passthrough_release(req, inode)   do { } while (0)
+
+#endif /* FUSE_CAP_PASSTHROUGH */
+
+/*
+ * With -o writeback, the kernel may read from a file opened write-only to
+ * fill in the rest of a page it is writing, and it does O_APPEND itself,
+ * at offsets it picks, which an O_APPEND descriptor would ignore.
+ */
+static int
+loopback_open_flags(int flags)
+{
+    if (loopback.writeback) {
+        if ((flags & O_ACCMODE) == O_WRONLY) {
+            flags = (flags & ~O_ACCMODE) | O_RDWR;
+        }
+        flags &= ~O_APPEND;
+    }
+
+    return flags & ~O_NOFOLLOW;
+}
+
+/*
+ * -o direct_io sends every read and write to us uncached, as does an
+ * O_DIRECT open. -o parallel_direct_writes then lets the kernel have
+ * several such writes to one file in flight at once, instead of holding
+ * the inode lock across each, which is what database-style random writes
+ * to one big file need.
+ */
+static void
+loopback_open_mode(struct fuse_file_info *fi)
+{
+    if (loopback.direct_io || (fi->flags & O_DIRECT)) {
+        fi->direct_io = 1;
+    }
+
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 15)
+    if (loopback.parallel_direct_writes) {
+        fi->parallel_direct_writes = 1;
+    }
+#endif
+}
+
+static void
+loopback_create(fuse_req_t req, fuse_ino_t parent, const char *name,
+                mode_t mode, struct fuse_file_info *fi)
+{
+    struct loopback_inode *dir = loopback_inode(parent);
+    struct fuse_entry_param e;
+    char real[NAME_MAX + 1];
+    struct timespec mtime;
+    int fd, err;
+
+    if (loopback.case_insensitive &&
+        loopback_names_resolve(dir, name, real, &mtime)) {
+        if (fi->flags & O_EXCL) {
+            fuse_reply_err(req, EEXIST);
+            return;
+        }
+        name = real;
+    }
+
+    if ((fi->flags & O_TRUNC) && loopback.cache_dir) {
+        struct loopback_inode *inode = loopback_inode_child(dir, name);
+
+        if (inode) {
+            loopback_cache_invalidate(inode);
+            loopback_inode_put(inode, 1);
+        }
+    }
+
+    fd = openat(dir->fd, name, loopback_open_flags(fi->flags | O_CREAT), mode);
+    if (fd == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    if (loopback.case_insensitive) {
+        loopback_names_changed(dir, &mtime, name, NULL);
+    }
+
+    err = loopback_do_lookup(parent, name, &e);
+    if (err) {
+        close(fd);
+        fuse_reply_err(req, err);
+        return;
+    }
+    if (name == real) {
+        e.entry_timeout = 0;
+    }
+
+    fi->fh = fd;
+    loopback_open_mode(fi);
+    loopback_passthrough_open(req, loopback_inode(e.ino), fi);
+    loopback_cache_attach(loopback_inode(e.ino), fd);
+    fuse_reply_create(req, &e, fi);
+}
+
+static void
+loopback_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    char procname[LOOPBACK_PROCNAME_MAX];
+    int fd;
+
+    loopback_procname(loopback_fd(ino), procname);
+
+    /*
+     * With FUSE_CAP_ATOMIC_O_TRUNC the truncation comes here rather than
+     * through setattr, and another handle may have the copy attached.
+     */
+    if (fi->flags & O_TRUNC) {
+        loopback_cache_invalidate(loopback_inode(ino));
+    }
+
+    fd = open(procname, loopback_open_flags(fi->flags));
+    if (fd == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    fi->fh = fd;
+    loopback_open_mode(fi);
+    loopback_passthrough_open(req, loopback_inode(ino), fi);
+    loopback_cache_attach(loopback_inode(ino), fd);
+    fuse_reply_open(req, fi);
+}
+
+/*
+ * Reads and writes hand libfuse the backing descriptor instead of a copy
+ * of the data. With the splice capabilities (see loopback_init()), the
+ * bytes then move between the backing file and /dev/fuse through a pipe
+ * without ever being copied into this process.
+ */
+static void
+loopback_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+              struct fuse_file_info *fi)
+{
+    struct fuse_bufvec buf = FUSE_BUFVEC_INIT(size);
+    int fd = fi->fh;
+
+    if (loopback.cache_dir) {
+        int cfd = loopback_cache_fd(loopback_inode(ino));
+
+        loopback_cache_count(cfd != -1, size);
+        if (cfd != -1) {
+            fd = cfd;
+        }
+    }
+
+    buf.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    buf.buf[0].fd = fd;
+    buf.buf[0].pos = offset;
+
+    fuse_reply_data(req, &buf, FUSE_BUF_SPLICE_MOVE);
+}
+
+static void
+loopback_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *in_buf,
+                   off_t offset, struct fuse_file_info *fi)
+{
+    struct fuse_bufvec out_buf = FUSE_BUFVEC_INIT(fuse_buf_size(in_buf));
+    struct loopback_inode *inode = loopback_inode(ino);
+    const char *mem = loopback_write_mem(in_buf);
+    ssize_t res;
+
+    out_buf.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    out_buf.buf[0].fd = fi->fh;
+    out_buf.buf[0].pos = offset;
+
+    /* Before, so no read after the write can see the copy. */
+    if (!loopback.cache_write_through) {
+        loopback_cache_invalidate(inode);
+    }
+
+    res = fuse_buf_copy(&out_buf, in_buf, 0);
+    if (res > 0 && loopback.cache_write_through) {
+        loopback_cache_write(inode, fi->fh, mem, offset, res);
+    }
+    if (res < 0) {
+        fuse_reply_err(req, -res);
+    } else {
+        fuse_reply_write(req, (size_t)res);
+    }
+}
+
+static void
+loopback_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+    struct statvfs stbuf;
+    int res;
+
+    res = fstatvfs(loopback_fd(ino), &stbuf);
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+    } else {
+        fuse_reply_statfs(req, &stbuf);
+    }
+}
+
+static void
+loopback_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    int res;
+
+    (void)ino;
+
+    res = close(dup(fi->fh));
+    fuse_reply_err(req, res == -1 ? errno : 0);
+}
+
+static void
+loopback_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    close(fi->fh);
+    loopback_passthrough_release(req, loopback_inode(ino));
+    loopback_cache_detach(loopback_inode(ino));
+    fuse_reply_err(req, 0);
+}
+
+static void
+loopback_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+               struct fuse_file_info *fi)
+{
+    int res;
+
+    (void)ino;
+
+    res = datasync ? fdatasync(fi->fh) : fsync(fi->fh);
+    fuse_reply_err(req, res == -1 ? errno : 0);
+}
+
+/*
+ * Punching holes and zeroing ranges (the only modes the kernel passes on
+ * besides FALLOC_FL_KEEP_SIZE) are done on the backing file as asked.
+ */
+static void
+loopback_fallocate(fuse_req_t req, fuse_ino_t ino, int mode, off_t offset,
+                   off_t length, struct fuse_file_info *fi)
+{
+    int res;
+
+    loopback_cache_invalidate(loopback_inode(ino));
+    res = fallocate(fi->fh, mode, offset, length);
+    fuse_reply_err(req, res == -1 ? errno : 0);
+}
+
+/*
+ * A copy between two files of the mount is one copy_file_range(2) between
+ * the backing files, so no data passes through the daemon, and a backing
+ * file system that can share extents (Btrfs, XFS) makes it a reflink.
+ */
+static void
+loopback_copy_file_range(fuse_req_t req, fuse_ino_t ino_in, off_t off_in,
+                         struct fuse_file_info *fi_in, fuse_ino_t ino_out,
+                         off_t off_out, struct fuse_file_info *fi_out,
+                         size_t len, int flags)
+{
+    ssize_t res;
+
+    (void)ino_in;
+
+    loopback_cache_invalidate(loopback_inode(ino_out));
+    res = copy_file_range(fi_in->fh, &off_in, fi_out->fh, &off_out, len,
+                          flags);
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+    } else {
+        fuse_reply_write(req, (size_t)res);
+    }
+}
+
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 8)
+
+/* SEEK_DATA and SEEK_HOLE, so sparse files stay sparse when copied. */
+static void
+loopback_lseek(fuse_req_t req, fuse_ino_t ino, off_t off, int whence,
+               struct fuse_file_info *fi)
+{
+    off_t res;
+
+    (void)ino;
+
+    res = lseek(fi->fh, off, whence);
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+    } else {
+        fuse_reply_lseek(req, res);
+    }
+}
+
+#endif
+
+/*
+ * Extended attributes go through /proc as well. The name there is itself
+ * a symbolic link, so a symbolic link's own attributes are out of reach.
+ */
+static int
+loopback_xattr_procname(fuse_ino_t ino, char *procname)
+{
+    struct loopback_inode *inode = loopback_inode(ino);
+
+    if (inode->type == S_IFLNK) {
+        return ENOTSUP;
+    }
+
+    loopback_procname(inode->fd, procname);
+
+    return 0;
+}
+
+#define LOOPBACK_XATTR_SECURITY "security."
+
+static inline int
+loopback_xattr_is_security(const char *name)
+{
+    return strncmp(name, LOOPBACK_XATTR_SECURITY,
+                   sizeof(LOOPBACK_XATTR_SECURITY) - 1) == 0;
+}
+
+/* With -o nosecurity_xattrs, the security namespace is not supported. */
+static inline int
+loopback_xattr_hidden(const char *name)
+{
+    return loopback.nosecurity_xattrs && loopback_xattr_is_security(name);
+}
+
+/* Replies from the cache, if it has an answer still good for name. */
+static int
+loopback_xattr_cached(fuse_req_t req, struct loopback_inode *inode,
+                      const char *name, size_t size)
+{
+    char value[LOOPBACK_XATTR_VALUE_MAX];
+    struct loopback_xattr *xa;
+    struct timespec now;
+    size_t vsize = 0;
+    int err = -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&loopback.mutex);
+    for (xa = inode->xattrs; xa; xa = xa->next) {
+        if (strcmp(xa->name, name) == 0) {
+            if (now.tv_sec < xa->expires.tv_sec ||
+                (now.tv_sec == xa->expires.tv_sec &&
+                 now.tv_nsec < xa->expires.tv_nsec)) {
+                err = xa->err;
+                vsize = xa->size;
+                memcpy(value, xa->value, vsize);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&loopback.mutex);
+
+    if (err == -1) {
+        return 0;
+    }
+
+    if (err) {
+        fuse_reply_err(req, err);
+    } else if (size == 0) {
+        fuse_reply_xattr(req, vsize);
+    } else if (size < vsize) {
+        fuse_reply_err(req, ERANGE);
+    } else {
+        fuse_reply_buf(req, value, vsize);
+    }
+
+    return 1;
+}
+
+/*
+ * Remembers a getxattr() result, unless the inode's entries were flushed
+ * since gen was read: the result may be older than the change.
+ */
+static void
+loopback_xattr_remember(struct loopback_inode *inode, unsigned gen,
+                        const char *name, int err, const char *value,
+                        size_t size)
+{
+    struct loopback_xattr *xa, *old, *drop = NULL, *tail = NULL;
+    size_t namelen = strlen(name) + 1;
+    struct loopback_xattr **pp;
+    time_t whole;
+    unsigned n;
+
+    xa = malloc(sizeof(*xa) + namelen + size);
+    if (xa == NULL) {
+        return;
+    }
+
+    memcpy(xa->name, name, namelen);
+    xa->value = xa->name + namelen;
+    memcpy(xa->value, value, size);
+    xa->size = size;
+    xa->err = err;
+
+    clock_gettime(CLOCK_MONOTONIC, &xa->expires);
+    whole = (time_t)loopback.timeout;
+    xa->expires.tv_nsec += (long)((loopback.timeout - whole) * 1e9);
+    xa->expires.tv_sec += whole + xa->expires.tv_nsec / 1000000000;
+    xa->expires.tv_nsec %= 1000000000;
+
+    pthread_mutex_lock(&loopback.mutex);
+
+    if (inode->xattr_gen != gen) {
+        pthread_mutex_unlock(&loopback.mutex);
+        free(xa);
+        return;
+    }
+
+    /* Newest first; an older entry for the name and the oldest go. */
+    xa->next = inode->xattrs;
+    inode->xattrs = xa;
+    for (pp = &xa->next, n = 1; *pp; ) {
+        old = *pp;
+        if (strcmp(old->name, name) == 0) {
+            *pp = old->next;
+            old->next = drop;
+            drop = old;
+        } else if (++n > LOOPBACK_XATTR_ENTRIES) {
+            tail = old;
+            *pp = NULL;
+        } else {
+            pp = &old->next;
+        }
+    }
+
+    pthread_mutex_unlock(&loopback.mutex);
+
+    loopback_xattr_free(drop);
+    loopback_xattr_free(tail);
+}
+
+static void
+loopback_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+                  const char *value, size_t size, int flags)
+{
+    char procname[LOOPBACK_PROCNAME_MAX];
+    int res, err;
+
+    if (loopback_xattr_hidden(name)) {
+        fuse_reply_err(req, ENOTSUP);
+        return;
+    }
+
+    err = loopback_xattr_procname(ino, procname);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+
+    res = setxattr(procname, name, value, size, flags);
+    err = res == -1 ? errno : 0;
+    loopback_xattr_flush(loopback_inode(ino));
+    fuse_reply_err(req, err);
+}
+
+static void
+loopback_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+                  size_t size)
+{
+    struct loopback_inode *inode = loopback_inode(ino);
+    char small[LOOPBACK_XATTR_VALUE_MAX];
+    char procname[LOOPBACK_PROCNAME_MAX];
+    unsigned gen;
+    ssize_t res;
+    char *value;
+    int err;
+
+    if (ino == FUSE_ROOT_ID && loopback.cache_dir &&
+        strcmp(name, LOOPBACK_CACHE_STATS_XATTR) == 0) {
+        loopback_getxattr_cache_stats(req, size);
+        return;
+    }
+
+    if (loopback_xattr_hidden(name)) {
+        fuse_reply_err(req, ENOTSUP);
+        return;
+    }
+
+    err = loopback_xattr_procname(ino, procname);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+
+    if (loopback_xattr_cached(req, inode, name, size)) {
+        return;
+    }
+
+    pthread_mutex_lock(&loopback.mutex);
+    gen = inode->xattr_gen;
+    pthread_mutex_unlock(&loopback.mutex);
+
+    /* A short value is read whole, which spares the kernel's size probe. */
+    res = getxattr(procname, name, small, sizeof(small));
+    if (res == -1 && errno != ERANGE) {
+        err = errno;
+        if (err == ENODATA || err == ENOTSUP) {
+            loopback_xattr_remember(inode, gen, name, err, NULL, 0);
+        }
+        fuse_reply_err(req, err);
+        return;
+    }
+
+    if (res != -1) {
+        if (!loopback_xattr_is_security(name)) {
+            loopback_xattr_remember(inode, gen, name, 0, small, res);
+        }
+        if (size == 0) {
+            fuse_reply_xattr(req, res);
+        } else if (size < (size_t)res) {
+            fuse_reply_err(req, ERANGE);
+        } else {
+            fuse_reply_buf(req, small, res);
+        }
+        return;
+    }
+
+    if (size == 0) {
+        res = getxattr(procname, name, NULL, 0);
+        if (res == -1) {
+            fuse_reply_err(req, errno);
+        } else {
+            fuse_reply_xattr(req, res);
+        }
+        return;
+    }
+
+    value = malloc(size);
+    if (value == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    res = getxattr(procname, name, value, size);
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+    } else {
+        fuse_reply_buf(req, value, res);
+    }
+
+    free(value);
+}
+
+/* listxattr() for -o nosecurity_xattrs: the whole list, filtered. */
+static void
+loopback_listxattr_hidden(fuse_req_t req, const char *procname, size_t size)
+{
+    char *list, *p, *q;
+    ssize_t res;
+    size_t len;
+
+    res = listxattr(procname, NULL, 0);
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    list = malloc(res + 1);
+    if (list == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    /* ERANGE if the list grew meanwhile; the caller will ask again. */
+    res = listxattr(procname, list, res);
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+        free(list);
+        return;
+    }
+
+    for (p = q = list; p < list + res; p += len) {
+        len = strlen(p) + 1;
+        if (!loopback_xattr_is_security(p)) {
+            memmove(q, p, len);
+            q += len;
+        }
+    }
+    len = q - list;
+
+    if (size == 0) {
+        fuse_reply_xattr(req, len);
+    } else if (size < len) {
+        fuse_reply_err(req, ERANGE);
+    } else {
+        fuse_reply_buf(req, list, len);
+    }
+
+    free(list);
+}
+
+static void
+loopback_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+{
+    char procname[LOOPBACK_PROCNAME_MAX];
+    ssize_t res;
+    char *list;
+    int err;
+
+    err = loopback_xattr_procname(ino, procname);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+
+    if (loopback.nosecurity_xattrs) {
+        loopback_listxattr_hidden(req, procname, size);
+        return;
+    }
+
+    if (size == 0) {
+        res = listxattr(procname, NULL, 0);
+        if (res == -1) {
+            fuse_reply_err(req, errno);
+        } else {
+            fuse_reply_xattr(req, res);
+        }
+        return;
+    }
+
+    list = malloc(size);
+    if (list == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    res = listxattr(procname, list, size);
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+    } else {
+        fuse_reply_buf(req, list, res);
+    }
+
+    free(list);
+}
+
+static void
+loopback_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
+{
+    char procname[LOOPBACK_PROCNAME_MAX];
+    int res, err;
+
+    if (loopback_xattr_hidden(name)) {
+        fuse_reply_err(req, ENOTSUP);
+        return;
+    }
+
+    err = loopback_xattr_procname(ino, procname);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+
+    res = removexattr(procname, name);
+    err = res == -1 ? errno : 0;
+    loopback_xattr_flush(loopback_inode(ino));
+    fuse_reply_err(req, err);
+}
+
+#define LOOPBACK_CAP_SPLICE \
+    (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE)
+
+static void
+loopback_init(void *userdata, struct fuse_conn_info *conn)
+{
+    (void)userdata;
+
+    if (loopback.splice) {
+        conn->want |= conn->capable & LOOPBACK_CAP_SPLICE;
+    } else {
+        conn->want &= ~LOOPBACK_CAP_SPLICE;
+    }
+
+    /* Written data has to be at hand to go to the cache as well. */
+    if (loopback.cache_dir && loopback.cache_write_through) {
+        conn->want &= ~FUSE_CAP_SPLICE_WRITE;
+    }
+
+    if (loopback.writeback) {
+        if (conn->capable & FUSE_CAP_WRITEBACK_CACHE) {
+            conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+        } else {
+            fprintf(stderr, "loopback_ll: the kernel has no writeback "
+                    "cache; writing through\n");
+            loopback.writeback = 0;
+        }
+    } else {
+        conn->want &= ~FUSE_CAP_WRITEBACK_CACHE;
+    }
+
+    if (!loopback.readdirplus) {
+        conn->want &= ~(FUSE_CAP_READDIRPLUS | FUSE_CAP_READDIRPLUS_AUTO);
+    }
+
+#ifdef FUSE_CAP_PASSTHROUGH
+    if (loopback.passthrough) {
+        if (conn->capable & FUSE_CAP_PASSTHROUGH) {
+            conn->want |= FUSE_CAP_PASSTHROUGH;
+            /* The source may not itself be on a stacked file system. */
+            conn->max_backing_stack_depth = 1;
+        } else {
+            fprintf(stderr, "loopback_ll: the kernel cannot pass file I/O "
+                    "through; serving it here\n");
+            loopback.passthrough = 0;
+        }
+    }
+#endif
+}
+
+static void
+loopback_destroy(void *userdata)
+{
+    size_t i;
+
+    (void)userdata;
+
+    for (i = 0; i < loopback.table_size; i++) {
+        while (loopback.table[i]) {
+            struct loopback_inode *inode = loopback.table[i];
+            loopback.table[i] = inode->next;
+            loopback_xattr_free(inode->xattrs);
+            loopback_names_free(inode->names);
+            close(inode->fd);
+            free(inode);
+        }
+    }
+    loopback.ninodes = 0;
+
+    loopback_xattr_free(loopback.root.xattrs);
+    loopback.root.xattrs = NULL;
+    loopback_names_free(loopback.root.names);
+    loopback.root.names = NULL;
+}
+
+static const struct fuse_lowlevel_ops loopback_oper = {
+    .init         = loopback_init,
+    .destroy      = loopback_destroy,
+    .lookup       = loopback_lookup,
+    .forget       = loopback_forget,
+    .forget_multi = loopback_forget_multi,
+    .getattr      = loopback_getattr,
+    .setattr      = loopback_setattr,
+    .readlink     = loopback_readlink,
+    .mknod        = loopback_mknod,
+    .mkdir        = loopback_mkdir,
+    .symlink      = loopback_symlink,
+    .link         = loopback_link,
+    .unlink       = loopback_unlink,
+    .rmdir        = loopback_rmdir,
+    .rename       = loopback_rename,
+    .opendir      = loopback_opendir,
+    .readdir      = loopback_readdir,
+    .readdirplus  = loopback_readdirplus,
+    .releasedir   = loopback_releasedir,
+    .fsyncdir     = loopback_fsyncdir,
+    .create       = loopback_create,
+    .open         = loopback_open,
+    .read         = loopback_read,
+    .write_buf    = loopback_write_buf,
+    .statfs       = loopback_statfs,
+    .flush        = loopback_flush,
+    .release      = loopback_release,
+    .fsync        = loopback_fsync,
+    .setxattr     = loopback_setxattr,
+    .getxattr     = loopback_getxattr,
+    .listxattr    = loopback_listxattr,
+    .removexattr  = loopback_removexattr,
+    .fallocate    = loopback_fallocate,
+    .copy_file_range = loopback_copy_file_range,
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 8)
+    .lseek        = loopback_lseek,
+#endif
+};
+
+static const struct fuse_opt loopback_opts[] = {
+	{ "source=%s", offsetof(struct loopback, source), 0 },
+	{ "timeout=%lf", offsetof(struct loopback, timeout), 0 },
+	{ "splice", offsetof(struct loopback, splice), 1 },
+	{ "nosplice", offsetof(struct loopback, splice), 0 },
+	{ "passthrough", offsetof(struct loopback, passthrough), 1 },
+	{ "writeback", offsetof(struct loopback, writeback), 1 },
+	{ "direct_io", offsetof(struct loopback, direct_io), 1 },
+	{ "parallel_direct_writes",
+	  offsetof(struct loopback, parallel_direct_writes), 1 },
+	{ "watch", offsetof(struct loopback, watch), 1 },
+	{ "nosecurity_xattrs", offsetof(struct loopback, nosecurity_xattrs), 1 },
+	{ "case_insensitive", offsetof(struct loopback, case_insensitive), 1 },
+	{ "readdirplus", offsetof(struct loopback, readdirplus), 1 },
+	{ "noreaddirplus", offsetof(struct loopback, readdirplus), 0 },
+	{ "cache_dir=%s", offsetof(struct loopback, cache_dir), 0 },
+	{ "cache_size=%lu", offsetof(struct loopback, cache_size), 0 },
+	{ "cache_write_through",
+	  offsetof(struct loopback, cache_write_through), 1 },
+	FUSE_OPT_END
+};
+
+static void
+loopback_usage(const char *progname)
+{
+    printf("usage: %s [options] <mountpoint>\n\n", progname);
+    printf("loopback options:\n"
+           "    -o source=DIR          directory to mirror (required)\n"
+           "    -o timeout=SEC         entry and attribute timeout "
+           "(default 1.0,\n"
+           "                           or 86400 with -o watch)\n"
+           "    -o nosplice            copy data through the daemon instead "
+           "of splicing\n"
+           "    -o passthrough         have the kernel do file I/O on the "
+           "backing files\n"
+           "                           (Linux 6.9 and later, as root)\n"
+           "    -o writeback           let the kernel cache writes and send "
+           "them in batches\n"
+           "    -o direct_io           bypass the kernel's page cache\n"
+           "    -o parallel_direct_writes\n"
+           "                           allow concurrent uncached writes to "
+           "one file\n"
+           "    -o watch               follow changes to the source with "
+           "inotify, so the\n"
+           "                           kernel can cache for long\n"
+           "    -o nosecurity_xattrs   do not support xattrs in the "
+           "security namespace\n"
+           "    -o case_insensitive    match names without regard to "
+           "(ASCII) case\n"
+           "    -o noreaddirplus       list directories without "
+           "attributes\n"
+           "    -o cache_dir=DIR       keep copies of files read in DIR, "
+           "on fast storage\n"
+           "    -o cache_size=MB       room for copies (default 1024)\n"
+           "    -o cache_write_through\n"
+           "                           write copies too, instead of "
+           "dropping them\n");
+}
+
+/* Every inode the kernel holds on to keeps a descriptor open. */
+static void
+loopback_raise_fd_limit(void)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        (void)setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static int
+loopback_init_root(void)
+{
+    struct stat st;
+    int fd;
+
+    fd = open(loopback.source, O_PATH | O_DIRECTORY);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "loopback_ll: %s: %s\n", loopback.source,
+                strerror(errno));
+        return -1;
+    }
+
+    loopback.root.fd = fd;
+    loopback.root.type = S_IFDIR;
+    loopback.root.dev = st.st_dev;
+    loopback.root.ino = st.st_ino;
+    loopback.root.nlookup = 2;
+    loopback.root.wd = -1;
+    loopback.root.cache_fd = -1;
+
+    loopback.table_size = LOOPBACK_TABLE_MIN;
+    loopback.table = calloc(loopback.table_size,
+                            sizeof(struct loopback_inode *));
+    if (loopback.table == NULL) {
+        fprintf(stderr, "loopback_ll: out of memory\n");
+        close(fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct fuse_cmdline_opts opts;
+    struct fuse_loop_config config;
+    struct fuse_session *se;
+    int res = 1;
+
+    if (fuse_parse_cmdline(&args, &opts) != 0) {
+        return 1;
+    }
+
+    if (opts.show_help) {
+        loopback_usage(argv[0]);
+        fuse_cmdline_help();
+        fuse_lowlevel_help();
+        res = 0;
+        goto out1;
+    } else if (opts.show_version) {
+        fuse_lowlevel_version();
+        res = 0;
+        goto out1;
+    }
+
+    if (opts.mountpoint == NULL) {
+        loopback_usage(argv[0]);
+        goto out1;
+    }
+
+    pthread_mutex_init(&loopback.mutex, NULL);
+    loopback.timeout = -1;
+    loopback.splice = 1;
+    loopback.readdirplus = 1;
+    loopback.cache_size = 1024;
+    loopback.inotify_fd = -1;
+    if (fuse_opt_parse(&args, &loopback, loopback_opts, NULL) == -1) {
+        goto out1;
+    }
+
+    if (loopback.timeout < 0) {
+        loopback.timeout = loopback.watch ? LOOPBACK_WATCH_TIMEOUT
+                                          : LOOPBACK_TIMEOUT;
+    }
+
+    if (loopback.source == NULL) {
+        fprintf(stderr, "loopback_ll: -o source=DIR is required\n");
+        goto out1;
+    }
+
+    /* The kernel will not pass I/O through for a file it caches writes of. */
+    if (loopback.writeback && loopback.passthrough) {
+        fprintf(stderr, "loopback_ll: -o writeback and -o passthrough "
+                "cannot be combined\n");
+        goto out1;
+    }
+
+    /* Passed-through reads would never see the cache. */
+    if (loopback.cache_dir && loopback.passthrough) {
+        fprintf(stderr, "loopback_ll: -o cache_dir and -o passthrough "
+                "cannot be combined\n");
+        goto out1;
+    }
+
+#if FUSE_VERSION < FUSE_MAKE_VERSION(3, 15)
+    if (loopback.parallel_direct_writes) {
+        fprintf(stderr, "loopback_ll: this libfuse cannot ask for parallel "
+                "direct writes; ignoring -o parallel_direct_writes\n");
+        loopback.parallel_direct_writes = 0;
+    }
+#endif
+
+#ifndef FUSE_CAP_PASSTHROUGH
+    if (loopback.passthrough) {
+        fprintf(stderr, "loopback_ll: this libfuse cannot pass file I/O "
+                "through; ignoring -o passthrough\n");
+        loopback.passthrough = 0;
+    }
+#endif
+
+    if (loopback.watch) {
+        loopback.inotify_fd = inotify_init1(IN_CLOEXEC);
+        if (loopback.inotify_fd == -1) {
+            fprintf(stderr, "loopback_ll: inotify: %s\n", strerror(errno));
+            goto out1;
+        }
+    }
+
+    if (loopback_init_root() == -1) {
+        goto out1;
+    }
+    loopback_watch(&loopback.root);
+
+    if (loopback.cache_dir &&
+        loopback_cache_init(loopback.cache_dir,
+                            (uint64_t)loopback.cache_size << 20) == -1) {
+        goto out1;
+    }
+
+    loopback_raise_fd_limit();
+    umask(0);
+
+    se = fuse_session_new(&args, &loopback_oper, sizeof(loopback_oper), NULL);
+    if (se == NULL) {
+        goto out1;
+    }
+    loopback.se = se;
+
+    if (fuse_set_signal_handlers(se) != 0) {
+        goto out2;
+    }
+
+    if (fuse_session_mount(se, opts.mountpoint) != 0) {
+        goto out3;
+    }
+
+    fuse_daemonize(opts.foreground);
+
+    if (loopback.watch &&
+        pthread_create(&loopback.watcher, NULL, loopback_watch_main, NULL)) {
+        fprintf(stderr, "loopback_ll: cannot start the watcher\n");
+        fuse_session_unmount(se);
+        goto out3;
+    }
+
+    if (loopback.cache_dir && loopback_cache_start(2) == -1) {
+        fprintf(stderr, "loopback_ll: cannot start the cache fillers\n");
+        fuse_session_unmount(se);
+        goto out3;
+    }
+
+    if (opts.singlethread) {
+        res = fuse_session_loop(se);
+    } else {
+        config.clone_fd = opts.clone_fd;
+        config.max_idle_threads = opts.max_idle_threads;
+        res = fuse_session_loop_mt(se, &config);
+    }
+
+    if (loopback.watch) {
+        pthread_cancel(loopback.watcher);
+        pthread_join(loopback.watcher, NULL);
+    }
+
+    fuse_session_unmount(se);
+out3:
+    fuse_remove_signal_handlers(se);
+out2:
+    fuse_session_destroy(se);
+out1:
+    free(opts.mountpoint);
+    fuse_opt_free_args(&args);
+
+    if (loopback.root.fd > 0) {
+        close(loopback.root.fd);
+    }
+    if (loopback.inotify_fd != -1) {
+        close(loopback.inotify_fd);
+    }
+    if (loopback.cache_dir) {
+        char stats[512];
+
+        loopback_cache_stop();
+        if (loopback_cache_stats(stats, sizeof(stats)) > 0) {
+            fprintf(stderr, "loopback_ll: cache: %s", stats);
+        }
+        free(loopback.cache_dir);
+    }
+    free(loopback.table);
+    free(loopback.source);
+
+    return res ? 1 : 0;
+}
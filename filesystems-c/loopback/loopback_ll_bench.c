@@ -0,0 +1,623 @@
+/*
+  loopback_ll_bench: data throughput through a loopback_ll mount
+
+  The bench mounts "loopback_ll -f -o source=SOURCE" on MOUNTPOINT, once
+  as is and once per -v with those options added, and for each mount
+  times:
+
+    seqwrite  a SIZE-byte file written in BLOCK-sized writes, then fsync()
+    seqread   the same file read back in BLOCK-sized reads, after
+              posix_fadvise(DONTNEED) so the kernel's cache of the FUSE
+              file cannot answer
+    smallwrite  N records of RECORD bytes appended to a log, one write()
+              each, up to and including close()
+    dbwrite   N 4 KB pwrite()s at random places in a 64 MB file, shared
+              out among THREADS threads with a descriptor each
+    copy      the seqwrite file copied to a new file in the mount with
+              copy_file_range(), then fsync(); where that fails, with
+              read() and write() as cp(1) would
+    hotread   a SIZE-byte file written once per mount, read back whole
+              in each run, as seqread; with -o cache_dir, the first run
+              fills the cache and later ones read from it
+    lsl       a directory of FILES empty files, made fresh in SOURCE for
+              each run, listed through the mount and every entry
+              lstat()ed, as ls -l does (ops are entries)
+
+  and prints MB/s and operations per second, the median of the runs. The
+  backing file stays in the host's page cache, so what is measured is the
+  cost of the trip through FUSE and the daemon, not the backing disk.
+  For example, splice against copying, and against kernel passthrough
+  (as root):
+
+    loopback_ll_bench -v nosplice -v passthrough /tmp/src /mnt/loop
+
+  or the writeback cache for small appends, and parallel direct writes:
+
+    loopback_ll_bench -w smallwrite,dbwrite -v writeback -v direct_io \
+        -v direct_io,parallel_direct_writes /tmp/src /mnt/loop
+
+  or a cache on local disk in front of a slow source (an NFS mount, or
+  a directory throttled with dm-delay):
+
+    loopback_ll_bench -w seqread,hotread -r 5 \
+        -v cache_dir=/var/tmp/llcache,cache_size=4096 /mnt/nfs /mnt/loop
+
+  or listing with and without readdirplus:
+
+    loopback_ll_bench -w lsl -f 200000 -v noreaddirplus /tmp/src /mnt/loop
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+#define _GNU_SOURCE	/* asprintf */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MAX_VARIANTS	16
+#define MAX_RUNS	64
+#define MAX_THREADS	256
+#define DB_FILE_SIZE	(64 * 1024 * 1024)
+#define DB_BLOCK	4096
+
+enum workload {
+	W_SEQWRITE, W_SEQREAD, W_SMALLWRITE, W_DBWRITE, W_COPY, W_HOTREAD,
+	W_LSL, W_COUNT
+};
+
+static const char *workload_names[W_COUNT] = {
+	"seqwrite", "seqread", "smallwrite", "dbwrite", "copy", "hotread",
+	"lsl",
+};
+
+static const char *program = "./loopback_ll";
+static const char *source;
+static const char *mountpoint;
+static size_t size = 1024 * 1024 * 1024;
+static size_t blocksize = 1024 * 1024;
+static int runs = 3;
+static size_t nrecords = 100000;
+static size_t recordsize = 128;
+static int nthreads = 8;
+static size_t nfiles = 100000;
+
+static char *buf;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+	fprintf(stderr, "loopback_ll_bench: %s: %s\n", what, strerror(errno));
+	exit(1);
+}
+
+/* Returns seconds taken. */
+static double seqwrite(const char *path)
+{
+	size_t done;
+	double t0;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		die(path);
+
+	t0 = now();
+	for (done = 0; done < size; done += blocksize) {
+		size_t n = size - done < blocksize ? size - done : blocksize;
+		if (write(fd, buf, n) != (ssize_t)n)
+			die("write");
+	}
+	if (fsync(fd) == -1)
+		die("fsync");
+	t0 = now() - t0;
+
+	close(fd);
+	return t0;
+}
+
+static double seqread(const char *path)
+{
+	size_t done = 0;
+	ssize_t n;
+	double t0;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		die(path);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+	t0 = now();
+	while ((n = read(fd, buf, blocksize)) > 0)
+		done += n;
+	if (n == -1)
+		die("read");
+	t0 = now() - t0;
+
+	close(fd);
+	if (done != size) {
+		fprintf(stderr, "loopback_ll_bench: read %zu of %zu bytes\n",
+			done, size);
+		exit(1);
+	}
+	return t0;
+}
+
+static double smallwrite(const char *path)
+{
+	struct stat st;
+	size_t i;
+	double t0;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (fd == -1)
+		die(path);
+
+	t0 = now();
+	for (i = 0; i < nrecords; i++)
+		if (write(fd, buf, recordsize) != (ssize_t)recordsize)
+			die("write");
+	if (close(fd) == -1)
+		die("close");
+	t0 = now() - t0;
+
+	if (stat(path, &st) == -1)
+		die(path);
+	if ((size_t)st.st_size != nrecords * recordsize) {
+		fprintf(stderr,
+			"loopback_ll_bench: log is %lld bytes, not %zu\n",
+			(long long)st.st_size, nrecords * recordsize);
+		exit(1);
+	}
+	return t0;
+}
+
+struct dbwriter {
+	pthread_t thread;
+	const char *path;
+	uint64_t seed;
+	size_t ops;
+};
+
+static void *dbwriter_main(void *arg)
+{
+	struct dbwriter *d = arg;
+	uint64_t x = d->seed;
+	size_t i;
+	int fd;
+
+	fd = open(d->path, O_RDWR);
+	if (fd == -1)
+		die(d->path);
+	for (i = 0; i < d->ops; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		off_t off = (off_t)(x % (DB_FILE_SIZE / DB_BLOCK)) * DB_BLOCK;
+		if (pwrite(fd, buf, DB_BLOCK, off) != DB_BLOCK)
+			die("pwrite");
+	}
+	close(fd);
+	return NULL;
+}
+
+static double dbwrite(const char *path)
+{
+	struct dbwriter d[MAX_THREADS];
+	double t0;
+	int fd, i;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1 || ftruncate(fd, DB_FILE_SIZE) == -1)
+		die(path);
+	close(fd);
+
+	t0 = now();
+	for (i = 0; i < nthreads; i++) {
+		d[i].path = path;
+		d[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+		d[i].ops = nrecords / nthreads;
+		if (pthread_create(&d[i].thread, NULL, dbwriter_main, &d[i]))
+			die("pthread_create");
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(d[i].thread, NULL);
+	t0 = now() - t0;
+
+	return t0;
+}
+
+static double copy(const char *from, const char *to)
+{
+	size_t done = 0;
+	ssize_t n = 0;
+	double t0;
+	int in, out;
+
+	in = open(from, O_RDONLY);
+	if (in == -1)
+		die(from);
+	out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out == -1)
+		die(to);
+
+	t0 = now();
+	while (done < size &&
+	       (n = copy_file_range(in, NULL, out, NULL, size - done, 0)) > 0)
+		done += n;
+	if (n == -1) {
+		static int warned;
+		if (!warned) {
+			warned = 1;
+			fprintf(stderr, "loopback_ll_bench: "
+				"copy_file_range: %s; copying with read "
+				"and write\n", strerror(errno));
+		}
+		while ((n = read(in, buf, blocksize)) > 0)
+			if (write(out, buf, n) != n)
+				die("write");
+		if (n == -1)
+			die("read");
+	}
+	if (fsync(out) == -1)
+		die("fsync");
+	t0 = now() - t0;
+
+	close(in);
+	close(out);
+	return t0;
+}
+
+static void make_dir(const char *dir)
+{
+	char *name;
+	size_t i;
+	int fd;
+
+	if (mkdir(dir, 0755) == -1)
+		die(dir);
+	for (i = 0; i < nfiles; i++) {
+		if (asprintf(&name, "%s/file%07zu", dir, i) == -1)
+			die("asprintf");
+		fd = open(name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (fd == -1)
+			die(name);
+		close(fd);
+		free(name);
+	}
+}
+
+static void remove_dir(const char *dir)
+{
+	char *name;
+	size_t i;
+
+	for (i = 0; i < nfiles; i++) {
+		if (asprintf(&name, "%s/file%07zu", dir, i) == -1)
+			die("asprintf");
+		unlink(name);
+		free(name);
+	}
+	rmdir(dir);
+}
+
+/* The directory is new to the mount, so nothing of it is cached yet. */
+static double lsl(const char *dir)
+{
+	struct dirent *de;
+	struct stat st;
+	size_t n = 0;
+	double t0;
+	DIR *dp;
+
+	t0 = now();
+	dp = opendir(dir);
+	if (!dp)
+		die(dir);
+	while ((de = readdir(dp)) != NULL) {
+		if (fstatat(dirfd(dp), de->d_name, &st,
+			    AT_SYMLINK_NOFOLLOW) == -1)
+			die(de->d_name);
+		n++;
+	}
+	closedir(dp);
+	t0 = now() - t0;
+
+	if (n != nfiles + 2) {
+		fprintf(stderr,
+			"loopback_ll_bench: listed %zu entries, not %zu\n",
+			n, nfiles + 2);
+		exit(1);
+	}
+	return t0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static int is_mounted(void)
+{
+	struct stat st, parent;
+	char *up;
+
+	if (asprintf(&up, "%s/..", mountpoint) == -1)
+		return 0;
+	int mounted = stat(mountpoint, &st) == 0 && stat(up, &parent) == 0 &&
+		      st.st_dev != parent.st_dev;
+	free(up);
+	return mounted;
+}
+
+static pid_t mount_loopback(const char *variant)
+{
+	char *opts;
+	pid_t pid;
+	int i;
+
+	if (asprintf(&opts, "source=%s%s%s", source, *variant ? "," : "",
+		     variant) == -1)
+		die("asprintf");
+
+	pid = fork();
+	if (pid == -1)
+		die("fork");
+	if (pid == 0) {
+		execl(program, program, "-f", "-o", opts, mountpoint,
+		      (char *)NULL);
+		perror(program);
+		_exit(127);
+	}
+	free(opts);
+
+	for (i = 0; i < 1000 && !is_mounted(); i++) {
+		if (waitpid(pid, NULL, WNOHANG) == pid) {
+			fprintf(stderr, "loopback_ll_bench: %s exited before "
+				"mounting %s\n", program, mountpoint);
+			exit(1);
+		}
+		usleep(10000);
+	}
+	if (!is_mounted()) {
+		fprintf(stderr, "loopback_ll_bench: %s did not mount\n",
+			mountpoint);
+		kill(pid, SIGKILL);
+		exit(1);
+	}
+
+	return pid;
+}
+
+/* loopback_ll unmounts itself on the way out of its session loop. */
+static void unmount_loopback(pid_t pid)
+{
+	int i;
+
+	kill(pid, SIGTERM);
+	for (i = 0; i < 500; i++) {
+		if (waitpid(pid, NULL, WNOHANG) == pid)
+			return;
+		usleep(10000);
+	}
+	fprintf(stderr, "loopback_ll_bench: %s did not exit; killing it; "
+		"%s may need to be unmounted by hand\n", program, mountpoint);
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+}
+
+static int in_list(const char *list, const char *word)
+{
+	size_t len = strlen(word);
+
+	while (*list) {
+		if (!strncmp(list, word, len) &&
+		    (list[len] == ',' || list[len] == '\0'))
+			return 1;
+		list = strchr(list, ',');
+		if (!list)
+			break;
+		list++;
+	}
+	return 0;
+}
+
+static void run(const char *label, const char *variant, const char *workloads)
+{
+	double secs[W_COUNT][MAX_RUNS];
+	double bytes[W_COUNT], ops[W_COUNT];
+	char *path, *path2, *path3;
+	pid_t pid;
+	int w, r;
+
+	if (asprintf(&path, "%s/loopback_ll_bench.dat", mountpoint) == -1 ||
+	    asprintf(&path2, "%s/loopback_ll_bench.copy", mountpoint) == -1 ||
+	    asprintf(&path3, "%s/loopback_ll_bench.hot", mountpoint) == -1)
+		die("asprintf");
+
+	bytes[W_SEQWRITE] = bytes[W_SEQREAD] = bytes[W_COPY] = size;
+	bytes[W_HOTREAD] = size;
+	ops[W_COPY] = 1;
+	ops[W_SEQWRITE] = ops[W_SEQREAD] = (size + blocksize - 1) / blocksize;
+	ops[W_HOTREAD] = ops[W_SEQREAD];
+	bytes[W_SMALLWRITE] = nrecords * recordsize;
+	ops[W_SMALLWRITE] = nrecords;
+	ops[W_DBWRITE] = nrecords / nthreads * nthreads;
+	bytes[W_DBWRITE] = ops[W_DBWRITE] * DB_BLOCK;
+	bytes[W_LSL] = 0;
+	ops[W_LSL] = nfiles;
+
+	pid = mount_loopback(variant);
+	if (in_list(workloads, "hotread"))
+		seqwrite(path3);
+	for (r = 0; r < runs; r++) {
+		/* seqread and copy use what seqwrite wrote. */
+		if (in_list(workloads, "seqwrite") ||
+		    in_list(workloads, "seqread") || in_list(workloads, "copy"))
+			secs[W_SEQWRITE][r] = seqwrite(path);
+		if (in_list(workloads, "seqread"))
+			secs[W_SEQREAD][r] = seqread(path);
+		if (in_list(workloads, "copy"))
+			secs[W_COPY][r] = copy(path, path2);
+		if (in_list(workloads, "hotread"))
+			secs[W_HOTREAD][r] = seqread(path3);
+		if (in_list(workloads, "smallwrite"))
+			secs[W_SMALLWRITE][r] = smallwrite(path);
+		if (in_list(workloads, "dbwrite"))
+			secs[W_DBWRITE][r] = dbwrite(path);
+		if (in_list(workloads, "lsl")) {
+			char *dir, *mdir;
+
+			if (asprintf(&dir, "%s/loopback_ll_bench.dir%d",
+				     source, r) == -1 ||
+			    asprintf(&mdir, "%s/loopback_ll_bench.dir%d",
+				     mountpoint, r) == -1)
+				die("asprintf");
+			make_dir(dir);
+			secs[W_LSL][r] = lsl(mdir);
+			remove_dir(dir);
+			free(dir);
+			free(mdir);
+		}
+	}
+	unlink(path);
+	unlink(path2);
+	unlink(path3);
+	unmount_loopback(pid);
+	free(path);
+	free(path2);
+	free(path3);
+
+	for (w = 0; w < W_COUNT; w++) {
+		double t;
+
+		if (!in_list(workloads, workload_names[w]))
+			continue;
+		qsort(secs[w], runs, sizeof(double), cmp_double);
+		t = secs[w][runs / 2];
+		printf("%-32.32s %-10s %10.1f %12.0f\n", label,
+		       workload_names[w], bytes[w] / t / 1e6, ops[w] / t);
+	}
+	fflush(stdout);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+"usage: loopback_ll_bench [-x loopback_ll] [-s MB] [-b KB] [-n N] [-R bytes]\n"
+"                         [-t threads] [-f files] [-r runs] [-w workloads]\n"
+"                         [-v options]... SOURCE MOUNTPOINT\n"
+"\n"
+"  -x  loopback_ll to mount (default ./loopback_ll)\n"
+"  -s  file size in MB (default 1024)\n"
+"  -b  I/O size in KB (default 1024)\n"
+"  -n  small writes per measurement (default 100000)\n"
+"  -R  bytes per smallwrite record (default 128)\n"
+"  -t  dbwrite threads (default 8)\n"
+"  -f  files in the lsl directory (default 100000)\n"
+"  -r  runs per measurement, the median is reported (default 3)\n"
+"  -w  workloads: any of seqwrite,seqread,smallwrite,dbwrite,copy,hotread,\n"
+"      lsl (default seqwrite,seqread,smallwrite,dbwrite,copy)\n"
+"  -v  also mount with these -o options, e.g. -v passthrough\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *variants[MAX_VARIANTS];
+	const char *workloads = "seqwrite,seqread,smallwrite,dbwrite,copy";
+	int nvariants = 0, i, ch;
+
+	while ((ch = getopt(argc, argv, "b:f:n:r:R:s:t:v:w:x:")) != -1) {
+		switch (ch) {
+		case 'b':
+			blocksize = strtoul(optarg, NULL, 0) * 1024;
+			break;
+		case 'f':
+			nfiles = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			nrecords = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		case 'R':
+			recordsize = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0) * 1024 * 1024;
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'v':
+			if (nvariants == MAX_VARIANTS)
+				usage();
+			variants[nvariants++] = optarg;
+			break;
+		case 'w':
+			workloads = optarg;
+			break;
+		case 'x':
+			program = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 2 || size == 0 || blocksize == 0 || runs < 1 ||
+	    runs > MAX_RUNS || nrecords == 0 || recordsize == 0 ||
+	    nthreads < 1 || nthreads > MAX_THREADS ||
+	    (size_t)nthreads > nrecords || nfiles == 0)
+		usage();
+	if (blocksize < DB_BLOCK)
+		blocksize = DB_BLOCK;
+	if (recordsize > blocksize)
+		blocksize = recordsize;
+	source = argv[0];
+	mountpoint = argv[1];
+
+	buf = malloc(blocksize);
+	if (!buf)
+		die("malloc");
+	for (i = 0; i < (int)blocksize; i++)
+		buf[i] = (char)(i * 131 + 7);
+
+	printf("# %zu MB file, %zu KB I/O; %zu small writes, %zu-byte records, "
+	       "%d dbwrite threads; median of %d runs\n", size >> 20,
+	       blocksize >> 10, nrecords, recordsize, nthreads, runs);
+	printf("%-32s %-10s %10s %12s\n", "options", "workload", "MB/s",
+	       "ops/s");
+
+	run("(default)", "", workloads);
+	for (i = 0; i < nvariants; i++)
+		run(variants[i], variants[i], workloads);
+
+	free(buf);
+	return 0;
+}
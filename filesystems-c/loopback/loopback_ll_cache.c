@@ -0,0 +1,710 @@
+/*
+  FUSE: Filesystem in Userspace
+  Copyright (C) 2001-2007  Miklos Szeredi <miklos@szeredi.hu>
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+
+*/
+
+/*
+ * The read cache behind loopback_ll's -o cache_dir. See loopback_ll_cache.h.
+ *
+ * Every copy in the cache directory has an entry in a hash table by name.
+ * Entries for finished copies are also on a list, most recently opened
+ * first, which eviction takes from the tail. An entry for a copy being
+ * made holds its size against the budget until the copy is done; it is
+ * named ".fill-NAME" until then.
+ */
+
+#define _GNU_SOURCE
+
+#include "loopback_ll_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define LOOPBACK_CACHE_NAME_MAX 96
+#define LOOPBACK_CACHE_BUCKETS  4096
+#define LOOPBACK_CACHE_QUEUE    256
+#define LOOPBACK_CACHE_FILLING  ".fill-"
+#define LOOPBACK_CACHE_COPY     (1024 * 1024)
+
+struct loopback_cache_entry {
+    struct loopback_cache_entry *hnext; /* hash chain; victim list */
+    struct loopback_cache_entry *prev, *next; /* LRU; ready entries only */
+    uint64_t size;
+    int ready;
+    int dropped;                 /* while filling: not to be kept */
+    char name[LOOPBACK_CACHE_NAME_MAX];
+};
+
+struct loopback_cache_job {
+    struct loopback_cache_job *next;
+    struct loopback_cache_key key;
+    int srcfd;
+};
+
+static struct {
+    int dirfd;
+    uint64_t budget;
+    uint64_t used;               /* ready and reserved bytes */
+    size_t nentries;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct loopback_cache_entry *buckets[LOOPBACK_CACHE_BUCKETS];
+    struct loopback_cache_entry *head, *tail;
+    struct loopback_cache_job *jobs, **jobs_tail;
+    unsigned njobs;
+    pthread_t *fillers;
+    unsigned nfillers;
+    int stopping;
+
+    /* Updated with atomic adds, outside the mutex. */
+    uint64_t hits, misses, hit_bytes, miss_bytes;
+    uint64_t fills, fill_bytes, fill_failures, evictions;
+} cache = {
+    .dirfd = -1,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void
+loopback_cache_name(const struct loopback_cache_key *key, char *name)
+{
+    snprintf(name, LOOPBACK_CACHE_NAME_MAX, "%llx-%llx-%llx.%09ld-%llx",
+             (unsigned long long)key->dev, (unsigned long long)key->ino,
+             (unsigned long long)key->mtime.tv_sec, key->mtime.tv_nsec,
+             (unsigned long long)key->size);
+}
+
+static inline int
+loopback_cache_same(const struct loopback_cache_key *a, const struct stat *st)
+{
+    return a->dev == st->st_dev && a->ino == st->st_ino &&
+           a->size == st->st_size && a->mtime.tv_sec == st->st_mtim.tv_sec &&
+           a->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static inline struct loopback_cache_entry **
+loopback_cache_bucket(const char *name)
+{
+    uint32_t h = 2166136261u;
+
+    while (*name) {
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    }
+
+    return &cache.buckets[h % LOOPBACK_CACHE_BUCKETS];
+}
+
+/* The functions ending in _locked are called with cache.mutex held. */
+
+static struct loopback_cache_entry *
+loopback_cache_find_locked(const char *name)
+{
+    struct loopback_cache_entry *e;
+
+    for (e = *loopback_cache_bucket(name); e; e = e->hnext) {
+        if (strcmp(e->name, name) == 0) {
+            break;
+        }
+    }
+
+    return e;
+}
+
+static void
+loopback_cache_lru_remove_locked(struct loopback_cache_entry *e)
+{
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        cache.head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        cache.tail = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+static void
+loopback_cache_lru_push_locked(struct loopback_cache_entry *e)
+{
+    e->prev = NULL;
+    e->next = cache.head;
+    if (cache.head) {
+        cache.head->prev = e;
+    } else {
+        cache.tail = e;
+    }
+    cache.head = e;
+}
+
+static void
+loopback_cache_insert_locked(struct loopback_cache_entry *e)
+{
+    struct loopback_cache_entry **bucket = loopback_cache_bucket(e->name);
+
+    e->hnext = *bucket;
+    *bucket = e;
+    cache.used += e->size;
+    cache.nentries++;
+    if (e->ready) {
+        loopback_cache_lru_push_locked(e);
+    }
+}
+
+static void
+loopback_cache_remove_locked(struct loopback_cache_entry *e)
+{
+    struct loopback_cache_entry **pp = loopback_cache_bucket(e->name);
+
+    while (*pp != e) {
+        pp = &(*pp)->hnext;
+    }
+    *pp = e->hnext;
+    e->hnext = NULL;
+    cache.used -= e->size;
+    cache.nentries--;
+    if (e->ready) {
+        loopback_cache_lru_remove_locked(e);
+    }
+}
+
+/*
+ * Makes room for need more bytes, taking ready copies from the tail of
+ * the LRU. The entries taken go on *victims, for loopback_cache_evict()
+ * to remove once the mutex is dropped. Returns -1 if the room cannot be
+ * made, because what is left is being filled.
+ */
+static int
+loopback_cache_room_locked(uint64_t need,
+                           struct loopback_cache_entry **victims)
+{
+    struct loopback_cache_entry *e;
+
+    while (cache.used + need > cache.budget) {
+        e = cache.tail;
+        if (e == NULL) {
+            return -1;
+        }
+        loopback_cache_remove_locked(e);
+        e->hnext = *victims;
+        *victims = e;
+    }
+
+    return 0;
+}
+
+static void
+loopback_cache_evict(struct loopback_cache_entry *victims)
+{
+    struct loopback_cache_entry *e, *next;
+
+    for (e = victims; e; e = next) {
+        next = e->hnext;
+        /* A descriptor open on the copy keeps it readable. */
+        unlinkat(cache.dirfd, e->name, 0);
+        __atomic_fetch_add(&cache.evictions, 1, __ATOMIC_RELAXED);
+        free(e);
+    }
+}
+
+struct loopback_cache_found {
+    char name[LOOPBACK_CACHE_NAME_MAX];
+    uint64_t size;
+    struct timespec atime;
+};
+
+static int
+loopback_cache_older(const void *a, const void *b)
+{
+    const struct loopback_cache_found *x = a, *y = b;
+
+    if (x->atime.tv_sec != y->atime.tv_sec) {
+        return x->atime.tv_sec < y->atime.tv_sec ? -1 : 1;
+    }
+    return (x->atime.tv_nsec > y->atime.tv_nsec) -
+           (x->atime.tv_nsec < y->atime.tv_nsec);
+}
+
+/* Takes in the copies a previous run left, oldest access last in line. */
+static int
+loopback_cache_scan(void)
+{
+    struct loopback_cache_entry *e, *victims = NULL;
+    struct loopback_cache_found *found = NULL, *more;
+    size_t i, n = 0, max = 0;
+    struct dirent *entry;
+    struct stat st;
+    DIR *dp;
+    int fd;
+
+    fd = dup(cache.dirfd);
+    if (fd == -1) {
+        return -1;
+    }
+    dp = fdopendir(fd);
+    if (dp == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    while ((entry = readdir(dp))) {
+        if (strncmp(entry->d_name, LOOPBACK_CACHE_FILLING,
+                    sizeof(LOOPBACK_CACHE_FILLING) - 1) == 0) {
+            unlinkat(cache.dirfd, entry->d_name, 0);
+            continue;
+        }
+        if (entry->d_name[0] == '.' ||
+            strlen(entry->d_name) >= LOOPBACK_CACHE_NAME_MAX ||
+            fstatat(cache.dirfd, entry->d_name, &st,
+                    AT_SYMLINK_NOFOLLOW) == -1 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (n == max) {
+            max = max ? max * 2 : 256;
+            more = realloc(found, max * sizeof(*found));
+            if (more == NULL) {
+                break;
+            }
+            found = more;
+        }
+        strcpy(found[n].name, entry->d_name);
+        found[n].size = st.st_size;
+        found[n].atime = st.st_atim;
+        n++;
+    }
+    closedir(dp);
+
+    if (n) {
+        qsort(found, n, sizeof(*found), loopback_cache_older);
+    }
+
+    pthread_mutex_lock(&cache.mutex);
+    for (i = 0; i < n; i++) {
+        e = calloc(1, sizeof(*e));
+        if (e == NULL) {
+            break;
+        }
+        strcpy(e->name, found[i].name);
+        e->size = found[i].size;
+        e->ready = 1;
+        loopback_cache_insert_locked(e);
+    }
+    /* The budget may be smaller than last time. */
+    loopback_cache_room_locked(0, &victims);
+    pthread_mutex_unlock(&cache.mutex);
+
+    loopback_cache_evict(victims);
+    free(found);
+
+    return 0;
+}
+
+int
+loopback_cache_init(const char *dir, uint64_t budget)
+{
+    if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+        fprintf(stderr, "loopback_ll: %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    cache.dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cache.dirfd == -1) {
+        fprintf(stderr, "loopback_ll: %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    cache.budget = budget;
+    cache.jobs = NULL;
+    cache.jobs_tail = &cache.jobs;
+    cache.njobs = 0;
+    cache.stopping = 0;
+
+    if (loopback_cache_scan() == -1) {
+        fprintf(stderr, "loopback_ll: %s: %s\n", dir, strerror(errno));
+        close(cache.dirfd);
+        cache.dirfd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Copies size bytes of src to out; returns -1 if it cannot. */
+static int
+loopback_cache_copy(int src, int out, off_t size, char **buf)
+{
+    off_t done = 0;
+    ssize_t n = 0;
+
+    /* In the kernel where it can be, e.g. NFS to a local disk. */
+    while (done < size && !cache.stopping &&
+           (n = copy_file_range(src, NULL, out, NULL, size - done, 0)) > 0) {
+        done += n;
+    }
+
+    if (n == -1) {
+        if (*buf == NULL) {
+            *buf = malloc(LOOPBACK_CACHE_COPY);
+            if (*buf == NULL) {
+                return -1;
+            }
+        }
+        while (done < size && !cache.stopping &&
+               (n = pread(src, *buf, LOOPBACK_CACHE_COPY, done)) > 0) {
+            if (pwrite(out, *buf, n, done) != n) {
+                return -1;
+            }
+            done += n;
+        }
+    }
+
+    return done == size ? 0 : -1;
+}
+
+static void
+loopback_cache_do_fill(struct loopback_cache_job *job, char **buf)
+{
+    char tmp[sizeof(LOOPBACK_CACHE_FILLING) + LOOPBACK_CACHE_NAME_MAX];
+    char name[LOOPBACK_CACHE_NAME_MAX];
+    struct loopback_cache_entry *e;
+    struct stat st;
+    int out, ok = 0;
+
+    loopback_cache_name(&job->key, name);
+    snprintf(tmp, sizeof(tmp), LOOPBACK_CACHE_FILLING "%s", name);
+
+    out = openat(cache.dirfd, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                 0600);
+    if (out != -1) {
+        /* The file must not have changed under the copy. */
+        ok = loopback_cache_copy(job->srcfd, out, job->key.size, buf) == 0 &&
+             fstat(job->srcfd, &st) == 0 &&
+             loopback_cache_same(&job->key, &st);
+        if (close(out) == -1) {
+            ok = 0;
+        }
+    }
+
+    pthread_mutex_lock(&cache.mutex);
+    e = loopback_cache_find_locked(name);
+    if (ok && !e->dropped &&
+        renameat(cache.dirfd, tmp, cache.dirfd, name) == 0) {
+        e->ready = 1;
+        loopback_cache_lru_push_locked(e);
+        e = NULL;
+    } else {
+        ok = 0;
+        loopback_cache_remove_locked(e);
+    }
+    pthread_mutex_unlock(&cache.mutex);
+
+    if (ok) {
+        __atomic_fetch_add(&cache.fills, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&cache.fill_bytes, job->key.size, __ATOMIC_RELAXED);
+    } else {
+        unlinkat(cache.dirfd, tmp, 0);
+        free(e);
+        __atomic_fetch_add(&cache.fill_failures, 1, __ATOMIC_RELAXED);
+    }
+
+    close(job->srcfd);
+    free(job);
+}
+
+static void *
+loopback_cache_filler(void *arg)
+{
+    struct loopback_cache_job *job;
+    char *buf = NULL;
+
+    (void)arg;
+
+    pthread_mutex_lock(&cache.mutex);
+    for (;;) {
+        while (cache.jobs == NULL && !cache.stopping) {
+            pthread_cond_wait(&cache.cond, &cache.mutex);
+        }
+        if (cache.stopping) {
+            break;
+        }
+        job = cache.jobs;
+        cache.jobs = job->next;
+        if (cache.jobs == NULL) {
+            cache.jobs_tail = &cache.jobs;
+        }
+        cache.njobs--;
+        pthread_mutex_unlock(&cache.mutex);
+
+        loopback_cache_do_fill(job, &buf);
+
+        pthread_mutex_lock(&cache.mutex);
+    }
+    pthread_mutex_unlock(&cache.mutex);
+
+    free(buf);
+
+    return NULL;
+}
+
+int
+loopback_cache_start(unsigned nfillers)
+{
+    unsigned i;
+
+    cache.fillers = calloc(nfillers, sizeof(pthread_t));
+    if (cache.fillers == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < nfillers; i++) {
+        if (pthread_create(&cache.fillers[i], NULL, loopback_cache_filler,
+                           NULL)) {
+            break;
+        }
+    }
+    cache.nfillers = i;
+
+    return i ? 0 : -1;
+}
+
+void
+loopback_cache_stop(void)
+{
+    struct loopback_cache_entry *e, *next;
+    struct loopback_cache_job *job;
+    char tmp[sizeof(LOOPBACK_CACHE_FILLING) + LOOPBACK_CACHE_NAME_MAX];
+    unsigned i;
+
+    if (cache.dirfd == -1) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache.mutex);
+    cache.stopping = 1;
+    pthread_cond_broadcast(&cache.cond);
+    pthread_mutex_unlock(&cache.mutex);
+
+    for (i = 0; i < cache.nfillers; i++) {
+        pthread_join(cache.fillers[i], NULL);
+    }
+    free(cache.fillers);
+    cache.fillers = NULL;
+    cache.nfillers = 0;
+
+    while ((job = cache.jobs)) {
+        cache.jobs = job->next;
+        close(job->srcfd);
+        free(job);
+    }
+
+    for (i = 0; i < LOOPBACK_CACHE_BUCKETS; i++) {
+        for (e = cache.buckets[i]; e; e = next) {
+            next = e->hnext;
+            if (!e->ready) {
+                snprintf(tmp, sizeof(tmp), LOOPBACK_CACHE_FILLING "%s",
+                         e->name);
+                unlinkat(cache.dirfd, tmp, 0);
+            }
+            free(e);
+        }
+        cache.buckets[i] = NULL;
+    }
+    cache.head = cache.tail = NULL;
+    cache.used = 0;
+    cache.nentries = 0;
+
+    close(cache.dirfd);
+    cache.dirfd = -1;
+}
+
+int
+loopback_cache_lookup(const struct loopback_cache_key *key)
+{
+    char name[LOOPBACK_CACHE_NAME_MAX];
+    struct loopback_cache_entry *e;
+    int fd;
+
+    loopback_cache_name(key, name);
+
+    pthread_mutex_lock(&cache.mutex);
+    e = loopback_cache_find_locked(name);
+    if (e == NULL || !e->ready) {
+        pthread_mutex_unlock(&cache.mutex);
+        return -1;
+    }
+    loopback_cache_lru_remove_locked(e);
+    loopback_cache_lru_push_locked(e);
+
+    /* Under the mutex, or the copy could be evicted between the two. */
+    fd = openat(cache.dirfd, name, O_RDWR | O_CLOEXEC);
+    if (fd == -1) {
+        /* Someone removed it from the directory. */
+        loopback_cache_remove_locked(e);
+        free(e);
+    }
+    pthread_mutex_unlock(&cache.mutex);
+
+    return fd;
+}
+
+void
+loopback_cache_fill(const struct loopback_cache_key *key, int srcfd)
+{
+    struct loopback_cache_entry *e, *victims = NULL;
+    struct loopback_cache_job *job;
+
+    if (key->size <= 0 || (uint64_t)key->size > cache.budget / 4) {
+        close(srcfd);
+        return;
+    }
+
+    e = calloc(1, sizeof(*e));
+    job = malloc(sizeof(*job));
+    if (e == NULL || job == NULL) {
+        goto out;
+    }
+    loopback_cache_name(key, e->name);
+    e->size = key->size;
+    job->key = *key;
+    job->srcfd = srcfd;
+    job->next = NULL;
+
+    pthread_mutex_lock(&cache.mutex);
+    if (cache.stopping || cache.njobs == LOOPBACK_CACHE_QUEUE ||
+        loopback_cache_find_locked(e->name) ||
+        loopback_cache_room_locked(e->size, &victims) == -1) {
+        pthread_mutex_unlock(&cache.mutex);
+        loopback_cache_evict(victims);
+        goto out;
+    }
+    loopback_cache_insert_locked(e);
+    *cache.jobs_tail = job;
+    cache.jobs_tail = &job->next;
+    cache.njobs++;
+    pthread_cond_signal(&cache.cond);
+    pthread_mutex_unlock(&cache.mutex);
+
+    loopback_cache_evict(victims);
+    return;
+
+out:
+    free(e);
+    free(job);
+    close(srcfd);
+}
+
+void
+loopback_cache_drop(const struct loopback_cache_key *key)
+{
+    char name[LOOPBACK_CACHE_NAME_MAX];
+    struct loopback_cache_entry *e;
+
+    loopback_cache_name(key, name);
+
+    pthread_mutex_lock(&cache.mutex);
+    e = loopback_cache_find_locked(name);
+    if (e && !e->ready) {
+        /* The filler throws it away when done. */
+        e->dropped = 1;
+        e = NULL;
+    } else if (e) {
+        loopback_cache_remove_locked(e);
+    }
+    pthread_mutex_unlock(&cache.mutex);
+
+    if (e) {
+        unlinkat(cache.dirfd, name, 0);
+        free(e);
+    }
+}
+
+void
+loopback_cache_rekey(const struct loopback_cache_key *old,
+                     const struct loopback_cache_key *new)
+{
+    char oldname[LOOPBACK_CACHE_NAME_MAX], newname[LOOPBACK_CACHE_NAME_MAX];
+    struct loopback_cache_entry *e, *victims = NULL;
+
+    loopback_cache_name(old, oldname);
+    loopback_cache_name(new, newname);
+
+    pthread_mutex_lock(&cache.mutex);
+    e = loopback_cache_find_locked(oldname);
+    if (e == NULL || !e->ready || loopback_cache_find_locked(newname)) {
+        pthread_mutex_unlock(&cache.mutex);
+        if (e) {
+            loopback_cache_drop(old);
+        }
+        return;
+    }
+
+    loopback_cache_remove_locked(e);
+    if (renameat(cache.dirfd, oldname, cache.dirfd, newname) == 0) {
+        strcpy(e->name, newname);
+        e->size = new->size;
+    }
+    if (strcmp(e->name, newname) != 0 || e->size > cache.budget / 4) {
+        e->hnext = victims;
+        victims = e;
+    } else {
+        /* Should the room not be there, the next fill will make it. */
+        loopback_cache_room_locked(e->size, &victims);
+        loopback_cache_insert_locked(e);
+    }
+    pthread_mutex_unlock(&cache.mutex);
+
+    loopback_cache_evict(victims);
+}
+
+void
+loopback_cache_count(int hit, size_t bytes)
+{
+    if (hit) {
+        __atomic_fetch_add(&cache.hits, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&cache.hit_bytes, bytes, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&cache.misses, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&cache.miss_bytes, bytes, __ATOMIC_RELAXED);
+    }
+}
+
+int
+loopback_cache_stats(char *buf, size_t size)
+{
+    uint64_t used, budget;
+    size_t nentries;
+
+    pthread_mutex_lock(&cache.mutex);
+    used = cache.used;
+    budget = cache.budget;
+    nentries = cache.nentries;
+    pthread_mutex_unlock(&cache.mutex);
+
+    return snprintf(buf, size,
+                    "read hits %llu (%llu bytes), misses %llu (%llu bytes)\n"
+                    "fills %llu (%llu bytes), failed %llu; evictions %llu\n"
+                    "%zu files, %llu of %llu bytes\n",
+                    (unsigned long long)cache.hits,
+                    (unsigned long long)cache.hit_bytes,
+                    (unsigned long long)cache.misses,
+                    (unsigned long long)cache.miss_bytes,
+                    (unsigned long long)cache.fills,
+                    (unsigned long long)cache.fill_bytes,
+                    (unsigned long long)cache.fill_failures,
+                    (unsigned long long)cache.evictions, nentries,
+                    (unsigned long long)used, (unsigned long long)budget);
+}
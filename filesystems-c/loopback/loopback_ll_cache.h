@@ -0,0 +1,67 @@
+/*
+  FUSE: Filesystem in Userspace
+  Copyright (C) 2001-2007  Miklos Szeredi <miklos@szeredi.hu>
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+
+*/
+
+#ifndef _LOOPBACK_LL_CACHE_H_
+#define _LOOPBACK_LL_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/*
+ * A read cache for loopback_ll (-o cache_dir=DIR), for a source on slow
+ * storage such as a network file system.
+ *
+ * Files are cached whole, in DIR, under a name made of the backing file's
+ * device, inode number, modification time and size, so a file changed in
+ * the source is simply not found again; its old copy ages out. Copies are
+ * made by filler threads, in the background, when a file that is not
+ * cached is opened; the open itself, and reads until the next open, go to
+ * the source. Past the size budget, the least recently opened copies are
+ * removed. A file larger than a quarter of the budget is not cached.
+ *
+ * The cache outlives the daemon: a copy left in DIR is found again the
+ * next time, and one still being made is thrown away.
+ */
+
+#define LOOPBACK_CACHE_STATS_XATTR "user.loopback_ll.cache_stats"
+
+/* A version of a backing file. */
+struct loopback_cache_key {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+};
+
+int loopback_cache_init(const char *dir, uint64_t budget);
+int loopback_cache_start(unsigned nfillers);
+void loopback_cache_stop(void);
+
+/* A descriptor on the copy of key, open for reading and writing, or -1. */
+int loopback_cache_lookup(const struct loopback_cache_key *key);
+
+/* Has a copy of key made from srcfd, which is the cache's to close. */
+void loopback_cache_fill(const struct loopback_cache_key *key, int srcfd);
+
+/* Forgets the copy of key, which no longer matches the file. */
+void loopback_cache_drop(const struct loopback_cache_key *key);
+
+/* Files the copy of old, brought up to date, as that of new. */
+void loopback_cache_rekey(const struct loopback_cache_key *old,
+                          const struct loopback_cache_key *new);
+
+/* Counts a read served from a copy (hit) or from the source. */
+void loopback_cache_count(int hit, size_t bytes);
+
+/* Prints the counters; returns what snprintf() does. */
+int loopback_cache_stats(char *buf, size_t size);
+
+#endif /* _LOOPBACK_LL_CACHE_H_ */
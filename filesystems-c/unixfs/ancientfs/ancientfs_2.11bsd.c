@@ -18,6 +18,8 @@
 
 DECL_UNIXFS("2.11BSD", 211bsd);
 
+static const struct unixfs_byteorder* byteorder;
+
 static void*
 unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
                      char** fsname, char** volname)
@@ -58,7 +60,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
         goto out;
     }
 
-    if (pread(fd, fs, SBSIZE, (off_t)(DEV_BSIZE * SUPERB)) != SBSIZE) {
+    if (unixfs_pread(fd, fs, SBSIZE, (off_t)(DEV_BSIZE * SUPERB)) != SBSIZE) {
         perror("pread");
         err = EIO;
         goto out;
@@ -68,6 +70,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
 
     unixfs->s_flags = flags;
     unixfs->s_endian = (fse == UNIXFS_FS_INVALID) ? UNIXFS_FS_PDP : fse;
+    byteorder = unixfs_byteorder(unixfs->s_endian);
     unixfs->s_fs_info = (void*)fs;
     unixfs->s_bdev = fd;
 
@@ -269,16 +272,18 @@ unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
      */
 
     for (; j <= 3; j++) {
-        char ubuf[UNIXFS_IOSIZE(unixfs)];
-        int ret = unixfs_internal_bread((off_t)nb, ubuf);
-        if (ret) {
+        int ret;
+        const a_daddr_t* bap = (const a_daddr_t*)
+            unixfs_indirect_bread(unixfs, (off_t)nb, UNIXFS_IOSIZE(unixfs),
+                                  byteorder->fs32v, unixfs_internal_bread,
+                                  &ret);
+        if (!bap) {
             *error = ret;
             return (off_t)0;
         }
-        a_daddr_t* bap = (a_daddr_t*)ubuf;
         sh -= NSHIFT;
         i = (bn >> sh) & NMASK;
-        nb = fs32_to_host(unixfs->s_endian, bap[i]);
+        nb = bap[i];
         if (nb == 0)
             return (off_t)0; /* !writable; should be -1 rather */
     }
@@ -305,8 +310,8 @@ unixfs_internal_bread(off_t blkno, char* blkbuf)
         return 0;
     }
 
-    if (pread(unixfs->s_bdev, blkbuf, UNIXFS_IOSIZE(unixfs),
-              blkno * (off_t)DEV_BSIZE) != UNIXFS_IOSIZE(unixfs))
+    if (unixfs_pread(unixfs->s_bdev, blkbuf, UNIXFS_IOSIZE(unixfs),
+                     blkno * (off_t)DEV_BSIZE) != UNIXFS_IOSIZE(unixfs))
         return EIO;
 
     return 0;
@@ -357,10 +362,8 @@ unixfs_internal_iget(ino_t ino)
 
 #endif
 
-    int i;
-
-    for (i = 0; i < NADDR; i++)
-        ip->I_daddr[i] = fs32_to_host(unixfs->s_endian, dip->di_addr[i]);
+    memcpy(ip->I_daddr, dip->di_addr, NADDR * sizeof(uint32_t));
+    byteorder->fs32v(ip->I_daddr, NADDR * sizeof(uint32_t));
 
     if (S_ISCHR(ip->I_mode) || S_ISBLK(ip->I_mode)) {
         uint32_t rdev = ip->I_daddr[0];
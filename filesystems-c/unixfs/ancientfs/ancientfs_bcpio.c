@@ -304,7 +304,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
             int missing = unixfs_internal_namei(parent_ino, cnp, &stbuf);
             if (!missing) {
                 parent_ino = stbuf.st_ino;
-                if (!term) { /* out of order */
+                if (!term || !*term) { /* out of order */
                     struct inode* dirp = unixfs_inodelayer_iget(parent_ino);
                     if (!dirp || !dirp->I_initialized) {
                         fprintf(stderr,
@@ -373,7 +373,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
             ci->ci_next_sibling = ci->ci_parent->ci_children;
             ci->ci_parent->ci_children = ci;
 
-            if (term && !S_ISDIR(ip->I_mode)) /* out of order */
+            if (term && *term && !S_ISDIR(ip->I_mode)) /* out of order */
                 ip->I_mode = S_IFDIR | 0755;
 
             if (S_ISDIR(ip->I_mode)) {
@@ -624,7 +624,7 @@ unixfs_internal_pbread(struct inode* ip, char* buf, size_t nbyte, off_t offset,
 
     /* caller already checked for bounds */
 
-    return pread(unixfs->s_bdev, buf, nbyte, start + offset);
+    return unixfs_pread(unixfs->s_bdev, buf, nbyte, start + offset);
 }
 
 static int
@@ -180,20 +180,25 @@ next:
             if (!fs->s_initialized) {
                 fs->s_initialized = 1;
                 int count = spcl.c_count;
-                char* bmp = (char*)fs->s_dumpmap;
-                while (count--) {
-                   if (read(fd, bmp, BSIZE) != BSIZE) {
-                       fprintf(stderr,
-                               "*** fatal error: failed to read bitmap\n");
-                       err = EIO;
-                       goto out;
-                   }
-                   /* fix up endian-ness */
-                   int idx;
-                   for (idx = 0; idx < BSIZE/sizeof(uint16_t); idx++)
-                       bmp[idx] = fs16_to_host(unixfs->s_endian, bmp[idx]);
-                   bmp += BSIZE / sizeof(uint16_t);
-               }
+                if ((count < 0) ||
+                    (count > (int)(sizeof(fs->s_dumpmap) / BSIZE))) {
+                    fprintf(stderr,
+                            "*** fatal error: inode map too large (%d)\n",
+                            count);
+                    err = EINVAL;
+                    goto out;
+                }
+                ssize_t mapsize = (ssize_t)count * BSIZE;
+                if (read(fd, fs->s_dumpmap, mapsize) != mapsize) {
+                    fprintf(stderr,
+                            "*** fatal error: failed to read bitmap\n");
+                    err = EIO;
+                    goto out;
+                }
+                /* BIT_ON wants the map's 16-bit words little-endian */
+                if (unixfs->s_endian == UNIXFS_FS_BIG)
+                    unixfs_bitmap_swab16(fs->s_dumpmap,
+                                         mapsize / sizeof(uint16_t));
            } else {
                fprintf(stderr, "*** warning: duplicate inode map\n");
                /* ignore the data */
@@ -349,9 +354,13 @@ unixfs_internal_fini(void* filsys)
     struct super_block* sb = (struct super_block*)filsys;
     struct filsys* fs = (struct filsys*)sb->s_fs_info;
     if (fs) {
-        ino_t i = fs->s_lastino;
-        for (; i >= (ino_t)ROOTINO; i--) {
-            struct inode* tmp = unixfs_internal_iget(i);
+        /* only inodes marked in the map were ever loaded */
+        size_t nbits = min((size_t)fs->s_lastino, sizeof(fs->s_dumpmap) * 8);
+        size_t i = unixfs_bitmap_find_next_set(fs->s_dumpmap, nbits,
+                                               ROOTINO - 1);
+        for (; i < nbits;
+             i = unixfs_bitmap_find_next_set(fs->s_dumpmap, nbits, i + 1)) {
+            struct inode* tmp = unixfs_internal_iget((ino_t)(i + 1));
             if (tmp) {
                 struct tap_node_info* ti =
                     (struct tap_node_info*)tmp->I_private;
@@ -410,8 +419,8 @@ unixfs_internal_bread(off_t blkno, char* blkbuf)
         return 0;
     }
 
-    if (pread(unixfs->s_bdev, blkbuf, UNIXFS_IOSIZE(unixfs),
-              blkno * (off_t)BSIZE) != UNIXFS_IOSIZE(unixfs))
+    if (unixfs_pread(unixfs->s_bdev, blkbuf, UNIXFS_IOSIZE(unixfs),
+                     blkno * (off_t)BSIZE) != UNIXFS_IOSIZE(unixfs))
         return EIO;
 
     return 0;
@@ -9,6 +9,7 @@
 
 #include "unixfs_internal.h"
 #include "ancientfs.h"
+#include "unixfs_bitmap.h"
 
 typedef int16_t  a_short;      /* ancient short */
 typedef uint16_t a_ushort;     /* ancient unsigned short */
@@ -127,9 +128,7 @@ struct spcl {
     char          c_addr[BSIZE - 88];
 } __attribute__((packed));
 
-#define MWORD16(m, n)  m[(uint16_t)(n - 1)/MLEN]
-#define MBIT16(n)      (1 << ((uint16_t)(n - 1) % MLEN))
-#define BIT_ON(n, w)   (MWORD16(w, n) & MBIT16(n))
+#define BIT_ON(n, w)   unixfs_bitmap_test((w), (uint16_t)((n) - 1))
 
 static inline int
 ancientfs_dump_cksum(uint16_t* buf, fs_endian_t e, uint32_t flags)
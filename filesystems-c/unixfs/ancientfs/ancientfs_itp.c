@@ -129,7 +129,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
             goto out;
         }
 
-        if (pread(fd, tapeblock, BSIZE, (off_t)(i * BSIZE)) != BSIZE) {
+        if (unixfs_pread(fd, tapeblock, BSIZE, (off_t)(i * BSIZE)) != BSIZE) {
             fprintf(stderr, "*** fatal error: cannot read tape block %llu\n",
                     (off_t)i);
             err = EIO;
@@ -312,8 +312,8 @@ unixfs_internal_bread(off_t blkno, char* blkbuf)
         /* NOTREACHED */
     }
 
-    if (pread(unixfs->s_bdev, blkbuf, UNIXFS_IOSIZE(unixfs),
-              blkno * (off_t)BSIZE) != UNIXFS_IOSIZE(unixfs))
+    if (unixfs_pread(unixfs->s_bdev, blkbuf, UNIXFS_IOSIZE(unixfs),
+                     blkno * (off_t)BSIZE) != UNIXFS_IOSIZE(unixfs))
         return EIO;
 
     return 0;
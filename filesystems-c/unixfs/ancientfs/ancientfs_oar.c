@@ -417,7 +417,7 @@ unixfs_internal_pbread(struct inode* ip, char* buf, size_t nbyte, off_t offset,
 
     /* caller already checked for bounds */
 
-    return pread(unixfs->s_bdev, buf, nbyte, start + offset);
+    return unixfs_pread(unixfs->s_bdev, buf, nbyte, start + offset);
 }
 
 static int
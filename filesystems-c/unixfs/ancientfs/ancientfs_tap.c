@@ -130,7 +130,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
             goto out;
         }
 
-        if (pread(fd, tapeblock, BSIZE, (off_t)(i * BSIZE)) != BSIZE) {
+        if (unixfs_pread(fd, tapeblock, BSIZE, (off_t)(i * BSIZE)) != BSIZE) {
             fprintf(stderr, "*** fatal error: cannot read tape block %llu\n",
                     (off_t)i);
             err = EIO;
@@ -182,7 +182,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
                             (ino64_t)(fs->s_lastino + 1));
                     abort();
                 }
-                if (term) { /* directory */
+                if (term && *term) { /* directory */
                     fs->s_directories++;
                     ip->I_mode = S_IFDIR | 0755;
                     ip->I_uid  = getuid();
@@ -212,7 +212,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
                 ti->ti_parent = (struct tap_node_info*)(parent_ip->I_private);
                 ti->ti_next_sibling = ti->ti_parent->ti_children;
                 ti->ti_parent->ti_children = ti;
-                if (term)
+                if (term && *term)
                     parent_ino = fs->s_lastino + 1;
                 fs->s_lastino++;
                 unixfs_internal_iput(parent_ip);
@@ -317,8 +317,8 @@ unixfs_internal_bread(off_t blkno, char* blkbuf)
         /* NOTREACHED */
     }
 
-    if (pread(unixfs->s_bdev, blkbuf, UNIXFS_IOSIZE(unixfs),
-              blkno * (off_t)BSIZE) != UNIXFS_IOSIZE(unixfs))
+    if (unixfs_pread(unixfs->s_bdev, blkbuf, UNIXFS_IOSIZE(unixfs),
+                     blkno * (off_t)BSIZE) != UNIXFS_IOSIZE(unixfs))
         return EIO;
 
     return 0;
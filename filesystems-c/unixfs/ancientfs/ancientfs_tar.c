@@ -153,20 +153,15 @@ retry:
         memcpy(te->name, hdr->name, 100);
         te->name[100] = '\0';
     } else { /* ustar */
-        if (hdr->prefix[0]) {
+        if (!hdr->prefix[0]) {
             memcpy(te->name, hdr->name, 100);
             te->name[100] = '\0';
-        } else {
-            if (hdr->prefix[154]) {
-                memcpy(te->name, hdr->prefix, 155);
-                memcpy(te->name + 155, hdr->name, 100);
-                te->name[255] = '\0';
-            } else {
-                int n = snprintf(te->name, UNIXFS_MAXPATHLEN, "%s",
-                                 hdr->prefix);
-                memcpy(te->name + n, hdr->name, 100);
-                te->name[n + 99] = '\0';
-            }
+        } else { /* prefix "/" name, neither necessarily terminated */
+            size_t n = strnlen(hdr->prefix, 155);
+            memcpy(te->name, hdr->prefix, n);
+            te->name[n++] = '/';
+            memcpy(te->name + n, hdr->name, 100);
+            te->name[n + 100] = '\0';
         }
     }
 
@@ -638,7 +633,7 @@ unixfs_internal_pbread(struct inode* ip, char* buf, size_t nbyte, off_t offset,
 
     /* caller already checked for bounds */
 
-    return pread(unixfs->s_bdev, buf, nbyte, start + offset);
+    return unixfs_pread(unixfs->s_bdev, buf, nbyte, start + offset);
 }
 
 static int
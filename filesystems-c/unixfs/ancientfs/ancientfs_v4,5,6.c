@@ -18,6 +18,8 @@
 
 DECL_UNIXFS("UNIX V4/V5/V6", v456);
 
+static const struct unixfs_byteorder* byteorder;
+
 static void*
 unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
                      char** fsname, char** volname)
@@ -56,7 +58,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
         goto out;
     }
 
-    if (pread(fd, fs, BSIZE, (off_t)(BSIZE * 1)) != BSIZE) {
+    if (unixfs_pread(fd, fs, BSIZE, (off_t)(BSIZE * 1)) != BSIZE) {
         perror("pread");
         err = EIO;
         goto out;
@@ -66,6 +68,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
 
     unixfs->s_flags = flags; 
     unixfs->s_endian = (fse == UNIXFS_FS_INVALID) ? UNIXFS_FS_PDP : fse;
+    byteorder = unixfs_byteorder(unixfs->s_endian);
     unixfs->s_fs_info = (void*)fs;
     unixfs->s_bdev = fd;
    
@@ -226,8 +229,7 @@ unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
 
     int ret;
     a_int i, nb;
-    a_int* bap;
-    char ubuf[UNIXFS_IOSIZE(unixfs)];
+    const a_int* bap;
 
     if (((a_int)ip->I_mode & ILARG) == 0) {
         /* small file algorithm */
@@ -247,29 +249,28 @@ unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
         i = 7;
     if ((nb = (a_int)(ip->I_daddr[i])) == 0)
         return 0; /* !writable */
-    else {
-        ret = unixfs_internal_bread((off_t)nb, ubuf);
-        if (ret) {
-            *error = ret;
-            return 0;
-        }
-    }
 
-    bap = (a_int*)ubuf;
+    bap = (const a_int*)
+        unixfs_indirect_bread(unixfs, (off_t)nb, UNIXFS_IOSIZE(unixfs),
+                              byteorder->fs16v, unixfs_internal_bread, &ret);
+    if (!bap) {
+        *error = ret;
+        return 0;
+    }
 
     /* "huge" fetch of double indirect block */
 
     if (i == 7) {
         i = ((bn >> 8) & 0377) - 7;
-        if ((nb = fs16_to_host(unixfs->s_endian, bap[i])) == 0)
+        if ((nb = bap[i]) == 0)
             return 0; /* !writable */
-        else {
-            ret = unixfs_internal_bread((off_t)nb, ubuf);
-            if (ret) {
-                *error = ret;
-                return 0;
-            }
-            bap = (a_int*)ubuf;
+        bap = (const a_int*)
+            unixfs_indirect_bread(unixfs, (off_t)nb, UNIXFS_IOSIZE(unixfs),
+                                  byteorder->fs16v, unixfs_internal_bread,
+                                  &ret);
+        if (!bap) {
+            *error = ret;
+            return 0;
         }
     }
 
@@ -278,7 +279,7 @@ unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
     *error = 0;
 
     i = bn & 0377;
-    if ((nb = fs16_to_host(unixfs->s_endian, bap[i])) == 0)
+    if ((nb = bap[i]) == 0)
         return 0; /* !writable */
 
     return (off_t)nb;
@@ -299,8 +300,8 @@ unixfs_internal_bread(off_t blkno, char* blkbuf)
         return 0;
     }
 
-    if (pread(unixfs->s_bdev, blkbuf, UNIXFS_IOSIZE(unixfs),
-              blkno * (off_t)BSIZE) != UNIXFS_IOSIZE(unixfs))
+    if (unixfs_pread(unixfs->s_bdev, blkbuf, UNIXFS_IOSIZE(unixfs),
+                     blkno * (off_t)BSIZE) != UNIXFS_IOSIZE(unixfs))
         return EIO;
 
     return 0;
@@ -0,0 +1,221 @@
+/*
+ * UnixFS
+ *
+ * Microbenchmarks for the unixfs bitmap primitives.
+ *
+ * Each primitive runs against a straightforward byte-at-a-time version of
+ * the same job (the nibble table count that minixfs used, a per-word swap
+ * like the one the dump readers used). The unixfs_bitmap kernels are picked
+ * at run time; run with UNIXFS_BITMAP_ISA=scalar (or popcnt) to compare the
+ * kernels with each other.
+ *
+ * Copyright (c) 2008 Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ */
+
+#include "unixfs_bitmap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const int nibblemap[] = { 4,3,3,2,3,2,2,1,3,2,2,1,2,1,1,0 };
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1.0e9;
+}
+
+static uint64_t
+xorshift64(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return (*state = x);
+}
+
+/* dense: random bytes; sparse: one set bit per 'spacing' bits on average */
+static void
+fill(uint8_t* map, size_t nbytes, size_t spacing)
+{
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    size_t i;
+
+    if (spacing == 0) {
+        for (i = 0; i + 8 <= nbytes; i += 8) {
+            uint64_t w = xorshift64(&state);
+            memcpy(map + i, &w, sizeof(w));
+        }
+        for (; i < nbytes; i++)
+            map[i] = (uint8_t)xorshift64(&state);
+        return;
+    }
+
+    memset(map, 0, nbytes);
+    for (i = 0; i < nbytes * 8; i += 1 + xorshift64(&state) % (2 * spacing))
+        map[i >> 3] |= (uint8_t)(1 << (i & 7));
+}
+
+static size_t
+count_free_nibble(const uint8_t* map, size_t nbytes)
+{
+    size_t j, sum = 0;
+
+    for (j = 0; j < nbytes; j++)
+        sum += nibblemap[map[j] & 0xf] + nibblemap[(map[j] >> 4) & 0xf];
+
+    return sum;
+}
+
+static size_t
+walk_bytewise(const uint8_t* map, size_t nbits)
+{
+    size_t i, found = 0;
+
+    for (i = 0; i < nbits; i++)
+        if ((map[i >> 3] >> (i & 7)) & 1)
+            found++;
+
+    return found;
+}
+
+static size_t
+walk_bitmap(const uint8_t* map, size_t nbits)
+{
+    size_t i, found = 0;
+
+    for (i = unixfs_bitmap_find_next_set(map, nbits, 0); i < nbits;
+         i = unixfs_bitmap_find_next_set(map, nbits, i + 1))
+        found++;
+
+    return found;
+}
+
+static void
+swab16_wordwise(uint8_t* map, size_t count)
+{
+    uint16_t* w = (uint16_t*)map;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        w[i] = (uint16_t)((w[i] << 8) | (w[i] >> 8));
+}
+
+static void
+report(const char* what, size_t nbytes, int rounds, double elapsed,
+       size_t result)
+{
+    printf("%-26s %8.2f GB/s  %9.3f ms/round  (result %zu)\n", what,
+           (double)nbytes * rounds / elapsed / 1.0e9,
+           elapsed * 1.0e3 / rounds, result);
+}
+
+static void
+usage(const char* progname)
+{
+    fprintf(stderr,
+    "usage: %s [-g GIB] [-r ROUNDS] [-s SPACING]\n"
+    "     . GIB is the bitmap size in GiB (default 2)\n"
+    "     . ROUNDS is the number of passes per benchmark (default 3)\n"
+    "     . SPACING is the mean distance between set bits in the sparse\n"
+    "       map walked by the find-next-set benchmark (default 65536)\n",
+    progname);
+    exit(1);
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t gib = 2, spacing = 65536;
+    int rounds = 3, ch, r;
+
+    while ((ch = getopt(argc, argv, "g:r:s:")) != -1) {
+        switch (ch) {
+        case 'g': gib = strtoul(optarg, NULL, 0); break;
+        case 'r': rounds = atoi(optarg); break;
+        case 's': spacing = strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if (gib == 0 || rounds <= 0 || spacing == 0)
+        usage(argv[0]);
+
+    size_t nbytes = gib << 30;
+    uint8_t* map = malloc(nbytes);
+    if (!map) {
+        fprintf(stderr, "failed to allocate a %zu GiB bitmap\n", gib);
+        return 1;
+    }
+
+    printf("bitmap %zu GiB, %d rounds, kernels: %s\n", gib, rounds,
+           unixfs_bitmap_isa());
+
+    double t;
+    size_t result = 0;
+
+    fill(map, nbytes, 0);
+
+    t = now();
+    for (r = 0; r < rounds; r++)
+        result = count_free_nibble(map, nbytes);
+    report("count free (nibble table)", nbytes, rounds, now() - t, result);
+
+    t = now();
+    for (r = 0; r < rounds; r++)
+        result = nbytes * 8 - unixfs_bitmap_popcount(map, 0, nbytes * 8);
+    report("count free (popcount)", nbytes, rounds, now() - t, result);
+
+    t = now();
+    for (r = 0; r < rounds; r++)
+        result = unixfs_bitmap_popcount(map, 3, nbytes * 8 - 5);
+    report("popcount (unaligned range)", nbytes, rounds, now() - t, result);
+
+    t = now();
+    for (r = 0; r < rounds; r++)
+        swab16_wordwise(map, nbytes / 2);
+    report("swab16 (word loop)", nbytes, rounds, now() - t, nbytes / 2);
+
+    t = now();
+    for (r = 0; r < rounds; r++)
+        unixfs_bitmap_swab16(map, nbytes / 2);
+    report("swab16 (bulk)", nbytes, rounds, now() - t, nbytes / 2);
+
+    t = now();
+    for (r = 0; r < rounds; r++)
+        unixfs_bitmap_swab32(map, nbytes / 4);
+    report("swab32 (bulk)", nbytes, rounds, now() - t, nbytes / 4);
+
+    t = now();
+    for (r = 0; r < rounds; r++)
+        unixfs_bitmap_swab64(map, nbytes / 8);
+    report("swab64 (bulk)", nbytes, rounds, now() - t, nbytes / 8);
+
+    t = now();
+    for (r = 0; r < rounds; r++)
+        unixfs_bitmap_wswap32(map, nbytes / 4);
+    report("wswap32 (bulk, PDP-11)", nbytes, rounds, now() - t, nbytes / 4);
+
+    fill(map, nbytes, spacing);
+
+    t = now();
+    for (r = 0; r < rounds; r++)
+        result = walk_bytewise(map, nbytes * 8);
+    report("walk set bits (bit test)", nbytes, rounds, now() - t, result);
+
+    t = now();
+    for (r = 0; r < rounds; r++)
+        result = walk_bitmap(map, nbytes * 8);
+    report("walk set bits (find next)", nbytes, rounds, now() - t, result);
+
+    free(map);
+
+    return 0;
+}
@@ -0,0 +1,452 @@
+/*
+ * UnixFS
+ *
+ * In-process benchmark for the UnixFS file system engines.
+ *
+ * This takes the place of unixfs.c's main(): it initializes a file system
+ * flavor the same way, but instead of mounting it, it drives the flavor's
+ * unixfs_ops directly. There is no kernel, no FUSE and no privilege
+ * involved, so the numbers reflect only the engine and the image's page
+ * cache residency. Each flavor's Makefile has a "bench" target that links
+ * this file against the flavor (e.g. ancientfs_bench).
+ *
+ * Workloads:
+ *
+ *   walk     every entry in the tree: nextdirentry, namei and igetattr
+ *   lookup   namei of names picked at random from the tree
+ *   seqread  every regular file read front to back in -b sized requests
+ *   randread 4 KB requests at random aligned offsets of random files
+ *
+ * Copyright (c) 2008 Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ */
+
+#include "unixfs.h"
+#include "unixfs_internal.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BENCH_RANDREAD_SIZE 4096
+
+static struct unixfs* unixfs;
+
+struct samples {
+    uint64_t* ns;
+    size_t    count;
+    size_t    capacity;
+    uint64_t  bytes;
+    uint64_t  elapsed;
+};
+
+struct name {
+    ino_t parent;
+    char* name;
+};
+
+struct file {
+    ino_t ino;
+    off_t size;
+};
+
+static struct name* names;
+static size_t       nnames, names_capacity;
+static struct file* files;
+static size_t       nfiles, files_capacity;
+
+static uint64_t
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t
+xorshift64(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return (*state = x);
+}
+
+static void*
+grow(void* p, size_t* capacity, size_t count, size_t elemsize)
+{
+    if (count < *capacity)
+        return p;
+
+    *capacity = *capacity ? *capacity * 2 : 1024;
+    p = realloc(p, *capacity * elemsize);
+    if (!p) {
+        fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+        abort();
+    }
+
+    return p;
+}
+
+static void
+sample(struct samples* s, uint64_t ns)
+{
+    s->ns = grow(s->ns, &s->capacity, s->count, sizeof(uint64_t));
+    s->ns[s->count++] = ns;
+    s->elapsed += ns;
+}
+
+static int
+compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static double
+percentile_us(struct samples* s, double p)
+{
+    size_t i = (size_t)(p * (double)(s->count - 1) + 0.5);
+    return (double)s->ns[i] / 1000.0;
+}
+
+static void
+report(const char* workload, struct samples* s)
+{
+    if (s->count == 0) {
+        printf("%-9s %10s\n", workload, "no samples");
+        return;
+    }
+
+    qsort(s->ns, s->count, sizeof(uint64_t), compare_u64);
+
+    double seconds = (double)s->elapsed / 1.0e9;
+
+    printf("%-9s %10zu %12.0f %9.1f %9.1f %9.1f %9.1f", workload, s->count,
+           (double)s->count / seconds, percentile_us(s, 0.50),
+           percentile_us(s, 0.90), percentile_us(s, 0.99),
+           percentile_us(s, 0.999));
+    if (s->bytes)
+        printf(" %9.1f", (double)s->bytes / seconds / 1.0e6);
+    printf("\n");
+}
+
+/* the same read loop as unixfs_ll_read() */
+static ssize_t
+bench_read(struct inode* ip, char* buf, size_t count, off_t offset)
+{
+    int error = 0;
+    size_t nbytes = 0;
+
+    do {
+        ssize_t ret = unixfs->ops->pbread(ip, buf + nbytes, count, offset,
+                                          &error);
+        if (ret < 0)
+            return -1;
+        count -= ret;
+        offset += ret;
+        nbytes += ret;
+    } while (!error && count);
+
+    return (ssize_t)nbytes;
+}
+
+static int
+walk(struct samples* s)
+{
+    ino_t* stack = NULL;
+    size_t depth = 0, stack_capacity = 0;
+
+    stack = grow(stack, &stack_capacity, depth, sizeof(ino_t));
+    stack[depth++] = OSXFUSE_ROOTINO;
+
+    while (depth) {
+        ino_t dino = stack[--depth];
+
+        struct inode* dp = unixfs->ops->iget(dino);
+        if (!dp) {
+            fprintf(stderr, "failed to get directory inode %llu\n",
+                    (unsigned long long)dino);
+            free(stack);
+            return -1;
+        }
+
+        struct unixfs_dirbuf dirbuf;
+        struct unixfs_direntry dent;
+        off_t offset = 0;
+
+        dirbuf.flags.initialized = 0;
+
+        for (;;) {
+            struct stat stbuf;
+            uint64_t begin = now();
+
+            if (unixfs->ops->nextdirentry(dp, &dirbuf, &offset, &dent) != 0)
+                break;
+            if (dent.ino == 0 || strcmp(dent.name, ".") == 0 ||
+                strcmp(dent.name, "..") == 0)
+                continue;
+            if (unixfs->ops->namei(dino, dent.name, &stbuf) != 0 ||
+                unixfs->ops->igetattr(dent.ino, &stbuf) != 0)
+                continue;
+
+            sample(s, now() - begin);
+
+            names = grow(names, &names_capacity, nnames, sizeof(struct name));
+            names[nnames].parent = dino;
+            names[nnames].name = strdup(dent.name);
+            nnames++;
+
+            if (S_ISDIR(stbuf.st_mode)) {
+                stack = grow(stack, &stack_capacity, depth, sizeof(ino_t));
+                stack[depth++] = dent.ino;
+            } else if (S_ISREG(stbuf.st_mode)) {
+                files = grow(files, &files_capacity, nfiles,
+                             sizeof(struct file));
+                files[nfiles].ino = dent.ino;
+                files[nfiles].size = stbuf.st_size;
+                nfiles++;
+            }
+        }
+
+        unixfs->ops->iput(dp);
+    }
+
+    free(stack);
+
+    return 0;
+}
+
+static void
+lookup(struct samples* s, size_t nops, uint64_t* seed)
+{
+    size_t i;
+
+    if (nnames == 0)
+        return;
+
+    for (i = 0; i < nops; i++) {
+        struct name* n = &names[xorshift64(seed) % nnames];
+        struct stat stbuf;
+        uint64_t begin = now();
+        if (unixfs->ops->namei(n->parent, n->name, &stbuf) == 0)
+            sample(s, now() - begin);
+    }
+}
+
+static void
+seqread(struct samples* s, char* buf, size_t iosize)
+{
+    size_t i;
+
+    for (i = 0; i < nfiles; i++) {
+        struct inode* ip = unixfs->ops->iget(files[i].ino);
+        if (!ip)
+            continue;
+
+        off_t offset = 0;
+        while (offset < files[i].size) {
+            size_t count = min((off_t)iosize, files[i].size - offset);
+            uint64_t begin = now();
+            ssize_t ret = bench_read(ip, buf, count, offset);
+            if (ret <= 0)
+                break;
+            sample(s, now() - begin);
+            s->bytes += ret;
+            offset += ret;
+        }
+
+        unixfs->ops->iput(ip);
+    }
+}
+
+static void
+randread(struct samples* s, char* buf, size_t nops, uint64_t* seed)
+{
+    size_t i, tries;
+
+    if (nfiles == 0)
+        return;
+
+    for (i = 0; i < nops; i++) {
+        struct file* f = NULL;
+
+        for (tries = 0; tries < 64; tries++) {
+            f = &files[xorshift64(seed) % nfiles];
+            if (f->size > 0)
+                break;
+        }
+        if (f->size == 0)
+            return; /* nothing but empty files */
+
+        off_t nblocks = (f->size + BENCH_RANDREAD_SIZE - 1) /
+                        BENCH_RANDREAD_SIZE;
+        off_t offset =
+            (off_t)(xorshift64(seed) % nblocks) * BENCH_RANDREAD_SIZE;
+        size_t count = min((off_t)BENCH_RANDREAD_SIZE, f->size - offset);
+
+        uint64_t begin = now();
+        struct inode* ip = unixfs->ops->iget(f->ino);
+        if (!ip)
+            continue;
+        ssize_t ret = bench_read(ip, buf, count, offset);
+        unixfs->ops->iput(ip);
+        if (ret <= 0)
+            continue;
+        sample(s, now() - begin);
+        s->bytes += ret;
+    }
+}
+
+static void
+usage(const char* progname)
+{
+    fprintf(stderr,
+    "usage: %s [--force] [--fsendian pdp|big|little] [--type TYPE]\n"
+    "       [-n OPS] [-b IOSIZE] [-S SEED] [-w WORKLOADS] --dmg DMG\n"
+    "     . DMG and TYPE are as for the file system itself\n"
+    "     . OPS is the number of random lookups and reads (default 100000)\n"
+    "     . IOSIZE is the sequential read request size (default 131072)\n"
+    "     . SEED seeds the random workloads (default 1)\n"
+    "     . WORKLOADS is a comma-separated subset of\n"
+    "       walk,lookup,seqread,randread (default all)\n",
+    progname);
+    exit(1);
+}
+
+int
+main(int argc, char** argv)
+{
+    char* dmg = NULL;
+    char* type = NULL;
+    char* fsendian = NULL;
+    char* workloads = "walk,lookup,seqread,randread";
+    int force = 0;
+    size_t nops = 100000, iosize = 131072;
+    uint64_t seed = 1;
+    int ch;
+
+    static struct option longopts[] = {
+        { "dmg",      required_argument, NULL, 'd' },
+        { "force",    no_argument,       NULL, 'f' },
+        { "fsendian", required_argument, NULL, 'e' },
+        { "type",     required_argument, NULL, 't' },
+        { NULL,       0,                 NULL, 0   },
+    };
+
+    while ((ch = getopt_long(argc, argv, "b:n:S:w:", longopts, NULL)) != -1) {
+        switch (ch) {
+        case 'd': dmg = optarg; break;
+        case 'f': force = 1; break;
+        case 'e': fsendian = optarg; break;
+        case 't': type = optarg; break;
+        case 'b': iosize = strtoul(optarg, NULL, 0); break;
+        case 'n': nops = strtoul(optarg, NULL, 0); break;
+        case 'S': seed = strtoull(optarg, NULL, 0); break;
+        case 'w': workloads = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if (!dmg || iosize == 0)
+        usage(argv[0]);
+
+    if (seed == 0) /* xorshift never leaves zero */
+        seed = 1;
+
+    if (!(unixfs = unixfs_preflight(dmg, &type, &unixfs))) {
+        if (type)
+            fprintf(stderr, "invalid file system type %s\n", type);
+        else
+            fprintf(stderr, "missing file system type\n");
+        return 1;
+    }
+
+    if (force)
+        unixfs->flags |= UNIXFS_FORCE;
+
+    unixfs->fsname = type;
+
+    unixfs->fsendian = UNIXFS_FS_INVALID;
+
+    if (fsendian) {
+        if (strcasecmp(fsendian, "pdp") == 0) {
+            unixfs->fsendian = UNIXFS_FS_PDP;
+        } else if (strcasecmp(fsendian, "big") == 0) {
+            unixfs->fsendian = UNIXFS_FS_BIG;
+        } else if (strcasecmp(fsendian, "little") == 0) {
+            unixfs->fsendian = UNIXFS_FS_LITTLE;
+        } else {
+            fprintf(stderr, "invalid endian type %s\n", fsendian);
+            return 1;
+        }
+    }
+
+    if ((unixfs->filsys =
+        unixfs->ops->init(dmg, unixfs->flags, unixfs->fsendian,
+                          &unixfs->fsname, &unixfs->volname)) == NULL) {
+        fprintf(stderr, "failed to initialize file system\n");
+        return 1;
+    }
+
+    char* buf = malloc(max(iosize, (size_t)BENCH_RANDREAD_SIZE));
+    if (!buf) {
+        fprintf(stderr, "failed to allocate a %zu byte buffer\n", iosize);
+        return 1;
+    }
+
+    struct samples tree, s;
+    memset(&tree, 0, sizeof(tree));
+    memset(&s, 0, sizeof(s));
+
+    /* The tree walk always runs: it collects the names and files. */
+    if (walk(&tree) != 0)
+        return 1;
+
+    printf("%s (%s): %zu names, %zu regular files, seed %llu\n",
+           unixfs->fsname, unixfs->volname ? unixfs->volname : "-",
+           nnames, nfiles, (unsigned long long)seed);
+    printf("%-9s %10s %12s %9s %9s %9s %9s %9s\n", "workload", "ops",
+           "ops/s", "p50 us", "p90 us", "p99 us", "p99.9 us", "MB/s");
+
+    char* list = strdup(workloads);
+    char* cursor = list;
+    char* w;
+
+    while ((w = strsep(&cursor, ",")) != NULL) {
+        free(s.ns);
+        memset(&s, 0, sizeof(s));
+
+        if (strcmp(w, "walk") == 0) {
+            report(w, &tree);
+            continue;
+        } else if (strcmp(w, "lookup") == 0)
+            lookup(&s, nops, &seed);
+        else if (strcmp(w, "seqread") == 0)
+            seqread(&s, buf, iosize);
+        else if (strcmp(w, "randread") == 0)
+            randread(&s, buf, nops, &seed);
+        else {
+            fprintf(stderr, "unknown workload %s\n", w);
+            continue;
+        }
+
+        report(w, &s);
+    }
+
+    free(list);
+    free(tree.ns);
+    free(s.ns);
+    free(buf);
+
+    unixfs->ops->fini(unixfs->filsys);
+
+    return 0;
+}
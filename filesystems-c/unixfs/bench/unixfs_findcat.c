@@ -0,0 +1,514 @@
+/*
+ * UnixFS
+ *
+ * A general-purpose file system layer for writing/reimplementing/porting
+ * Unix file systems through OSXFUSE.
+
+ * Copyright (c) 2008 Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ */
+
+/*
+ * unixfs_findcat: a find(1) and cat(1) mix against a mounted file system.
+ *
+ * Finder threads walk the tree over and over, listing every directory and
+ * lstat()ing every entry; cat threads read every regular file from start
+ * to end. What comes out is how long a single lstat() took while the
+ * reads were going on, and how fast the reads went. That is the mix the
+ * request scheduler (--workers, see unixfs_sched.h) is meant to help.
+ *
+ * With -m, the bench mounts the file system itself, once with the stock
+ * multithreaded loop and once per -v variant, for example:
+ *
+ *   unixfs_findcat -m "../ufs/ufs --dmg ufs.img --type ufs2" \
+ *       -v "--workers 8" -v "--workers 8 --clone-fd --pin-cpus" /mnt/t
+ *
+ * The kernel caches entries and attributes (UNIXFS_META_TIMEOUT), so after
+ * the first pass most lstat()s never reach the daemon; directory listings
+ * always do. On Linux, -D has the dentry and inode caches dropped every
+ * 100 ms, which needs root.
+ */
+
+#define _GNU_SOURCE /* asprintf */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MAX_THREADS  256
+#define MAX_SAMPLES  (1 << 20) /* per finder */
+#define MAX_VARIANTS 16
+
+static const char* mountpoint;
+static const char* mount_command;
+static unsigned    duration = 10;
+static unsigned    nfinders = 2;
+static unsigned    ncats = 4;
+static size_t      blocksize = 128 * 1024;
+static int         drop_caches;
+
+static char** files;
+static size_t nfiles;
+
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  start_cond = PTHREAD_COND_INITIALIZER;
+static int             started;
+static volatile int    stopped;
+
+struct finder {
+    pthread_t thread;
+    uint64_t  entries;
+    uint64_t  dirs;
+    uint64_t  errors;
+    uint32_t* samples; /* lstat latency, ns, saturating */
+    size_t    nsamples;
+};
+
+struct cat {
+    pthread_t thread;
+    unsigned  index;
+    uint64_t  bytes;
+    uint64_t  files;
+    uint64_t  errors;
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+wait_for_start(void)
+{
+    pthread_mutex_lock(&start_lock);
+    while (!started)
+        pthread_cond_wait(&start_cond, &start_lock);
+    pthread_mutex_unlock(&start_lock);
+}
+
+static void
+walk(struct finder* f, const char* dir)
+{
+    DIR* d = opendir(dir);
+    struct dirent* de;
+
+    if (!d) {
+        f->errors++;
+        return;
+    }
+    f->dirs++;
+
+    while (!stopped && (de = readdir(d)) != NULL) {
+        struct stat st;
+        char* path;
+
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        if (asprintf(&path, "%s/%s", dir, de->d_name) == -1) {
+            f->errors++;
+            continue;
+        }
+
+        uint64_t t0 = now_ns();
+        int error = lstat(path, &st);
+        uint64_t t = now_ns() - t0;
+
+        if (f->nsamples < MAX_SAMPLES)
+            f->samples[f->nsamples++] = (t > UINT32_MAX) ? UINT32_MAX : t;
+        f->entries++;
+        if (error)
+            f->errors++;
+        else if (S_ISDIR(st.st_mode))
+            walk(f, path);
+        free(path);
+    }
+
+    closedir(d);
+}
+
+static void*
+finder_main(void* arg)
+{
+    struct finder* f = arg;
+
+    if (!(f->samples = malloc(MAX_SAMPLES * sizeof(uint32_t)))) {
+        fprintf(stderr, "unixfs_findcat: out of memory\n");
+        exit(1);
+    }
+
+    wait_for_start();
+    while (!stopped)
+        walk(f, mountpoint);
+
+    return NULL;
+}
+
+static void*
+cat_main(void* arg)
+{
+    struct cat* c = arg;
+    size_t i = c->index;
+    char* buf = malloc(blocksize);
+
+    if (!buf) {
+        fprintf(stderr, "unixfs_findcat: out of memory\n");
+        exit(1);
+    }
+
+    wait_for_start();
+    while (!stopped) {
+        int fd = open(files[i % nfiles], O_RDONLY);
+        ssize_t n = 0;
+
+        if (fd == -1) {
+            c->errors++;
+        } else {
+            while (!stopped && (n = read(fd, buf, blocksize)) > 0)
+                c->bytes += n;
+            if (n < 0)
+                c->errors++;
+            else if (n == 0)
+                c->files++;
+            close(fd);
+        }
+        i += ncats;
+    }
+    free(buf);
+
+    return NULL;
+}
+
+static void*
+dropper_main(void* arg)
+{
+    (void)arg;
+
+    wait_for_start();
+    while (!stopped) {
+        int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+        if (fd == -1 || write(fd, "2", 1) != 1) {
+            perror("unixfs_findcat: drop_caches");
+            if (fd != -1)
+                close(fd);
+            break;
+        }
+        close(fd);
+        usleep(100000);
+    }
+
+    return NULL;
+}
+
+static void
+collect_files(const char* dir)
+{
+    DIR* d = opendir(dir);
+    struct dirent* de;
+
+    if (!d)
+        return;
+
+    while ((de = readdir(d)) != NULL) {
+        struct stat st;
+        char* path;
+
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        if (asprintf(&path, "%s/%s", dir, de->d_name) == -1)
+            continue;
+        if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            collect_files(path);
+        } else if (S_ISREG(st.st_mode) && st.st_size > 0) {
+            char** p = realloc(files, (nfiles + 1) * sizeof(char*));
+            if (p) {
+                files = p;
+                files[nfiles++] = path;
+                continue;
+            }
+        }
+        free(path);
+    }
+
+    closedir(d);
+}
+
+static int
+cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static double
+pct(const uint32_t* v, size_t n, double p)
+{
+    return n ? v[(size_t)(p * (n - 1))] / 1000.0 : 0;
+}
+
+static void
+run(const char* label)
+{
+    struct finder finders[MAX_THREADS];
+    struct cat cats[MAX_THREADS];
+    pthread_t dropper;
+    uint64_t entries = 0, dirs = 0, bytes = 0, nread = 0, errors = 0;
+    size_t nsamples = 0;
+    uint32_t* all;
+    unsigned i;
+
+    for (i = 0; i < nfiles; i++)
+        free(files[i]);
+    free(files);
+    files = NULL;
+    nfiles = 0;
+    collect_files(mountpoint);
+    if (nfiles == 0 && ncats) {
+        fprintf(stderr, "unixfs_findcat: no files to read under %s\n",
+                mountpoint);
+        exit(1);
+    }
+
+    memset(finders, 0, sizeof(finders));
+    memset(cats, 0, sizeof(cats));
+    started = 0;
+    stopped = 0;
+
+    for (i = 0; i < nfinders; i++)
+        if (pthread_create(&finders[i].thread, NULL, finder_main,
+                           &finders[i]) != 0)
+            goto nothreads;
+    for (i = 0; i < ncats; i++) {
+        cats[i].index = i;
+        if (pthread_create(&cats[i].thread, NULL, cat_main, &cats[i]) != 0)
+            goto nothreads;
+    }
+    if (drop_caches &&
+        pthread_create(&dropper, NULL, dropper_main, NULL) != 0)
+        goto nothreads;
+
+    pthread_mutex_lock(&start_lock);
+    started = 1;
+    pthread_cond_broadcast(&start_cond);
+    pthread_mutex_unlock(&start_lock);
+
+    uint64_t begin = now_ns();
+    sleep(duration);
+    stopped = 1;
+
+    for (i = 0; i < nfinders; i++) {
+        pthread_join(finders[i].thread, NULL);
+        entries += finders[i].entries;
+        dirs += finders[i].dirs;
+        errors += finders[i].errors;
+        nsamples += finders[i].nsamples;
+    }
+    for (i = 0; i < ncats; i++) {
+        pthread_join(cats[i].thread, NULL);
+        bytes += cats[i].bytes;
+        nread += cats[i].files;
+        errors += cats[i].errors;
+    }
+    if (drop_caches)
+        pthread_join(dropper, NULL);
+    double elapsed = (now_ns() - begin) / 1e9;
+
+    if (!(all = malloc((nsamples ? nsamples : 1) * sizeof(uint32_t)))) {
+        fprintf(stderr, "unixfs_findcat: out of memory\n");
+        exit(1);
+    }
+    nsamples = 0;
+    for (i = 0; i < nfinders; i++) {
+        memcpy(all + nsamples, finders[i].samples,
+               finders[i].nsamples * sizeof(uint32_t));
+        nsamples += finders[i].nsamples;
+        free(finders[i].samples);
+    }
+    qsort(all, nsamples, sizeof(uint32_t), cmp_u32);
+
+    printf("%-32.32s %10.0f %8.0f %8.1f %8.1f %8.1f %9.1f %8.1f %7.1f %6"
+           PRIu64 "\n", label, entries / elapsed, dirs / elapsed,
+           pct(all, nsamples, 0.50), pct(all, nsamples, 0.99),
+           pct(all, nsamples, 0.999),
+           nsamples ? all[nsamples - 1] / 1000.0 : 0.0,
+           bytes / elapsed / (1024 * 1024), nread / elapsed, errors);
+    fflush(stdout);
+
+    free(all);
+    return;
+
+nothreads:
+    fprintf(stderr, "unixfs_findcat: cannot create threads\n");
+    exit(1);
+}
+
+static int
+is_mounted(void)
+{
+    struct stat st, parent;
+    char* up;
+
+    if (asprintf(&up, "%s/..", mountpoint) == -1)
+        return 0;
+    int mounted = stat(mountpoint, &st) == 0 && stat(up, &parent) == 0 &&
+                  st.st_dev != parent.st_dev;
+    free(up);
+    return mounted;
+}
+
+static pid_t
+mount_variant(const char* variant)
+{
+    char* command;
+    pid_t pid;
+    int i;
+
+    if (asprintf(&command, "exec %s %s -f %s", mount_command, variant,
+                 mountpoint) == -1) {
+        fprintf(stderr, "unixfs_findcat: out of memory\n");
+        exit(1);
+    }
+
+    if ((pid = fork()) == -1) {
+        perror("unixfs_findcat: fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        execl("/bin/sh", "sh", "-c", command, (char*)NULL);
+        _exit(127);
+    }
+    free(command);
+
+    for (i = 0; i < 1000 && !is_mounted(); i++) {
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            fprintf(stderr, "unixfs_findcat: the file system exited "
+                    "before mounting %s\n", mountpoint);
+            exit(1);
+        }
+        usleep(10000);
+    }
+    if (!is_mounted()) {
+        fprintf(stderr, "unixfs_findcat: %s did not mount\n", mountpoint);
+        kill(pid, SIGKILL);
+        exit(1);
+    }
+
+    return pid;
+}
+
+/* The daemon unmounts on its way out. */
+static void
+unmount_variant(pid_t pid)
+{
+    int i;
+
+    kill(pid, SIGTERM);
+    for (i = 0; i < 1000; i++) {
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+            return;
+        usleep(10000);
+    }
+    fprintf(stderr, "unixfs_findcat: the file system did not exit; "
+            "%s may need to be unmounted by hand\n", mountpoint);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+"usage: unixfs_findcat [-d seconds] [-f finders] [-c cats] [-b blocksize]\n"
+"                      [-D] [-m mount-command [-v variant]...] MOUNTPOINT\n"
+"\n"
+"  -d  seconds per run (default 10)\n"
+"  -f  tree-walking threads (default 2)\n"
+"  -c  file-reading threads (default 4)\n"
+"  -b  bytes per read (default 131072)\n"
+"  -D  drop the kernel's dentry and inode caches every 100 ms (Linux, root)\n"
+"  -m  mount with this command (plus -f MOUNTPOINT), then unmount\n"
+"  -v  also run with these arguments added to the mount command\n");
+    exit(2);
+}
+
+int
+main(int argc, char* argv[])
+{
+    const char* variants[MAX_VARIANTS];
+    unsigned nvariants = 0, i;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "b:c:d:Df:m:v:")) != -1) {
+        switch (ch) {
+        case 'b':
+            blocksize = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            ncats = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            duration = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        case 'D':
+            drop_caches = 1;
+            break;
+        case 'f':
+            nfinders = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            mount_command = optarg;
+            break;
+        case 'v':
+            if (nvariants == MAX_VARIANTS)
+                usage();
+            variants[nvariants++] = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1 || duration == 0 || blocksize == 0 ||
+        nfinders > MAX_THREADS || ncats > MAX_THREADS ||
+        (nfinders + ncats) == 0 || (nvariants && !mount_command))
+        usage();
+    mountpoint = argv[0];
+
+    printf("# %u finders, %u cats, %zu-byte reads, %u s per run%s; "
+           "lstat latency in us\n", nfinders, ncats, blocksize, duration,
+           drop_caches ? ", caches dropped" : "");
+    printf("%-32s %10s %8s %8s %8s %8s %9s %8s %7s %6s\n", "loop",
+           "entries/s", "dirs/s", "p50", "p99", "p99.9", "max", "MB/s",
+           "files/s", "errors");
+
+    if (!mount_command) {
+        run(mountpoint);
+        return 0;
+    }
+
+    pid_t pid = mount_variant("");
+    run("stock");
+    unmount_variant(pid);
+
+    for (i = 0; i < nvariants; i++) {
+        pid = mount_variant(variants[i]);
+        run(variants[i]);
+        unmount_variant(pid);
+    }
+
+    return 0;
+}
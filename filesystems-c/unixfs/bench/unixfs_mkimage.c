@@ -0,0 +1,1580 @@
+/*
+ * UnixFS
+ *
+ * A generator for synthetic file system images and archives.
+ *
+ * Writes a tree of directories and files in one of the formats that the
+ * unixfs flavors read, so that unixfs_bench and the stress tests have
+ * something realistic to chew on without shipping images around. The tree
+ * is shaped by a file count and a directory fan-out; file sizes come from a
+ * distribution; data blocks can be scattered to mimic an aged file system;
+ * and extra files can be made just large enough to need single, double or
+ * triple indirect blocks.
+ *
+ * The same parameters and seed always produce the same image, byte for
+ * byte. File contents come from the LFSR that posix_compat_test uses,
+ * restarted for every 512-byte sector of every file so that any block size
+ * can be assembled from them.
+ *
+ * Copyright (c) 2008 Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MKIMAGE_TIME 1199145600 /* 2008-01-01 00:00:00 UTC */
+#define SECTOR       512
+
+enum { E_LITTLE, E_BIG, E_PDP };
+
+enum { DIST_FIXED, DIST_UNIFORM, DIST_EXP };
+
+static struct {
+    const char* type;
+    const char* output;
+    uint32_t    nfiles;
+    uint32_t    fanout;
+    int         dist;
+    uint64_t    dist_a;
+    uint64_t    dist_b;
+    unsigned    frag;      /* percent of allocations that jump */
+    unsigned    depth;     /* deepest indirect level to exercise */
+    uint64_t    seed;
+    int         endian;    /* -1 => the format's native order */
+    uint64_t    size;      /* bytes; 0 => just large enough */
+} opt = {
+    NULL, NULL, 1000, 16, DIST_EXP, 16384, 0, 0, 0, 1, -1, 0,
+};
+
+static void
+fatal(const char* fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "unixfs_mkimage: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+
+    exit(1);
+}
+
+static uint64_t
+xorshift64(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return (*state = x);
+}
+
+static inline void
+put16(uint8_t* p, uint16_t v, int e)
+{
+    if (e == E_BIG) {
+        p[0] = v >> 8; p[1] = v;
+    } else {
+        p[0] = v; p[1] = v >> 8;
+    }
+}
+
+static inline void
+put32(uint8_t* p, uint32_t v, int e)
+{
+    if (e == E_PDP) {
+        put16(p, v >> 16, E_LITTLE);
+        put16(p + 2, v, E_LITTLE);
+    } else if (e == E_BIG) {
+        put16(p, v >> 16, E_BIG);
+        put16(p + 2, v, E_BIG);
+    } else {
+        put16(p, v, E_LITTLE);
+        put16(p + 2, v >> 16, E_LITTLE);
+    }
+}
+
+static inline void
+put64(uint8_t* p, uint64_t v, int e)
+{
+    if (e == E_BIG) {
+        put32(p, v >> 32, E_BIG);
+        put32(p + 4, v, E_BIG);
+    } else {
+        put32(p, v, E_LITTLE);
+        put32(p + 4, v >> 32, E_LITTLE);
+    }
+}
+
+/* The 3-byte disk addresses of V7 and System V inodes. */
+static inline void
+put24(uint8_t* p, uint32_t v, int e)
+{
+    switch (e) {
+    case E_LITTLE: p[0] = v;       p[1] = v >> 8; p[2] = v >> 16; break;
+    case E_BIG:    p[0] = v >> 16; p[1] = v >> 8; p[2] = v;       break;
+    case E_PDP:    p[0] = v >> 16; p[1] = v;      p[2] = v >> 8;  break;
+    }
+}
+
+/*
+ * The tree. Node 0 is the root; directory k (k > 0) hangs off directory
+ * (k - 1) / fanout and file i lives in directory i / fanout, so every
+ * directory holds at most fanout files and fanout subdirectories. The
+ * indirect-depth files, if any, go in the root.
+ */
+
+struct node {
+    uint32_t parent;
+    uint32_t child;     /* first child; 0 => none */
+    uint32_t sibling;   /* next child of parent; 0 => none */
+    uint32_t nsubdirs;
+    uint64_t size;
+    uint8_t* data;      /* directory contents; files are generated */
+    uint8_t  isdir;
+    uint8_t  sparse;    /* only the first and last blocks are written */
+    char     name[16];
+};
+
+static struct node* nodes;
+static uint32_t     nnodes;
+static uint32_t*    order;  /* preorder: a directory, its files, subdirs */
+static uint32_t     norder;
+
+static uint64_t
+draw_size(uint64_t* rng)
+{
+    double u;
+
+    switch (opt.dist) {
+    case DIST_UNIFORM:
+        return opt.dist_a + xorshift64(rng) % (opt.dist_b - opt.dist_a + 1);
+    case DIST_EXP:
+        u = (double)((xorshift64(rng) >> 11) + 1) / 9007199254740992.0;
+        return (uint64_t)(-log(u) * (double)opt.dist_a);
+    default:
+        return opt.dist_a;
+    }
+}
+
+static void
+tree_visit(uint32_t d)
+{
+    uint32_t c;
+
+    order[norder++] = d;
+    for (c = nodes[d].child; c; c = nodes[c].sibling)
+        if (!nodes[c].isdir)
+            order[norder++] = c;
+    for (c = nodes[d].child; c; c = nodes[c].sibling)
+        if (nodes[c].isdir)
+            tree_visit(c);
+}
+
+/*
+ * Build the tree. For block-mapped formats, deep[l - 1] is the size that
+ * needs level-l indirect blocks; archives pass NULL.
+ */
+static void
+tree_build(const uint64_t* deep, unsigned ndeep)
+{
+    uint32_t ndirs = (opt.nfiles + opt.fanout - 1) / opt.fanout;
+    uint32_t i, n;
+    uint64_t rng = opt.seed ^ 0x9e3779b97f4a7c15ULL;
+
+    if (ndirs == 0)
+        ndirs = 1;
+
+    if (!deep)
+        ndeep = 0;
+    else if (opt.depth > ndeep)
+        fprintf(stderr, "*** warning: %s has only %u levels of indirect "
+                "blocks\n", opt.type, ndeep);
+    else
+        ndeep = opt.depth;
+
+    nnodes = ndirs + opt.nfiles + ndeep;
+    nodes = calloc(nnodes, sizeof(struct node));
+    order = calloc(nnodes, sizeof(uint32_t));
+    if (!nodes || !order)
+        fatal("out of memory");
+
+    for (n = 0; n < ndirs; n++) {
+        nodes[n].isdir = 1;
+        if (n > 0) {
+            nodes[n].parent = (n - 1) / opt.fanout;
+            snprintf(nodes[n].name, sizeof(nodes[n].name), "d%04u", n);
+        }
+    }
+
+    for (i = 0; i < opt.nfiles; i++, n++) {
+        nodes[n].parent = i / opt.fanout;
+        nodes[n].size = draw_size(&rng);
+        snprintf(nodes[n].name, sizeof(nodes[n].name), "f%06u", i);
+    }
+
+    for (i = 0; i < ndeep; i++, n++) {
+        nodes[n].size = deep[i];
+        nodes[n].sparse = 1;
+        snprintf(nodes[n].name, sizeof(nodes[n].name), "indirect%c",
+                 (char)('1' + i));
+    }
+
+    /* link back to front so that children stay in creation order */
+    for (n = nnodes - 1; n > 0; n--) {
+        struct node* p = &nodes[nodes[n].parent];
+        nodes[n].sibling = p->child;
+        p->child = n;
+        if (nodes[n].isdir)
+            p->nsubdirs++;
+    }
+
+    norder = 0;
+    tree_visit(0);
+}
+
+static size_t
+tree_path(uint32_t n, char* buf, size_t size)
+{
+    size_t len = 0;
+
+    if (n == 0)
+        return 0;
+
+    if (nodes[n].parent != 0) {
+        len = tree_path(nodes[n].parent, buf, size);
+        if (len + 1 < size)
+            buf[len++] = '/';
+    }
+
+    len += snprintf(buf + len, size - len, "%s", nodes[n].name);
+    if (len >= size)
+        fatal("path too long");
+
+    return len;
+}
+
+/* posix_compat_test's LFSR, restarted for every sector of every file. */
+static void
+fill_sector(uint8_t* p, uint32_t n, uint64_t sector)
+{
+    uint32_t lfsr = (uint32_t)(opt.seed * 0x9e3779b1u) ^ (n * 0x85ebca6bu) ^
+                    (uint32_t)(sector * 0xc2b2ae35u) ^ (uint32_t)(sector >> 32);
+    int i;
+
+    if (lfsr == 0)
+        lfsr = 1;
+
+    for (i = 0; i < SECTOR; i += 4) {
+        lfsr = (lfsr >> 1) ^ (-(lfsr & 1u) & 0xd0000001u);
+        put32(p + i, lfsr, E_LITTLE);
+    }
+}
+
+/* Contents of node n: len bytes (a multiple of SECTOR) at offset off. */
+static void
+node_read(uint32_t n, uint8_t* buf, size_t len, uint64_t off)
+{
+    struct node* np = &nodes[n];
+    size_t done;
+
+    for (done = 0; done < len; done += SECTOR) {
+        uint64_t pos = off + done;
+        if (pos >= np->size) {
+            memset(buf + done, 0, len - done);
+            return;
+        }
+        if (np->data)
+            memcpy(buf + done, np->data + pos,
+                   (np->size - pos < SECTOR) ? np->size - pos : SECTOR);
+        else
+            fill_sector(buf + done, n, pos / SECTOR);
+        if (np->size - pos < SECTOR)
+            memset(buf + done + (np->size - pos), 0,
+                   SECTOR - (np->size - pos));
+    }
+}
+
+/*
+ * Fixed-size directory entries: a 16- or 32-bit inode number and a name
+ * padded with NULs (V7, System V, Minix, dump).
+ */
+static void
+dir_fixed(uint32_t rootino, unsigned inosize, unsigned namesize, int e)
+{
+    unsigned entsize = inosize + namesize;
+    uint32_t d, c;
+
+    for (d = 0; d < nnodes && nodes[d].isdir; d++) {
+        struct node* dp = &nodes[d];
+        size_t count = 2, off;
+
+        for (c = dp->child; c; c = nodes[c].sibling)
+            count++;
+
+        dp->size = count * entsize;
+        dp->data = calloc(1, dp->size);
+        if (!dp->data)
+            fatal("out of memory");
+
+#define DIR_FIXED_ENT(ino, nm) do {                                     \
+            if (inosize == 2)                                           \
+                put16(dp->data + off, (ino), e);                        \
+            else                                                        \
+                put32(dp->data + off, (ino), e);                        \
+            strncpy((char*)dp->data + off + inosize, (nm), namesize);   \
+            off += entsize;                                             \
+        } while (0)
+
+        off = 0;
+        DIR_FIXED_ENT(rootino + d, ".");
+        DIR_FIXED_ENT(rootino + dp->parent, "..");
+        for (c = dp->child; c; c = nodes[c].sibling)
+            DIR_FIXED_ENT(rootino + c, nodes[c].name);
+
+#undef DIR_FIXED_ENT
+    }
+}
+
+/* 4.4BSD directory entries in 512-byte chunks (UFS). */
+static void
+dir_ufs(uint32_t rootino, int e)
+{
+    uint32_t d, c;
+
+    for (d = 0; d < nnodes && nodes[d].isdir; d++) {
+        struct node* dp = &nodes[d];
+        size_t count = 2, chunk = 0, last = 0, off = 0;
+
+        for (c = dp->child; c; c = nodes[c].sibling)
+            count++;
+
+        /* 24 bytes holds any name we make; round up a chunk for spill */
+        dp->data = calloc(1, (count * 24 / 512 + 2) * 512);
+        if (!dp->data)
+            fatal("out of memory");
+
+#define DIR_UFS_ENT(ino, type, nm) do {                                 \
+            size_t namlen = strlen(nm);                                 \
+            size_t reclen = (8 + namlen + 1 + 3) & ~(size_t)3;          \
+            if (off + reclen > chunk + 512) {                           \
+                put16(dp->data + last + 4, chunk + 512 - last, e);      \
+                off = chunk += 512;                                     \
+            }                                                           \
+            put32(dp->data + off, (ino), e);                            \
+            put16(dp->data + off + 4, reclen, e);                       \
+            dp->data[off + 6] = (type);                                 \
+            dp->data[off + 7] = namlen;                                 \
+            memcpy(dp->data + off + 8, (nm), namlen);                   \
+            last = off;                                                 \
+            off += reclen;                                              \
+        } while (0)
+
+        DIR_UFS_ENT(rootino + d, 4, ".");
+        DIR_UFS_ENT(rootino + dp->parent, 4, "..");
+        for (c = dp->child; c; c = nodes[c].sibling)
+            DIR_UFS_ENT(rootino + c, nodes[c].isdir ? 4 : 8, nodes[c].name);
+
+#undef DIR_UFS_ENT
+
+        put16(dp->data + last + 4, chunk + 512 - last, e);
+        dp->size = chunk + 512;
+    }
+}
+
+/*
+ * Block-mapped images. Blocks are handed out in order from a cursor; with
+ * fragmentation, that percentage of allocations first moves the cursor
+ * to a random spot. A dry run only counts blocks, which is how an image is
+ * sized when -m isn't given.
+ */
+
+struct image {
+    int      fd;
+    int      dry;
+    int      endian;
+    uint32_t bsize;
+    uint64_t nblocks;
+    uint64_t first;     /* first allocatable block */
+    uint64_t cursor;
+    uint64_t counted;   /* blocks allocated by a dry run */
+    uint8_t* used;
+    uint64_t rng;
+    unsigned ndirect;   /* direct addresses in an inode */
+    unsigned nlevels;   /* levels of indirection */
+    unsigned addrsize;  /* bytes per indirect block entry */
+    unsigned nindir;
+    unsigned scale;     /* block number => disk address */
+};
+
+static void
+image_pwrite(struct image* im, const void* buf, size_t len, uint64_t off)
+{
+    if (im->dry)
+        return;
+    if (pwrite(im->fd, buf, len, (off_t)off) != (ssize_t)len)
+        fatal("%s: %s", opt.output, strerror(errno));
+}
+
+static uint64_t
+image_alloc(struct image* im)
+{
+    uint64_t b, n;
+
+    if (im->dry)
+        return ++im->counted;
+
+    if (opt.frag && (xorshift64(&im->rng) % 100) < opt.frag)
+        im->cursor = im->first +
+                     xorshift64(&im->rng) % (im->nblocks - im->first);
+
+    for (b = im->cursor, n = im->first; n < im->nblocks; n++, b++) {
+        if (b >= im->nblocks)
+            b = im->first;
+        if (!im->used[b]) {
+            im->used[b] = 1;
+            im->cursor = b + 1;
+            return b;
+        }
+    }
+
+    fatal("image is full; use -m to make it larger");
+    return 0;
+}
+
+static void
+image_putaddr(struct image* im, uint8_t* buf, uint64_t i, uint64_t addr)
+{
+    switch (im->addrsize) {
+    case 2: put16(buf + i * 2, addr, im->endian); break;
+    case 4: put32(buf + i * 4, addr, im->endian); break;
+    case 8: put64(buf + i * 8, addr, im->endian); break;
+    }
+}
+
+/* The sizes that just reach each level of indirect blocks. */
+static unsigned
+image_deep_sizes(struct image* im, uint64_t* deep)
+{
+    uint64_t lbn = im->ndirect, span = im->nindir;
+    unsigned l;
+
+    for (l = 0; l < im->nlevels; l++) {
+        deep[l] = (lbn + 1) * im->bsize;
+        lbn += span;
+        span *= im->nindir;
+    }
+
+    return im->nlevels;
+}
+
+/*
+ * Write node n's data and indirect blocks. Fills in the inode's addresses
+ * (ndirect direct ones followed by one per indirect level) and returns the
+ * number of blocks used. Indirect blocks are allocated just ahead of the
+ * first data block they map, as a file system growing the file would.
+ */
+static uint64_t
+image_map(struct image* im, uint32_t n, uint64_t* addr)
+{
+    struct node* np = &nodes[n];
+    uint64_t nb = (np->size + im->bsize - 1) / im->bsize;
+    uint64_t lbn, total = 0;
+    uint64_t indblk[3], indkey[3];
+    uint8_t* ind[3];
+    uint8_t* buf;
+    int d, k;
+
+    memset(addr, 0, (im->ndirect + im->nlevels) * sizeof(uint64_t));
+
+    buf = malloc(im->bsize);
+    for (d = 0; d < 3; d++) {
+        ind[d] = calloc(1, im->bsize);
+        indkey[d] = UINT64_MAX;
+    }
+    if (!buf || !ind[0] || !ind[1] || !ind[2])
+        fatal("out of memory");
+
+    for (lbn = 0; lbn < nb; lbn++) {
+        uint64_t b;
+
+        if (np->sparse && lbn != 0 && lbn != nb - 1)
+            continue;
+
+        if (lbn < im->ndirect) {
+            b = image_alloc(im);
+            addr[lbn] = b * im->scale;
+        } else {
+            uint64_t l = lbn - im->ndirect, span = im->nindir, idx[3];
+            int level = 1;
+
+            while (l >= span) {
+                l -= span;
+                span *= im->nindir;
+                level++;
+            }
+            if (level > (int)im->nlevels)
+                fatal("%s is too large for %s", np->name, opt.type);
+
+            for (d = level - 1, span = l; d >= 0; d--) {
+                idx[d] = span % im->nindir;
+                span /= im->nindir;
+            }
+
+            for (d = 0; d < level; d++) {
+                /* which block at this depth: level and the path above */
+                uint64_t key = (uint64_t)level << 60, div = 1;
+                for (k = d; k < level; k++)
+                    div *= im->nindir;
+                key |= l / div;
+                if (indkey[d] == key)
+                    continue;
+                for (k = d; k < 3; k++) {
+                    if (indkey[k] != UINT64_MAX)
+                        image_pwrite(im, ind[k], im->bsize,
+                                     indblk[k] * im->bsize);
+                    indkey[k] = UINT64_MAX;
+                }
+                indblk[d] = image_alloc(im);
+                indkey[d] = key;
+                memset(ind[d], 0, im->bsize);
+                total++;
+                if (d == 0)
+                    addr[im->ndirect + level - 1] = indblk[0] * im->scale;
+                else
+                    image_putaddr(im, ind[d - 1], idx[d - 1],
+                                  indblk[d] * im->scale);
+            }
+
+            b = image_alloc(im);
+            image_putaddr(im, ind[level - 1], idx[level - 1], b * im->scale);
+        }
+
+        if (!im->dry) {
+            node_read(n, buf, im->bsize, lbn * im->bsize);
+            image_pwrite(im, buf, im->bsize, b * im->bsize);
+        }
+        total++;
+    }
+
+    for (d = 0; d < 3; d++) {
+        if (indkey[d] != UINT64_MAX)
+            image_pwrite(im, ind[d], im->bsize, indblk[d] * im->bsize);
+        free(ind[d]);
+    }
+    free(buf);
+
+    return total;
+}
+
+/* Size an image: metadata blocks plus whatever the tree needs, and slack. */
+static void
+image_size(struct image* im, uint64_t meta)
+{
+    uint64_t addr[16];
+    uint32_t i;
+
+    if (opt.size) {
+        im->nblocks = opt.size / im->bsize;
+    } else {
+        im->dry = 1;
+        im->counted = 0;
+        for (i = 0; i < norder; i++)
+            (void)image_map(im, order[i], addr);
+        im->dry = 0;
+        im->nblocks = meta + im->counted + im->counted / 16 + 16;
+    }
+
+    if (im->nblocks <= meta)
+        fatal("image size too small");
+}
+
+static void
+image_open(struct image* im)
+{
+    im->fd = open(opt.output, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (im->fd < 0)
+        fatal("%s: %s", opt.output, strerror(errno));
+
+    if (ftruncate(im->fd, (off_t)(im->nblocks * im->bsize)) != 0)
+        fatal("%s: %s", opt.output, strerror(errno));
+
+    im->used = calloc(im->nblocks, 1);
+    if (!im->used)
+        fatal("out of memory");
+
+    memset(im->used, 1, im->first);
+    im->cursor = im->first;
+    im->rng = opt.seed ^ 0xd1b54a32d192ed03ULL;
+}
+
+static uint64_t
+image_nfree(struct image* im)
+{
+    uint64_t b, nfree = 0;
+
+    for (b = im->first; b < im->nblocks; b++)
+        if (!im->used[b])
+            nfree++;
+
+    return nfree;
+}
+
+static void
+image_close(struct image* im)
+{
+    if (close(im->fd) != 0)
+        fatal("%s: %s", opt.output, strerror(errno));
+    free(im->used);
+}
+
+static inline uint16_t
+node_mode(uint32_t n)
+{
+    return nodes[n].isdir ? 040755 : 0100644;
+}
+
+static inline uint16_t
+node_nlink(uint32_t n)
+{
+    return nodes[n].isdir ? 2 + nodes[n].nsubdirs : 1;
+}
+
+/*
+ * V7 and System V: 64-byte inodes with thirteen 3-byte addresses (ten
+ * direct, then single, double and triple indirect), a free block list
+ * chained through the free blocks themselves, root inode 2.
+ */
+static void
+mk_s5(int sysv)
+{
+    struct image im = { 0 };
+    uint64_t deep[3], addr[13];
+    uint32_t i, ninodes, ipb, isize, tinode;
+    uint8_t  sb[512] = { 0 };
+    int      e;
+
+    if (!sysv && opt.endian >= 0 && opt.endian != E_PDP) /* see l3tol() */
+        fprintf(stderr, "*** warning: V7 images are PDP-11 endian\n");
+
+    e = im.endian = (sysv && opt.endian >= 0) ? opt.endian :
+                                                (sysv ? E_LITTLE : E_PDP);
+    im.bsize = sysv ? 1024 : 512;
+    im.ndirect = 10;
+    im.nlevels = 3;
+    im.addrsize = 4;
+    im.nindir = im.bsize / 4;
+    im.scale = 1;
+
+    tree_build(deep, image_deep_sizes(&im, deep));
+
+    /* ancientfs's v7 bmap fails on a hole rather than reading zeroes */
+    for (i = 0; !sysv && i < nnodes; i++)
+        nodes[i].sparse = 0;
+
+    ipb = im.bsize / 64;
+    ninodes = nnodes + 1 + nnodes / 16 + ipb;
+    ninodes -= ninodes % ipb;
+    if (ninodes > 65535)
+        fatal("%s holds at most 65535 inodes", opt.type);
+    isize = 2 + ninodes / ipb;
+
+    dir_fixed(2, 2, 14, e);
+
+    image_size(&im, isize);
+    if (im.nblocks >= (1 << 24))
+        fatal("%s addresses at most %u blocks", opt.type, 1 << 24);
+    im.first = isize;
+    image_open(&im);
+
+    for (i = 0; i < norder; i++) {
+        uint32_t n = order[i];
+        uint8_t  di[64] = { 0 };
+        int j;
+
+        (void)image_map(&im, n, addr);
+
+        put16(di + 0, node_mode(n), e);
+        put16(di + 2, node_nlink(n), e);
+        put32(di + 8, nodes[n].size, e);
+        for (j = 0; j < 13; j++)
+            put24(di + 12 + j * 3, addr[j], e);
+        put32(di + 52, MKIMAGE_TIME, e);
+        put32(di + 56, MKIMAGE_TIME, e);
+        put32(di + 60, MKIMAGE_TIME, e);
+
+        image_pwrite(&im, di, 64, 2 * im.bsize + (uint64_t)(1 + n) * 64);
+    }
+
+    /*
+     * The free list, built as mkfs builds it: going down from the end,
+     * every 50 blocks the list so far is written into the next free block,
+     * which then starts a new list. The superblock keeps the last one.
+     */
+    uint32_t nfree = 1, tfree = 0, fl[50] = { 0 };
+    unsigned flc = sysv ? 4 : 2;
+    uint64_t b;
+
+    for (b = im.nblocks - 1; b >= im.first; b--) {
+        if (im.used[b])
+            continue;
+        if (nfree == 50) {
+            uint8_t* chunk = calloc(1, im.bsize);
+            if (!chunk)
+                fatal("out of memory");
+            put16(chunk, nfree, e);
+            for (i = 0; i < 50; i++)
+                put32(chunk + flc + i * 4, fl[i], e);
+            image_pwrite(&im, chunk, im.bsize, b * im.bsize);
+            free(chunk);
+            nfree = 0;
+        }
+        fl[nfree++] = b;
+        tfree++;
+    }
+
+    /* free inodes are counted from just past the root */
+    tinode = ninodes - 2 - (nnodes - 1);
+
+    if (sysv) {
+        put16(sb + 0, isize, e);
+        put32(sb + 4, im.nblocks, e);
+        put16(sb + 8, nfree, e);
+        for (i = 0; i < 50; i++)
+            put32(sb + 12 + i * 4, fl[i], e);
+        put32(sb + 420, MKIMAGE_TIME, e);
+        put32(sb + 432, tfree, e);
+        put16(sb + 436, tinode, e);
+        memcpy(sb + 440, "mkimg", 5);
+        memcpy(sb + 446, "bench", 5);
+        put32(sb + 500, 0x7c269d38 - MKIMAGE_TIME, e); /* FsOKAY */
+        put32(sb + 504, 0xfd187e20, e);                /* magic */
+        put32(sb + 508, 2, e);                         /* 1K blocks */
+    } else {
+        put16(sb + 0, isize, e);
+        put32(sb + 2, im.nblocks, e);
+        put16(sb + 6, nfree, e);
+        for (i = 0; i < 50; i++)
+            put32(sb + 8 + i * 4, fl[i], e);
+        put32(sb + 414, MKIMAGE_TIME, e);
+        put32(sb + 418, tfree, e);
+        put16(sb + 422, tinode, e);
+        put16(sb + 424, 1, e);                         /* s_m */
+        put16(sb + 426, 1, e);                         /* s_n */
+    }
+
+    image_pwrite(&im, sb, sizeof(sb), 512);
+    image_close(&im);
+}
+
+/*
+ * Minix: a superblock at 1024, inode and zone bitmaps, the inode table,
+ * then data zones; root inode 1. V1 has 32-byte inodes with 16-bit zone
+ * numbers and no triple indirect block; V2 and V3 have 64-byte inodes
+ * with 32-bit zones. V3 also has 32-bit inode numbers and 60-byte names.
+ */
+static void
+mk_minix(int version)
+{
+    struct image im = { 0 };
+    uint64_t deep[3], addr[10];
+    uint32_t i, ninodes, isz, imap, zmap, itable, firstdata;
+    uint8_t  sb[1024] = { 0 };
+    uint8_t* map;
+    uint64_t b;
+    const int e = E_LITTLE;
+
+    if (opt.endian >= 0 && opt.endian != E_LITTLE)
+        fprintf(stderr, "*** warning: Minix images are little endian\n");
+
+    im.endian = e;
+    im.bsize = 1024;
+    im.ndirect = 7;
+    im.nlevels = (version == 1) ? 2 : 3;
+    im.addrsize = (version == 1) ? 2 : 4;
+    im.nindir = im.bsize / im.addrsize;
+    im.scale = 1;
+    isz = (version == 1) ? 32 : 64;
+
+    tree_build(deep, image_deep_sizes(&im, deep));
+
+    ninodes = nnodes + nnodes / 16 + 16;
+    if (version < 3 && ninodes > 65535)
+        fatal("%s holds at most 65535 inodes", opt.type);
+    imap = (ninodes + 1 + 8191) / 8192;
+    itable = (ninodes * isz + im.bsize - 1) / im.bsize;
+
+    if (version == 3)
+        dir_fixed(1, 4, 60, e);
+    else
+        dir_fixed(1, 2, 14, e);
+
+    /* the zone map has to cover the whole image, itself included */
+    image_size(&im, 2 + imap + 1 + itable);
+    zmap = (im.nblocks + 8191) / 8192;
+    if (!opt.size)
+        im.nblocks += zmap - 1;
+    firstdata = 2 + imap + zmap + itable;
+    if (im.nblocks <= firstdata)
+        fatal("image size too small");
+    if (version == 1 && im.nblocks > 65535)
+        fatal("%s addresses at most 65535 zones", opt.type);
+    im.first = firstdata;
+    image_open(&im);
+
+    map = calloc(imap > zmap ? imap : zmap, im.bsize);
+    if (!map)
+        fatal("out of memory");
+
+    /* inode map: bit 0 is reserved, and so is everything past the end */
+    memset(map, 0xff, imap * im.bsize);
+    for (i = nnodes + 1; i <= ninodes; i++)
+        map[i >> 3] &= ~(1 << (i & 7));
+    image_pwrite(&im, map, imap * im.bsize, 2 * im.bsize);
+
+    for (i = 0; i < norder; i++) {
+        uint32_t n = order[i];
+        uint8_t  di[64] = { 0 };
+        int j;
+
+        (void)image_map(&im, n, addr);
+
+        if (version == 1) {
+            put16(di + 0, node_mode(n), e);
+            put32(di + 4, nodes[n].size, e);
+            put32(di + 8, MKIMAGE_TIME, e);
+            di[13] = node_nlink(n) > 255 ? 255 : node_nlink(n);
+            for (j = 0; j < 9; j++)
+                put16(di + 14 + j * 2, addr[j], e);
+        } else {
+            put16(di + 0, node_mode(n), e);
+            put16(di + 2, node_nlink(n), e);
+            put32(di + 8, nodes[n].size, e);
+            put32(di + 12, MKIMAGE_TIME, e);
+            put32(di + 16, MKIMAGE_TIME, e);
+            put32(di + 20, MKIMAGE_TIME, e);
+            for (j = 0; j < 10; j++)
+                put32(di + 24 + j * 4, addr[j], e);
+        }
+
+        image_pwrite(&im, di, isz,
+                     (uint64_t)(2 + imap + zmap) * im.bsize +
+                     (uint64_t)n * isz);
+    }
+
+    /* zone map: bit z is zone firstdata - 1 + z */
+    memset(map, 0xff, zmap * im.bsize);
+    for (b = firstdata; b < im.nblocks; b++) {
+        uint64_t z = b - firstdata + 1;
+        if (!im.used[b])
+            map[z >> 3] &= ~(1 << (z & 7));
+    }
+    image_pwrite(&im, map, zmap * im.bsize, (uint64_t)(2 + imap) * im.bsize);
+    free(map);
+
+    if (version == 3) {
+        put32(sb + 0, ninodes, e);
+        put16(sb + 6, imap, e);
+        put16(sb + 8, zmap, e);
+        put16(sb + 10, firstdata, e);
+        put32(sb + 16, 0x7fffffff, e);
+        put32(sb + 20, im.nblocks, e);
+        put16(sb + 24, 0x4d5a, e);
+        put16(sb + 28, im.bsize, e);
+    } else {
+        put16(sb + 0, ninodes, e);
+        put16(sb + 2, (version == 1) ? im.nblocks : 0, e);
+        put16(sb + 4, imap, e);
+        put16(sb + 6, zmap, e);
+        put16(sb + 8, firstdata, e);
+        put32(sb + 12, (version == 1) ? (7 + 512 + 512 * 512) * 1024 :
+                                        0x7fffffff, e);
+        put16(sb + 16, (version == 1) ? 0x137f : 0x2468, e);
+        put16(sb + 18, 1, e);                          /* MINIX_VALID_FS */
+        put32(sb + 20, (version == 1) ? 0 : im.nblocks, e);
+    }
+
+    image_pwrite(&im, sb, sizeof(sb), 1024);
+    image_close(&im);
+}
+
+/*
+ * UFS1 (4.4BSD) and UFS2: 8K blocks of 1K fragments in a single cylinder
+ * group; root inode 2. The superblock, inodes, directories and summary
+ * totals are all there, which is what a read-only mount looks at; the
+ * cylinder group maps are not written.
+ */
+static void
+mk_ufs(int ufs2)
+{
+    struct image im = { 0 };
+    const uint32_t bsize = 8192, fsize = 1024, frag = bsize / fsize;
+    uint64_t deep[3], addr[15], sboff, fssize, dblkno;
+    uint32_t i, ipg, isz, inopb, sblkno, cblkno, iblkno, ndirs = 0;
+    uint8_t  sb[2048] = { 0 };
+    uint64_t genrng = opt.seed ^ 0xa0761d6478bd642fULL;
+    int      e;
+
+    e = im.endian = (opt.endian == E_BIG) ? E_BIG : E_LITTLE;
+    if (opt.endian == E_PDP)
+        fprintf(stderr, "*** warning: UFS images are little or big endian\n");
+
+    isz = ufs2 ? 256 : 128;
+    inopb = bsize / isz;
+    im.bsize = bsize;
+    im.ndirect = 12;
+    im.nlevels = 3;
+    im.addrsize = ufs2 ? 8 : 4;
+    im.nindir = bsize / im.addrsize;
+    im.scale = frag;
+
+    tree_build(deep, image_deep_sizes(&im, deep));
+
+    ipg = 2 + nnodes + nnodes / 16 + inopb;
+    ipg -= ipg % inopb;
+
+    /* sizes and locations below are in fragments */
+    sboff = ufs2 ? 65536 : 8192;
+    sblkno = sboff / fsize;
+    cblkno = sblkno + frag;
+    iblkno = cblkno + frag;
+    dblkno = iblkno + (uint64_t)ipg / inopb * frag;
+
+    dir_ufs(2, e);
+
+    /* the block after the inodes holds the cylinder summary */
+    image_size(&im, dblkno / frag + 1);
+    fssize = im.nblocks * frag;
+    if (!ufs2 && fssize > UINT32_MAX)
+        fatal("%s addresses at most %u fragments", opt.type, UINT32_MAX);
+    im.first = dblkno / frag + 1;
+    image_open(&im);
+
+    for (i = 0; i < norder; i++) {
+        uint32_t n = order[i];
+        uint8_t  di[256] = { 0 };
+        uint64_t blocks = image_map(&im, n, addr) * (bsize / 512);
+        int j;
+
+        if (nodes[n].isdir)
+            ndirs++;
+
+        put16(di + 0, node_mode(n), e);
+        put16(di + 2, node_nlink(n), e);
+        if (ufs2) {
+            put32(di + 12, bsize, e);
+            put64(di + 16, nodes[n].size, e);
+            put64(di + 24, blocks, e);
+            put64(di + 32, MKIMAGE_TIME, e);
+            put64(di + 40, MKIMAGE_TIME, e);
+            put64(di + 48, MKIMAGE_TIME, e);
+            put64(di + 56, MKIMAGE_TIME, e);
+            put32(di + 80, (uint32_t)xorshift64(&genrng), e);
+            for (j = 0; j < 15; j++)
+                put64(di + 112 + j * 8, addr[j], e);
+        } else {
+            put64(di + 8, nodes[n].size, e);
+            put32(di + 16, MKIMAGE_TIME, e);
+            put32(di + 24, MKIMAGE_TIME, e);
+            put32(di + 32, MKIMAGE_TIME, e);
+            for (j = 0; j < 15; j++)
+                put32(di + 40 + j * 4, addr[j], e);
+            put32(di + 104, blocks, e);
+            put32(di + 108, (uint32_t)xorshift64(&genrng), e);
+        }
+
+        image_pwrite(&im, di, isz,
+                     (uint64_t)iblkno * fsize + (uint64_t)(2 + n) * isz);
+    }
+
+    uint64_t nbfree = image_nfree(&im);
+    uint32_t nifree = ipg - 2 - nnodes;
+    uint8_t  cs[16] = { 0 };
+
+    put32(cs + 0, ndirs, e);
+    put32(cs + 4, nbfree, e);
+    put32(cs + 8, nifree, e);
+    image_pwrite(&im, cs, sizeof(cs), dblkno * fsize);
+
+    put32(sb + 8, sblkno, e);
+    put32(sb + 12, cblkno, e);
+    put32(sb + 16, iblkno, e);
+    put32(sb + 20, dblkno, e);
+    put32(sb + 28, 0xffffffff, e);                     /* cgmask */
+    put32(sb + 32, MKIMAGE_TIME, e);
+    put32(sb + 36, fssize, e);
+    put32(sb + 40, fssize - dblkno, e);
+    put32(sb + 44, 1, e);                              /* ncg */
+    put32(sb + 48, bsize, e);
+    put32(sb + 52, fsize, e);
+    put32(sb + 56, frag, e);
+    put32(sb + 60, 8, e);                              /* minfree */
+    put32(sb + 68, 60, e);                             /* rps */
+    put32(sb + 72, ~(bsize - 1), e);
+    put32(sb + 76, ~(fsize - 1), e);
+    put32(sb + 80, 13, e);                             /* bshift */
+    put32(sb + 84, 10, e);                             /* fshift */
+    put32(sb + 88, 1, e);                              /* maxcontig */
+    put32(sb + 92, im.nindir, e);                      /* maxbpg */
+    put32(sb + 96, 3, e);                              /* fragshift */
+    put32(sb + 100, 1, e);                             /* fsbtodb */
+    put32(sb + 104, sizeof(sb), e);
+    put32(sb + 108, ~(fsize - 1), e);                  /* csmask */
+    put32(sb + 112, 10, e);                            /* csshift */
+    put32(sb + 116, im.nindir, e);
+    put32(sb + 120, inopb, e);
+    put32(sb + 124, fsize / 512, e);                   /* nspf */
+    put32(sb + 136, 1, e);                             /* interleave */
+    put32(sb + 152, dblkno, e);                        /* csaddr */
+    put32(sb + 156, fsize, e);                         /* cssize */
+    put32(sb + 160, bsize, e);                         /* cgsize */
+    put32(sb + 164, 1, e);                             /* ntrak */
+    put32(sb + 168, fssize * (fsize / 512), e);        /* nsect */
+    put32(sb + 172, fssize * (fsize / 512), e);        /* spc */
+    put32(sb + 176, 1, e);                             /* ncyl */
+    put32(sb + 180, 1, e);                             /* cpg */
+    put32(sb + 184, ipg, e);
+    put32(sb + 188, fssize, e);                        /* fpg */
+    put32(sb + 192, ndirs, e);
+    put32(sb + 196, nbfree, e);
+    put32(sb + 200, nifree, e);
+    sb[209] = 1;                                       /* FS_CLEAN */
+
+    if (ufs2) {
+        memcpy(sb + 680, "mkimage", 7);                /* volname */
+        put32(sb + 860, bsize, e);                     /* maxbsize */
+        put64(sb + 1000, sboff, e);                    /* sblockloc */
+        put64(sb + 1008, ndirs, e);
+        put64(sb + 1016, nbfree, e);
+        put64(sb + 1024, nifree, e);
+        put64(sb + 1072, MKIMAGE_TIME, e);
+        put64(sb + 1080, fssize, e);
+        put64(sb + 1088, fssize - dblkno, e);
+        put64(sb + 1096, dblkno, e);                   /* csaddr */
+    }
+
+    put32(sb + 1320, ufs2 ? 120 : 60, e);              /* maxsymlinklen */
+    put32(sb + 1324, 2, e);                            /* FS_44INODEFMT */
+    put64(sb + 1328, (uint64_t)1 << 40, e);            /* maxfilesize */
+    put64(sb + 1336, bsize - 1, e);                    /* qbmask */
+    put64(sb + 1344, fsize - 1, e);                    /* qfmask */
+    put32(sb + 1356, 1, e);                            /* FS_DYNAMICPOSTBLFMT */
+    put32(sb + 1360, 1, e);                            /* nrpos */
+    put32(sb + 1372, ufs2 ? 0x19540119 : 0x00011954, e);
+
+    image_pwrite(&im, sb, sizeof(sb), sboff);
+    image_close(&im);
+}
+
+/* Archives are written front to back through a small buffer. */
+
+struct out {
+    int      fd;
+    uint64_t off;
+    size_t   len;
+    uint8_t  buf[65536];
+};
+
+static void
+out_flush(struct out* o)
+{
+    if (o->len && write(o->fd, o->buf, o->len) != (ssize_t)o->len)
+        fatal("%s: %s", opt.output, strerror(errno));
+    o->len = 0;
+}
+
+static void
+out_write(struct out* o, const void* p, size_t n)
+{
+    const uint8_t* q = p;
+
+    while (n) {
+        size_t chunk = sizeof(o->buf) - o->len;
+        if (chunk > n)
+            chunk = n;
+        if (q)
+            memcpy(o->buf + o->len, q, chunk);
+        else
+            memset(o->buf + o->len, 0, chunk);
+        o->len += chunk;
+        o->off += chunk;
+        n -= chunk;
+        if (q)
+            q += chunk;
+        if (o->len == sizeof(o->buf))
+            out_flush(o);
+    }
+}
+
+static void
+out_align(struct out* o, size_t align)
+{
+    if (o->off % align)
+        out_write(o, NULL, align - o->off % align);
+}
+
+static void
+out_data(struct out* o, uint32_t n)
+{
+    uint8_t  sector[SECTOR];
+    uint64_t off;
+
+    for (off = 0; off < nodes[n].size; off += SECTOR) {
+        uint64_t left = nodes[n].size - off;
+        node_read(n, sector, SECTOR, off);
+        out_write(o, sector, left < SECTOR ? left : SECTOR);
+    }
+}
+
+static struct out*
+out_open(void)
+{
+    struct out* o = calloc(1, sizeof(struct out));
+    if (!o)
+        fatal("out of memory");
+
+    o->fd = open(opt.output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (o->fd < 0)
+        fatal("%s: %s", opt.output, strerror(errno));
+
+    return o;
+}
+
+static void
+out_close(struct out* o)
+{
+    out_flush(o);
+    if (close(o->fd) != 0)
+        fatal("%s: %s", opt.output, strerror(errno));
+    free(o);
+}
+
+/*
+ * tar: V7 tar has no magic and marks directories with a trailing slash;
+ * ustar adds a magic and a type flag, and splits long names into a prefix
+ * and a name. ancientfs cannot infer directories, so both get entries.
+ */
+static void
+mk_tar(int ustar)
+{
+    struct out* o;
+    uint32_t i;
+
+    tree_build(NULL, 0);
+    o = out_open();
+
+    for (i = 1; i < norder; i++) {
+        uint32_t n = order[i];
+        uint8_t  h[512] = { 0 };
+        char     path[1024];
+        size_t   len = tree_path(n, path, sizeof(path) - 1);
+        unsigned sum = 0;
+        int j;
+
+        if (nodes[n].isdir) {
+            path[len++] = '/';
+            path[len] = '\0';
+        }
+
+        if (len <= 100) {
+            memcpy(h, path, len);
+        } else {
+            char* slash = ustar ? path + len - 101 : NULL;
+            while (slash && *slash && *slash != '/')
+                slash++;
+            if (!slash || (size_t)(slash - path) > 155)
+                fatal("%s: name too long for %s", path, opt.type);
+            memcpy(h + 345, path, slash - path);
+            memcpy(h, slash + 1, len - (slash - path) - 1);
+        }
+
+        if (nodes[n].size > 077777777777ULL)
+            fatal("%s: too large for %s", path, opt.type);
+
+        snprintf((char*)h + 100, 8, "%07o", node_mode(n) & 07777);
+        snprintf((char*)h + 108, 8, "%07o", 0);
+        snprintf((char*)h + 116, 8, "%07o", 0);
+        snprintf((char*)h + 124, 12, "%011llo",
+                 (unsigned long long)(nodes[n].isdir ? 0 : nodes[n].size));
+        snprintf((char*)h + 136, 12, "%011o", MKIMAGE_TIME);
+        h[156] = nodes[n].isdir ? '5' : '0';
+        if (ustar) {
+            memcpy(h + 257, "ustar", 6);
+            memcpy(h + 263, "00", 2);
+            snprintf((char*)h + 329, 8, "%07o", 0);
+            snprintf((char*)h + 337, 8, "%07o", 0);
+        }
+
+        memset(h + 148, ' ', 8);
+        for (j = 0; j < 512; j++)
+            sum += h[j];
+        snprintf((char*)h + 148, 8, "%06o", sum);
+
+        out_write(o, h, sizeof(h));
+        if (!nodes[n].isdir) {
+            out_data(o, n);
+            out_align(o, 512);
+        }
+    }
+
+    out_write(o, NULL, 1024);
+    out_align(o, 10240);
+    out_close(o);
+}
+
+/* cpio: odc and newc are ASCII, bcpio is binary 16-bit words. */
+
+enum { CPIO_ODC, CPIO_NEWC, CPIO_BIN };
+
+static void
+cpio_entry(struct out* o, int kind, int e, uint32_t n, const char* name)
+{
+    size_t   namesize = strlen(name) + 1;
+    uint64_t size = (n == UINT32_MAX || nodes[n].isdir) ? 0 : nodes[n].size;
+    uint32_t ino = (n == UINT32_MAX) ? 0 : 1 + n;
+    uint16_t mode = (n == UINT32_MAX) ? 0 : node_mode(n);
+    uint16_t nlink = (n == UINT32_MAX) ? 1 : node_nlink(n);
+    uint32_t mtime = (n == UINT32_MAX) ? 0 : MKIMAGE_TIME;
+    char     h[112];
+    unsigned align = 1;
+
+    switch (kind) {
+
+    case CPIO_ODC:
+        if (ino > 0777777 || size > 077777777777ULL)
+            fatal("%s: too large for %s", name, opt.type);
+        snprintf(h, sizeof(h),
+                 "070707%06o%06o%06o%06o%06o%06o%06o%011o%06o%011llo",
+                 0, ino, mode, 0, 0, nlink, 0, mtime, (unsigned)namesize,
+                 (unsigned long long)size);
+        out_write(o, h, 76);
+        out_write(o, name, namesize);
+        break;
+
+    case CPIO_NEWC:
+        if (size > UINT32_MAX)
+            fatal("%s: too large for %s", name, opt.type);
+        snprintf(h, sizeof(h),
+                 "070701%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X",
+                 ino, mode, 0, 0, nlink, mtime, (unsigned)size, 0, 0, 0, 0,
+                 (unsigned)namesize, 0);
+        out_write(o, h, 110);
+        out_write(o, name, namesize);
+        align = 4;
+        break;
+
+    case CPIO_BIN: {
+        uint8_t b[26] = { 0 };
+        if (ino > 65535 || size > UINT32_MAX)
+            fatal("%s: too large for %s", name, opt.type);
+        put16(b + 0, 070707, e);
+        put16(b + 4, ino, e);
+        put16(b + 6, mode, e);
+        put16(b + 12, nlink, e);
+        put16(b + 16, mtime >> 16, e);
+        put16(b + 18, mtime, e);
+        put16(b + 20, namesize, e);
+        put16(b + 22, size >> 16, e);
+        put16(b + 24, size, e);
+        out_write(o, b, sizeof(b));
+        out_write(o, name, namesize);
+        align = 2;
+        break;
+    }
+    }
+
+    out_align(o, align);
+    if (size) {
+        out_data(o, n);
+        out_align(o, align);
+    }
+}
+
+static void
+mk_cpio(int kind)
+{
+    struct out* o;
+    char path[1024];
+    uint32_t i;
+    int e = (opt.endian >= 0) ? opt.endian : E_LITTLE;
+
+    if (e == E_PDP)
+        e = E_LITTLE;
+
+    tree_build(NULL, 0);
+    o = out_open();
+
+    cpio_entry(o, kind, e, 0, ".");
+    for (i = 1; i < norder; i++) {
+        (void)tree_path(order[i], path, sizeof(path));
+        cpio_entry(o, kind, e, order[i], path);
+    }
+    cpio_entry(o, kind, e, UINT32_MAX, "TRAILER!!!");
+
+    out_align(o, 512);
+    out_close(o);
+}
+
+/*
+ * dump: a tape label, the map of dumped inodes, then each inode's header
+ * followed by its data records, and an end marker; records are 512 or
+ * 1024 bytes, the tape is written in 10K blocks. Directories are in the
+ * V7 format, root inode 2.
+ */
+
+#define DUMP_MAGIC    60011
+#define DUMP_CHECKSUM 84446
+
+enum { TS_TAPE = 1, TS_INODE, TS_BITS, TS_ADDR, TS_END };
+
+static void
+dump_header(struct out* o, unsigned rec, int e, int type, uint32_t n,
+            uint32_t count)
+{
+    uint8_t  h[1024] = { 0 };
+    uint16_t sum = 0;
+    unsigned i;
+
+    put16(h + 0, type, e);
+    put32(h + 2, MKIMAGE_TIME, e);                     /* c_date */
+    put32(h + 6, MKIMAGE_TIME, e);                     /* c_ddate */
+    put16(h + 10, 1, e);                               /* c_volume */
+    put32(h + 12, o->off / rec, e);                    /* c_tapea */
+    put16(h + 18, DUMP_MAGIC, e);
+
+    if (type == TS_INODE || type == TS_ADDR) {
+        put16(h + 16, 2 + n, e);                       /* c_inumber */
+        put16(h + 22, node_mode(n), e);
+        put16(h + 24, node_nlink(n), e);
+        put32(h + 30, nodes[n].size, e);
+        put32(h + 74, MKIMAGE_TIME, e);
+        put32(h + 78, MKIMAGE_TIME, e);
+        put32(h + 82, MKIMAGE_TIME, e);
+    }
+
+    put16(h + 86, count, e);                           /* c_count */
+    for (i = 0; i < count && type != TS_BITS; i++)
+        h[88 + i] = 1;
+
+    for (i = 0; i < rec; i += 2)
+        sum += (e == E_BIG) ? (h[i] << 8 | h[i + 1]) : (h[i] | h[i + 1] << 8);
+    put16(h + 20, (uint16_t)(DUMP_CHECKSUM - sum), e);
+
+    out_write(o, h, rec);
+}
+
+static void
+mk_dump(int rec)
+{
+    struct out* o;
+    uint8_t* map;
+    uint32_t i, maprecs;
+    int e = (opt.endian >= 0) ? opt.endian : E_PDP;
+
+    tree_build(NULL, 0);
+    if (nnodes + 1 > 65535)
+        fatal("%s holds at most 65535 inodes", opt.type);
+
+    dir_fixed(2, 2, 14, e);
+    o = out_open();
+
+    dump_header(o, rec, e, TS_TAPE, 0, 0);
+
+    /* one bit per inode, in 16-bit words */
+    maprecs = ((nnodes + 1) / 8 + 1 + rec - 1) / rec;
+    map = calloc(maprecs, rec);
+    if (!map)
+        fatal("out of memory");
+    for (i = 0; i < nnodes; i++) {
+        uint32_t bit = 1 + i;                          /* inode 2 + i */
+        uint32_t w = bit / 16;
+        uint16_t v = (e == E_BIG) ? (map[w * 2] << 8 | map[w * 2 + 1]) :
+                                    (map[w * 2] | map[w * 2 + 1] << 8);
+        put16(map + w * 2, v | (1 << (bit % 16)), e);
+    }
+    dump_header(o, rec, e, TS_BITS, 0, maprecs);
+    out_write(o, map, (size_t)maprecs * rec);
+    free(map);
+
+    /* inode order: directories come first, as dump writes them */
+    for (i = 0; i < nnodes; i++) {
+        uint64_t nrec = (nodes[i].size + rec - 1) / rec, r = 0;
+        uint8_t* buf = malloc(rec);
+        int type = TS_INODE;
+
+        if (!buf)
+            fatal("out of memory");
+
+        do {
+            uint32_t count = (nrec - r > (uint64_t)rec - 88) ? rec - 88 : nrec - r;
+            uint32_t j;
+            dump_header(o, rec, e, type, i, count);
+            for (j = 0; j < count; j++, r++) {
+                node_read(i, buf, rec, r * rec);
+                out_write(o, buf, rec);
+            }
+            type = TS_ADDR;
+        } while (r < nrec);
+
+        free(buf);
+    }
+
+    dump_header(o, rec, e, TS_END, 0, 0);
+    out_align(o, 10240);
+    out_close(o);
+}
+
+static uint64_t
+parse_size(const char* s)
+{
+    char* end;
+    uint64_t v = strtoull(s, &end, 0);
+
+    switch (*end) {
+    case 'k': case 'K': v <<= 10; end++; break;
+    case 'm': case 'M': v <<= 20; end++; break;
+    case 'g': case 'G': v <<= 30; end++; break;
+    }
+
+    if (*end != '\0' && *end != ':')
+        fatal("bad size '%s'", s);
+
+    return v;
+}
+
+static void
+parse_dist(const char* s)
+{
+    const char* colon = strchr(s, ':');
+
+    if (!colon)
+        fatal("bad size distribution '%s'", s);
+
+    if (strncmp(s, "fixed:", 6) == 0) {
+        opt.dist = DIST_FIXED;
+        opt.dist_a = parse_size(colon + 1);
+    } else if (strncmp(s, "exp:", 4) == 0) {
+        opt.dist = DIST_EXP;
+        opt.dist_a = parse_size(colon + 1);
+    } else if (strncmp(s, "uniform:", 8) == 0) {
+        const char* colon2 = strchr(colon + 1, ':');
+        if (!colon2)
+            fatal("bad size distribution '%s'", s);
+        opt.dist = DIST_UNIFORM;
+        opt.dist_a = parse_size(colon + 1);
+        opt.dist_b = parse_size(colon2 + 1);
+        if (opt.dist_b < opt.dist_a)
+            fatal("bad size distribution '%s'", s);
+    } else {
+        fatal("bad size distribution '%s'", s);
+    }
+}
+
+static const struct {
+    const char* name;
+    void      (*make)(int);
+    int         arg;
+    const char* what;
+} formats[] = {
+    { "v7",        mk_s5,    0,         "V7 file system (ancientfs v7)" },
+    { "sysv",      mk_s5,    1,         "System V file system (sysvfs)" },
+    { "minix",     mk_minix, 1,         "Minix V1 file system (minixfs)" },
+    { "minix2",    mk_minix, 2,         "Minix V2 file system (minixfs)" },
+    { "minix3",    mk_minix, 3,         "Minix V3 file system (minixfs)" },
+    { "ufs",       mk_ufs,   0,         "UFS1 file system (ufs 44bsd)" },
+    { "ufs2",      mk_ufs,   1,         "UFS2 file system (ufs ufs2)" },
+    { "tar",       mk_tar,   0,         "V7 tar archive (ancientfs tar)" },
+    { "ustar",     mk_tar,   1,         "ustar archive (ancientfs tar)" },
+    { "cpio_odc",  mk_cpio,  CPIO_ODC,  "odc cpio archive (ancientfs)" },
+    { "cpio_newc", mk_cpio,  CPIO_NEWC, "newc cpio archive (ancientfs)" },
+    { "bcpio",     mk_cpio,  CPIO_BIN,  "binary cpio archive (ancientfs)" },
+    { "dump",      mk_dump,  512,  "dump tape (ancientfs)" },
+    { "dump1k",    mk_dump,  1024, "dump1k tape (ancientfs)" },
+    { NULL, NULL, 0, NULL },
+};
+
+static void
+usage(const char* progname)
+{
+    int i;
+
+    fprintf(stderr,
+    "usage: %s -t TYPE -o IMAGE [-n FILES] [-f FANOUT] [-s DIST] [-F PCT]\n"
+    "          [-d DEPTH] [-S SEED] [-E ENDIAN] [-m SIZE]\n"
+    "     . TYPE is one of:\n", progname);
+    for (i = 0; formats[i].name; i++)
+        fprintf(stderr, "         %-10s %s\n", formats[i].name,
+                formats[i].what);
+    fprintf(stderr,
+    "     . FILES is the number of regular files (default 1000)\n"
+    "     . FANOUT is the most files, and subdirectories, in a directory\n"
+    "       (default 16)\n"
+    "     . DIST is the file size distribution: fixed:N, uniform:MIN:MAX\n"
+    "       or exp:MEAN; sizes take k, m or g (default exp:16k)\n"
+    "     . PCT is the percentage of block allocations that jump to a\n"
+    "       random place, scattering files over the image (default 0)\n"
+    "     . DEPTH adds sparse files that need 1 up to DEPTH levels of\n"
+    "       indirect blocks (default 0; ignored for archives)\n"
+    "     . SEED seeds everything; same seed, same image (default 1)\n"
+    "     . ENDIAN is le, be or pdp where the format allows a choice\n"
+    "     . SIZE is the image size; by default it is just large enough\n");
+    exit(1);
+}
+
+int
+main(int argc, char** argv)
+{
+    int ch, i;
+
+    while ((ch = getopt(argc, argv, "d:E:F:f:m:n:o:S:s:t:")) != -1) {
+        switch (ch) {
+        case 'd': opt.depth = atoi(optarg); break;
+        case 'F': opt.frag = atoi(optarg); break;
+        case 'f': opt.fanout = strtoul(optarg, NULL, 0); break;
+        case 'm': opt.size = parse_size(optarg); break;
+        case 'n': opt.nfiles = strtoul(optarg, NULL, 0); break;
+        case 'o': opt.output = optarg; break;
+        case 'S': opt.seed = strtoull(optarg, NULL, 0); break;
+        case 's': parse_dist(optarg); break;
+        case 't': opt.type = optarg; break;
+        case 'E':
+            if (strcmp(optarg, "le") == 0)
+                opt.endian = E_LITTLE;
+            else if (strcmp(optarg, "be") == 0)
+                opt.endian = E_BIG;
+            else if (strcmp(optarg, "pdp") == 0)
+                opt.endian = E_PDP;
+            else
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (!opt.type || !opt.output || opt.fanout == 0 || opt.frag > 100 ||
+        opt.depth > 3)
+        usage(argv[0]);
+
+    if (opt.seed == 0)
+        opt.seed = 1;
+
+    for (i = 0; formats[i].name; i++) {
+        if (strcmp(opt.type, formats[i].name) == 0) {
+            formats[i].make(formats[i].arg);
+            return 0;
+        }
+    }
+
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,699 @@
+/*
+ * UnixFS
+ *
+ * Replays a trace recorded with --record against a file system flavor.
+ *
+ * Like unixfs_bench, this takes the place of unixfs.c's main() and drives
+ * the flavor's unixfs_ops directly, with no kernel or FUSE in the way. Each
+ * request in the trace is turned into the unixfs_ops calls the lowlevel
+ * front end would have made for it:
+ *
+ *   lookup     namei
+ *   getattr    igetattr
+ *   readlink   readlink
+ *   statfs     statvfs
+ *   opendir    iget and istat, then nextdirentry for every entry, with the
+ *              children loaded in batches through igetv (or igetattr one
+ *              by one where there is no igetv, or it fails)
+ *   open       iget, kept under the traced file handle
+ *   read       pbread through the inode opened under the same handle
+ *   release    iput of that inode
+ *
+ * readdir and releasedir only copy out or free what opendir built, so they
+ * are counted but cost nothing here. Requests against /.unixfs-stats are
+ * skipped.
+ *
+ * Requests are started in the order they were started when recorded, by a
+ * pool of worker threads. By default each worker takes the next request as
+ * soon as it is free; with a speed, requests are held back until their
+ * recorded start time (divided by the speed) has come. Per-operation
+ * latencies are reported next to the ones that were recorded, which
+ * include the kernel round trip and so are never smaller.
+ *
+ * Copyright (c) 2008 Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ */
+
+#include "unixfs.h"
+#include "unixfs_internal.h"
+#include "unixfs_trace.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define REPLAY_STATS_INO ((uint64_t)-2) /* see unixfs.c */
+
+static struct unixfs* unixfs;
+
+struct request {
+    struct unixfs_trace_record tr;
+    char*                      name;
+    size_t                     index;
+};
+
+static struct request* requests;
+static size_t          nrequests;
+static size_t          next_request;
+static double          speed;
+static uint64_t        replay_start;
+
+struct samples {
+    uint64_t* ns;
+    size_t    count;
+    size_t    capacity;
+};
+
+struct worker {
+    pthread_t      thread;
+    struct samples replayed[UNIXFS_STATS_NOPS];
+    char*          buf;
+    size_t         bufsize;
+    size_t         failed;
+};
+
+/*
+ * Open files by traced handle. Workers may pick up a read before another
+ * worker has finished the open it depends on, so a missing handle is
+ * opened on the spot rather than treated as an error.
+ */
+
+struct handle {
+    uint64_t      fh;
+    uint64_t      ino;
+    struct inode* ip;
+    int           refs;
+};
+
+static pthread_mutex_t handles_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct handle*  handles;
+static size_t          handles_capacity; /* power of 2 */
+static size_t          nhandles;
+
+static uint64_t
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void*
+grow(void* p, size_t* capacity, size_t count, size_t elemsize)
+{
+    if (count < *capacity)
+        return p;
+
+    *capacity = *capacity ? *capacity * 2 : 1024;
+    p = realloc(p, *capacity * elemsize);
+    if (!p) {
+        fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+        abort();
+    }
+
+    return p;
+}
+
+static void
+sample(struct samples* s, uint64_t ns)
+{
+    s->ns = grow(s->ns, &s->capacity, s->count, sizeof(uint64_t));
+    s->ns[s->count++] = ns;
+}
+
+static int
+compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int
+compare_requests(const void* a, const void* b)
+{
+    const struct request* x = a;
+    const struct request* y = b;
+
+    if (x->tr.tr_begin != y->tr.tr_begin)
+        return (x->tr.tr_begin > y->tr.tr_begin) ? 1 : -1;
+
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+static double
+percentile_us(struct samples* s, double p)
+{
+    size_t i = (size_t)(p * (double)(s->count - 1) + 0.5);
+    return (double)s->ns[i] / 1000.0;
+}
+
+static struct handle*
+handle_slot(uint64_t fh)
+{
+    size_t i = (size_t)(fh * 0x9e3779b97f4a7c15ULL) & (handles_capacity - 1);
+
+    while (handles[i].fh && handles[i].fh != fh)
+        i = (i + 1) & (handles_capacity - 1);
+
+    return &handles[i];
+}
+
+static void
+handle_rehash(void)
+{
+    struct handle* old = handles;
+    size_t i, oldcapacity = handles_capacity;
+
+    handles_capacity = oldcapacity ? oldcapacity * 2 : 1024;
+    handles = calloc(handles_capacity, sizeof(struct handle));
+    if (!handles) {
+        fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+        abort();
+    }
+
+    for (i = 0; i < oldcapacity; i++)
+        if (old[i].fh)
+            *handle_slot(old[i].fh) = old[i];
+
+    free(old);
+}
+
+/* Returns the inode open under fh, opening ino if need be, referenced. */
+static struct inode*
+handle_get(uint64_t fh, uint64_t ino)
+{
+    struct handle* h;
+    struct inode* ip;
+
+    pthread_mutex_lock(&handles_lock);
+    if ((nhandles + 1) * 2 > handles_capacity)
+        handle_rehash();
+    h = handle_slot(fh);
+    if (!h->fh) {
+        h->ip = unixfs->ops->iget((ino_t)ino);
+        if (!h->ip) {
+            pthread_mutex_unlock(&handles_lock);
+            return NULL;
+        }
+        h->fh = fh;
+        h->ino = ino;
+        nhandles++;
+    }
+    h->refs++;
+    ip = h->ip;
+    pthread_mutex_unlock(&handles_lock);
+
+    return ip;
+}
+
+/* Drops a reference; the last one closes the file. */
+static void
+handle_put(uint64_t fh)
+{
+    struct handle* h;
+    struct inode* ip = NULL;
+
+    pthread_mutex_lock(&handles_lock);
+    h = handles_capacity ? handle_slot(fh) : NULL;
+    if (h && h->fh) {
+        if (--h->refs <= 0) {
+            ip = h->ip;
+            /* backward-shift delete keeps the probe chains intact */
+            size_t i = h - handles, j = i;
+            for (;;) {
+                j = (j + 1) & (handles_capacity - 1);
+                if (!handles[j].fh)
+                    break;
+                size_t k = (size_t)(handles[j].fh * 0x9e3779b97f4a7c15ULL) &
+                           (handles_capacity - 1);
+                if ((j > i && (k <= i || k > j)) ||
+                    (j < i && (k <= i && k > j))) {
+                    handles[i] = handles[j];
+                    i = j;
+                }
+            }
+            memset(&handles[i], 0, sizeof(struct handle));
+            nhandles--;
+        }
+    }
+    pthread_mutex_unlock(&handles_lock);
+
+    if (ip)
+        unixfs->ops->iput(ip);
+}
+
+/* the same batches as unixfs_ll_addentries(), minus the reply buffer */
+static void
+replay_getentries(ino_t* inos, struct inode** ips, int count)
+{
+    int i;
+    struct stat stbuf;
+
+    if (unixfs->ops->igetv && unixfs->ops->igetv(inos, count, ips) >= 0) {
+        for (i = 0; i < count; i++) {
+            if (!ips[i])
+                continue;
+            unixfs->ops->istat(ips[i], &stbuf);
+            unixfs->ops->iput(ips[i]);
+        }
+        return;
+    }
+
+    for (i = 0; i < count; i++)
+        (void)unixfs->ops->igetattr(inos[i], &stbuf);
+}
+
+/* the same walk as unixfs_ll_opendir() */
+static int
+replay_opendir(uint64_t ino)
+{
+    struct inode* dp = unixfs->ops->iget((ino_t)ino);
+    if (!dp)
+        return ENOENT;
+
+    struct stat stbuf;
+    unixfs->ops->istat(dp, &stbuf);
+
+    if (!S_ISDIR(stbuf.st_mode)) {
+        unixfs->ops->iput(dp);
+        return ENOTDIR;
+    }
+
+    ino_t* inos = malloc(UNIXFS_READDIR_BATCH * sizeof(ino_t));
+    struct inode** ips = malloc(UNIXFS_READDIR_BATCH * sizeof(struct inode*));
+
+    if (!inos || !ips) {
+        unixfs->ops->iput(dp);
+        free(inos);
+        free(ips);
+        return ENOMEM;
+    }
+
+    struct unixfs_dirbuf dirbuf;
+    struct unixfs_direntry dent;
+    off_t offset = 0;
+
+    dirbuf.flags.initialized = 0;
+
+    int more = 1;
+
+    while (more) {
+        int count = 0;
+        while (count < UNIXFS_READDIR_BATCH) {
+            if (unixfs->ops->nextdirentry(dp, &dirbuf, &offset, &dent) != 0) {
+                more = 0;
+                break;
+            }
+            if (dent.ino == 0)
+                continue;
+            inos[count++] = dent.ino;
+        }
+        if (count)
+            replay_getentries(inos, ips, count);
+    }
+
+    unixfs->ops->iput(dp);
+
+    free(inos);
+    free(ips);
+
+    return 0;
+}
+
+/* the same read loop as unixfs_ll_read() */
+static int
+replay_read(struct worker* w, const struct unixfs_trace_record* tr)
+{
+    struct inode* ip = handle_get(tr->tr_fh, tr->tr_ino);
+    if (!ip)
+        return ENOENT;
+
+    struct stat stbuf;
+    unixfs->ops->istat(ip, &stbuf);
+
+    size_t count = tr->tr_size;
+    off_t offset = (off_t)tr->tr_offset;
+
+    if (offset >= stbuf.st_size)
+        count = 0;
+    else if (offset + (off_t)count > stbuf.st_size)
+        count = stbuf.st_size - offset;
+
+    if (count > w->bufsize) {
+        free(w->buf);
+        w->buf = malloc(count);
+        w->bufsize = w->buf ? count : 0;
+        if (!w->buf) {
+            handle_put(tr->tr_fh);
+            return ENOMEM;
+        }
+    }
+
+    int error = 0;
+    size_t nbytes = 0;
+
+    while (count) {
+        ssize_t ret = unixfs->ops->pbread(ip, w->buf + nbytes, count, offset,
+                                          &error);
+        if (ret < 0)
+            break;
+        count -= ret;
+        offset += ret;
+        nbytes += ret;
+        if (error)
+            break;
+    }
+
+    handle_put(tr->tr_fh);
+
+    return error;
+}
+
+static int
+replay(struct worker* w, const struct request* r)
+{
+    const struct unixfs_trace_record* tr = &r->tr;
+    struct stat stbuf;
+
+    switch (tr->tr_op) {
+
+    case UNIXFS_STATS_STATFS: {
+        struct statvfs sv;
+        unixfs->ops->statvfs(&sv);
+        return 0;
+    }
+
+    case UNIXFS_STATS_LOOKUP:
+        return unixfs->ops->namei((ino_t)tr->tr_ino, r->name, &stbuf);
+
+    case UNIXFS_STATS_GETATTR:
+        return unixfs->ops->igetattr((ino_t)tr->tr_ino, &stbuf);
+
+    case UNIXFS_STATS_READLINK: {
+        char path[UNIXFS_MAXPATHLEN];
+        return unixfs->ops->readlink((ino_t)tr->tr_ino, path);
+    }
+
+    case UNIXFS_STATS_OPENDIR:
+        return replay_opendir(tr->tr_ino);
+
+    case UNIXFS_STATS_READDIR:
+    case UNIXFS_STATS_RELEASEDIR:
+        return 0;
+
+    case UNIXFS_STATS_OPEN:
+        return handle_get(tr->tr_fh, tr->tr_ino) ? 0 : ENOENT;
+
+    case UNIXFS_STATS_RELEASE:
+        handle_put(tr->tr_fh); /* the reference open took */
+        return 0;
+
+    case UNIXFS_STATS_READ:
+        return replay_read(w, tr);
+    }
+
+    return EINVAL;
+}
+
+static void*
+worker_main(void* arg)
+{
+    struct worker* w = (struct worker*)arg;
+
+    for (;;) {
+        size_t i = __atomic_fetch_add(&next_request, 1, __ATOMIC_RELAXED);
+        if (i >= nrequests)
+            break;
+
+        const struct request* r = &requests[i];
+
+        if (speed > 0) {
+            uint64_t due = replay_start +
+                           (uint64_t)((double)r->tr.tr_begin / speed);
+            uint64_t t = now();
+            if (due > t) {
+                struct timespec ts;
+                ts.tv_sec = (due - t) / 1000000000ULL;
+                ts.tv_nsec = (due - t) % 1000000000ULL;
+                while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+                    ;
+            }
+        }
+
+        uint64_t begin = now();
+        int error = replay(w, r);
+        sample(&w->replayed[r->tr.tr_op], now() - begin);
+        if (error && error != ENOENT)
+            w->failed++;
+    }
+
+    return NULL;
+}
+
+static int
+load(const char* path)
+{
+    struct unixfs_trace_header th;
+    size_t capacity = 0;
+
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+
+    if (fread(&th, sizeof(th), 1, fp) != 1 ||
+        memcmp(th.th_magic, UNIXFS_TRACE_MAGIC, sizeof(th.th_magic)) != 0) {
+        fprintf(stderr, "%s is not a UnixFS trace\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    if (th.th_version != UNIXFS_TRACE_VERSION ||
+        th.th_recsize != sizeof(struct unixfs_trace_record)) {
+        fprintf(stderr, "%s: unsupported trace version or byte order\n",
+                path);
+        fclose(fp);
+        return -1;
+    }
+
+    for (;;) {
+        struct request* r;
+
+        requests = grow(requests, &capacity, nrequests,
+                        sizeof(struct request));
+        r = &requests[nrequests];
+
+        if (fread(&r->tr, sizeof(r->tr), 1, fp) != 1)
+            break;
+
+        r->name = calloc(1, (size_t)r->tr.tr_namelen + 1);
+        if (!r->name) {
+            fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+            abort();
+        }
+        if (r->tr.tr_namelen &&
+            fread(r->name, r->tr.tr_namelen, 1, fp) != 1) {
+            free(r->name);
+            fprintf(stderr, "%s: truncated after %zu requests\n", path,
+                    nrequests);
+            break;
+        }
+
+        if (r->tr.tr_op >= UNIXFS_STATS_NOPS ||
+            r->tr.tr_ino == REPLAY_STATS_INO) {
+            free(r->name);
+            continue;
+        }
+
+        r->index = nrequests++;
+    }
+
+    fclose(fp);
+
+    qsort(requests, nrequests, sizeof(struct request), compare_requests);
+
+    printf("%s: %zu requests over %.3f s, recorded on %s\n", path, nrequests,
+           nrequests ? (double)requests[nrequests - 1].tr.tr_begin / 1.0e9 : 0,
+           th.th_fsname[0] ? th.th_fsname : "-");
+
+    return 0;
+}
+
+static void
+report(struct worker* workers, int nworkers, uint64_t elapsed)
+{
+    int op, i;
+    size_t failed = 0;
+
+    printf("%-10s %9s %9s %9s %9s %9s %9s | %9s %9s\n", "op", "ops",
+           "p50 us", "p90 us", "p99 us", "p99.9 us", "max us", "rec p50",
+           "rec p99");
+
+    for (op = 0; op < UNIXFS_STATS_NOPS; op++) {
+        struct samples s, rec;
+        size_t n;
+
+        memset(&s, 0, sizeof(s));
+        memset(&rec, 0, sizeof(rec));
+
+        for (i = 0; i < nworkers; i++) {
+            struct samples* ws = &workers[i].replayed[op];
+            for (n = 0; n < ws->count; n++)
+                sample(&s, ws->ns[n]);
+        }
+
+        if (s.count == 0)
+            continue;
+
+        for (n = 0; n < nrequests; n++)
+            if (requests[n].tr.tr_op == op)
+                sample(&rec, requests[n].tr.tr_elapsed);
+
+        qsort(s.ns, s.count, sizeof(uint64_t), compare_u64);
+        qsort(rec.ns, rec.count, sizeof(uint64_t), compare_u64);
+
+        printf("%-10s %9zu %9.1f %9.1f %9.1f %9.1f %9.1f | %9.1f %9.1f\n",
+               unixfs_stats_opname(op), s.count, percentile_us(&s, 0.50),
+               percentile_us(&s, 0.90), percentile_us(&s, 0.99),
+               percentile_us(&s, 0.999), (double)s.ns[s.count - 1] / 1000.0,
+               percentile_us(&rec, 0.50), percentile_us(&rec, 0.99));
+
+        free(s.ns);
+        free(rec.ns);
+    }
+
+    for (i = 0; i < nworkers; i++)
+        failed += workers[i].failed;
+
+    printf("%zu requests in %.3f s (%.0f/s) with %d worker%s, "
+           "%zu failed\n", nrequests, (double)elapsed / 1.0e9,
+           (double)nrequests / ((double)elapsed / 1.0e9), nworkers,
+           (nworkers == 1) ? "" : "s", failed);
+}
+
+static void
+usage(const char* progname)
+{
+    fprintf(stderr,
+    "usage: %s [--force] [--fsendian pdp|big|little] [--type TYPE]\n"
+    "       [-j WORKERS] [-s SPEED] --dmg DMG TRACE\n"
+    "     . DMG and TYPE are as for the file system itself\n"
+    "     . TRACE was written by the file system's --record option\n"
+    "     . WORKERS is the number of requests in flight (default 1)\n"
+    "     . SPEED of 1 keeps the recorded timing, 2 halves the gaps, and\n"
+    "       so on; 0 replays as fast as possible (default 0)\n",
+    progname);
+    exit(1);
+}
+
+int
+main(int argc, char** argv)
+{
+    char* dmg = NULL;
+    char* type = NULL;
+    char* fsendian = NULL;
+    int force = 0, nworkers = 1, i;
+    int ch;
+
+    static struct option longopts[] = {
+        { "dmg",      required_argument, NULL, 'd' },
+        { "force",    no_argument,       NULL, 'f' },
+        { "fsendian", required_argument, NULL, 'e' },
+        { "type",     required_argument, NULL, 't' },
+        { NULL,       0,                 NULL, 0   },
+    };
+
+    while ((ch = getopt_long(argc, argv, "j:s:", longopts, NULL)) != -1) {
+        switch (ch) {
+        case 'd': dmg = optarg; break;
+        case 'f': force = 1; break;
+        case 'e': fsendian = optarg; break;
+        case 't': type = optarg; break;
+        case 'j': nworkers = atoi(optarg); break;
+        case 's': speed = strtod(optarg, NULL); break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if (!dmg || optind != argc - 1 || nworkers < 1 || speed < 0)
+        usage(argv[0]);
+
+    if (!(unixfs = unixfs_preflight(dmg, &type, &unixfs))) {
+        if (type)
+            fprintf(stderr, "invalid file system type %s\n", type);
+        else
+            fprintf(stderr, "missing file system type\n");
+        return 1;
+    }
+
+    if (force)
+        unixfs->flags |= UNIXFS_FORCE;
+
+    unixfs->fsname = type;
+
+    unixfs->fsendian = UNIXFS_FS_INVALID;
+
+    if (fsendian) {
+        if (strcasecmp(fsendian, "pdp") == 0) {
+            unixfs->fsendian = UNIXFS_FS_PDP;
+        } else if (strcasecmp(fsendian, "big") == 0) {
+            unixfs->fsendian = UNIXFS_FS_BIG;
+        } else if (strcasecmp(fsendian, "little") == 0) {
+            unixfs->fsendian = UNIXFS_FS_LITTLE;
+        } else {
+            fprintf(stderr, "invalid endian type %s\n", fsendian);
+            return 1;
+        }
+    }
+
+    if (load(argv[optind]) != 0)
+        return 1;
+
+    if ((unixfs->filsys =
+        unixfs->ops->init(dmg, unixfs->flags, unixfs->fsendian,
+                          &unixfs->fsname, &unixfs->volname)) == NULL) {
+        fprintf(stderr, "failed to initialize file system\n");
+        return 1;
+    }
+
+    struct worker* workers = calloc(nworkers, sizeof(struct worker));
+    if (!workers) {
+        fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+        return 1;
+    }
+
+    replay_start = now();
+
+    for (i = 0; i < nworkers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_main,
+                           &workers[i]) != 0) {
+            fprintf(stderr, "failed to start worker %d\n", i);
+            nworkers = i;
+            break;
+        }
+    }
+
+    for (i = 0; i < nworkers; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    uint64_t elapsed = now() - replay_start;
+
+    report(workers, nworkers, elapsed);
+
+    /* whatever the trace left open */
+    for (size_t n = 0; n < handles_capacity; n++)
+        if (handles[n].fh)
+            unixfs->ops->iput(handles[n].ip);
+
+    unixfs->ops->fini(unixfs->filsys);
+
+    return 0;
+}
@@ -12,6 +12,7 @@ struct ufs_sb_info {
 	struct ufs_sb_private_info * s_uspi;
 	struct ufs_csum	* s_csp;
 	unsigned s_bytesex;
+	const struct unixfs_byteorder * s_byteorder;
 	unsigned s_flags;
 	struct buffer_head ** s_ucg;
 	struct ufs_cg_private_info * s_ucpi[UFS_MAX_GROUP_LOADED];
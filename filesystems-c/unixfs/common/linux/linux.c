@@ -9,8 +9,10 @@
 int
 sb_bread_intobh(struct super_block* sb, off_t block, struct buffer_head* bh)
 {
-    if (pread(sb->s_bdev, bh->b_data, sb->s_blocksize,
-              block * (off_t)sb->s_blocksize) != sb->s_blocksize)
+    UNIXFS_PROBE2(bread, block, sb->s_blocksize);
+
+    if (unixfs_pread(sb->s_bdev, bh->b_data, sb->s_blocksize,
+                     block * (off_t)sb->s_blocksize) != sb->s_blocksize)
         return EIO;
 
     return 0;
@@ -9,6 +9,10 @@
  */
 
 #include "unixfs.h"
+#include "unixfs_probes.h"
+#include "unixfs_sched.h"
+#include "unixfs_stats.h"
+#include "unixfs_trace.h"
 
 #include <errno.h>
 #include <stddef.h>
@@ -18,14 +22,55 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <dlfcn.h>
+#include <sys/stat.h>
 
 #include <fuse/fuse_opt.h>
 #include <fuse/fuse_lowlevel.h>
 
 #define UNIXFS_META_TIMEOUT 60.0 /* timeout for nodes and their attributes */
 
+/*
+ * With --immutable, the image is promised not to change underneath us for
+ * the lifetime of the mount. Entries, attributes, negative lookups, and file
+ * data can then be cached by the kernel for as long as it likes.
+ */
+#define UNIXFS_IMMUTABLE_TIMEOUT 1.0e9 /* effectively forever */
+
+#if __APPLE__
+#define UNIXFS_IMMUTABLE_ARGS "-oiosize=1048576"
+#else
+#define UNIXFS_IMMUTABLE_ARGS "-omax_read=131072,max_readahead=1048576"
+#endif
+
+/*
+ * Every mount has a read-only /.unixfs-stats that reports the counters kept
+ * by unixfs_stats (see unixfs_stats.h) in the Prometheus text format. It is
+ * served here, without involving the file system, under an inode number
+ * that none of our file systems can produce. It is found by lookup but not
+ * listed by readdir.
+ */
+#define UNIXFS_STATS_NAME ".unixfs-stats"
+#define UNIXFS_STATS_INO  ((fuse_ino_t)-2)
+
 static struct unixfs* unixfs = (struct unixfs*)0;
 
+static int    unixfs_immutable = 0;
+static double unixfs_meta_timeout = UNIXFS_META_TIMEOUT;
+
+struct replybuf {
+    char*  p;
+    size_t size;
+};
+
+static void
+unixfs_ll_stats_stat(struct stat* stbuf)
+{
+    memset(stbuf, 0, sizeof(struct stat));
+    stbuf->st_ino = UNIXFS_STATS_INO;
+    stbuf->st_mode = S_IFREG | 0444;
+    stbuf->st_nlink = 1;
+}
+
 static void
 unixfs_ll_statfs(fuse_req_t req, fuse_ino_t ino)
 {
@@ -39,6 +84,7 @@ unixfs_ll_statfs(fuse_req_t req, fuse_ino_t ino)
 static void
 unixfs_ll_destroy(void* data)
 {
+    unixfs_trace_close();
     unixfs->ops->fini(unixfs->filsys);
 }
 
@@ -48,14 +94,32 @@ unixfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name)
     struct fuse_entry_param e;
     memset(&e, 0, sizeof(e));
 
+    if (parent == UNIXFS_STATS_INO) {
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
+
+    if ((parent == FUSE_ROOT_ID) && (strcmp(name, UNIXFS_STATS_NAME) == 0)) {
+        unixfs_ll_stats_stat(&e.attr);
+        e.ino = UNIXFS_STATS_INO;
+        e.entry_timeout = unixfs_meta_timeout;
+        fuse_reply_entry(req, &e);
+        return;
+    }
+
     int error = unixfs->ops->namei(parent, name, &(e.attr));
     if (error) {
-        fuse_reply_err(req, error);
+        if ((error == ENOENT) && unixfs_immutable) {
+            /* negative entry: ino 0 with a timeout */
+            e.entry_timeout = unixfs_meta_timeout;
+            fuse_reply_entry(req, &e);
+        } else
+            fuse_reply_err(req, error);
         return;
     }
 
     e.ino = e.attr.st_ino;
-    e.attr_timeout = e.entry_timeout = UNIXFS_META_TIMEOUT;
+    e.attr_timeout = e.entry_timeout = unixfs_meta_timeout;
 
     fuse_reply_entry(req, &e);
 }
@@ -65,9 +129,16 @@ void unixfs_ll_getattr(fuse_req_t req, fuse_ino_t ino,
                        struct fuse_file_info* fi)
 {
     struct stat stbuf;
+
+    if (ino == UNIXFS_STATS_INO) {
+        unixfs_ll_stats_stat(&stbuf);
+        fuse_reply_attr(req, &stbuf, 0.0);
+        return;
+    }
+
     int error = unixfs->ops->igetattr(ino, &stbuf);
     if (!error)
-        fuse_reply_attr(req, &stbuf, UNIXFS_META_TIMEOUT);
+        fuse_reply_attr(req, &stbuf, unixfs_meta_timeout);
     else
         fuse_reply_err(req, error);
 }
@@ -79,17 +150,73 @@ unixfs_ll_readlink(fuse_req_t req, fuse_ino_t ino)
 
     char path[UNIXFS_MAXPATHLEN];
 
+    if (ino == UNIXFS_STATS_INO) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
     if ((ret = unixfs->ops->readlink(ino, path)) != 0)
         fuse_reply_err(req, ret);
 
     fuse_reply_readlink(req, path);
 }
 
+/*
+ * A directory's listing is built once, at opendir time, and readdir hands
+ * out slices of it. Children are handled in batches so that file systems
+ * with a bulk iget can read each inode table block once per batch instead
+ * of once per child.
+ */
+
 static void
-unixfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
-                  struct fuse_file_info* fi)
+unixfs_ll_addentry(fuse_req_t req, struct replybuf* b, const char* name,
+                   struct stat* stbuf)
 {
-    (void)fi;
+    size_t oldsize = b->size;
+    b->size += fuse_add_direntry(req, NULL, 0, name, NULL, 0);
+    char* newp = (char *)realloc(b->p, b->size);
+    if (!newp) {
+        fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+        abort();
+    }
+    b->p = newp;
+    fuse_add_direntry(req, b->p + oldsize, b->size - oldsize, name,
+                      stbuf, b->size);
+}
+
+static void
+unixfs_ll_addentries(fuse_req_t req, struct replybuf* b,
+                     struct unixfs_direntry* dents, ino_t* inos,
+                     struct inode** ips, int count)
+{
+    int i;
+    struct stat stbuf;
+
+    if (unixfs->ops->igetv && unixfs->ops->igetv(inos, count, ips) >= 0) {
+        for (i = 0; i < count; i++) {
+            if (!ips[i])
+                continue;
+            unixfs->ops->istat(ips[i], &stbuf);
+            unixfs->ops->iput(ips[i]);
+            unixfs_ll_addentry(req, b, dents[i].name, &stbuf);
+        }
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (unixfs->ops->igetattr(dents[i].ino, &stbuf) != 0)
+            continue;
+        unixfs_ll_addentry(req, b, dents[i].name, &stbuf);
+    }
+}
+
+static void
+unixfs_ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+    if (ino == UNIXFS_STATS_INO) {
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
 
     struct inode* dp = unixfs->ops->iget(ino);
     if (!dp) {
@@ -106,54 +233,110 @@ unixfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
         return;
     }
 
-    off_t offset = 0;
-    struct unixfs_direntry dent;
-
-    struct replybuf {
-        char*  p;
-        size_t size;
-    } b;
+    struct replybuf* b = calloc(1, sizeof(struct replybuf));
+    struct unixfs_direntry* dents =
+        malloc(UNIXFS_READDIR_BATCH * sizeof(struct unixfs_direntry));
+    ino_t* inos = malloc(UNIXFS_READDIR_BATCH * sizeof(ino_t));
+    struct inode** ips = malloc(UNIXFS_READDIR_BATCH * sizeof(struct inode*));
 
-    memset(&b, 0, sizeof(b));
+    if (!b || !dents || !inos || !ips) {
+        unixfs->ops->iput(dp);
+        free(b);
+        free(dents);
+        free(inos);
+        free(ips);
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
 
+    off_t offset = 0;
     struct unixfs_dirbuf dirbuf;
+    dirbuf.flags.initialized = 0;
 
-    while (unixfs->ops->nextdirentry(dp, &dirbuf, &offset, &dent) == 0) {
+    int more = 1;
 
-        if (dent.ino == 0)
-            continue;
-
-        if (unixfs->ops->igetattr(dent.ino, &stbuf) != 0)
-            continue;
-
-        size_t oldsize = b.size;
-        b.size += fuse_add_direntry(req, NULL, 0, dent.name, NULL, 0);
-        char* newp = (char *)realloc(b.p, b.size);
-        if (!newp) {
-            fprintf(stderr, "*** fatal error: cannot allocate memory\n");
-            abort();
+    while (more) {
+        int count = 0;
+        while (count < UNIXFS_READDIR_BATCH) {
+            if (unixfs->ops->nextdirentry(dp, &dirbuf, &offset,
+                                          &dents[count]) != 0) {
+                more = 0;
+                break;
+            }
+            if (dents[count].ino == 0)
+                continue;
+            inos[count] = dents[count].ino;
+            count++;
         }
-        b.p = newp;
-        fuse_add_direntry(req, b.p + oldsize, b.size - oldsize, dent.name,
-                          &stbuf, b.size);
+        if (count)
+            unixfs_ll_addentries(req, b, dents, inos, ips, count);
     }
 
     unixfs->ops->iput(dp);
 
-    if (off < b.size)
-        fuse_reply_buf(req, b.p + off, min(b.size - off, size));
+    free(dents);
+    free(inos);
+    free(ips);
+
+    fi->fh = (uint64_t)(long)b;
+    fuse_reply_open(req, fi);
+}
+
+static void
+unixfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                  struct fuse_file_info* fi)
+{
+    struct replybuf* b = (struct replybuf*)(long)(fi->fh);
+    if (!b) {
+        fuse_reply_err(req, EBADF);
+        return;
+    }
+
+    if (off < b->size)
+        fuse_reply_buf(req, b->p + off, min(b->size - off, size));
     else
         fuse_reply_buf(req, NULL, 0);
+}
+
+static void
+unixfs_ll_releasedir(fuse_req_t req, fuse_ino_t ino,
+                     struct fuse_file_info* fi)
+{
+    struct replybuf* b = (struct replybuf*)(long)(fi->fh);
+    if (b) {
+        free(b->p);
+        free(b);
+    }
 
-    free(b.p);
+    fi->fh = 0;
+
+    fuse_reply_err(req, 0);
 }
 
 static void
 unixfs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
 {
+    if (ino == UNIXFS_STATS_INO) {
+        /* the snapshot taken here is what this open file reads */
+        struct replybuf* b = calloc(1, sizeof(struct replybuf));
+        if (b)
+            b->p = unixfs_stats_snapshot(&b->size);
+        if (!b || !b->p) {
+            free(b);
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
+        fi->fh = (uint64_t)(long)b;
+        fi->direct_io = 1;
+        fuse_reply_open(req, fi);
+        return;
+    }
+
     struct inode* ip = unixfs->ops->iget(ino);
-    if (!ip)
+    if (!ip) {
         fuse_reply_err(req, ENOENT);
+        return;
+    }
 
     struct stat stbuf;
     unixfs->ops->istat(ip, &stbuf);
@@ -168,6 +351,8 @@ unixfs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
         unixfs->ops->iput(ip);
     } else {
         fi->fh = (uint64_t)(long)ip;
+        if (unixfs_immutable)
+            fi->keep_cache = 1;
         fuse_reply_open(req, fi);
     }
 }
@@ -175,7 +360,13 @@ unixfs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
 static void
 unixfs_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
 {
-    if (fi->fh)
+    if (ino == UNIXFS_STATS_INO) {
+        struct replybuf* b = (struct replybuf*)(long)(fi->fh);
+        if (b) {
+            free(b->p);
+            free(b);
+        }
+    } else if (fi->fh)
         unixfs->ops->iput((struct inode *)(long)(fi->fh));
 
     fi->fh = 0;
@@ -187,6 +378,15 @@ static void
 unixfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t count, off_t offset,
                struct fuse_file_info* fi)
 {
+    if (ino == UNIXFS_STATS_INO) {
+        struct replybuf* b = (struct replybuf*)(long)(fi->fh);
+        if (b && offset < b->size)
+            fuse_reply_buf(req, b->p + offset, min(b->size - offset, count));
+        else
+            fuse_reply_buf(req, NULL, 0);
+        return;
+    }
+
     struct inode* ip = (struct inode*)(long)(fi->fh);
     if (!ip) {
         fuse_reply_err(req, EBADF);
@@ -228,36 +428,157 @@ unixfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t count, off_t offset,
 out:
     fuse_reply_buf(req, buf, nbytes);
 
+    unixfs_stats_add(UNIXFS_STATS_BYTES_READ, nbytes);
+
     free(buf);
 }
 
+/*
+ * Every handler is entered through one of these, which time it (reply
+ * included) into the per-operation latency histograms, fire the entry
+ * and return probes (see unixfs_probes.h), and, with --record, append the
+ * request to the trace (see unixfs_trace.h). The file handle traced is the
+ * one passed in or, for open and opendir, the one handed back.
+ */
+
+#define UNIXFS_LL_TIMED(op, ino, name, size, off, fi, call)                  \
+    do {                                                                     \
+        uint64_t begin = unixfs_stats_begin();                               \
+        uint64_t tbegin = unixfs_trace_begin();                              \
+        uint64_t fh = (fi) ? ((struct fuse_file_info*)(fi))->fh : 0;         \
+        call;                                                                \
+        unixfs_stats_end(op, begin);                                         \
+        if (!fh && (fi))                                                     \
+            fh = ((struct fuse_file_info*)(fi))->fh;                         \
+        unixfs_trace_end(op, tbegin, ino, name, size, off, fh);              \
+    } while (0)
+
+static void
+unixfs_ll_timed_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+    UNIXFS_LL_TIMED(UNIXFS_STATS_STATFS, ino, NULL, 0, 0, NULL,
+                    unixfs_ll_statfs(req, ino));
+}
+
+static void
+unixfs_ll_timed_lookup(fuse_req_t req, fuse_ino_t parent, const char* name)
+{
+    UNIXFS_PROBE2(lookup_entry, parent, name);
+    UNIXFS_LL_TIMED(UNIXFS_STATS_LOOKUP, parent, name, 0, 0, NULL,
+                    unixfs_ll_lookup(req, parent, name));
+    UNIXFS_PROBE1(lookup_return, parent);
+}
+
+static void
+unixfs_ll_timed_getattr(fuse_req_t req, fuse_ino_t ino,
+                        struct fuse_file_info* fi)
+{
+    UNIXFS_PROBE1(getattr_entry, ino);
+    UNIXFS_LL_TIMED(UNIXFS_STATS_GETATTR, ino, NULL, 0, 0, NULL,
+                    unixfs_ll_getattr(req, ino, fi));
+    UNIXFS_PROBE1(getattr_return, ino);
+}
+
+static void
+unixfs_ll_timed_readlink(fuse_req_t req, fuse_ino_t ino)
+{
+    UNIXFS_LL_TIMED(UNIXFS_STATS_READLINK, ino, NULL, 0, 0, NULL,
+                    unixfs_ll_readlink(req, ino));
+}
+
+static void
+unixfs_ll_timed_opendir(fuse_req_t req, fuse_ino_t ino,
+                        struct fuse_file_info* fi)
+{
+    UNIXFS_LL_TIMED(UNIXFS_STATS_OPENDIR, ino, NULL, 0, 0, fi,
+                    unixfs_ll_opendir(req, ino, fi));
+}
+
+static void
+unixfs_ll_timed_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+                        off_t off, struct fuse_file_info* fi)
+{
+    UNIXFS_PROBE3(readdir_entry, ino, size, off);
+    UNIXFS_LL_TIMED(UNIXFS_STATS_READDIR, ino, NULL, size, off, fi,
+                    unixfs_ll_readdir(req, ino, size, off, fi));
+    UNIXFS_PROBE1(readdir_return, ino);
+}
+
+static void
+unixfs_ll_timed_releasedir(fuse_req_t req, fuse_ino_t ino,
+                           struct fuse_file_info* fi)
+{
+    UNIXFS_LL_TIMED(UNIXFS_STATS_RELEASEDIR, ino, NULL, 0, 0, fi,
+                    unixfs_ll_releasedir(req, ino, fi));
+}
+
+static void
+unixfs_ll_timed_open(fuse_req_t req, fuse_ino_t ino,
+                     struct fuse_file_info* fi)
+{
+    UNIXFS_LL_TIMED(UNIXFS_STATS_OPEN, ino, NULL, 0, 0, fi,
+                    unixfs_ll_open(req, ino, fi));
+}
+
+static void
+unixfs_ll_timed_release(fuse_req_t req, fuse_ino_t ino,
+                        struct fuse_file_info* fi)
+{
+    UNIXFS_LL_TIMED(UNIXFS_STATS_RELEASE, ino, NULL, 0, 0, fi,
+                    unixfs_ll_release(req, ino, fi));
+}
+
+static void
+unixfs_ll_timed_read(fuse_req_t req, fuse_ino_t ino, size_t count,
+                     off_t offset, struct fuse_file_info* fi)
+{
+    UNIXFS_PROBE3(read_entry, ino, count, offset);
+    UNIXFS_LL_TIMED(UNIXFS_STATS_READ, ino, NULL, count, offset, fi,
+                    unixfs_ll_read(req, ino, count, offset, fi));
+    UNIXFS_PROBE1(read_return, ino);
+}
+
 static struct fuse_lowlevel_ops unixfs_ll_oper = {
-    .statfs     = unixfs_ll_statfs,
+    .statfs     = unixfs_ll_timed_statfs,
     .destroy    = unixfs_ll_destroy,
-    .lookup     = unixfs_ll_lookup,
-    .getattr    = unixfs_ll_getattr,
-    .readlink   = unixfs_ll_readlink,
-    .readdir    = unixfs_ll_readdir,
-    .open       = unixfs_ll_open,
-    .release    = unixfs_ll_release,
-    .read       = unixfs_ll_read,
+    .lookup     = unixfs_ll_timed_lookup,
+    .getattr    = unixfs_ll_timed_getattr,
+    .readlink   = unixfs_ll_timed_readlink,
+    .opendir    = unixfs_ll_timed_opendir,
+    .readdir    = unixfs_ll_timed_readdir,
+    .releasedir = unixfs_ll_timed_releasedir,
+    .open       = unixfs_ll_timed_open,
+    .release    = unixfs_ll_timed_release,
+    .read       = unixfs_ll_timed_read,
 };
 
 struct options {
-    char* dmg;
-    int   force;
-    char* fsendian;
-    char* type;
+    int      clone_fd;
+    char*    dmg;
+    int      force;
+    char*    fsendian;
+    int      immutable;
+    int      pin_cpus;
+    unsigned queue_depth;
+    char*    record;
+    char*    type;
+    unsigned workers;
 } options;
 
 #define UNIXFS_OPT_KEY(t, p, v) { t, offsetof(struct options, p), v }
 
 static struct fuse_opt unixfs_opts[] = {
 
+    UNIXFS_OPT_KEY("--clone-fd", clone_fd, 1),
     UNIXFS_OPT_KEY("--dmg %s", dmg, 0),
     UNIXFS_OPT_KEY("--force", force, 1),
     UNIXFS_OPT_KEY("--fsendian %s", fsendian, 0),
+    UNIXFS_OPT_KEY("--immutable", immutable, 1),
+    UNIXFS_OPT_KEY("--pin-cpus", pin_cpus, 1),
+    UNIXFS_OPT_KEY("--queue-depth %u", queue_depth, 0),
+    UNIXFS_OPT_KEY("--record %s", record, 0),
     UNIXFS_OPT_KEY("--type %s", type, 0),
+    UNIXFS_OPT_KEY("--workers %u", workers, 0),
 
     FUSE_OPT_END
 };
@@ -325,6 +646,21 @@ main(int argc, char* argv[])
 
     fuse_opt_add_arg(&args, extra_args);
 
+    if (options.immutable) {
+        unixfs_immutable = 1;
+        unixfs_meta_timeout = UNIXFS_IMMUTABLE_TIMEOUT;
+        fuse_opt_add_arg(&args, UNIXFS_IMMUTABLE_ARGS);
+    }
+
+    if (options.record) {
+        int error = unixfs_trace_open(options.record, unixfs->fsname);
+        if (error) {
+            fprintf(stderr, "failed to open trace %s: %s\n", options.record,
+                    strerror(error));
+            return -1;
+        }
+    }
+
     int err = -1;
     struct fuse_chan *ch;
 
@@ -339,7 +675,15 @@ main(int argc, char* argv[])
                 goto bailout;
             if (fuse_set_signal_handlers(se) != -1) {
                 fuse_session_add_chan(se, ch);
-                if (multithreaded)
+                if (options.workers) {
+                    struct unixfs_sched_config config = {
+                        .workers     = options.workers,
+                        .queue_depth = options.queue_depth,
+                        .clone_fd    = options.clone_fd,
+                        .pin_cpus    = options.pin_cpus,
+                    };
+                    err = unixfs_sched_loop(se, ch, &config);
+                } else if (multithreaded)
                     err = fuse_session_loop_mt(se);
                 else
                     err = fuse_session_loop(se);
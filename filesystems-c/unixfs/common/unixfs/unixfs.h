@@ -54,6 +54,9 @@ struct unixfs_direntry {
 
 #define UNIXFS_DIRBUFSIZ 8192
 
+/* children handed to igetv at a time when a directory is listed */
+#define UNIXFS_READDIR_BATCH 512
+
 struct unixfs_dirbuf {
     struct flags {
        uint32_t initialized;
@@ -74,6 +77,7 @@ struct unixfs_ops {
     off_t         (*bmap)(struct inode* ip, off_t lblkno, int* error);
     int           (*bread)(off_t blkno, char* blkbuf);
     struct inode* (*iget)(ino_t ino);
+    int           (*igetv)(ino_t* inos, int count, struct inode** ips);
     void          (*iput)(struct inode* ip);
     int           (*igetattr)(ino_t ino, struct stat* stbuf);
     void          (*istat)(struct inode* ip, struct stat* stbuf);
@@ -0,0 +1,415 @@
+/*
+ * UnixFS
+ *
+ * A general-purpose file system layer for writing/reimplementing/porting
+ * Unix file systems through OSXFUSE.
+
+ * Copyright (c) 2008 Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ */
+
+#include "unixfs_bitmap.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define UNIXFS_BITMAP_X86 1
+#include <immintrin.h>
+#else
+#define UNIXFS_BITMAP_X86 0
+#endif
+
+/*
+ * Each kernel works on whole bytes. The exported functions trim partial
+ * bytes at either end of a bit range and hand the rest to these.
+ */
+struct bitmap_kernels {
+    const char* isa;
+    size_t (*count)(const uint8_t* p, size_t nbytes); /* set bits */
+    size_t (*scan)(const uint8_t* p, size_t nbytes);  /* first non-zero byte */
+    void   (*swab16)(uint8_t* p, size_t count);
+    void   (*swab32)(uint8_t* p, size_t count);
+    void   (*swab64)(uint8_t* p, size_t count);
+    void   (*wswap32)(uint8_t* p, size_t count);
+};
+
+static inline uint64_t
+bitmap_load64(const uint8_t* p)
+{
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+static inline size_t
+bitmap_weight64(uint64_t w)
+{
+    w = w - ((w >> 1) & 0x5555555555555555ULL);
+    w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+    w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (size_t)((w * 0x0101010101010101ULL) >> 56);
+}
+
+static size_t
+bitmap_count_scalar(const uint8_t* p, size_t nbytes)
+{
+    size_t i, count = 0;
+
+    for (i = 0; i + 8 <= nbytes; i += 8)
+        count += bitmap_weight64(bitmap_load64(p + i));
+    for (; i < nbytes; i++)
+        count += bitmap_weight64(p[i]);
+
+    return count;
+}
+
+static size_t
+bitmap_scan_scalar(const uint8_t* p, size_t nbytes)
+{
+    size_t i = 0;
+
+    while (i + 8 <= nbytes && bitmap_load64(p + i) == 0)
+        i += 8;
+    while (i < nbytes && p[i] == 0)
+        i++;
+
+    return i;
+}
+
+static void
+bitmap_swab16_scalar(uint8_t* p, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        uint16_t w;
+        memcpy(&w, p + 2 * i, sizeof(w));
+        w = (uint16_t)((w << 8) | (w >> 8));
+        memcpy(p + 2 * i, &w, sizeof(w));
+    }
+}
+
+static void
+bitmap_swab32_scalar(uint8_t* p, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        uint32_t w;
+        memcpy(&w, p + 4 * i, sizeof(w));
+        w = ((w << 24) | ((w << 8) & 0x00ff0000) |
+             ((w >> 8) & 0x0000ff00) | (w >> 24));
+        memcpy(p + 4 * i, &w, sizeof(w));
+    }
+}
+
+static void
+bitmap_swab64_scalar(uint8_t* p, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        uint64_t w;
+        memcpy(&w, p + 8 * i, sizeof(w));
+        w = ((w & 0x00ff00ff00ff00ffULL) << 8) |
+            ((w >> 8) & 0x00ff00ff00ff00ffULL);
+        w = ((w & 0x0000ffff0000ffffULL) << 16) |
+            ((w >> 16) & 0x0000ffff0000ffffULL);
+        w = (w << 32) | (w >> 32);
+        memcpy(p + 8 * i, &w, sizeof(w));
+    }
+}
+
+static void
+bitmap_wswap32_scalar(uint8_t* p, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        uint32_t w;
+        memcpy(&w, p + 4 * i, sizeof(w));
+        w = (w << 16) | (w >> 16);
+        memcpy(p + 4 * i, &w, sizeof(w));
+    }
+}
+
+static const struct bitmap_kernels bitmap_kernels_scalar = {
+    "scalar",
+    bitmap_count_scalar,
+    bitmap_scan_scalar,
+    bitmap_swab16_scalar,
+    bitmap_swab32_scalar,
+    bitmap_swab64_scalar,
+    bitmap_wswap32_scalar,
+};
+
+#if UNIXFS_BITMAP_X86
+
+__attribute__((target("popcnt")))
+static size_t
+bitmap_count_popcnt(const uint8_t* p, size_t nbytes)
+{
+    size_t i;
+    uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+
+    /* independent accumulators keep the popcnt units busy */
+    for (i = 0; i + 32 <= nbytes; i += 32) {
+        c0 += __builtin_popcountll(bitmap_load64(p + i));
+        c1 += __builtin_popcountll(bitmap_load64(p + i + 8));
+        c2 += __builtin_popcountll(bitmap_load64(p + i + 16));
+        c3 += __builtin_popcountll(bitmap_load64(p + i + 24));
+    }
+    for (; i + 8 <= nbytes; i += 8)
+        c0 += __builtin_popcountll(bitmap_load64(p + i));
+    for (; i < nbytes; i++)
+        c0 += __builtin_popcount(p[i]);
+
+    return (size_t)(c0 + c1 + c2 + c3);
+}
+
+/*
+ * Nibble lookup through vpshufb, summed with vpsadbw. A byte lane gains at
+ * most 8 per round, so after 8 rounds it holds at most 64, well short of
+ * overflowing, when the lanes are folded into the 64-bit accumulators.
+ */
+__attribute__((target("avx2,popcnt")))
+static size_t
+bitmap_count_avx2(const uint8_t* p, size_t nbytes)
+{
+    const __m256i lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+
+    while (i + 32 <= nbytes) {
+        __m256i local = _mm256_setzero_si256();
+        int round;
+        for (round = 0; round < 8 && i + 32 <= nbytes; round++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+            __m256i lo = _mm256_and_si256(v, nibble);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+            local = _mm256_add_epi8(local, _mm256_shuffle_epi8(lookup, lo));
+            local = _mm256_add_epi8(local, _mm256_shuffle_epi8(lookup, hi));
+        }
+        acc = _mm256_add_epi64(acc,
+                  _mm256_sad_epu8(local, _mm256_setzero_si256()));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    size_t count = (size_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+
+    return count + bitmap_count_popcnt(p + i, nbytes - i);
+}
+
+__attribute__((target("avx2")))
+static size_t
+bitmap_scan_avx2(const uint8_t* p, size_t nbytes)
+{
+    size_t i = 0;
+
+    while (i + 64 <= nbytes) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p + i + 32));
+        __m256i v = _mm256_or_si256(a, b);
+        if (!_mm256_testz_si256(v, v))
+            break;
+        i += 64;
+    }
+
+    return i + bitmap_scan_scalar(p + i, nbytes - i);
+}
+
+__attribute__((target("avx2")))
+static void
+bitmap_swab16_avx2(uint8_t* p, size_t count)
+{
+    const __m256i mask = _mm256_setr_epi8(
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+
+    for (; count >= 16; count -= 16, p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        _mm256_storeu_si256((__m256i*)p, _mm256_shuffle_epi8(v, mask));
+    }
+    bitmap_swab16_scalar(p, count);
+}
+
+__attribute__((target("avx2")))
+static void
+bitmap_swab32_avx2(uint8_t* p, size_t count)
+{
+    const __m256i mask = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    for (; count >= 8; count -= 8, p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        _mm256_storeu_si256((__m256i*)p, _mm256_shuffle_epi8(v, mask));
+    }
+    bitmap_swab32_scalar(p, count);
+}
+
+__attribute__((target("avx2")))
+static void
+bitmap_swab64_avx2(uint8_t* p, size_t count)
+{
+    const __m256i mask = _mm256_setr_epi8(
+        7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+        7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+
+    for (; count >= 4; count -= 4, p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        _mm256_storeu_si256((__m256i*)p, _mm256_shuffle_epi8(v, mask));
+    }
+    bitmap_swab64_scalar(p, count);
+}
+
+__attribute__((target("avx2")))
+static void
+bitmap_wswap32_avx2(uint8_t* p, size_t count)
+{
+    const __m256i mask = _mm256_setr_epi8(
+        2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+        2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+
+    for (; count >= 8; count -= 8, p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        _mm256_storeu_si256((__m256i*)p, _mm256_shuffle_epi8(v, mask));
+    }
+    bitmap_wswap32_scalar(p, count);
+}
+
+static const struct bitmap_kernels bitmap_kernels_popcnt = {
+    "popcnt",
+    bitmap_count_popcnt,
+    bitmap_scan_scalar,
+    bitmap_swab16_scalar,
+    bitmap_swab32_scalar,
+    bitmap_swab64_scalar,
+    bitmap_wswap32_scalar,
+};
+
+static const struct bitmap_kernels bitmap_kernels_avx2 = {
+    "avx2",
+    bitmap_count_avx2,
+    bitmap_scan_avx2,
+    bitmap_swab16_avx2,
+    bitmap_swab32_avx2,
+    bitmap_swab64_avx2,
+    bitmap_wswap32_avx2,
+};
+
+#endif /* UNIXFS_BITMAP_X86 */
+
+static const struct bitmap_kernels* bitmap_kernels = &bitmap_kernels_scalar;
+static pthread_once_t bitmap_once = PTHREAD_ONCE_INIT;
+
+static void
+bitmap_select(void)
+{
+#if UNIXFS_BITMAP_X86
+    const char* cap = getenv("UNIXFS_BITMAP_ISA");
+    int allow_popcnt = !cap || strcmp(cap, "scalar") != 0;
+    int allow_avx2 = !cap || strcmp(cap, "avx2") == 0;
+
+    __builtin_cpu_init();
+    if (allow_popcnt && __builtin_cpu_supports("popcnt")) {
+        bitmap_kernels = &bitmap_kernels_popcnt;
+        if (allow_avx2 && __builtin_cpu_supports("avx2"))
+            bitmap_kernels = &bitmap_kernels_avx2;
+    }
+#endif
+}
+
+static inline const struct bitmap_kernels*
+bitmap_get_kernels(void)
+{
+    (void)pthread_once(&bitmap_once, bitmap_select);
+    return bitmap_kernels;
+}
+
+size_t
+unixfs_bitmap_popcount(const void* map, size_t start, size_t end)
+{
+    const uint8_t* p = (const uint8_t*)map;
+    size_t first = start >> 3;
+    size_t last = end >> 3;
+    size_t count = 0;
+
+    if (start >= end)
+        return 0;
+
+    if (first == last)
+        return bitmap_weight64(p[first] & (0xffU << (start & 7)) &
+                               ((1U << (end & 7)) - 1));
+
+    if (start & 7)
+        count += bitmap_weight64(p[first++] >> (start & 7));
+
+    count += bitmap_get_kernels()->count(p + first, last - first);
+
+    if (end & 7)
+        count += bitmap_weight64(p[last] & ((1U << (end & 7)) - 1));
+
+    return count;
+}
+
+size_t
+unixfs_bitmap_find_next_set(const void* map, size_t nbits, size_t start)
+{
+    const uint8_t* p = (const uint8_t*)map;
+    size_t nbytes = (nbits + 7) >> 3;
+    size_t i = start >> 3;
+    unsigned b;
+
+    if (start >= nbits)
+        return nbits;
+
+    b = p[i] & (0xffU << (start & 7));
+    if (!b) {
+        i++;
+        i += bitmap_get_kernels()->scan(p + i, nbytes - i);
+        if (i >= nbytes)
+            return nbits;
+        b = p[i];
+    }
+
+    start = (i << 3) + (size_t)__builtin_ctz(b);
+
+    return (start < nbits) ? start : nbits;
+}
+
+void
+unixfs_bitmap_swab16(void* words, size_t count)
+{
+    bitmap_get_kernels()->swab16((uint8_t*)words, count);
+}
+
+void
+unixfs_bitmap_swab32(void* words, size_t count)
+{
+    bitmap_get_kernels()->swab32((uint8_t*)words, count);
+}
+
+void
+unixfs_bitmap_swab64(void* words, size_t count)
+{
+    bitmap_get_kernels()->swab64((uint8_t*)words, count);
+}
+
+void
+unixfs_bitmap_wswap32(void* words, size_t count)
+{
+    bitmap_get_kernels()->wswap32((uint8_t*)words, count);
+}
+
+const char*
+unixfs_bitmap_isa(void)
+{
+    return bitmap_get_kernels()->isa;
+}
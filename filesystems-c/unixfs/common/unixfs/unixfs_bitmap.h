@@ -0,0 +1,56 @@
+/*
+ * UnixFS
+ *
+ * A general-purpose file system layer for writing/reimplementing/porting
+ * Unix file systems through OSXFUSE.
+
+ * Copyright (c) 2008 Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ */
+
+#ifndef _UNIXFS_BITMAP_H_
+#define _UNIXFS_BITMAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bitmap primitives shared by the file system flavors.
+ *
+ * A bitmap is a byte array in which bit n lives at (map[n >> 3] >> (n & 7)).
+ * That is the on-disk layout of the Minix zone and inode maps. It is also
+ * the layout of a dump inode map once its 16-bit words have been put into
+ * little-endian order (see unixfs_bitmap_swab16()).
+ *
+ * The range functions pick an x86 popcnt or AVX2 kernel at run time when the
+ * processor has one, and fall back to portable scalar code otherwise. Setting
+ * UNIXFS_BITMAP_ISA to "scalar", "popcnt" or "avx2" in the environment caps
+ * the selection, which is mostly useful for benchmarking.
+ */
+
+/* number of set bits in [start, end) */
+extern size_t unixfs_bitmap_popcount(const void* map, size_t start,
+                                     size_t end);
+
+/* index of the first set bit in [start, nbits), or nbits if there is none */
+extern size_t unixfs_bitmap_find_next_set(const void* map, size_t nbits,
+                                          size_t start);
+
+/* byte-swap count 16/32/64-bit words in place; need not be aligned */
+extern void unixfs_bitmap_swab16(void* words, size_t count);
+extern void unixfs_bitmap_swab32(void* words, size_t count);
+extern void unixfs_bitmap_swab64(void* words, size_t count);
+
+/* swap the 16-bit halves of count 32-bit words (PDP-11 longs) in place */
+extern void unixfs_bitmap_wswap32(void* words, size_t count);
+
+/* name of the kernel set in use: "scalar", "popcnt" or "avx2" */
+extern const char* unixfs_bitmap_isa(void);
+
+static inline int
+unixfs_bitmap_test(const void* map, size_t n)
+{
+    return (((const uint8_t*)map)[n >> 3] >> (n & 7)) & 1;
+}
+
+#endif /* _UNIXFS_BITMAP_H_ */
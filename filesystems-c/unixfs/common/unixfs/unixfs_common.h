@@ -40,6 +40,15 @@ static int           unixfs_internal_readlink(ino_t ino,
                                               char path[UNIXFS_MAXPATHLEN]);
 static int           unixfs_internal_statvfs(struct statvfs* svb);
 
+/*
+ * Optional operations. A file system that implements one defines the
+ * corresponding macro to its implementation before including this file.
+ */
+
+#ifndef UNIXFS_INTERNAL_IGETV
+#define UNIXFS_INTERNAL_IGETV NULL /* bulk iget; readdir uses it if present */
+#endif
+
 /* To be used in file-system-specific code. */
 
 #define DECL_UNIXFS(fsname, sufx)                     \
@@ -50,6 +59,7 @@ static int           unixfs_internal_statvfs(struct statvfs* svb);
         .bmap         = unixfs_internal_bmap,         \
         .bread        = unixfs_internal_bread,        \
         .iget         = unixfs_internal_iget,         \
+        .igetv        = UNIXFS_INTERNAL_IGETV,        \
         .iput         = unixfs_internal_iput,         \
         .igetattr     = unixfs_internal_igetattr,     \
         .istat        = unixfs_internal_istat,        \
@@ -14,9 +14,12 @@
  */
 
 #include "unixfs_internal.h"
+#include "unixfs_bitmap.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 static int desirednodes = 65536;
 static pthread_mutex_t ihash_lock;
@@ -25,6 +28,24 @@ typedef struct ihash_head ihash_head;
 static size_t ihash_count = 0;
 static size_t iprivsize = 0;
 
+/*
+ * Our images are read-only, so an initialized inode never goes stale. When
+ * the last reference to one is dropped, we park it on an LRU list rather
+ * than freeing it. A later iget (say, a lookup right after a readdir) then
+ * costs a hash probe instead of an inode table read.
+ */
+static int desiredfreenodes = 131072;
+static TAILQ_HEAD(ilru_head, inode) ilru_head;
+static size_t ilru_count = 0;
+
+#define UNIXFS_IGETV_MAXRUN 64 /* max inode table blocks per read */
+
+/*
+ * Bumped on every mount so that per-thread indirect block caches left over
+ * from an earlier instance never match.
+ */
+static uint32_t indirect_generation = 0;
+
 static u_long ihash_mask;
 
 static ihash_head*
@@ -36,6 +57,8 @@ unixfs_inodelayer_firstfromhash(ino_t ino)
 int
 unixfs_inodelayer_init(size_t privsize)
 {
+    indirect_generation++;
+
     if (!UNIXFS_ENABLE_INODEHASH)
         return 0;
 
@@ -46,6 +69,9 @@ unixfs_inodelayer_init(size_t privsize)
 
     iprivsize = privsize;
 
+    TAILQ_INIT(&ilru_head);
+    ilru_count = 0;
+
     int i;
     u_long hashsize;
     LIST_HEAD(generic, generic) *hashtbl;
@@ -78,6 +104,16 @@ unixfs_inodelayer_fini(void)
         return;
 
     if (ihash_table != NULL) {
+        struct inode* ip;
+        while ((ip = TAILQ_FIRST(&ilru_head)) != NULL) {
+            TAILQ_REMOVE(&ilru_head, ip, I_lrulink);
+            LIST_REMOVE(ip, I_hashlink);
+            ilru_count--;
+            ihash_count--;
+            (void)pthread_cond_destroy(&ip->I_state_cond);
+            free(ip);
+        }
+
         if (ihash_count != 0) {
             fprintf(stderr,
                     "*** warning: ihash terminated when not empty (%lu)\n",
@@ -176,6 +212,8 @@ unixfs_inodelayer_iget(ino_t ino)
                     }
                 }
                 pthread_mutex_unlock(&ihash_lock); /* XXX See comment below. */
+                unixfs_stats_add(UNIXFS_STATS_ICACHE_HITS, 1);
+                UNIXFS_PROBE1(iget_hit, ino);
                 err = needs_unlock = 0; /* XXX See comment below. */
                 /*
                  * XXX Yes, this comment. There's a subtlety here. This logic
@@ -187,10 +225,18 @@ unixfs_inodelayer_iget(ino_t ino)
                 this_node->I_count++;
                 this_node->I_attachoutstanding = 1;
                 pthread_mutex_unlock(&ihash_lock);
+                unixfs_stats_add(UNIXFS_STATS_ICACHE_MISSES, 1);
+                UNIXFS_PROBE1(iget_miss, ino);
                 err = needs_unlock = 0;
             } else {
+                if (this_node->I_count == 0) { /* parked on the LRU list */
+                    TAILQ_REMOVE(&ilru_head, this_node, I_lrulink);
+                    ilru_count--;
+                }
                 this_node->I_count++;
                 pthread_mutex_unlock(&ihash_lock);
+                unixfs_stats_add(UNIXFS_STATS_ICACHE_HITS, 1);
+                UNIXFS_PROBE1(iget_hit, ino);
                 err = needs_unlock = 0;
             }
         }
@@ -252,14 +298,166 @@ unixfs_inodelayer_iput(struct inode* ip)
 
     pthread_mutex_lock(&ihash_lock);
     ip->I_count--;
-    if (ip->I_count == 0) {
-        LIST_REMOVE(ip, I_hashlink);
-        ihash_count--;
-        pthread_mutex_unlock(&ihash_lock);
-        (void)pthread_cond_destroy(&ip->I_state_cond);
-        free(ip);
-    } else
+    if (ip->I_count != 0) {
         pthread_mutex_unlock(&ihash_lock);
+        return;
+    }
+
+    if (ip->I_initialized) {
+        TAILQ_INSERT_TAIL(&ilru_head, ip, I_lrulink);
+        ilru_count++;
+        if (ilru_count <= desiredfreenodes) {
+            pthread_mutex_unlock(&ihash_lock);
+            return;
+        }
+        ip = TAILQ_FIRST(&ilru_head);
+        TAILQ_REMOVE(&ilru_head, ip, I_lrulink);
+        ilru_count--;
+    }
+
+    LIST_REMOVE(ip, I_hashlink);
+    ihash_count--;
+    pthread_mutex_unlock(&ihash_lock);
+    (void)pthread_cond_destroy(&ip->I_state_cond);
+    free(ip);
+}
+
+struct igetv_slot {
+    ino_t         ino;
+    int           index;  /* in the caller's arrays */
+    off_t         blkno;
+    size_t        blkoff;
+    struct inode* ip;
+    int           dup;
+};
+
+static int
+igetv_cmp_ino(const void* a, const void* b)
+{
+    ino_t x = ((const struct igetv_slot*)a)->ino;
+    ino_t y = ((const struct igetv_slot*)b)->ino;
+    return (x < y) ? -1 : (x > y);
+}
+
+static int
+igetv_cmp_blkno(const void* a, const void* b)
+{
+    off_t x = ((const struct igetv_slot*)a)->blkno;
+    off_t y = ((const struct igetv_slot*)b)->blkno;
+    return (x < y) ? -1 : (x > y);
+}
+
+/*
+ * Get count inodes at once. On return, ips[i] holds a referenced inode for
+ * inos[i], or NULL if that one could not be loaded. Inodes are attached in
+ * ascending order so that two concurrent callers can't each end up waiting
+ * on an inode the other one is initializing. Every inode table block that
+ * holds a not-yet-initialized inode is read exactly once, and adjacent such
+ * blocks are coalesced into a single read.
+ */
+int
+unixfs_inodelayer_igetv(struct super_block* sb, ino_t* inos, int count,
+                        struct inode** ips,
+                        unixfs_inodelayer_locator_t locate,
+                        unixfs_inodelayer_decoder_t decode)
+{
+    int i, j, loaded = 0;
+
+    struct igetv_slot* slots = calloc(count, sizeof(struct igetv_slot));
+    if (!slots)
+        return -1;
+
+    for (i = 0; i < count; i++) {
+        slots[i].ino = inos[i];
+        slots[i].index = i;
+        ips[i] = NULL;
+    }
+
+    qsort(slots, count, sizeof(struct igetv_slot), igetv_cmp_ino);
+
+    /* Attach; duplicates get their reference once the first one is done. */
+
+    int npending = 0;
+    ino_t previno = 0;
+
+    for (i = 0; i < count; i++) {
+        if (i > 0 && slots[i].ino == previno) {
+            slots[i].dup = 1;
+            continue;
+        }
+        previno = slots[i].ino;
+        struct inode* ip = unixfs_inodelayer_iget(slots[i].ino);
+        if (!ip)
+            continue;
+        slots[i].ip = ip;
+        if (ip->I_initialized)
+            continue;
+        if (locate(slots[i].ino, &slots[i].blkno, &slots[i].blkoff) != 0) {
+            unixfs_inodelayer_ifailed(ip);
+            slots[i].ip = NULL;
+            continue;
+        }
+        if (npending != i) {
+            struct igetv_slot tmp = slots[npending];
+            slots[npending] = slots[i];
+            slots[i] = tmp;
+        }
+        npending++;
+    }
+
+    /* Read and decode whatever wasn't cached, one block run at a time. */
+
+    qsort(slots, npending, sizeof(struct igetv_slot), igetv_cmp_blkno);
+
+    size_t bsize = sb->s_blocksize;
+    char* buf = malloc(UNIXFS_IGETV_MAXRUN * bsize);
+
+    for (i = 0; i < npending; i = j) {
+        off_t first = slots[i].blkno;
+        off_t last = first;
+        for (j = i + 1; j < npending; j++) {
+            if (slots[j].blkno > last + 1 ||
+                slots[j].blkno - first >= UNIXFS_IGETV_MAXRUN)
+                break;
+            last = slots[j].blkno;
+        }
+
+        size_t nbytes = (size_t)(last - first + 1) * bsize;
+        int ok = buf && (unixfs_pread(sb->s_bdev, buf, nbytes,
+                                      first * (off_t)bsize) == (ssize_t)nbytes);
+
+        int k;
+        for (k = i; k < j; k++) {
+            struct inode* ip = slots[k].ip;
+            if (ok && decode(ip, buf + (slots[k].blkno - first) * bsize +
+                                 slots[k].blkoff) == 0) {
+                unixfs_inodelayer_isucceeded(ip);
+            } else {
+                unixfs_inodelayer_ifailed(ip);
+                slots[k].ip = NULL;
+            }
+        }
+    }
+
+    free(buf);
+
+    for (i = 0; i < count; i++) {
+        struct inode* ip = slots[i].ip;
+        if (slots[i].dup && (ip = unixfs_inodelayer_iget(slots[i].ino))) {
+            if (!ip->I_initialized) { /* the first occurrence failed */
+                unixfs_inodelayer_ifailed(ip);
+                ip = NULL;
+            }
+        }
+        if (ip) {
+            ips[slots[i].index] = ip;
+            loaded++;
+        }
+    }
+
+    free(slots);
+
+    return loaded;
 }
 
 void
@@ -282,3 +480,264 @@ unixfs_inodelayer_dump(unixfs_inodelayer_iterator_t it)
 out:
     pthread_mutex_unlock(&ihash_lock);
 }
+
+static pthread_mutex_t          statvfs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t                statvfs_thread;
+static int                      statvfs_pending = 0;
+static int                      statvfs_started = 0;
+static unixfs_statvfs_counter_t statvfs_counter = NULL;
+
+static void*
+unixfs_statvfs_count(void* arg)
+{
+    struct super_block* sb = (struct super_block*)arg;
+    struct statvfs svb;
+
+    pthread_mutex_lock(&statvfs_lock);
+    memcpy(&svb, &sb->s_statvfs, sizeof(struct statvfs));
+    pthread_mutex_unlock(&statvfs_lock);
+
+    statvfs_counter(sb, &svb);
+
+    pthread_mutex_lock(&statvfs_lock);
+    memcpy(&sb->s_statvfs, &svb, sizeof(struct statvfs));
+    pthread_mutex_unlock(&statvfs_lock);
+
+    return NULL;
+}
+
+void
+unixfs_statvfs_defer(struct super_block* sb, unixfs_statvfs_counter_t counter)
+{
+    /*
+     * init runs before fuse_daemonize() forks, and a thread made here would
+     * not survive into the daemon. The counter is started by the first
+     * unixfs_statvfs_get() instead, which always runs in the daemon.
+     */
+    pthread_mutex_lock(&statvfs_lock);
+    statvfs_counter = counter;
+    statvfs_started = 0;
+    pthread_mutex_unlock(&statvfs_lock);
+}
+
+void
+unixfs_statvfs_get(struct super_block* sb, struct statvfs* svb)
+{
+    int start = 0;
+
+    pthread_mutex_lock(&statvfs_lock);
+    if (statvfs_counter && !statvfs_started) {
+        statvfs_started = 1;
+        if (pthread_create(&statvfs_thread, (const pthread_attr_t*)0,
+                           unixfs_statvfs_count, (void*)sb) == 0)
+            statvfs_pending = 1;
+        else
+            start = 1;
+    }
+    memcpy(svb, &sb->s_statvfs, sizeof(struct statvfs));
+    pthread_mutex_unlock(&statvfs_lock);
+
+    if (start) {
+        (void)unixfs_statvfs_count((void*)sb); /* do it the slow way */
+        pthread_mutex_lock(&statvfs_lock);
+        memcpy(svb, &sb->s_statvfs, sizeof(struct statvfs));
+        pthread_mutex_unlock(&statvfs_lock);
+    }
+}
+
+void
+unixfs_statvfs_fini(void)
+{
+    pthread_mutex_lock(&statvfs_lock);
+    int pending = statvfs_pending;
+    statvfs_pending = 0;
+    statvfs_started = 0;
+    statvfs_counter = NULL;
+    pthread_mutex_unlock(&statvfs_lock);
+
+    if (pending) /* only ever set in the process that made the thread */
+        (void)pthread_join(statvfs_thread, (void**)0);
+}
+
+/* Bulk byte order conversion, one table per on-disk byte order. */
+
+static void
+fsv_none(void* buf, size_t nbytes)
+{
+}
+
+static void
+fsv_swab16(void* buf, size_t nbytes)
+{
+    unixfs_bitmap_swab16(buf, nbytes / sizeof(uint16_t));
+}
+
+static void
+fsv_swab32(void* buf, size_t nbytes)
+{
+    unixfs_bitmap_swab32(buf, nbytes / sizeof(uint32_t));
+}
+
+static void
+fsv_swab64(void* buf, size_t nbytes)
+{
+    unixfs_bitmap_swab64(buf, nbytes / sizeof(uint64_t));
+}
+
+#ifdef __LITTLE_ENDIAN__
+
+static void
+fsv_pdp32(void* buf, size_t nbytes)
+{
+    unixfs_bitmap_wswap32(buf, nbytes / sizeof(uint32_t));
+}
+
+static const struct unixfs_byteorder unixfs_byteorders[] = {
+    /* endian            16-bit      32-bit      64-bit     */
+    { UNIXFS_FS_PDP,    fsv_none,   fsv_pdp32,  fsv_none   },
+    { UNIXFS_FS_LITTLE, fsv_none,   fsv_none,   fsv_none   },
+    { UNIXFS_FS_BIG,    fsv_swab16, fsv_swab32, fsv_swab64 },
+};
+
+#else /* __BIG_ENDIAN__ */
+
+/* a PDP-11 long is two little-endian shorts, high one first */
+static const struct unixfs_byteorder unixfs_byteorders[] = {
+    /* endian            16-bit      32-bit      64-bit     */
+    { UNIXFS_FS_PDP,    fsv_swab16, fsv_swab16, fsv_swab64 },
+    { UNIXFS_FS_LITTLE, fsv_swab16, fsv_swab32, fsv_swab64 },
+    { UNIXFS_FS_BIG,    fsv_none,   fsv_none,   fsv_none   },
+};
+
+#endif
+
+const struct unixfs_byteorder*
+unixfs_byteorder(fs_endian_t e)
+{
+    if (e >= UNIXFS_FS_INVALID)
+        e = UNIXFS_FS_LITTLE;
+
+    assert(unixfs_byteorders[e].endian == e);
+
+    return &unixfs_byteorders[e];
+}
+
+/*
+ * Indirect block cache. Mapping consecutive logical blocks of a file goes
+ * through the same indirect blocks again and again; rather than reading
+ * and converting one pointer each time, every thread keeps the last few
+ * indirect blocks it has seen, converted to host byte order in one go.
+ * Our images are read-only, so the only way an entry goes stale is a
+ * remount, which the generation number takes care of.
+ */
+
+#define UNIXFS_INDIRECT_SLOTS 8
+
+struct indirect_slot {
+    struct super_block* sb;
+    uint32_t            generation;
+    off_t               blkno;
+    size_t              size;
+    uint64_t            lastuse;
+    char*               data;
+    size_t              capacity;
+};
+
+struct indirect_cache {
+    uint64_t             clock;
+    struct indirect_slot slots[UNIXFS_INDIRECT_SLOTS];
+};
+
+static pthread_key_t  indirect_key;
+static pthread_once_t indirect_once = PTHREAD_ONCE_INIT;
+
+static void
+unixfs_indirect_destroy(void* arg)
+{
+    struct indirect_cache* cache = (struct indirect_cache*)arg;
+    int i;
+
+    for (i = 0; i < UNIXFS_INDIRECT_SLOTS; i++)
+        free(cache->slots[i].data);
+    free(cache);
+}
+
+static void
+unixfs_indirect_once(void)
+{
+    (void)pthread_key_create(&indirect_key, unixfs_indirect_destroy);
+}
+
+const void*
+unixfs_indirect_bread(struct super_block* sb, off_t blkno, size_t size,
+                      unixfs_fsv_to_host_t convert,
+                      unixfs_indirect_reader_t bread, int* error)
+{
+    struct indirect_cache* cache;
+    struct indirect_slot* slot = NULL;
+    int i;
+
+    (void)pthread_once(&indirect_once, unixfs_indirect_once);
+
+    cache = (struct indirect_cache*)pthread_getspecific(indirect_key);
+    if (!cache) {
+        cache = calloc(1, sizeof(struct indirect_cache));
+        if (!cache || pthread_setspecific(indirect_key, cache) != 0) {
+            free(cache);
+            *error = ENOMEM;
+            return NULL;
+        }
+    }
+
+    cache->clock++;
+
+    for (i = 0; i < UNIXFS_INDIRECT_SLOTS; i++) {
+        struct indirect_slot* s = &cache->slots[i];
+        if (s->sb == sb && s->generation == indirect_generation &&
+            s->blkno == blkno && s->size == size) {
+            s->lastuse = cache->clock;
+            unixfs_stats_add(UNIXFS_STATS_BCACHE_HITS, 1);
+            UNIXFS_PROBE2(indirect_hit, blkno, size);
+            *error = 0;
+            return s->data;
+        }
+        if (!slot || s->lastuse < slot->lastuse)
+            slot = s;
+    }
+
+    unixfs_stats_add(UNIXFS_STATS_BCACHE_MISSES, 1);
+    UNIXFS_PROBE2(indirect_miss, blkno, size);
+
+    slot->sb = NULL;
+
+    if (slot->capacity < size) {
+        char* data = realloc(slot->data, size);
+        if (!data) {
+            *error = ENOMEM;
+            return NULL;
+        }
+        slot->data = data;
+        slot->capacity = size;
+    }
+
+    if (bread)
+        *error = bread(blkno, slot->data);
+    else if (unixfs_pread(sb->s_bdev, slot->data, size,
+                          blkno * (off_t)size) != (ssize_t)size)
+        *error = EIO;
+    else
+        *error = 0;
+
+    if (*error)
+        return NULL;
+
+    convert(slot->data, size);
+
+    slot->sb = sb;
+    slot->generation = indirect_generation;
+    slot->blkno = blkno;
+    slot->size = size;
+    slot->lastuse = cache->clock;
+
+    return slot->data;
+}
@@ -12,6 +12,8 @@
 #define _UNIXFS_INTERNAL_H_
 
 #include "unixfs.h"
+#include "unixfs_probes.h"
+#include "unixfs_stats.h"
 
 #include <libgen.h>
 #if __linux__
@@ -123,6 +125,7 @@ struct super_block {
  */
 typedef struct inode {
     LIST_ENTRY(inode)   I_hashlink;
+    TAILQ_ENTRY(inode)  I_lrulink;
     pthread_cond_t      I_state_cond;
     uint32_t            I_initialized;
     uint32_t            I_attachoutstanding;
@@ -175,14 +178,75 @@ typedef struct inode {
 
 typedef int (*unixfs_inodelayer_iterator_t)(struct inode*, void*);
 
+/*
+ * For bulk loading, a file system tells the inode layer where an inode
+ * lives (the s_blocksize-sized inode table block and the byte offset
+ * within it) and how to decode it from a raw on-disk copy.
+ */
+typedef int (*unixfs_inodelayer_locator_t)(ino_t ino, off_t* blkno,
+                                           size_t* blkoff);
+typedef int (*unixfs_inodelayer_decoder_t)(struct inode* ip, char* raw);
+
 int           unixfs_inodelayer_init(size_t privsize);
 void          unixfs_inodelayer_fini(void);
 struct inode* unixfs_inodelayer_iget(ino_t ino);
+int           unixfs_inodelayer_igetv(struct super_block* sb, ino_t* inos,
+                                      int count, struct inode** ips,
+                                      unixfs_inodelayer_locator_t locate,
+                                      unixfs_inodelayer_decoder_t decode);
 void          unixfs_inodelayer_iput(struct inode* ip);
 void          unixfs_inodelayer_isucceeded(struct inode* ip);
 void          unixfs_inodelayer_ifailed(struct inode* ip);
 void          unixfs_inodelayer_dump(unixfs_inodelayer_iterator_t);
 
+/*
+ * Deferred statvfs. A file system whose free counts take a full scan to
+ * compute fills in sb->s_statvfs with whatever it can get cheaply (say,
+ * the counts the super block claims) and hands the scan to a counter that
+ * runs once, on a background thread started by the first statvfs (so that
+ * it is made in the daemon, after the fork). statvfs never waits for it.
+ */
+
+typedef void (*unixfs_statvfs_counter_t)(struct super_block*, struct statvfs*);
+
+void          unixfs_statvfs_defer(struct super_block* sb,
+                                   unixfs_statvfs_counter_t counter);
+void          unixfs_statvfs_get(struct super_block* sb, struct statvfs* svb);
+void          unixfs_statvfs_fini(void);
+
+/*
+ * Bulk byte order conversion. A file system picks the table for its
+ * on-disk byte order once, at mount time, and uses it to convert whole
+ * blocks of like-sized values (indirect blocks, say) in place. The
+ * converters take a byte count and use SIMD shuffles where available.
+ */
+
+typedef void (*unixfs_fsv_to_host_t)(void* buf, size_t nbytes);
+
+struct unixfs_byteorder {
+    fs_endian_t          endian;
+    unixfs_fsv_to_host_t fs16v; /* array of 16-bit values */
+    unixfs_fsv_to_host_t fs32v; /* array of 32-bit values */
+    unixfs_fsv_to_host_t fs64v; /* array of 64-bit values */
+};
+
+const struct unixfs_byteorder* unixfs_byteorder(fs_endian_t e);
+
+/*
+ * Read an indirect block and convert it to host order through a small
+ * per-thread cache. The block is read with bread if given, or else as
+ * size bytes at blkno * size on sb->s_bdev. The returned buffer belongs to
+ * the calling thread and stays valid until that thread's next call.
+ */
+
+typedef int (*unixfs_indirect_reader_t)(off_t blkno, char* blkbuf);
+
+const void*   unixfs_indirect_bread(struct super_block* sb, off_t blkno,
+                                    size_t size,
+                                    unixfs_fsv_to_host_t convert,
+                                    unixfs_indirect_reader_t bread,
+                                    int* error);
+
 /* Byte Swappers */
 
 #define cpu_to_le32(x) OSSwapHostToLittleInt32(x)
@@ -206,9 +270,9 @@ static inline uint64_t
 fs64_to_host(fs_endian_t e, uint64_t x)
 {
     if (e == UNIXFS_FS_BIG)
-        return OSSwapLittleToHostInt64(x);
-    else
         return OSSwapBigToHostInt64(x);
+    else
+        return OSSwapLittleToHostInt64(x);
 }
 
 static inline uint32_t
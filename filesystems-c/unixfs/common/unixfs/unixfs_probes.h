@@ -0,0 +1,56 @@
+/*
+ * UnixFS
+ *
+ * A general-purpose file system layer for writing/reimplementing/porting
+ * Unix file systems through OSXFUSE.
+
+ * Copyright (c) 2008 Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ */
+
+#ifndef _UNIXFS_PROBES_H_
+#define _UNIXFS_PROBES_H_
+
+#define UNIXFS_ENABLE_PROBES 1 /* 1 => enable; 0 => disable */
+
+/*
+ * Static tracepoints for Linux. When <sys/sdt.h> (systemtap-sdt-dev) is
+ * around at build time, each UNIXFS_PROBEn() becomes a USDT probe in the
+ * "unixfs" provider: a single nop in the instruction stream plus an ELF
+ * note that tells bpftrace or perf where to patch in a breakpoint. Nothing
+ * runs unless somebody attaches. Without the header, or on other
+ * platforms, the probes compile away entirely.
+ *
+ *   lookup_entry(parent, name)        lookup_return(parent)
+ *   getattr_entry(ino)                getattr_return(ino)
+ *   readdir_entry(ino, size, off)     readdir_return(ino)
+ *   read_entry(ino, count, off)       read_return(ino)
+ *   iget_hit(ino)                     iget_miss(ino)
+ *   indirect_hit(blkno, size)         indirect_miss(blkno, size)
+ *   bread(blkno, blocksize)           image_read(offset, nbyte)
+ *
+ * See support/debugging/unixfs_*.bt for scripts that use them.
+ */
+
+#if UNIXFS_ENABLE_PROBES && defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define UNIXFS_HAVE_PROBES 1
+#endif
+#endif
+
+#if UNIXFS_HAVE_PROBES
+
+#define UNIXFS_PROBE1(name, a)       DTRACE_PROBE1(unixfs, name, a)
+#define UNIXFS_PROBE2(name, a, b)    DTRACE_PROBE2(unixfs, name, a, b)
+#define UNIXFS_PROBE3(name, a, b, c) DTRACE_PROBE3(unixfs, name, a, b, c)
+
+#else
+
+#define UNIXFS_PROBE1(name, a)       do { } while (0)
+#define UNIXFS_PROBE2(name, a, b)    do { } while (0)
+#define UNIXFS_PROBE3(name, a, b, c) do { } while (0)
+
+#endif
+
+#endif /* _UNIXFS_PROBES_H_ */
@@ -0,0 +1,494 @@
+/*
+ * UnixFS
+ *
+ * A general-purpose file system layer for writing/reimplementing/porting
+ * Unix file systems through OSXFUSE.
+
+ * Copyright (c) 2008 Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ */
+
+#if __linux__
+#define _GNU_SOURCE /* CPU_SET, pthread_setaffinity_np */
+#endif
+
+#include "unixfs_sched.h"
+
+#if UNIXFS_ENABLE_SCHED
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+#if __linux__
+#include <sched.h>
+#include <sys/ioctl.h>
+#endif
+
+#if __APPLE__
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#endif
+
+#define UNIXFS_SCHED_DEFAULT_DEPTH 16
+
+/* From the FUSE kernel protocol, only to pick a lane with. */
+#define UNIXFS_SCHED_OP_READ 15
+
+enum {
+    UNIXFS_SCHED_META,
+    UNIXFS_SCHED_BULK,
+    UNIXFS_SCHED_NLANES
+};
+
+struct unixfs_sched_req {
+    struct fuse_chan* ch;       /* the reply goes back where this came from */
+    size_t            len;
+    char              buf[];
+};
+
+/*
+ * A fixed ring. The owner takes from the head, oldest first; thieves take
+ * from the tail. All under the owning worker's lock; count is also read
+ * without it, to skip empty queues cheaply.
+ */
+struct unixfs_sched_deque {
+    struct unixfs_sched_req** slots;
+    unsigned                  head;
+    unsigned                  count;
+};
+
+struct unixfs_sched;
+
+struct unixfs_sched_worker {
+    struct unixfs_sched*      sched;
+    unsigned                  index;
+    pthread_t                 thread;
+    struct fuse_chan*         ch;
+    int                       owns_ch;
+    char*                     rbuf;
+    size_t                    rbufsize;
+    pthread_mutex_t           lock;
+    struct unixfs_sched_deque lanes[UNIXFS_SCHED_NLANES];
+};
+
+struct unixfs_sched {
+    struct fuse_session*        se;
+    unsigned                    nworkers;
+    unsigned                    depth;
+    int                         pin_cpus;
+    int                         wake[2];
+    struct unixfs_sched_worker* workers;
+};
+
+static unsigned
+unixfs_sched_count(struct unixfs_sched_deque* dq)
+{
+    return __atomic_load_n(&dq->count, __ATOMIC_RELAXED);
+}
+
+static void
+unixfs_sched_push(struct unixfs_sched_worker* w, int lane,
+                  struct unixfs_sched_req* r)
+{
+    struct unixfs_sched_deque* dq = &w->lanes[lane];
+    unsigned depth = w->sched->depth;
+
+    pthread_mutex_lock(&w->lock);
+    dq->slots[(dq->head + dq->count) % depth] = r;
+    __atomic_store_n(&dq->count, dq->count + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static struct unixfs_sched_req*
+unixfs_sched_take(struct unixfs_sched_worker* w, int lane, int steal)
+{
+    struct unixfs_sched_deque* dq = &w->lanes[lane];
+    struct unixfs_sched_req* r = NULL;
+    unsigned depth = w->sched->depth;
+
+    if (unixfs_sched_count(dq) == 0)
+        return NULL;
+
+    pthread_mutex_lock(&w->lock);
+    if (dq->count) {
+        if (steal) {
+            r = dq->slots[(dq->head + dq->count - 1) % depth];
+        } else {
+            r = dq->slots[dq->head];
+            dq->head = (dq->head + 1) % depth;
+        }
+        __atomic_store_n(&dq->count, dq->count - 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return r;
+}
+
+/* Our own queue first, then steal from the others. */
+static struct unixfs_sched_req*
+unixfs_sched_next(struct unixfs_sched_worker* w, int lane)
+{
+    struct unixfs_sched* s = w->sched;
+    struct unixfs_sched_req* r;
+    unsigned i;
+
+    if ((r = unixfs_sched_take(w, lane, 0)))
+        return r;
+    for (i = 1; i < s->nworkers; i++) {
+        struct unixfs_sched_worker* v =
+            &s->workers[(w->index + i) % s->nworkers];
+        if ((r = unixfs_sched_take(v, lane, 1)))
+            return r;
+    }
+
+    return NULL;
+}
+
+static unsigned
+unixfs_sched_queued(struct unixfs_sched_worker* w)
+{
+    return unixfs_sched_count(&w->lanes[UNIXFS_SCHED_META]) +
+           unixfs_sched_count(&w->lanes[UNIXFS_SCHED_BULK]);
+}
+
+static int
+unixfs_sched_lane(const char* buf)
+{
+    uint32_t opcode;
+
+    /* struct fuse_in_header: uint32_t len, then uint32_t opcode */
+    memcpy(&opcode, buf + sizeof(uint32_t), sizeof(opcode));
+    return (opcode == UNIXFS_SCHED_OP_READ) ? UNIXFS_SCHED_BULK
+                                            : UNIXFS_SCHED_META;
+}
+
+static void
+unixfs_sched_wake(struct unixfs_sched* s)
+{
+    char c = 0;
+    (void)write(s->wake[1], &c, 1); /* a full pipe is awake enough */
+}
+
+/*
+ * Reads whatever the device has for us without blocking, up to the queue
+ * depth. Returns the number of requests queued, or -1 once the session is
+ * over.
+ */
+static int
+unixfs_sched_fill(struct unixfs_sched_worker* w)
+{
+    struct unixfs_sched* s = w->sched;
+    int n = 0;
+
+    while (unixfs_sched_queued(w) < s->depth) {
+        struct fuse_chan* ch = w->ch;
+        int res = fuse_chan_recv(&ch, w->rbuf, w->rbufsize);
+
+        if (res == -EAGAIN || res == -EINTR)
+            break;
+        if (res <= 0 || fuse_session_exited(s->se)) {
+            if (res < 0)
+                fuse_session_exit(s->se);
+            return -1;
+        }
+
+        struct unixfs_sched_req* r = malloc(sizeof(*r) + res);
+        if (!r) {
+            fprintf(stderr, "unixfs: out of memory queueing a request\n");
+            fuse_session_exit(s->se);
+            return -1;
+        }
+        r->ch = ch;
+        r->len = res;
+        memcpy(r->buf, w->rbuf, res);
+        unixfs_sched_push(w, unixfs_sched_lane(r->buf), r);
+        n++;
+    }
+
+    return n;
+}
+
+static void
+unixfs_sched_wait(struct unixfs_sched_worker* w)
+{
+    struct unixfs_sched* s = w->sched;
+    int fd = fuse_chan_fd(w->ch);
+    fd_set fds;
+
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    FD_SET(s->wake[0], &fds);
+
+    /* select() rather than poll(), which Darwin does not do on devices */
+    if (select(((fd > s->wake[0]) ? fd : s->wake[0]) + 1, &fds, NULL, NULL,
+               NULL) > 0 && FD_ISSET(s->wake[0], &fds) &&
+        !fuse_session_exited(s->se)) {
+        char c;
+        (void)read(s->wake[0], &c, 1);
+    }
+}
+
+static void
+unixfs_sched_pin(unsigned index)
+{
+#if __linux__
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (ncpus < 1)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(index % ncpus, &set);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (error)
+        fprintf(stderr, "unixfs: cannot pin worker %u: %s\n", index,
+                strerror(error));
+#elif __APPLE__
+    /* Darwin has no binding; threads with distinct tags are kept apart. */
+    thread_affinity_policy_data_t policy = { (integer_t)index + 1 };
+    (void)thread_policy_set(pthread_mach_thread_np(pthread_self()),
+                            THREAD_AFFINITY_POLICY, (thread_policy_t)&policy,
+                            THREAD_AFFINITY_POLICY_COUNT);
+#else
+    (void)index;
+#endif
+}
+
+static void*
+unixfs_sched_worker_loop(void* arg)
+{
+    struct unixfs_sched_worker* w = arg;
+    struct unixfs_sched* s = w->sched;
+
+    if (s->pin_cpus)
+        unixfs_sched_pin(w->index);
+
+    while (!fuse_session_exited(s->se)) {
+        struct unixfs_sched_req* r = unixfs_sched_next(w, UNIXFS_SCHED_META);
+
+        if (!r) {
+            /*
+             * Before settling for bulk work, look for metadata requests the
+             * device may still be holding. That costs one read that fails
+             * with EAGAIN when there are none, next to a data transfer.
+             */
+            int n = unixfs_sched_fill(w);
+            if (n < 0)
+                break;
+            if (n > 1)
+                unixfs_sched_wake(s); /* let idle workers steal the surplus */
+            if (!(r = unixfs_sched_next(w, UNIXFS_SCHED_META)) &&
+                !(r = unixfs_sched_next(w, UNIXFS_SCHED_BULK))) {
+                if (n == 0)
+                    unixfs_sched_wait(w);
+                continue;
+            }
+        }
+
+        fuse_session_process(s->se, r->buf, r->len, r->ch);
+        free(r);
+    }
+
+    /* Whoever notices the end first passes it on to those still waiting. */
+    fuse_session_exit(s->se);
+    unixfs_sched_wake(s);
+
+    return NULL;
+}
+
+#if __linux__
+
+#ifndef FUSE_DEV_IOC_CLONE
+#define FUSE_DEV_IOC_CLONE _IOR(229, 0, uint32_t)
+#endif
+
+/*
+ * FUSE 2 has no clone_fd of its own. A clone channel reads and writes its
+ * own descriptor, attached to the mount with FUSE_DEV_IOC_CLONE; the
+ * kernel wants the reply to a request on the descriptor it was read from.
+ */
+static int
+unixfs_sched_clone_receive(struct fuse_chan** chp, char* buf, size_t size)
+{
+    struct unixfs_sched* s = fuse_chan_data(*chp);
+    ssize_t res;
+
+    do {
+        res = read(fuse_chan_fd(*chp), buf, size);
+    } while (res == -1 && errno == ENOENT); /* request was interrupted */
+
+    if (fuse_session_exited(s->se))
+        return 0;
+    if (res == -1) {
+        int error = errno;
+        if (error == ENODEV) {
+            fuse_session_exit(s->se);
+            return 0;
+        }
+        if (error != EINTR && error != EAGAIN)
+            perror("unixfs: reading device clone");
+        return -error;
+    }
+
+    return (int)res;
+}
+
+static int
+unixfs_sched_clone_send(struct fuse_chan* ch, const struct iovec iov[],
+                        size_t count)
+{
+    if (writev(fuse_chan_fd(ch), iov, count) == -1 && errno != ENOENT)
+        return -errno;
+    return 0;
+}
+
+static void
+unixfs_sched_clone_destroy(struct fuse_chan* ch)
+{
+    close(fuse_chan_fd(ch));
+}
+
+static struct fuse_chan_ops unixfs_sched_clone_ops = {
+    .receive = unixfs_sched_clone_receive,
+    .send    = unixfs_sched_clone_send,
+    .destroy = unixfs_sched_clone_destroy,
+};
+
+static struct fuse_chan*
+unixfs_sched_clone(struct unixfs_sched* s, struct fuse_chan* master)
+{
+    uint32_t masterfd = fuse_chan_fd(master);
+    struct fuse_chan* ch;
+
+    int fd = open("/dev/fuse", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+    if (ioctl(fd, FUSE_DEV_IOC_CLONE, &masterfd) == -1 ||
+        !(ch = fuse_chan_new(&unixfs_sched_clone_ops, fd,
+                             fuse_chan_bufsize(master), s))) {
+        close(fd);
+        return NULL;
+    }
+
+    return ch;
+}
+
+#endif /* __linux__ */
+
+int
+unixfs_sched_loop(struct fuse_session* se, struct fuse_chan* ch,
+                  const struct unixfs_sched_config* config)
+{
+    struct unixfs_sched s;
+    unsigned i, lane, started = 1;
+    int err = -1;
+
+    memset(&s, 0, sizeof(s));
+    s.se = se;
+    s.nworkers = config->workers ? config->workers : 1;
+    s.depth = config->queue_depth ? config->queue_depth
+                                  : UNIXFS_SCHED_DEFAULT_DEPTH;
+    s.pin_cpus = config->pin_cpus;
+    s.wake[0] = s.wake[1] = -1;
+
+#if !__linux__
+    if (config->clone_fd)
+        fprintf(stderr, "unixfs: --clone-fd needs Linux; ignored\n");
+#endif
+
+    int flags = fcntl(fuse_chan_fd(ch), F_GETFL);
+    if (flags == -1 ||
+        fcntl(fuse_chan_fd(ch), F_SETFL, flags | O_NONBLOCK) == -1 ||
+        pipe(s.wake) == -1 ||
+        fcntl(s.wake[0], F_SETFL, O_NONBLOCK) == -1 ||
+        fcntl(s.wake[1], F_SETFL, O_NONBLOCK) == -1) {
+        perror("unixfs: scheduler");
+        goto out;
+    }
+
+    if (!(s.workers = calloc(s.nworkers, sizeof(*s.workers))))
+        goto out;
+
+    for (i = 0; i < s.nworkers; i++) {
+        struct unixfs_sched_worker* w = &s.workers[i];
+        w->sched = &s;
+        w->index = i;
+        w->ch = ch;
+        pthread_mutex_init(&w->lock, NULL);
+#if __linux__
+        if (config->clone_fd && i > 0) {
+            if ((w->ch = unixfs_sched_clone(&s, ch)))
+                w->owns_ch = 1;
+            else {
+                perror("unixfs: cannot clone the device; sharing it");
+                w->ch = ch;
+            }
+        }
+#endif
+        w->rbufsize = fuse_chan_bufsize(w->ch);
+        w->rbuf = malloc(w->rbufsize);
+        for (lane = 0; lane < UNIXFS_SCHED_NLANES; lane++)
+            w->lanes[lane].slots = calloc(s.depth, sizeof(void*));
+        if (!w->rbuf || !w->lanes[UNIXFS_SCHED_META].slots ||
+            !w->lanes[UNIXFS_SCHED_BULK].slots) {
+            fprintf(stderr, "unixfs: out of memory for scheduler\n");
+            s.nworkers = i + 1;
+            goto out;
+        }
+    }
+
+    /* The calling thread is worker 0. */
+    for (; started < s.nworkers; started++) {
+        if (pthread_create(&s.workers[started].thread, NULL,
+                           unixfs_sched_worker_loop,
+                           &s.workers[started]) != 0) {
+            fprintf(stderr, "unixfs: cannot start worker %u\n", started);
+            fuse_session_exit(se);
+            unixfs_sched_wake(&s);
+            break;
+        }
+    }
+
+    if (started == s.nworkers) {
+        unixfs_sched_worker_loop(&s.workers[0]);
+        err = 0;
+    }
+
+    for (i = 1; i < started; i++)
+        pthread_join(s.workers[i].thread, NULL);
+
+out:
+    if (s.workers) {
+        for (i = 0; i < s.nworkers; i++) {
+            struct unixfs_sched_worker* w = &s.workers[i];
+            for (lane = 0; lane < UNIXFS_SCHED_NLANES; lane++) {
+                struct unixfs_sched_req* r;
+                if (w->lanes[lane].slots)
+                    while ((r = unixfs_sched_take(w, lane, 0)))
+                        free(r);
+                free(w->lanes[lane].slots);
+            }
+            if (w->owns_ch)
+                fuse_chan_destroy(w->ch);
+            free(w->rbuf);
+            pthread_mutex_destroy(&w->lock);
+        }
+        free(s.workers);
+    }
+    if (s.wake[0] != -1) {
+        close(s.wake[0]);
+        close(s.wake[1]);
+    }
+    fuse_session_reset(se);
+
+    return err;
+}
+
+#endif /* UNIXFS_ENABLE_SCHED */
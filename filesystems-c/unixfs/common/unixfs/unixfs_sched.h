@@ -0,0 +1,57 @@
+/*
+ * UnixFS
+ *
+ * A general-purpose file system layer for writing/reimplementing/porting
+ * Unix file systems through OSXFUSE.
+
+ * Copyright (c) 2008 Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ */
+
+#ifndef _UNIXFS_SCHED_H_
+#define _UNIXFS_SCHED_H_
+
+#include <fuse/fuse_lowlevel.h>
+
+#define UNIXFS_ENABLE_SCHED 1 /* 1 => enable; 0 => disable */
+
+/*
+ * A session loop to use in place of fuse_session_loop_mt(), selected with
+ * --workers N.
+ *
+ * A fixed pool of N workers serves the mount. A worker with nothing to do
+ * waits on the device; when it wakes, it reads as many requests as it can
+ * get without blocking (up to the queue depth) and queues them locally in
+ * one of two lanes: bulk (read) and metadata (everything else, readdir
+ * included, since a tree walk waits on it). Before taking bulk work, a
+ * worker checks the device for metadata once more. Workers take metadata
+ * before bulk and their own queue before someone else's, stealing from
+ * the other end of a busy worker's queue when their own is empty, so a
+ * lookup is never stuck behind a run of large reads just because they
+ * happened to arrive first.
+ *
+ * With clone_fd (Linux), every worker reads its own clone of the device
+ * descriptor, and replies go back on the descriptor the request came in
+ * on, whoever ends up serving it. With pin_cpus, worker i is bound to CPU
+ * i modulo the number of CPUs (on Darwin, only an affinity hint).
+ */
+
+struct unixfs_sched_config {
+    unsigned workers;
+    unsigned queue_depth;   /* requests a worker may hold queued; 0 => 16 */
+    int      clone_fd;
+    int      pin_cpus;
+};
+
+#if UNIXFS_ENABLE_SCHED
+
+int unixfs_sched_loop(struct fuse_session* se, struct fuse_chan* ch,
+                      const struct unixfs_sched_config* config);
+
+#else
+
+#define unixfs_sched_loop(se, ch, config) fuse_session_loop_mt(se)
+
+#endif
+
+#endif /* _UNIXFS_SCHED_H_ */
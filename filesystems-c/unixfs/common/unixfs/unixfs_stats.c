@@ -0,0 +1,326 @@
+/*
+ * UnixFS
+ *
+ * A general-purpose file system layer for writing/reimplementing/porting
+ * Unix file systems through OSXFUSE.
+
+ * Copyright (c) 2008 Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ */
+
+#include "unixfs_probes.h"
+#include "unixfs_stats.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+static const char* unixfs_stats_opnames[UNIXFS_STATS_NOPS] = {
+    [UNIXFS_STATS_STATFS]     = "statfs",
+    [UNIXFS_STATS_LOOKUP]     = "lookup",
+    [UNIXFS_STATS_GETATTR]    = "getattr",
+    [UNIXFS_STATS_READLINK]   = "readlink",
+    [UNIXFS_STATS_OPENDIR]    = "opendir",
+    [UNIXFS_STATS_READDIR]    = "readdir",
+    [UNIXFS_STATS_RELEASEDIR] = "releasedir",
+    [UNIXFS_STATS_OPEN]       = "open",
+    [UNIXFS_STATS_RELEASE]    = "release",
+    [UNIXFS_STATS_READ]       = "read",
+};
+
+static const struct {
+    const char* name;
+    const char* help;
+} unixfs_stats_counters[UNIXFS_STATS_NCOUNTERS] = {
+    [UNIXFS_STATS_BYTES_READ] =
+        { "unixfs_read_bytes_total", "File data bytes returned by read." },
+    [UNIXFS_STATS_BLOCK_READS] =
+        { "unixfs_block_reads_total", "Reads issued against the image." },
+    [UNIXFS_STATS_BLOCK_BYTES] =
+        { "unixfs_block_read_bytes_total", "Bytes requested from the image." },
+    [UNIXFS_STATS_ICACHE_HITS] =
+        { "unixfs_inode_cache_hits_total", "Inode lookups served in core." },
+    [UNIXFS_STATS_ICACHE_MISSES] =
+        { "unixfs_inode_cache_misses_total",
+          "Inode lookups that had to read the inode table." },
+    [UNIXFS_STATS_BCACHE_HITS] =
+        { "unixfs_indirect_cache_hits_total",
+          "Indirect blocks served from the per-thread cache." },
+    [UNIXFS_STATS_BCACHE_MISSES] =
+        { "unixfs_indirect_cache_misses_total",
+          "Indirect blocks that had to be read." },
+};
+
+struct unixfs_stats_set {
+    struct unixfs_stats_set* next;
+    uint64_t ops[UNIXFS_STATS_NOPS];
+    uint64_t nsec[UNIXFS_STATS_NOPS];
+    uint64_t hist[UNIXFS_STATS_NOPS][UNIXFS_STATS_BUCKETS];
+    uint64_t counters[UNIXFS_STATS_NCOUNTERS];
+};
+
+/*
+ * Live sets hang off stats_head. When a thread exits, its set is folded
+ * into stats_retired so that nothing it counted is lost.
+ */
+static pthread_mutex_t          stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct unixfs_stats_set* stats_head = NULL;
+static struct unixfs_stats_set  stats_retired;
+static unsigned                 stats_nthreads = 0;
+static pthread_key_t            stats_key;
+static pthread_once_t           stats_once = PTHREAD_ONCE_INIT;
+
+/* Only the owning thread writes a set; readers may race with it. */
+#define STATS_LOAD(x)     __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STATS_BUMP(x, n)  __atomic_store_n(&(x), (x) + (n), __ATOMIC_RELAXED)
+
+static void
+unixfs_stats_merge(struct unixfs_stats_set* to,
+                   struct unixfs_stats_set* from)
+{
+    int i, b;
+
+    for (i = 0; i < UNIXFS_STATS_NOPS; i++) {
+        to->ops[i] += STATS_LOAD(from->ops[i]);
+        to->nsec[i] += STATS_LOAD(from->nsec[i]);
+        for (b = 0; b < UNIXFS_STATS_BUCKETS; b++)
+            to->hist[i][b] += STATS_LOAD(from->hist[i][b]);
+    }
+
+    for (i = 0; i < UNIXFS_STATS_NCOUNTERS; i++)
+        to->counters[i] += STATS_LOAD(from->counters[i]);
+}
+
+static void
+unixfs_stats_retire(void* arg)
+{
+    struct unixfs_stats_set* set = (struct unixfs_stats_set*)arg;
+    struct unixfs_stats_set** pp;
+
+    pthread_mutex_lock(&stats_lock);
+    for (pp = &stats_head; *pp; pp = &(*pp)->next) {
+        if (*pp == set) {
+            *pp = set->next;
+            break;
+        }
+    }
+    unixfs_stats_merge(&stats_retired, set);
+    stats_nthreads--;
+    pthread_mutex_unlock(&stats_lock);
+
+    free(set);
+}
+
+static void
+unixfs_stats_init(void)
+{
+    (void)pthread_key_create(&stats_key, unixfs_stats_retire);
+}
+
+#if UNIXFS_ENABLE_STATS
+
+static struct unixfs_stats_set*
+unixfs_stats_self(void)
+{
+    struct unixfs_stats_set* set;
+
+    (void)pthread_once(&stats_once, unixfs_stats_init);
+
+    set = (struct unixfs_stats_set*)pthread_getspecific(stats_key);
+    if (set)
+        return set;
+
+    set = calloc(1, sizeof(struct unixfs_stats_set));
+    if (!set)
+        return NULL;
+
+    if (pthread_setspecific(stats_key, set) != 0) {
+        free(set);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    set->next = stats_head;
+    stats_head = set;
+    stats_nthreads++;
+    pthread_mutex_unlock(&stats_lock);
+
+    return set;
+}
+
+uint64_t
+unixfs_stats_begin(void)
+{
+#if __APPLE__
+    static mach_timebase_info_data_t tb;
+    if (tb.denom == 0)
+        (void)mach_timebase_info(&tb);
+    return mach_absolute_time() * tb.numer / tb.denom;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void
+unixfs_stats_end(unixfs_stats_op_t op, uint64_t begin)
+{
+    struct unixfs_stats_set* set = unixfs_stats_self();
+    if (!set)
+        return;
+
+    uint64_t ns = unixfs_stats_begin() - begin;
+    int b = (ns > 1) ? (63 - __builtin_clzll(ns)) : 0;
+    if (b >= UNIXFS_STATS_BUCKETS)
+        b = UNIXFS_STATS_BUCKETS - 1;
+
+    STATS_BUMP(set->ops[op], 1);
+    STATS_BUMP(set->nsec[op], ns);
+    STATS_BUMP(set->hist[op][b], 1);
+}
+
+void
+unixfs_stats_add(unixfs_stats_counter_t counter, uint64_t n)
+{
+    struct unixfs_stats_set* set = unixfs_stats_self();
+    if (set)
+        STATS_BUMP(set->counters[counter], n);
+}
+
+#endif /* UNIXFS_ENABLE_STATS */
+
+const char*
+unixfs_stats_opname(unixfs_stats_op_t op)
+{
+    if ((unsigned)op >= UNIXFS_STATS_NOPS)
+        return "unknown";
+
+    return unixfs_stats_opnames[op];
+}
+
+ssize_t
+unixfs_pread(int fd, void* buf, size_t nbyte, off_t offset)
+{
+    unixfs_stats_add(UNIXFS_STATS_BLOCK_READS, 1);
+    unixfs_stats_add(UNIXFS_STATS_BLOCK_BYTES, nbyte);
+    UNIXFS_PROBE2(image_read, offset, nbyte);
+
+    return pread(fd, buf, nbyte, offset);
+}
+
+struct statsbuf {
+    char*  p;
+    size_t len;
+    size_t size;
+    int    failed;
+};
+
+static void
+statsbuf_printf(struct statsbuf* sb, const char* fmt, ...)
+{
+    va_list ap;
+
+    if (sb->failed)
+        return;
+
+    for (;;) {
+        va_start(ap, fmt);
+        int n = vsnprintf(sb->p + sb->len, sb->size - sb->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            sb->failed = 1;
+            return;
+        }
+        if ((size_t)n < sb->size - sb->len) {
+            sb->len += n;
+            return;
+        }
+        size_t newsize = sb->size * 2 + n;
+        char* newp = realloc(sb->p, newsize);
+        if (!newp) {
+            sb->failed = 1;
+            return;
+        }
+        sb->p = newp;
+        sb->size = newsize;
+    }
+}
+
+char*
+unixfs_stats_snapshot(size_t* len)
+{
+    struct unixfs_stats_set total;
+    struct unixfs_stats_set* set;
+    unsigned nthreads;
+    int i, b;
+
+    memset(&total, 0, sizeof(total));
+
+    (void)pthread_once(&stats_once, unixfs_stats_init);
+
+    pthread_mutex_lock(&stats_lock);
+    unixfs_stats_merge(&total, &stats_retired);
+    for (set = stats_head; set; set = set->next)
+        unixfs_stats_merge(&total, set);
+    nthreads = stats_nthreads;
+    pthread_mutex_unlock(&stats_lock);
+
+    struct statsbuf sb = { malloc(16384), 0, 16384, 0 };
+    if (!sb.p)
+        return NULL;
+
+    statsbuf_printf(&sb,
+        "# HELP unixfs_op_latency_seconds Time spent handling requests.\n"
+        "# TYPE unixfs_op_latency_seconds histogram\n");
+
+    for (i = 0; i < UNIXFS_STATS_NOPS; i++) {
+        const char* op = unixfs_stats_opnames[i];
+        uint64_t cumulative = 0;
+        for (b = 0; b < UNIXFS_STATS_BUCKETS - 1; b++) {
+            cumulative += total.hist[i][b];
+            statsbuf_printf(&sb,
+                "unixfs_op_latency_seconds_bucket{op=\"%s\",le=\"%.9g\"} "
+                "%llu\n", op, (double)(2ULL << b) / 1.0e9,
+                (unsigned long long)cumulative);
+        }
+        statsbuf_printf(&sb,
+            "unixfs_op_latency_seconds_bucket{op=\"%s\",le=\"+Inf\"} %llu\n"
+            "unixfs_op_latency_seconds_sum{op=\"%s\"} %.9f\n"
+            "unixfs_op_latency_seconds_count{op=\"%s\"} %llu\n",
+            op, (unsigned long long)total.ops[i],
+            op, (double)total.nsec[i] / 1.0e9,
+            op, (unsigned long long)total.ops[i]);
+    }
+
+    for (i = 0; i < UNIXFS_STATS_NCOUNTERS; i++) {
+        statsbuf_printf(&sb, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+                        unixfs_stats_counters[i].name,
+                        unixfs_stats_counters[i].help,
+                        unixfs_stats_counters[i].name,
+                        unixfs_stats_counters[i].name,
+                        (unsigned long long)total.counters[i]);
+    }
+
+    statsbuf_printf(&sb,
+        "# HELP unixfs_stats_threads Threads currently keeping counters.\n"
+        "# TYPE unixfs_stats_threads gauge\n"
+        "unixfs_stats_threads %u\n", nthreads);
+
+    if (sb.failed) {
+        free(sb.p);
+        return NULL;
+    }
+
+    *len = sb.len;
+
+    return sb.p;
+}
@@ -0,0 +1,80 @@
+/*
+ * UnixFS
+ *
+ * A general-purpose file system layer for writing/reimplementing/porting
+ * Unix file systems through OSXFUSE.
+
+ * Copyright (c) 2008 Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ */
+
+#ifndef _UNIXFS_STATS_H_
+#define _UNIXFS_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define UNIXFS_ENABLE_STATS 1 /* 1 => enable; 0 => disable */
+
+/*
+ * Each thread updates its own set of counters without locking; a reader
+ * walks every thread's set and adds them up. Latencies go into log2
+ * buckets: bucket b counts requests that took [2^b, 2^(b+1)) ns.
+ */
+
+#define UNIXFS_STATS_BUCKETS 32
+
+typedef enum {
+    UNIXFS_STATS_STATFS,
+    UNIXFS_STATS_LOOKUP,
+    UNIXFS_STATS_GETATTR,
+    UNIXFS_STATS_READLINK,
+    UNIXFS_STATS_OPENDIR,
+    UNIXFS_STATS_READDIR,
+    UNIXFS_STATS_RELEASEDIR,
+    UNIXFS_STATS_OPEN,
+    UNIXFS_STATS_RELEASE,
+    UNIXFS_STATS_READ,
+    UNIXFS_STATS_NOPS,
+} unixfs_stats_op_t;
+
+typedef enum {
+    UNIXFS_STATS_BYTES_READ,      /* file data returned by read */
+    UNIXFS_STATS_BLOCK_READS,     /* preads against the image */
+    UNIXFS_STATS_BLOCK_BYTES,     /* bytes asked of those preads */
+    UNIXFS_STATS_ICACHE_HITS,     /* inode layer: found initialized */
+    UNIXFS_STATS_ICACHE_MISSES,   /* inode layer: had to be read */
+    UNIXFS_STATS_BCACHE_HITS,     /* indirect block cache */
+    UNIXFS_STATS_BCACHE_MISSES,
+    UNIXFS_STATS_NCOUNTERS,
+} unixfs_stats_counter_t;
+
+#if UNIXFS_ENABLE_STATS
+
+uint64_t unixfs_stats_begin(void);
+void     unixfs_stats_end(unixfs_stats_op_t op, uint64_t begin);
+void     unixfs_stats_add(unixfs_stats_counter_t counter, uint64_t n);
+
+#else
+
+#define unixfs_stats_begin()        ((uint64_t)0)
+#define unixfs_stats_end(op, begin) do { (void)(begin); } while (0)
+#define unixfs_stats_add(c, n)      do { } while (0)
+
+#endif
+
+/*
+ * Render the merged counters in the Prometheus text exposition format.
+ * Returns a malloc'ed, NUL-terminated buffer and its length (without the
+ * NUL) in *len, or NULL if out of memory.
+ */
+char*    unixfs_stats_snapshot(size_t* len);
+
+/* The name an operation goes by in the snapshot, e.g. "lookup". */
+const char* unixfs_stats_opname(unixfs_stats_op_t op);
+
+/* Read from the image, counting the request as a block read. */
+ssize_t  unixfs_pread(int fd, void* buf, size_t nbyte, off_t offset);
+
+#endif /* _UNIXFS_STATS_H_ */
@@ -0,0 +1,156 @@
+/*
+ * UnixFS
+ *
+ * A general-purpose file system layer for writing/reimplementing/porting
+ * Unix file systems through OSXFUSE.
+
+ * Copyright (c) 2008 Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ */
+
+#include "unixfs_trace.h"
+
+#if UNIXFS_ENABLE_TRACE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#if __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+#define UNIXFS_TRACE_BUFSIZ (1024 * 1024)
+
+/*
+ * Records go through one stdio stream under a lock. That is cheap next to
+ * a trip through the kernel, and keeps the records of concurrent requests
+ * whole without any per-thread buffering to drain at exit.
+ */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE*           trace_file = NULL;
+static char*           trace_buf = NULL;
+static uint64_t        trace_epoch;
+static uint32_t        trace_nthreads = 0;
+static __thread uint32_t trace_thread = 0;
+
+static uint64_t
+unixfs_trace_clock(void)
+{
+#if __APPLE__
+    static mach_timebase_info_data_t tb;
+    if (tb.denom == 0)
+        (void)mach_timebase_info(&tb);
+    return mach_absolute_time() * tb.numer / tb.denom;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+int
+unixfs_trace_open(const char* path, const char* fsname)
+{
+    struct unixfs_trace_header th;
+    struct timeval tv;
+
+    FILE* fp = fopen(path, "w");
+    if (!fp)
+        return errno;
+
+    trace_buf = malloc(UNIXFS_TRACE_BUFSIZ);
+    if (trace_buf)
+        setvbuf(fp, trace_buf, _IOFBF, UNIXFS_TRACE_BUFSIZ);
+
+    gettimeofday(&tv, NULL);
+
+    memset(&th, 0, sizeof(th));
+    memcpy(th.th_magic, UNIXFS_TRACE_MAGIC, sizeof(th.th_magic));
+    th.th_version = UNIXFS_TRACE_VERSION;
+    th.th_recsize = sizeof(struct unixfs_trace_record);
+    th.th_start = (uint64_t)tv.tv_sec * 1000000000ULL +
+                  (uint64_t)tv.tv_usec * 1000ULL;
+    if (fsname)
+        strncpy(th.th_fsname, fsname, sizeof(th.th_fsname) - 1);
+
+    if (fwrite(&th, sizeof(th), 1, fp) != 1) {
+        int error = errno;
+        fclose(fp);
+        free(trace_buf);
+        trace_buf = NULL;
+        return error;
+    }
+
+    trace_epoch = unixfs_trace_clock();
+    trace_file = fp;
+
+    return 0;
+}
+
+void
+unixfs_trace_close(void)
+{
+    pthread_mutex_lock(&trace_lock);
+    if (trace_file) {
+        if (fclose(trace_file) != 0)
+            perror("unixfs: trace");
+        trace_file = NULL;
+        free(trace_buf);
+        trace_buf = NULL;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+uint64_t
+unixfs_trace_begin(void)
+{
+    return trace_file ? unixfs_trace_clock() : 0;
+}
+
+void
+unixfs_trace_end(unixfs_stats_op_t op, uint64_t begin, uint64_t ino,
+                 const char* name, uint64_t size, uint64_t offset,
+                 uint64_t fh)
+{
+    struct unixfs_trace_record tr;
+    size_t namelen = 0;
+
+    if (!begin || !trace_file)
+        return;
+
+    uint64_t elapsed = unixfs_trace_clock() - begin;
+
+    if (name) {
+        namelen = strlen(name);
+        if (namelen > UINT8_MAX)
+            namelen = UINT8_MAX;
+    }
+
+    memset(&tr, 0, sizeof(tr));
+    tr.tr_begin = begin - trace_epoch;
+    tr.tr_ino = ino;
+    tr.tr_fh = fh;
+    tr.tr_offset = offset;
+    tr.tr_size = (size > UINT32_MAX) ? UINT32_MAX : (uint32_t)size;
+    tr.tr_elapsed = (elapsed > UINT32_MAX) ? UINT32_MAX : (uint32_t)elapsed;
+    tr.tr_op = (uint8_t)op;
+    tr.tr_namelen = (uint8_t)namelen;
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace_file) {
+        if (!trace_thread)
+            trace_thread = ++trace_nthreads;
+        tr.tr_thread = trace_thread;
+        fwrite(&tr, sizeof(tr), 1, trace_file);
+        if (namelen)
+            fwrite(name, namelen, 1, trace_file);
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+#endif /* UNIXFS_ENABLE_TRACE */
@@ -0,0 +1,73 @@
+/*
+ * UnixFS
+ *
+ * A general-purpose file system layer for writing/reimplementing/porting
+ * Unix file systems through OSXFUSE.
+
+ * Copyright (c) 2008 Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ */
+
+#ifndef _UNIXFS_TRACE_H_
+#define _UNIXFS_TRACE_H_
+
+#include "unixfs_stats.h"
+
+#include <stdint.h>
+
+#define UNIXFS_ENABLE_TRACE 1 /* 1 => enable; 0 => disable */
+
+/*
+ * With --record FILE, the lowlevel front end appends one record to FILE for
+ * every request it handles. bench/unixfs_replay.c reads such a trace and
+ * issues the same requests straight against a flavor's unixfs_ops.
+ *
+ * A trace is a header followed by records in completion order. Both are
+ * in the byte order of the host that wrote them. A record is followed by
+ * namelen bytes of name (lookup only), with no terminating NUL.
+ */
+
+#define UNIXFS_TRACE_MAGIC   "UFSTRACE"
+#define UNIXFS_TRACE_VERSION 1
+
+struct unixfs_trace_header {
+    char     th_magic[8];
+    uint32_t th_version;
+    uint32_t th_recsize;      /* sizeof(struct unixfs_trace_record) */
+    uint64_t th_start;        /* wall clock at start, ns since the epoch */
+    char     th_fsname[32];   /* type the image was mounted as */
+} __attribute__((packed));
+
+struct unixfs_trace_record {
+    uint64_t tr_begin;        /* ns since the trace started */
+    uint64_t tr_ino;          /* parent for lookup */
+    uint64_t tr_fh;           /* file handle: open's result, or read's */
+    uint64_t tr_offset;       /* read, readdir */
+    uint32_t tr_size;         /* read, readdir */
+    uint32_t tr_elapsed;      /* ns, reply included; saturates */
+    uint32_t tr_thread;       /* small per-thread number, from 1 */
+    uint8_t  tr_op;           /* unixfs_stats_op_t */
+    uint8_t  tr_namelen;
+    uint16_t tr_reserved;
+} __attribute__((packed));
+
+#if UNIXFS_ENABLE_TRACE
+
+int      unixfs_trace_open(const char* path, const char* fsname);
+void     unixfs_trace_close(void);
+uint64_t unixfs_trace_begin(void);
+void     unixfs_trace_end(unixfs_stats_op_t op, uint64_t begin, uint64_t ino,
+                          const char* name, uint64_t size, uint64_t offset,
+                          uint64_t fh);
+
+#else
+
+#define unixfs_trace_open(path, fsname) (ENOTSUP)
+#define unixfs_trace_close()            do { } while (0)
+#define unixfs_trace_begin()            ((uint64_t)0)
+#define unixfs_trace_end(op, begin, ino, name, size, offset, fh) \
+    do { (void)(begin); } while (0)
+
+#endif
+
+#endif /* _UNIXFS_TRACE_H_ */
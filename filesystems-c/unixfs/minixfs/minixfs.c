@@ -11,25 +11,30 @@
  */
 
 #include "minixfs.h"
+#include "unixfs_bitmap.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 
-static unsigned long count_free(struct buffer_head*[], unsigned, __u32);
-static unsigned long minix_count_free_blocks(struct minix_sb_info*);
+static unsigned long count_free(struct buffer_head*[], unsigned, __u32,
+                                unsigned long);
+static unsigned long minix_count_free_blocks(struct super_block*);
 static struct minix_inode*  minix_V1_raw_inode(struct super_block*, ino_t,
                                                struct buffer_head**);
 static struct minix2_inode* minix_V2_raw_inode(struct super_block*, ino_t,
                                                struct buffer_head**);
-static unsigned long minix_count_free_inodes(struct minix_sb_info*);
+static unsigned long minix_count_free_inodes(struct super_block*);
 static int           minix_iget_v1(struct super_block*, struct inode*);
 static int           minix_iget_v2(struct super_block*, struct inode*);
+static void          minix_decode_v1(struct inode*, struct minix_inode*);
+static void          minix_decode_v2(struct inode*, struct minix2_inode*);
 static unsigned      minix_last_byte(struct inode*, unsigned long);
 static int           minix_get_dirpage(struct inode*, sector_t, char*);
 static ino_t         minix_find_entry(struct inode*, const char*);
@@ -37,45 +42,41 @@ static ino_t         minix_find_entry(struct inode*, const char*);
 extern int           minix_get_block_v1(struct inode*, sector_t, off_t*);
 extern int           minix_get_block_v2(struct inode*, sector_t, off_t*);
 
-static const int nibblemap[] = { 4,3,3,2,3,2,2,1,3,2,2,1,2,1,1,0 };
-
+/*
+ * A map is numbits bits spread over numblocks blocks of blocksize bytes;
+ * bits past numbits in the last block are ignored. Only the first blocksize
+ * bytes of each buffer hold map; b_size is that of the whole buffer.
+ */
 static unsigned long
-count_free(struct buffer_head* map[], unsigned numblocks, __u32 numbits)
+count_free(struct buffer_head* map[], unsigned numblocks, __u32 numbits,
+           unsigned long blocksize)
 {
-    unsigned i, j, sum = 0;
+    unsigned i;
+    unsigned long sum = 0, done = 0;
     struct buffer_head* bh;
-  
-    for (i = 0; i < numblocks - 1; i++) {
-        if (!(bh = map[i])) 
-            return 0;
-        for (j = 0; j < bh->b_size; j++)
-            sum += nibblemap[bh->b_data[j] & 0xf]
-                + nibblemap[(bh->b_data[j] >> 4) & 0xf];
-    }
 
-    if (numblocks == 0 || !(bh = map[numblocks - 1]))
+    if (numblocks == 0)
         return 0;
 
-    i = ((numbits - (numblocks - 1) * bh->b_size * 8) / 16) * 2;
-    for (j = 0; j < i; j++) {
-        sum += nibblemap[bh->b_data[j] & 0xf]
-            + nibblemap[(bh->b_data[j] >> 4) & 0xf];
+    for (i = 0; i < numblocks && done < numbits; i++) {
+        if (!(bh = map[i]))
+            return 0;
+        size_t nbits = min(blocksize * 8, (unsigned long)(numbits - done));
+        sum += nbits - unixfs_bitmap_popcount(bh->b_data, 0, nbits);
+        done += nbits;
     }
 
-    i = numbits % 16;
-    if (i != 0) {
-        i = *(__u16*)(&bh->b_data[j]) | ~((1 << i) - 1);
-        sum += nibblemap[i & 0xf] + nibblemap[(i >> 4) & 0xf];
-        sum += nibblemap[(i >> 8) & 0xf] + nibblemap[(i >> 12) & 0xf];
-    }
-    return(sum);
+    return sum;
 }
 
 static unsigned long
-minix_count_free_blocks(struct minix_sb_info* sbi)
+minix_count_free_blocks(struct super_block* sb)
 {
+    struct minix_sb_info* sbi = minix_sb(sb);
+
     return (count_free(sbi->s_zmap, sbi->s_zmap_blocks,
-            sbi->s_nzones - sbi->s_firstdatazone + 1) << sbi->s_log_zone_size);
+            sbi->s_nzones - sbi->s_firstdatazone + 1,
+            sb->s_blocksize) << sbi->s_log_zone_size);
 }
 
 struct minix_inode*
@@ -129,25 +130,20 @@ minix_V2_raw_inode(struct super_block* sb, ino_t ino, struct buffer_head** bh)
 }
 
 static unsigned long
-minix_count_free_inodes(struct minix_sb_info* sbi)
+minix_count_free_inodes(struct super_block* sb)
 {
-    return count_free(sbi->s_imap, sbi->s_imap_blocks, sbi->s_ninodes + 1);
+    struct minix_sb_info* sbi = minix_sb(sb);
+
+    return count_free(sbi->s_imap, sbi->s_imap_blocks, sbi->s_ninodes + 1,
+                      sb->s_blocksize);
 }
 
-static int
-minix_iget_v1(struct super_block* sb, struct inode* inode)
+static void
+minix_decode_v1(struct inode* inode, struct minix_inode* raw_inode)
 {
-    struct buffer_head _bh;
-    struct buffer_head* bh = &_bh;;
-    bh->b_flags.dynamic = 0;
-    struct minix_inode* raw_inode;
     struct minix_inode_info* minix_inode = minix_i(inode);
     int i;
 
-    raw_inode = minix_V1_raw_inode(inode->I_sb, inode->I_ino, &bh);
-    if (!raw_inode)
-        return -1;
-
     inode->I_mode = raw_inode->di_mode;
     inode->I_uid = (uid_t)raw_inode->di_uid;
     inode->I_gid = (gid_t)raw_inode->di_gid;
@@ -164,24 +160,31 @@ minix_iget_v1(struct super_block* sb, struct inode* inode)
     if (S_ISCHR(inode->I_mode) || S_ISBLK(inode->I_mode))
         inode->I_rdev = old_decode_dev(raw_inode->di_zone[0]);
     minix_inode->i_dir_start_lookup = 0;
-    brelse(bh);
-    return 0; 
 }
 
 static int
-minix_iget_v2(struct super_block* sb, struct inode* inode)
+minix_iget_v1(struct super_block* sb, struct inode* inode)
 {
     struct buffer_head _bh;
     struct buffer_head* bh = &_bh;;
     bh->b_flags.dynamic = 0;
-    struct minix2_inode* raw_inode;
-    struct minix_inode_info* minix_inode = minix_i(inode);
-    int i;
+    struct minix_inode* raw_inode;
 
-    raw_inode = minix_V2_raw_inode(inode->I_sb, inode->I_ino, &bh);
+    raw_inode = minix_V1_raw_inode(inode->I_sb, inode->I_ino, &bh);
     if (!raw_inode)
         return -1;
 
+    minix_decode_v1(inode, raw_inode);
+    brelse(bh);
+    return 0; 
+}
+
+static void
+minix_decode_v2(struct inode* inode, struct minix2_inode* raw_inode)
+{
+    struct minix_inode_info* minix_inode = minix_i(inode);
+    int i;
+
     inode->I_mode = raw_inode->di_mode;
     inode->I_uid = (uid_t)raw_inode->di_uid;
     inode->I_gid = (gid_t)raw_inode->di_gid;
@@ -199,6 +202,21 @@ minix_iget_v2(struct super_block* sb, struct inode* inode)
     if (S_ISCHR(inode->I_mode) || S_ISBLK(inode->I_mode))
         inode->I_rdev = old_decode_dev(raw_inode->di_zone[0]);
     minix_inode->i_dir_start_lookup = 0;
+}
+
+static int
+minix_iget_v2(struct super_block* sb, struct inode* inode)
+{
+    struct buffer_head _bh;
+    struct buffer_head* bh = &_bh;;
+    bh->b_flags.dynamic = 0;
+    struct minix2_inode* raw_inode;
+
+    raw_inode = minix_V2_raw_inode(inode->I_sb, inode->I_ino, &bh);
+    if (!raw_inode)
+        return -1;
+
+    minix_decode_v2(inode, raw_inode);
     brelse(bh);
     return 0;
 }
@@ -360,7 +378,7 @@ minixfs_fill_super(int fd, void* data, int silent)
         sbi->s_link_max = MINIX2_LINK_MAX;
         sbi->s_mount_state = MINIX_VALID_FS;
         sb->s_blocksize = m3s->s_blocksize;
-        sb->s_blocksize_bits = m3s->s_blocksize;
+        sb->s_blocksize_bits = ffs(m3s->s_blocksize) - 1;
     } else
         goto out_no_fs;
 
@@ -461,10 +479,10 @@ minixfs_statvfs(struct super_block* sb, struct statvfs* buf)
     buf->f_frsize  = sb->s_blocksize;
     buf->f_blocks  =
         (sbi->s_nzones - sbi->s_firstdatazone) << sbi->s_log_zone_size;
-    buf->f_bfree   = minix_count_free_blocks(sbi);
+    buf->f_bfree   = minix_count_free_blocks(sb);
     buf->f_bavail  = buf->f_bfree;
     buf->f_files   = sbi->s_ninodes;
-    buf->f_ffree   = minix_count_free_inodes(sbi);
+    buf->f_ffree   = minix_count_free_inodes(sb);
     buf->f_namemax = sbi->s_namelen;
 
     return 0;
@@ -479,6 +497,36 @@ minixfs_iget(struct super_block* sb, struct inode* inode)
         return minix_iget_v2(sb, inode);
 }
 
+int
+minixfs_inode_location(struct super_block* sb, ino_t ino, off_t* blkno,
+                       size_t* blkoff)
+{
+    struct minix_sb_info* sbi = minix_sb(sb);
+    size_t isize = (sbi->s_version == MINIX_V1) ?
+        sizeof(struct minix_inode) : sizeof(struct minix2_inode);
+    unsigned long ipb = sb->s_blocksize / isize;
+
+    if (!ino || ino > sbi->s_ninodes)
+        return -1;
+
+    ino--;
+    *blkno = 2 + sbi->s_imap_blocks + sbi->s_zmap_blocks + ino / ipb;
+    *blkoff = (ino % ipb) * isize;
+
+    return 0;
+}
+
+int
+minixfs_iget_raw(struct super_block* sb, struct inode* inode, char* raw)
+{
+    if (INODE_VERSION(inode) == MINIX_V1)
+        minix_decode_v1(inode, (struct minix_inode*)raw);
+    else
+        minix_decode_v2(inode, (struct minix2_inode*)raw);
+
+    return 0;
+}
+
 ino_t
 minix_inode_by_name(struct inode* dir, const char* name)
 {
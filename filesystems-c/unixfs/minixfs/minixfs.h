@@ -91,6 +91,9 @@ struct super_block*
       minixfs_fill_super(int fd, void* args, int silent);
 int   minixfs_statvfs(struct super_block* sb, struct statvfs* buf);
 int   minixfs_iget(struct super_block* sb, struct inode* ip);
+int   minixfs_iget_raw(struct super_block* sb, struct inode* ip, char* raw);
+int   minixfs_inode_location(struct super_block* sb, ino_t ino, off_t* blkno,
+                             size_t* blkoff);
 ino_t minixfs_inode_by_name(struct inode* dir, const char* name);
 int   minixfs_next_direntry(struct inode* dir, struct unixfs_dirbuf* dirbuf,
                           off_t* offset, struct unixfs_direntry* dent);
@@ -5,6 +5,8 @@
  */
 
 #include "minixfs.h"
+
+#define UNIXFS_INTERNAL_IGETV unixfs_internal_igetv
 #include "unixfs_common.h"
 
 #include <errno.h>
@@ -16,6 +18,8 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 
+static int unixfs_internal_igetv(ino_t* inos, int count, struct inode** ips);
+
 DECL_UNIXFS("Minix", minix);
 
 static void*
@@ -120,8 +124,8 @@ unixfs_internal_bread(off_t blkno, char* blkbuf)
 {
     struct super_block* sb = unixfs;
 
-    if (pread(sb->s_bdev, blkbuf, sb->s_blocksize,
-              blkno * (off_t)(sb->s_blocksize)) != sb->s_blocksize)
+    if (unixfs_pread(sb->s_bdev, blkbuf, sb->s_blocksize,
+                     blkno * (off_t)(sb->s_blocksize)) != sb->s_blocksize)
         return EIO;
 
     return 0;
@@ -161,6 +165,34 @@ bad_inode:
     return NULL;
 }
 
+static int
+unixfs_internal_ilocate(ino_t ino, off_t* blkno, size_t* blkoff)
+{
+    return minixfs_inode_location(unixfs, ino, blkno, blkoff);
+}
+
+static int
+unixfs_internal_idecode(struct inode* inode, char* raw)
+{
+    inode->I_sb = unixfs;
+    inode->I_blkbits = unixfs->s_blocksize_bits;
+
+    return minixfs_iget_raw(unixfs, inode, raw);
+}
+
+static int
+unixfs_internal_igetv(ino_t* inos, int count, struct inode** ips)
+{
+    int i;
+    for (i = 0; i < count; i++)
+        if (inos[i] == OSXFUSE_ROOTINO)
+            inos[i] = MINIX_ROOT_INO;
+
+    return unixfs_inodelayer_igetv(unixfs, inos, count, ips,
+                                   unixfs_internal_ilocate,
+                                   unixfs_internal_idecode);
+}
+
 static void
 unixfs_internal_iput(struct inode* ip)
 {
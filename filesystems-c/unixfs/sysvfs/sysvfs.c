@@ -350,7 +350,7 @@ sysv_fill_super(int fd, void* args, int silent)
 
     for (i = 0; i < ARRAY_SIZE(flavours) && !size; i++) {
         blocknr = flavours[i].block;
-        if ((ret = pread(fd, bh->b_data, BLOCK_SIZE,
+        if ((ret = unixfs_pread(fd, bh->b_data, BLOCK_SIZE,
                         (off_t)(flavours[i].block * BLOCK_SIZE))) < 0)
             goto failed_errno;
         else if (ret != BLOCK_SIZE)
@@ -370,9 +370,9 @@ sysv_fill_super(int fd, void* args, int silent)
             sb->s_blocksize_bits = blksize_bits(512);
             if ((bh1 = malloc(sizeof(struct buffer_head))) == NULL)
                 goto failed_errno;
-            if (pread(fd, bh1->b_data, 512, (off_t)(blocknr * 512)) < 0)
+            if (unixfs_pread(fd, bh1->b_data, 512, (off_t)(blocknr * 512)) < 0)
                 goto failed_errno;
-            if (pread(fd, bh->b_data, 512, (off_t)((blocknr + 1) * 512)) < 0)
+            if (unixfs_pread(fd, bh->b_data, 512, (off_t)((blocknr + 1) * 512)) < 0)
                 goto failed_errno;
             break;
 
@@ -384,7 +384,7 @@ sysv_fill_super(int fd, void* args, int silent)
             blocknr = blocknr >> 1;
             sb->s_blocksize = 2048;
             sb->s_blocksize_bits = blksize_bits(2048);
-            if (pread(fd, bh->b_data, 2048, (off_t)(blocknr * 2048)) < 0)
+            if (unixfs_pread(fd, bh->b_data, 2048, (off_t)(blocknr * 2048)) < 0)
                 goto failed_errno;
             bh1 = bh;
             break;
@@ -515,45 +515,58 @@ sysv_raw_inode(struct super_block* sb, ino_t ino, struct buffer_head* bh)
     return res + (((unsigned int)ino - 1) & sbi->s_inodes_per_block_1);
 }
 
+#define SYSV_ITABLE_CHUNK 64 /* inode table blocks per read when counting */
+
 unsigned long
 sysv_count_free_inodes(struct super_block* sb)
 {
     struct sysv_sb_info* sbi = SYSV_SB(sb);
-    int ino, count, sb_count;
+    unsigned long ino, count;
+    int sb_count;
     struct sysv_dinode* raw_inode;
 
-    struct buffer_head bh;
-
     sb_count = fs16_to_host(sbi->s_bytesex, *sbi->s_sb_total_free_inodes);
 
     if (0)
         goto trust_sb;
 
+    char* buf = malloc(SYSV_ITABLE_CHUNK * sb->s_blocksize);
+    if (!buf)
+        goto Eio;
+
     count = 0;
     ino = SYSV_ROOT_INO+1;
 
-    raw_inode = sysv_raw_inode(sb, ino, &bh);
-    if (!raw_inode)
-        goto Eio;
+    unsigned long lastblk = (sbi->s_ninodes - 1) >> sbi->s_inodes_per_block_bits;
 
     while (ino <= sbi->s_ninodes) {
-        if (raw_inode->di_mode == 0 && raw_inode->di_nlink == 0)
-            count++;
-        if ((ino++ & sbi->s_inodes_per_block_1) == 0) {
-            raw_inode = sysv_raw_inode(sb, ino, &bh);
-            if (!raw_inode)
-                goto Eio;
-        } else
-            raw_inode++;
+        unsigned long blk = (ino - 1) >> sbi->s_inodes_per_block_bits;
+        unsigned long nblks = min(SYSV_ITABLE_CHUNK, lastblk - blk + 1);
+        size_t nbytes = nblks * sb->s_blocksize;
+        off_t where = (off_t)(sbi->s_firstinodezone + sbi->s_block_base + blk) *
+                      sb->s_blocksize;
+        if (unixfs_pread(sb->s_bdev, buf, nbytes, where) != (ssize_t)nbytes) {
+            free(buf);
+            goto Eio;
+        }
+        raw_inode = (struct sysv_dinode*)buf +
+                    ((ino - 1) & sbi->s_inodes_per_block_1);
+        unsigned long end = min(sbi->s_ninodes,
+                                (blk + nblks) << sbi->s_inodes_per_block_bits);
+        for (; ino <= end; ino++, raw_inode++)
+            if (raw_inode->di_mode == 0 && raw_inode->di_nlink == 0)
+                count++;
     }
 
+    free(buf);
+
     if (count != sb_count)
         goto Einval;
 out:
     return count;
 
 Einval:
-    printk("sysv_count_free_inodes: free inode count was %d, correcting to %d\n",
+    printk("sysv_count_free_inodes: free inode count was %d, correcting to %lu\n",
            sb_count, count);
     goto out;
 
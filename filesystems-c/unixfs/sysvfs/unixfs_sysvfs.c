@@ -5,6 +5,8 @@
  */
 
 #include "sysvfs.h"
+
+#define UNIXFS_INTERNAL_IGETV unixfs_internal_igetv
 #include "unixfs_common.h"
 
 #include <errno.h>
@@ -16,8 +18,18 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 
+static int unixfs_internal_igetv(ino_t* inos, int count, struct inode** ips);
+
 DECL_UNIXFS("UNIX System V", sysv);
 
+static void
+unixfs_internal_statvfs_count(struct super_block* sb, struct statvfs* svb)
+{
+    svb->f_bavail = sysv_count_free_blocks(sb);
+    svb->f_bfree  = svb->f_bavail;
+    svb->f_ffree  = sysv_count_free_inodes(sb);
+}
+
 static void*
 unixfs_internal_init(const char* dmg, uint32_t flags, __unused fs_endian_t fse,
                      char** fsname, char** volname)
@@ -58,16 +70,25 @@ unixfs_internal_init(const char* dmg, uint32_t flags, __unused fs_endian_t fse,
     unixfs = sb;
     unixfs->s_flags = flags;
 
+    /*
+     * Start out with the super block's idea of the free counts. Verifying
+     * them means walking the free list and reading the entire inode table,
+     * so that's done in the background.
+     */
     unixfs->s_statvfs.f_bsize   = max(PAGE_SIZE, sb->s_blocksize);
     unixfs->s_statvfs.f_frsize  = sb->s_blocksize;
     unixfs->s_statvfs.f_blocks  = sbi->s_ndatazones;
-    unixfs->s_statvfs.f_bavail  = sysv_count_free_blocks(sb);
+    unixfs->s_statvfs.f_bavail  = (sbi->s_type == FSTYPE_AFS) ? 0 :
+        fs32_to_host(sbi->s_bytesex, *sbi->s_free_blocks);
     unixfs->s_statvfs.f_bfree   = unixfs->s_statvfs.f_bavail;
     unixfs->s_statvfs.f_files   = sbi->s_ninodes;
-    unixfs->s_statvfs.f_ffree   = sysv_count_free_inodes(sb);
+    unixfs->s_statvfs.f_ffree   =
+        fs16_to_host(sbi->s_bytesex, *sbi->s_sb_total_free_inodes);
     unixfs->s_statvfs.f_namemax = SYSV_NAMELEN;
     unixfs->s_dentsize = 0;
 
+    unixfs_statvfs_defer(sb, unixfs_internal_statvfs_count);
+
     snprintf(unixfs->s_fsname, UNIXFS_MNAMELEN, "%s", sysv_flavor(sbi->s_type));
     snprintf(unixfs->s_volname, UNIXFS_MAXNAMLEN, "%s (%s)",
              unixfs_fstype, sysv_flavor(sbi->s_type));
@@ -103,6 +124,7 @@ out:
 static void
 unixfs_internal_fini(void* filsys)
 {
+    unixfs_statvfs_fini();
     unixfs_inodelayer_fini();
 
     struct super_block* sb = (struct super_block*)filsys;
@@ -144,48 +166,37 @@ unixfs_internal_bread(off_t blkno, char* blkbuf)
 {
     struct super_block* sb = unixfs;
 
-    if (pread(sb->s_bdev, blkbuf, sb->s_blocksize,
-              blkno * (off_t)(sb->s_blocksize)) != sb->s_blocksize)
+    if (unixfs_pread(sb->s_bdev, blkbuf, sb->s_blocksize,
+                     blkno * (off_t)(sb->s_blocksize)) != sb->s_blocksize)
         return EIO;
 
     return 0;
 }
 
-struct inode*
-unixfs_internal_iget(ino_t ino)
+static int
+unixfs_internal_ilocate(ino_t ino, off_t* blkno, size_t* blkoff)
 {
-   if (ino == OSXFUSE_ROOTINO)
-        ino = SYSV_ROOT_INO;
-
-   struct super_block* sb = unixfs;
-   struct sysv_sb_info* sbi = SYSV_SB(sb);
-
-   if (!ino || ino > sbi->s_ninodes) {
-       fprintf(stderr, "bad inode number: %llu\n", ino);
-       return NULL;
-    }
+    struct sysv_sb_info* sbi = SYSV_SB(unixfs);
 
-    struct inode* inode = unixfs_inodelayer_iget(ino);
-    if (!inode) {
-        fprintf(stderr, "*** fatal error: no inode for %llu\n", ino);
-        abort();
-    }
+    if (!ino || ino > sbi->s_ninodes)
+        return -1;
 
-    if (inode->I_initialized)
-        return inode;
+    *blkno = sbi->s_firstinodezone + sbi->s_block_base +
+             (((unsigned int)ino - 1) >> sbi->s_inodes_per_block_bits);
+    *blkoff = (((unsigned int)ino - 1) & sbi->s_inodes_per_block_1) *
+              sizeof(struct sysv_dinode);
 
-    struct buffer_head  bh;
-    struct sysv_dinode* raw_inode = sysv_raw_inode(sb, ino, &bh);
-    if (!raw_inode) {
-        fprintf(stderr, "major problem: failed to read inode %llu\n", ino);
-        unixfs_inodelayer_ifailed(inode);
-        goto bad_inode;
-    }
+    return 0;
+}
 
+static int
+unixfs_internal_idecode(struct inode* inode, char* raw)
+{
+    struct super_block* sb = unixfs;
+    struct sysv_sb_info* sbi = SYSV_SB(sb);
+    struct sysv_dinode* raw_inode = (struct sysv_dinode*)raw;
     struct sysv_inode_info *si = SYSV_I(inode);
 
-    inode->I_ino = ino;
-
     /* SystemV FS: kludge permissions if ino==SYSV_ROOT_INO ?? */
 
     inode->I_mode = fs16_to_host(unixfs->s_endian, raw_inode->di_mode);
@@ -217,6 +228,55 @@ unixfs_internal_iget(ino_t ino)
 
     si->i_dir_start_lookup = 0;
 
+    return 0;
+}
+
+static int
+unixfs_internal_igetv(ino_t* inos, int count, struct inode** ips)
+{
+    int i;
+    for (i = 0; i < count; i++)
+        if (inos[i] == OSXFUSE_ROOTINO)
+            inos[i] = SYSV_ROOT_INO;
+
+    return unixfs_inodelayer_igetv(unixfs, inos, count, ips,
+                                   unixfs_internal_ilocate,
+                                   unixfs_internal_idecode);
+}
+
+struct inode*
+unixfs_internal_iget(ino_t ino)
+{
+   if (ino == OSXFUSE_ROOTINO)
+        ino = SYSV_ROOT_INO;
+
+   struct super_block* sb = unixfs;
+   struct sysv_sb_info* sbi = SYSV_SB(sb);
+
+   if (!ino || ino > sbi->s_ninodes) {
+       fprintf(stderr, "bad inode number: %llu\n", ino);
+       return NULL;
+    }
+
+    struct inode* inode = unixfs_inodelayer_iget(ino);
+    if (!inode) {
+        fprintf(stderr, "*** fatal error: no inode for %llu\n", ino);
+        abort();
+    }
+
+    if (inode->I_initialized)
+        return inode;
+
+    struct buffer_head  bh;
+    struct sysv_dinode* raw_inode = sysv_raw_inode(sb, ino, &bh);
+    if (!raw_inode) {
+        fprintf(stderr, "major problem: failed to read inode %llu\n", ino);
+        unixfs_inodelayer_ifailed(inode);
+        goto bad_inode;
+    }
+
+    unixfs_internal_idecode(inode, (char*)raw_inode);
+
     unixfs_inodelayer_isucceeded(inode);
 
     return inode;
@@ -392,6 +452,6 @@ unixfs_internal_sanitycheck(void* filsys, off_t disksize)
 static int
 unixfs_internal_statvfs(struct statvfs* svb)
 {
-    memcpy(svb, &unixfs->s_statvfs, sizeof(struct statvfs));
+    unixfs_statvfs_get(unixfs, svb);
     return 0;
 }
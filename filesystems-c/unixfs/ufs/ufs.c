@@ -503,8 +503,9 @@ ufs_frag_map(struct inode* inode, sector_t frag, int* error)
     u64 ret = 0L;
     u64 temp = 0L;
 
-    __fs32 block;
-    __fs64 u2_block = 0L;
+    u32 block;
+    u64 u2_block = 0L;
+    int err;
 
     UFSD(": frag = %llu  depth = %d\n", (unsigned long long)frag, depth);
     UFSD(": uspi->s_fpbshift = %d ,uspi->s_apbmask = %x, mask=%llx\n",
@@ -520,62 +521,57 @@ ufs_frag_map(struct inode* inode, sector_t frag, int* error)
     if ((flags & UFS_TYPE_MASK) == UFS_TYPE_UFS2)
         goto ufs2;
 
-    block = ufsi->i_u1.i_data[*p++];
+    block = fs32_to_cpu(sb, ufsi->i_u1.i_data[*p++]);
     if (!block)
         goto out;
 
     while (--depth) {
 
-        struct buffer_head _bh;
-        struct buffer_head* bh = &_bh;
         sector_t n = *p++;
 
-        bh->b_flags.dynamic = 0;
-
-        if (sb_bread_intobh(sb, uspi->s_sbbase +
-                            fs32_to_cpu(sb, block) + (n >> shift), bh) != 0)
+        const u32* bap = (const u32*)
+            unixfs_indirect_bread(sb, uspi->s_sbbase + block + (n >> shift),
+                                  sb->s_blocksize,
+                                  UFS_SB(sb)->s_byteorder->fs32v, NULL, &err);
+        if (!bap)
             goto out;
 
-        block = ((__fs32 *) bh->b_data)[n & mask];
-
-        brelse (bh);
+        block = bap[n & mask];
 
         if (!block)
             goto out;
     }
 
-    ret = (u64)(uspi->s_sbbase + fs32_to_cpu(sb, block) +
-                (frag & uspi->s_fpbmask));
+    ret = (u64)(uspi->s_sbbase + block + (frag & uspi->s_fpbmask));
 
     goto out;
 
 ufs2:
 
-    u2_block = ufsi->i_u1.u2_i_data[*p++];
+    u2_block = fs64_to_cpu(sb, ufsi->i_u1.u2_i_data[*p++]);
     if (!u2_block)
         goto out;
 
     while (--depth) {
 
-        struct buffer_head _bh;
-        struct buffer_head* bh = &_bh;
         sector_t n = *p++;
 
-        temp = (u64)(uspi->s_sbbase) + fs64_to_cpu(sb, u2_block);
+        temp = (u64)(uspi->s_sbbase) + u2_block;
 
-        bh->b_flags.dynamic = 0;
-        if (sb_bread_intobh(sb, temp +(u64) (n>>shift), bh) != 0)
+        const u64* bap = (const u64*)
+            unixfs_indirect_bread(sb, temp + (u64)(n >> shift),
+                                  sb->s_blocksize,
+                                  UFS_SB(sb)->s_byteorder->fs64v, NULL, &err);
+        if (!bap)
             goto out;
 
-        u2_block = ((__fs64 *)bh->b_data)[n & mask];
-
-        brelse(bh);
+        u2_block = bap[n & mask];
 
         if (!u2_block)
             goto out;
     }
 
-    temp = (u64)uspi->s_sbbase + fs64_to_cpu(sb, u2_block);
+    temp = (u64)uspi->s_sbbase + u2_block;
     ret = temp + (u64)(frag & uspi->s_fpbmask);
 
 out:
@@ -1232,6 +1228,10 @@ again:
 
 magic_found:
 
+    sb->s_endian = (sbi->s_bytesex == BYTESEX_LE) ? UNIXFS_FS_LITTLE :
+                                                    UNIXFS_FS_BIG;
+    sbi->s_byteorder = unixfs_byteorder(sb->s_endian);
+
     /* Check block and fragment sizes */
 
     uspi->s_bsize  = fs32_to_cpu(sb, usb1->fs_bsize);
@@ -1511,21 +1511,34 @@ U_ufs_statvfs(struct super_block* sb, struct statvfs* buf)
 }
 
 int
-U_ufs_iget(struct super_block* sb, struct inode* inode)
+U_ufs_inode_location(struct super_block* sb, ino_t ino, off_t* blkno,
+                     size_t* blkoff)
 {
-    struct ufs_inode_info* ufsi;
     struct ufs_sb_private_info* uspi = UFS_SB(sb)->s_uspi;
-    int err;
-
-    unsigned long ino = inode->I_ino;
-
-    UFSD("ENTER, ino %lu\n", ino);
 
     if (ino < UFS_ROOTINO || ino > (uspi->s_ncg * uspi->s_ipg)) {
-        fprintf(stderr, "ufs_read_inode: bad inode number (%lu)\n", ino);
+        fprintf(stderr, "ufs_read_inode: bad inode number (%llu)\n",
+                (ino64_t)ino);
         return EIO;
     }
 
+    *blkno = uspi->s_sbbase + ufs_inotofsba(ino);
+
+    if ((UFS_SB(sb)->s_flags & UFS_TYPE_MASK) == UFS_TYPE_UFS2)
+        *blkoff = ufs_inotofsbo(ino) * sizeof(struct ufs2_inode);
+    else
+        *blkoff = ufs_inotofsbo(ino) * sizeof(struct ufs_inode);
+
+    return 0;
+}
+
+int
+U_ufs_iget_raw(struct super_block* sb, struct inode* inode, char* raw)
+{
+    struct ufs_inode_info* ufsi;
+    struct ufs_sb_private_info* uspi = UFS_SB(sb)->s_uspi;
+    int err;
+
     inode->I_sb = sb;
     inode->I_blkbits = sb->s_blocksize_bits;
     inode->I_nlink = 1;
@@ -1534,42 +1547,50 @@ U_ufs_iget(struct super_block* sb, struct inode* inode)
     ufsi->i_unused1 = 0;
     ufsi->i_dir_start_lookup = 0;
 
+    if ((UFS_SB(sb)->s_flags & UFS_TYPE_MASK) == UFS_TYPE_UFS2)
+        err = ufs2_read_inode(inode, (struct ufs2_inode*)raw);
+    else
+        err = ufs1_read_inode(inode, (struct ufs_inode*)raw);
+
+    if (err)
+        return -1;
+
+    inode->I_version++;
+
+    ufsi->i_lastfrag = (inode->I_size + uspi->s_fsize - 1) >> uspi->s_fshift;
+    ufsi->i_osync = 0;
+
+    return 0;
+}
+
+int
+U_ufs_iget(struct super_block* sb, struct inode* inode)
+{
+    off_t  blkno;
+    size_t blkoff;
+
+    UFSD("ENTER, ino %lu\n", (unsigned long)inode->I_ino);
+
+    if (U_ufs_inode_location(sb, inode->I_ino, &blkno, &blkoff) != 0)
+        return EIO;
+
     struct buffer_head _bh;
     struct buffer_head* bh = &_bh;
 
     bh->b_flags.dynamic = 0;
-    if (sb_bread_intobh(sb, uspi->s_sbbase +
-                        ufs_inotofsba(inode->I_ino), bh) != 0) {
+    if (sb_bread_intobh(sb, blkno, bh) != 0) {
         fprintf(stderr,
                 "ufs_read_inode: unable to read inode %llu\n", inode->I_ino);
-        goto bad_inode;
-    }
-
-    if ((UFS_SB(sb)->s_flags & UFS_TYPE_MASK) == UFS_TYPE_UFS2) {
-        struct ufs2_inode* ufs2_inode = (struct ufs2_inode*)bh->b_data;
-        err = ufs2_read_inode(inode, ufs2_inode + ufs_inotofsbo(inode->I_ino));
-    } else {
-        struct ufs_inode* ufs_inode = (struct ufs_inode*)bh->b_data;
-        err = ufs1_read_inode(inode, ufs_inode + ufs_inotofsbo(inode->I_ino));
+        return -1;
     }
 
-    if (err)
-        goto bad_inode;
-
-    inode->I_version++;
-
-    ufsi->i_lastfrag = (inode->I_size + uspi->s_fsize - 1) >> uspi->s_fshift;
-    ufsi->i_osync = 0;
+    int err = U_ufs_iget_raw(sb, inode, (char*)bh->b_data + blkoff);
 
     brelse(bh);
 
     UFSD("EXIT\n");
 
-    return 0;
-
-bad_inode:
-
-    return -1;
+    return err;
 }
 
 ino_t
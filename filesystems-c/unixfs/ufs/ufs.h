@@ -21,6 +21,9 @@ struct super_block*
       U_ufs_fill_super(int fd, void* args, int silent);
 int   U_ufs_statvfs(struct super_block* sb, struct statvfs* buf);
 int   U_ufs_iget(struct super_block* sb, struct inode* ip);
+int   U_ufs_iget_raw(struct super_block* sb, struct inode* ip, char* raw);
+int   U_ufs_inode_location(struct super_block* sb, ino_t ino, off_t* blkno,
+                           size_t* blkoff);
 ino_t U_ufs_inode_by_name(struct inode* dir, const char* name);
 int   U_ufs_next_direntry(struct inode* dir, struct unixfs_dirbuf* dirbuf,
                           off_t* offset, struct unixfs_direntry* dent);
@@ -45,7 +45,7 @@ unixfs_usage(void)
     "%s (version %s): UFS family of file systems for OSXFUSE\n"
     "Amit Singh <http://osxbook.com>\n"
     "usage:\n"
-    "      %s [--force] --dmg DMG --type TYPE MOUNTPOINT [OSXFUSE args...]\n"
+    "      %s [--force] [--immutable] [--record TRACE] [--workers N [--queue-depth N] [--clone-fd] [--pin-cpus]] --dmg DMG --type TYPE MOUNTPOINT [OSXFUSE args...]\n"
     "where:\n"
     "     . DMG must point to an ancient Unix disk image of a valid type\n"
     "     . TYPE is one of:",
@@ -60,6 +60,12 @@ unixfs_usage(void)
 
     fprintf(stderr, "%s",
     "     . --force attempts mounting even if there are warnings or errors\n"
+    "     . --immutable lets the kernel cache everything for the mount's lifetime\n"
+    "     . --record writes every request to TRACE, for bench/unixfs_replay\n"
+    "     . --workers serves requests from N threads with work stealing and metadata\n"
+    "       ahead of reads, in place of the stock multithreaded loop; --queue-depth\n"
+    "       caps the requests a thread may hold (16), --clone-fd gives each thread\n"
+    "       its own device descriptor (Linux), --pin-cpus binds threads to CPUs\n"
     );
 }
 
@@ -15,7 +15,9 @@
 #include <sys/statvfs.h>
 #include <fuse.h>
 
-char *bigfile_path = "/copyme.txt";
+#include "verybigfs.h"
+
+char *bigfile_path = "/" VERYBIGFS_FILE_NAME;
 
 static int
 verybigfs_statfs(const char *path, struct statvfs *stbuf)
@@ -40,7 +42,7 @@ verybigfs_getattr(const char *path, struct stat *stbuf)
     } else if (strcmp(path, bigfile_path) == 0) {
         stbuf->st_mode = S_IFREG | 0444;
         stbuf->st_nlink = 1;
-        stbuf->st_size = 128ULL * 1024ULL * 0xFFFFFFFFULL;
+        stbuf->st_size = VERYBIGFS_FILE_SIZE;
     } else
         return -ENOENT;
     return 0;
@@ -60,7 +62,16 @@ static int
 verybigfs_read(const char *path, char *buf, size_t size, off_t offset,
                struct fuse_file_info *fi)
 {
-    return 0;
+    if (strcmp(path, bigfile_path) != 0)
+        return -ENOENT;
+    if (offset < 0)
+        return -EINVAL;
+    if ((uint64_t)offset >= VERYBIGFS_FILE_SIZE)
+        return 0;
+    if (size > VERYBIGFS_FILE_SIZE - offset)
+        size = VERYBIGFS_FILE_SIZE - offset;
+    verybigfs_fill(buf, offset, size);
+    return size;
 }
 
 static struct fuse_operations verybigfs_oper = {
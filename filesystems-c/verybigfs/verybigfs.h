@@ -0,0 +1,99 @@
+/*
+ * A "very big" file system with a "very big" file. All that you can read.
+ *
+ * Copyright Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ *
+ * http://code.google.com/p/macfuse/
+ *
+ * Source License: GNU GENERAL PUBLIC LICENSE (GPL)
+ */
+
+#ifndef _VERYBIGFS_H_
+#define _VERYBIGFS_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define VERYBIGFS_FILE_NAME "copyme.txt"
+#define VERYBIGFS_FILE_SIZE (128ULL * 1024ULL * 0xFFFFFFFFULL)
+
+/*
+ * The content of the big file is a function of the offset alone: the 8-byte
+ * word at offset 8*i holds verybigfs_word(i), stored little-endian. Any
+ * range can be produced (or checked) without touching what precedes it,
+ * so random reads cost the same as sequential ones, and a reader can tell
+ * a short, stale or misplaced reply from a good one.
+ *
+ * The word is the counter times an odd constant, xored with another.
+ * Filling a run of words then needs only an add and an xor per word,
+ * which compilers turn into vector code at -O3; the Makefile builds so.
+ */
+
+#define VERYBIGFS_MULT 0x9E3779B97F4A7C15ULL
+#define VERYBIGFS_SEED 0x7665727962696766ULL /* "verybigf" */
+
+static inline uint64_t
+verybigfs_word(uint64_t i)
+{
+    return (i * VERYBIGFS_MULT) ^ VERYBIGFS_SEED;
+}
+
+static inline void
+verybigfs_fill_words(uint64_t *w, uint64_t i, size_t nwords)
+{
+    uint64_t v = i * VERYBIGFS_MULT;
+    size_t n;
+
+    /* Stepping v by addition keeps the multiply out of the loop. */
+    for (n = 0; n < nwords; n++) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        w[n] = __builtin_bswap64(v ^ VERYBIGFS_SEED);
+#else
+        w[n] = v ^ VERYBIGFS_SEED;
+#endif
+        v += VERYBIGFS_MULT;
+    }
+}
+
+/*
+ * Fills buf with size bytes of content starting at offset. buf need not be
+ * aligned; the bulk of it is filled a word at a time and only a partial
+ * word at either end goes through a bounce word.
+ */
+static inline void
+verybigfs_fill(char *buf, uint64_t offset, size_t size)
+{
+    uint64_t word;
+    size_t head = offset & 7;
+
+    if (head) {
+        size_t n = 8 - head;
+        if (n > size)
+            n = size;
+        verybigfs_fill_words(&word, offset >> 3, 1);
+        memcpy(buf, (char *)&word + head, n);
+        buf += n;
+        offset += n;
+        size -= n;
+    }
+
+    if ((((uintptr_t)buf) & 7) == 0) {
+        verybigfs_fill_words((uint64_t *)buf, offset >> 3, size >> 3);
+    } else {
+        size_t n;
+        for (n = 0; n < (size >> 3); n++) {
+            verybigfs_fill_words(&word, (offset >> 3) + n, 1);
+            memcpy(buf + (n << 3), &word, 8);
+        }
+    }
+
+    if (size & 7) {
+        size_t done = size & ~(size_t)7;
+        verybigfs_fill_words(&word, (offset + done) >> 3, 1);
+        memcpy(buf + done, &word, size & 7);
+    }
+}
+
+#endif /* _VERYBIGFS_H_ */
@@ -0,0 +1,337 @@
+/*
+ * A "very big" file system with a "very big" file. All that you can read.
+ *
+ * This is verybigfs over the lowlevel API, meant as a read-throughput
+ * target: the content is generated in place (see verybigfs.h), so what a
+ * reader measures is FUSE itself rather than some backing store.
+ *
+ * Options, besides the usual FUSE ones:
+ *
+ *   -o max_read=N   passed on to the kernel; also sizes the reply buffers
+ *   -o direct_io    open the file with direct_io, so every read reaches us
+ *   -o keep_cache   keep the page cache across opens
+ *   -s              single-threaded; the default is the multithreaded loop
+ *
+ * With FUSE 2.9 and later replies go out through fuse_reply_data(), which
+ * splices them into the device when mounted with -o splice_write.
+ *
+ * Copyright Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ *
+ * http://code.google.com/p/macfuse/
+ *
+ * Source License: GNU GENERAL PUBLIC LICENSE (GPL)
+ */
+
+#include <fuse_lowlevel.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/statvfs.h>
+
+#include "verybigfs.h"
+
+#define VERYBIGFS_ROOT_INO 1
+#define VERYBIGFS_FILE_INO 2
+
+/* The kernel does not send more than this per read unless told otherwise. */
+#define VERYBIGFS_DEFAULT_MAX_READ (128 * 1024)
+
+/* Nothing here ever changes, so let the kernel cache names and attributes. */
+#define VERYBIGFS_TIMEOUT 86400.0
+
+static struct verybigfs_options {
+    unsigned int max_read;
+    int          direct_io;
+    int          keep_cache;
+} options;
+
+static time_t verybigfs_mount_time;
+
+static pthread_key_t verybigfs_buffer_key;
+
+struct verybigfs_buffer {
+    size_t size;
+    char   data[] __attribute__((aligned(64)));
+};
+
+/*
+ * Each serving thread fills its own buffer; the multithreaded loop may
+ * retire idle threads, so the buffers are released through the key's
+ * destructor rather than kept in a fixed table.
+ */
+static char *
+verybigfs_buffer(size_t size)
+{
+    struct verybigfs_buffer *b = pthread_getspecific(verybigfs_buffer_key);
+
+    if (b && b->size >= size)
+        return b->data;
+
+    if (size < options.max_read + 8)
+        size = options.max_read + 8;
+
+    free(b);
+    if (posix_memalign((void **)&b, 4096,
+                       offsetof(struct verybigfs_buffer, data) + size) != 0) {
+        (void)pthread_setspecific(verybigfs_buffer_key, NULL);
+        return NULL;
+    }
+    b->size = size;
+    (void)pthread_setspecific(verybigfs_buffer_key, b);
+
+    return b->data;
+}
+
+static int
+verybigfs_stat(fuse_ino_t ino, struct stat *stbuf)
+{
+    memset(stbuf, 0, sizeof(struct stat));
+    stbuf->st_ino = ino;
+    stbuf->st_atime = stbuf->st_ctime = stbuf->st_mtime = verybigfs_mount_time;
+    stbuf->st_uid = getuid();
+    switch (ino) {
+    case VERYBIGFS_ROOT_INO:
+        stbuf->st_mode = S_IFDIR | 0755;
+        stbuf->st_nlink = 2;
+        break;
+    case VERYBIGFS_FILE_INO:
+        stbuf->st_mode = S_IFREG | 0444;
+        stbuf->st_nlink = 1;
+        stbuf->st_size = VERYBIGFS_FILE_SIZE;
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+static void
+verybigfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    struct fuse_entry_param e;
+
+    if (parent != VERYBIGFS_ROOT_INO || strcmp(name, VERYBIGFS_FILE_NAME) != 0) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    memset(&e, 0, sizeof(e));
+    e.ino = VERYBIGFS_FILE_INO;
+    e.attr_timeout = VERYBIGFS_TIMEOUT;
+    e.entry_timeout = VERYBIGFS_TIMEOUT;
+    verybigfs_stat(e.ino, &e.attr);
+
+    fuse_reply_entry(req, &e);
+}
+
+static void
+verybigfs_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct stat stbuf;
+
+    if (verybigfs_stat(ino, &stbuf) == -1)
+        fuse_reply_err(req, ENOENT);
+    else
+        fuse_reply_attr(req, &stbuf, VERYBIGFS_TIMEOUT);
+}
+
+static void
+verybigfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                     struct fuse_file_info *fi)
+{
+    static const struct {
+        const char *name;
+        fuse_ino_t  ino;
+    } entries[] = {
+        { ".",                 VERYBIGFS_ROOT_INO },
+        { "..",                VERYBIGFS_ROOT_INO },
+        { VERYBIGFS_FILE_NAME, VERYBIGFS_FILE_INO },
+    };
+    char buf[256];
+    size_t used = 0;
+
+    if (ino != VERYBIGFS_ROOT_INO) {
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
+
+    for (; off >= 0 && off < (off_t)(sizeof(entries) / sizeof(entries[0]));
+         off++) {
+        struct stat stbuf;
+        size_t len;
+
+        memset(&stbuf, 0, sizeof(stbuf));
+        stbuf.st_ino = entries[off].ino;
+        len = fuse_add_direntry(req, buf + used, sizeof(buf) - used,
+                                entries[off].name, &stbuf, off + 1);
+        if (used + len > size || used + len > sizeof(buf))
+            break;
+        used += len;
+    }
+
+    fuse_reply_buf(req, buf, used);
+}
+
+static void
+verybigfs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    if (ino != VERYBIGFS_FILE_INO)
+        fuse_reply_err(req, EISDIR);
+    else if ((fi->flags & O_ACCMODE) != O_RDONLY)
+        fuse_reply_err(req, EACCES);
+    else {
+        fi->direct_io = options.direct_io;
+        fi->keep_cache = options.keep_cache;
+        fuse_reply_open(req, fi);
+    }
+}
+
+static void
+verybigfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                  struct fuse_file_info *fi)
+{
+    assert(ino == VERYBIGFS_FILE_INO);
+
+    if (off < 0) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    if ((uint64_t)off >= VERYBIGFS_FILE_SIZE) {
+        fuse_reply_buf(req, NULL, 0);
+        return;
+    }
+    if (size > VERYBIGFS_FILE_SIZE - off)
+        size = VERYBIGFS_FILE_SIZE - off;
+
+    /*
+     * Fill whole words from the one containing off, into an aligned buffer,
+     * and reply from the right byte within it. That keeps the fill on the
+     * vector path no matter how the kernel carves up the reads.
+     */
+    size_t head = off & 7;
+    char *buf = verybigfs_buffer(head + size + 8);
+    if (!buf) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    verybigfs_fill_words((uint64_t *)buf, (uint64_t)off >> 3,
+                         (head + size + 7) >> 3);
+
+#if FUSE_VERSION >= 29
+    struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(size);
+    bufv.buf[0].mem = buf + head;
+    fuse_reply_data(req, &bufv, 0);
+#else
+    fuse_reply_buf(req, buf + head, size);
+#endif
+}
+
+static void
+verybigfs_ll_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+    struct statvfs stbuf;
+
+    memset(&stbuf, 0, sizeof(stbuf));
+    stbuf.f_bsize  = 1024 * 1024;  /* 1MB */
+    stbuf.f_frsize = 128  * 1024;  /* MAXPHYS */
+    stbuf.f_blocks = 0xFFFFFFFFUL;
+    stbuf.f_files  = 3;
+    stbuf.f_namemax = 255;
+
+    fuse_reply_statfs(req, &stbuf);
+}
+
+static struct fuse_lowlevel_ops verybigfs_ll_oper = {
+    .lookup  = verybigfs_ll_lookup,
+    .getattr = verybigfs_ll_getattr,
+    .readdir = verybigfs_ll_readdir,
+    .open    = verybigfs_ll_open,
+    .read    = verybigfs_ll_read,
+    .statfs  = verybigfs_ll_statfs,
+};
+
+enum {
+    KEY_MAX_READ,
+};
+
+#define VERYBIGFS_OPT(t, p, v) { t, offsetof(struct verybigfs_options, p), v }
+
+static struct fuse_opt verybigfs_opts[] = {
+    VERYBIGFS_OPT("direct_io",  direct_io,  1),
+    VERYBIGFS_OPT("keep_cache", keep_cache, 1),
+    FUSE_OPT_KEY("max_read=",   KEY_MAX_READ),
+    FUSE_OPT_END
+};
+
+static int
+verybigfs_opt_proc(void *data, const char *arg, int key,
+                   struct fuse_args *outargs)
+{
+    if (key == KEY_MAX_READ) {
+        unsigned long max_read = strtoul(arg + strlen("max_read="), NULL, 0);
+        if (max_read == 0 || max_read > (64 * 1024 * 1024)) {
+            fprintf(stderr, "verybigfs: invalid %s\n", arg);
+            return -1;
+        }
+        options.max_read = (unsigned int)max_read;
+    }
+    return 1; /* max_read also goes on to the kernel */
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct fuse_chan *ch;
+    char *mountpoint = NULL;
+    int multithreaded = 0, foreground = 0;
+    int err = -1;
+
+    options.max_read = VERYBIGFS_DEFAULT_MAX_READ;
+    verybigfs_mount_time = time(NULL);
+
+    if (fuse_opt_parse(&args, &options, verybigfs_opts,
+                       verybigfs_opt_proc) == -1)
+        return 1;
+
+    if (pthread_key_create(&verybigfs_buffer_key, free) != 0) {
+        fprintf(stderr, "verybigfs: cannot create thread key\n");
+        return 1;
+    }
+
+    if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded,
+                           &foreground) != -1 &&
+        (ch = fuse_mount(mountpoint, &args)) != NULL) {
+        struct fuse_session *se;
+
+        se = fuse_lowlevel_new(&args, &verybigfs_ll_oper,
+                               sizeof(verybigfs_ll_oper), NULL);
+        if (se != NULL) {
+            if (fuse_set_signal_handlers(se) != -1) {
+                fuse_session_add_chan(se, ch);
+                if (fuse_daemonize(foreground) != -1) {
+                    if (multithreaded)
+                        err = fuse_session_loop_mt(se);
+                    else
+                        err = fuse_session_loop(se);
+                }
+                fuse_remove_signal_handlers(se);
+                fuse_session_remove_chan(ch);
+            }
+            fuse_session_destroy(se);
+        }
+        fuse_unmount(mountpoint, ch);
+    }
+    free(mountpoint);
+    fuse_opt_free_args(&args);
+
+    return err ? 1 : 0;
+}
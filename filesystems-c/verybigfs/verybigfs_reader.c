@@ -0,0 +1,296 @@
+/*
+ * A "very big" file system with a "very big" file. All that you can read.
+ *
+ * verybigfs_reader reads the big file through a mounted verybigfs with an
+ * increasing number of threads, checks every byte against the content the
+ * file system is supposed to generate, and reports the throughput of each
+ * run. verybigfs_ll with -o direct_io makes every read a FUSE request, so
+ * the numbers are about what FUSE can move and not what the page cache can.
+ *
+ *   verybigfs_reader [-b blocksize] [-d seconds] [-t threads,...] [-n] [-r]
+ *                    MOUNTPOINT/copyme.txt
+ *
+ * Copyright Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ *
+ * http://code.google.com/p/macfuse/
+ *
+ * Source License: GNU GENERAL PUBLIC LICENSE (GPL)
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "verybigfs.h"
+
+#define MAX_THREADS 256
+
+static const char *path;
+static size_t      blocksize = 1024 * 1024;
+static unsigned    duration = 5;
+static int         verify = 1;
+static int         random_offsets = 0;
+static uint64_t    file_size;
+
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  start_cond = PTHREAD_COND_INITIALIZER;
+static int             started;
+static volatile int    stopped;
+
+struct reader {
+    pthread_t thread;
+    unsigned  index;
+    unsigned  nthreads;
+    uint64_t  bytes;
+    uint64_t  reads;
+    uint64_t  errors;
+    double    elapsed;
+};
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* xorshift64*, one stream per thread */
+static uint64_t
+next_random(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static void *
+reader_main(void *arg)
+{
+    struct reader *r = arg;
+    uint64_t nblocks = file_size / blocksize;
+    uint64_t block, state;
+    char *buf, *expected = NULL;
+    int fd;
+
+    if (posix_memalign((void **)&buf, 4096, blocksize) != 0 ||
+        (verify && posix_memalign((void **)&expected, 4096, blocksize) != 0)) {
+        fprintf(stderr, "verybigfs_reader: out of memory\n");
+        exit(1);
+    }
+
+    /* Each thread opens the file itself, as separate readers would. */
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        perror(path);
+        exit(1);
+    }
+
+    /* Sequential readers start evenly spread over the file. */
+    block = nblocks / r->nthreads * r->index;
+    state = 0x9E3779B97F4A7C15ULL * (r->index + 1);
+
+    pthread_mutex_lock(&start_lock);
+    while (!started)
+        pthread_cond_wait(&start_cond, &start_lock);
+    pthread_mutex_unlock(&start_lock);
+
+    double begin = now();
+
+    while (!stopped) {
+        uint64_t offset;
+        ssize_t n;
+
+        if (random_offsets)
+            block = next_random(&state) % nblocks;
+        else if (block >= nblocks)
+            block = 0;
+        offset = block * blocksize;
+
+        n = pread(fd, buf, blocksize, (off_t)offset);
+        if (n != (ssize_t)blocksize) {
+            if (r->errors++ == 0) {
+                if (n < 0)
+                    fprintf(stderr, "verybigfs_reader: read at %" PRIu64
+                            ": %s\n", offset, strerror(errno));
+                else
+                    fprintf(stderr, "verybigfs_reader: short read at %"
+                            PRIu64 ": %zd of %zu bytes\n", offset, n,
+                            blocksize);
+            }
+            if (n <= 0)
+                break;
+        }
+
+        if (verify && n > 0) {
+            verybigfs_fill(expected, offset, (size_t)n);
+            if (memcmp(buf, expected, (size_t)n) != 0) {
+                if (r->errors++ == 0) {
+                    size_t i = 0;
+                    while (buf[i] == expected[i])
+                        i++;
+                    fprintf(stderr, "verybigfs_reader: bad content at %"
+                            PRIu64 "\n", offset + i);
+                }
+            }
+        }
+
+        r->bytes += (n > 0) ? n : 0;
+        r->reads++;
+        block++;
+    }
+
+    r->elapsed = now() - begin;
+
+    close(fd);
+    free(expected);
+    free(buf);
+
+    return NULL;
+}
+
+static int
+run(unsigned nthreads)
+{
+    struct reader readers[MAX_THREADS];
+    uint64_t bytes = 0, reads = 0, errors = 0;
+    double elapsed = 0;
+    unsigned i;
+
+    memset(readers, 0, sizeof(readers));
+    started = 0;
+    stopped = 0;
+
+    for (i = 0; i < nthreads; i++) {
+        readers[i].index = i;
+        readers[i].nthreads = nthreads;
+        if (pthread_create(&readers[i].thread, NULL, reader_main,
+                           &readers[i]) != 0) {
+            fprintf(stderr, "verybigfs_reader: cannot create thread\n");
+            exit(1);
+        }
+    }
+
+    pthread_mutex_lock(&start_lock);
+    started = 1;
+    pthread_cond_broadcast(&start_cond);
+    pthread_mutex_unlock(&start_lock);
+
+    sleep(duration);
+    stopped = 1;
+
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(readers[i].thread, NULL);
+        bytes += readers[i].bytes;
+        reads += readers[i].reads;
+        errors += readers[i].errors;
+        if (readers[i].elapsed > elapsed)
+            elapsed = readers[i].elapsed;
+    }
+
+    if (elapsed <= 0)
+        elapsed = 1e-9;
+
+    printf("%7u %10.3f %10.3f %12.0f %8" PRIu64 "\n", nthreads,
+           bytes / elapsed / 1e9, bytes / elapsed / 1e9 / nthreads,
+           reads / elapsed, errors);
+    fflush(stdout);
+
+    return errors ? 1 : 0;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+"usage: verybigfs_reader [-b blocksize] [-d seconds] [-t threads,...] [-n] [-r]\n"
+"                        FILE\n"
+"\n"
+"  -b  bytes per read (default 1048576)\n"
+"  -d  seconds per thread count (default 5)\n"
+"  -t  comma-separated thread counts (default 1,2,4,8)\n"
+"  -n  do not verify content\n"
+"  -r  read at random block-aligned offsets instead of sequentially\n");
+    exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned counts[MAX_THREADS];
+    unsigned ncounts = 0, i;
+    const char *threads = "1,2,4,8";
+    struct stat st;
+    int ch, failed = 0;
+
+    while ((ch = getopt(argc, argv, "b:d:nrt:")) != -1) {
+        switch (ch) {
+        case 'b':
+            blocksize = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            duration = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            verify = 0;
+            break;
+        case 'r':
+            random_offsets = 1;
+            break;
+        case 't':
+            threads = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1 || blocksize == 0 || duration == 0)
+        usage();
+    path = argv[0];
+
+    for (const char *p = threads; *p && ncounts < MAX_THREADS; ) {
+        char *end;
+        unsigned long n = strtoul(p, &end, 10);
+        if (end == p || n == 0 || n > MAX_THREADS)
+            usage();
+        counts[ncounts++] = (unsigned)n;
+        p = (*end == ',') ? end + 1 : end;
+        if (*end && *end != ',')
+            usage();
+    }
+
+    if (stat(path, &st) != 0) {
+        perror(path);
+        return 1;
+    }
+    file_size = (uint64_t)st.st_size;
+    if (file_size < blocksize) {
+        fprintf(stderr, "verybigfs_reader: %s is smaller than one block\n",
+                path);
+        return 1;
+    }
+
+    printf("# %s, %zu-byte %s reads, %u s per run, %s\n", path, blocksize,
+           random_offsets ? "random" : "sequential", duration,
+           verify ? "verified" : "not verified");
+    printf("%7s %10s %10s %12s %8s\n", "threads", "GB/s", "GB/s/thr",
+           "reads/s", "errors");
+
+    for (i = 0; i < ncounts; i++)
+        failed |= run(counts[i]);
+
+    return failed;
+}
@@ -0,0 +1,742 @@
+// A concurrent performance suite for any mounted file system.
+//
+// Where posix_compat_test checks that a mount behaves, this measures how
+// fast it does so under load from several threads at once. Each workload
+// reports throughput and p50/p99/p99.9 latencies as JSON, so that runs
+// against loopback, the unixfs flavors, hello or clock can be compared
+// mechanically.
+//
+// On a writable mount (which must be an empty directory, as for
+// posix_compat_test) the workloads are:
+//
+//   metadata  create, stat and unlink of N files across T threads
+//   walk      readdir and lstat of a deep tree built for the purpose
+//   seq       large sequential writes, then reads verified against the
+//             deterministic bytes written
+//   rand      random 4 KB preads and pwrites in a per-thread file
+//   mixed     readers and writers sharing a set of files for a while
+//
+// A read-only mount (unixfs, hello, clock) is detected by a failed create;
+// then walk covers whatever tree is there, and seq and rand read its
+// regular files without verification.
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+// Note: typeof() is a gcc-ism
+#define ASSERT_OP(a, op, b) \
+  do { \
+    typeof(a) _a = (a); \
+    typeof(b) _b = (b); \
+    if (!(_a op _b)) { \
+      std::cerr << __FILE__ << ":" << __LINE__ \
+                << ", Assertion failed: " \
+                << "expected: (" #a ")" #op "(" #b "), " \
+                << "actual: (" << _a << ")" #op "(" << _b << ")" \
+                << ", errno " << errno << std::endl; \
+      exit(1); \
+    } \
+  } while (0);
+
+#define ASSERT_EQ(a, b) ASSERT_OP(a, ==, b)
+#define ASSERT_NE(a, b) ASSERT_OP(a, !=, b)
+#define ASSERT_GT(a, b) ASSERT_OP(a, >, b)
+#define ASSERT_GE(a, b) ASSERT_OP(a, >=, b)
+
+struct Options {
+  string path;
+  int threads;
+  int files;          // metadata: files in all
+  int depth;          // walk: levels below the top
+  int fanout;         // walk: subdirectories per directory
+  int leaf_files;     // walk: files per directory
+  size_t seq_bytes;   // seq: bytes per thread
+  size_t seq_iosize;
+  size_t rand_bytes;  // rand: file size per thread
+  int rand_ops;       // rand: operations per thread
+  int mixed_readers;
+  int mixed_writers;
+  int mixed_files;
+  double mixed_seconds;
+  string workloads;
+  string output;
+};
+
+static Options opts = {
+  "", 4, 10000, 4, 4, 8, 64 << 20, 1 << 20, 16 << 20, 10000, 4, 2, 8, 5.0,
+  "metadata,walk,seq,rand,mixed", "",
+};
+
+struct Result {
+  string workload;
+  string op;
+  int threads;
+  vector<uint64_t> ns;
+  uint64_t bytes;
+  double seconds;
+};
+
+static vector<Result> results;
+static bool read_only = false;
+
+static uint64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t xorshift64(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return (*state = x);
+}
+
+// The generator from posix_compat_test, with its state passed in so that
+// each thread (or file) has a sequence of its own that can be replayed to
+// verify what was read back.
+static void fillBufferWithDeterministicBytes(char *buf, size_t size,
+                                             uint32_t *lfsr) {
+  for (size_t i = 0; i < size; i++) {
+    *lfsr = (*lfsr >> 1) ^ (-(*lfsr & 1u) & 0xd0000001u);
+    buf[i] = *lfsr;  // truncated to 8 bits
+  }
+}
+
+static void writeAll(int fd, const char *buf, size_t nbytes) {
+  size_t total = 0;
+  while (total < nbytes) {
+    ssize_t result = write(fd, buf + total, nbytes - total);
+    ASSERT_GT(result, 0);// writing failed to fd
+    total += result;
+  }
+}
+
+// Returns the bytes read, which is short only at end of file.
+static size_t readAll(int fd, char *buf, size_t nbytes) {
+  size_t total = 0;
+  while (total < nbytes) {
+    ssize_t result = read(fd, buf + total, nbytes - total);
+    ASSERT_GE(result, 0);// reading failed from fd
+    if (result == 0)
+      break;
+    total += result;
+  }
+  return total;
+}
+
+// Per-thread sample sink; merged into a Result once the threads are done.
+struct Samples {
+  vector<uint64_t> ns;
+  uint64_t bytes;
+  Samples() : bytes(0) {}
+  void add(uint64_t begin, uint64_t nbytes = 0) {
+    ns.push_back(nowNs() - begin);
+    bytes += nbytes;
+  }
+};
+
+// Runs fn(thread, samples) on n threads and records the merged samples.
+static void runThreads(const string &workload, const string &op, int n,
+                       std::function<void(int, Samples *)> fn) {
+  vector<Samples> samples(n);
+  vector<std::thread> threads;
+  uint64_t begin = nowNs();
+  for (int i = 0; i < n; i++)
+    threads.push_back(std::thread(fn, i, &samples[i]));
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+
+  Result r;
+  r.workload = workload;
+  r.op = op;
+  r.threads = n;
+  r.bytes = 0;
+  r.seconds = (double)(nowNs() - begin) / 1.0e9;
+  for (int i = 0; i < n; i++) {
+    r.ns.insert(r.ns.end(), samples[i].ns.begin(), samples[i].ns.end());
+    r.bytes += samples[i].bytes;
+  }
+  std::sort(r.ns.begin(), r.ns.end());
+  results.push_back(r);
+
+  cerr << workload << "/" << op << ": " << r.ns.size() << " ops in "
+       << r.seconds << " s" << endl;
+}
+
+static string threadDir(const string &workload, int t) {
+  std::ostringstream s;
+  s << opts.path << "/" << workload << "." << t;
+  return s.str();
+}
+
+static string fileName(const string &dir, int i) {
+  std::ostringstream s;
+  s << dir << "/f" << i;
+  return s.str();
+}
+
+// Not timed: clears out what a workload left behind.
+static void removeTree(const string &path) {
+  DIR *dir = opendir(path.c_str());
+  if (dir) {
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL) {
+      if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+        continue;
+      string child(path + "/" + d->d_name);
+      struct stat sb;
+      if (lstat(child.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode))
+        removeTree(child);
+      else
+        unlink(child.c_str());
+    }
+    closedir(dir);
+  }
+  rmdir(path.c_str());
+}
+
+// The workloads remove what they make, which had better be all there is.
+static bool isEmptyDir(const string &path) {
+  DIR *dir = opendir(path.c_str());
+  if (!dir)
+    return false;
+  bool empty = true;
+  struct dirent *d;
+  while (empty && (d = readdir(dir)) != NULL)
+    empty = !strcmp(d->d_name, ".") || !strcmp(d->d_name, "..");
+  closedir(dir);
+  return empty;
+}
+
+// metadata: every thread creates, then stats, then unlinks its share of
+// the files in a directory of its own. Each phase is a separate result.
+static void metadataStorm() {
+  int per_thread = std::max(1, opts.files / opts.threads);
+
+  for (int t = 0; t < opts.threads; t++)
+    ASSERT_EQ(mkdir(threadDir("metadata", t).c_str(), 0755), 0);
+
+  runThreads("metadata", "create", opts.threads, [&](int t, Samples *s) {
+    string dir(threadDir("metadata", t));
+    for (int i = 0; i < per_thread; i++) {
+      uint64_t begin = nowNs();
+      int fd = open(fileName(dir, i).c_str(), O_CREAT | O_EXCL | O_WRONLY,
+                    0644);
+      ASSERT_GE(fd, 0);// create failed
+      ASSERT_EQ(close(fd), 0);
+      s->add(begin);
+    }
+  });
+
+  runThreads("metadata", "stat", opts.threads, [&](int t, Samples *s) {
+    string dir(threadDir("metadata", t));
+    struct stat sb;
+    for (int i = 0; i < per_thread; i++) {
+      uint64_t begin = nowNs();
+      ASSERT_EQ(stat(fileName(dir, i).c_str(), &sb), 0);
+      s->add(begin);
+    }
+  });
+
+  runThreads("metadata", "unlink", opts.threads, [&](int t, Samples *s) {
+    string dir(threadDir("metadata", t));
+    for (int i = 0; i < per_thread; i++) {
+      uint64_t begin = nowNs();
+      ASSERT_EQ(unlink(fileName(dir, i).c_str()), 0);
+      s->add(begin);
+    }
+  });
+
+  for (int t = 0; t < opts.threads; t++)
+    rmdir(threadDir("metadata", t).c_str());
+}
+
+static void buildTree(const string &dir, int depth) {
+  ASSERT_EQ(mkdir(dir.c_str(), 0755), 0);
+  for (int i = 0; i < opts.leaf_files; i++) {
+    int fd = open(fileName(dir, i).c_str(), O_CREAT | O_EXCL | O_WRONLY,
+                  0644);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(close(fd), 0);
+  }
+  if (depth == 0)
+    return;
+  for (int i = 0; i < opts.fanout; i++) {
+    std::ostringstream s;
+    s << dir << "/d" << i;
+    buildTree(s.str(), depth - 1);
+  }
+}
+
+// Regular files found by the walk, for the read-only workloads.
+struct FoundFile {
+  string path;
+  off_t size;
+};
+
+static vector<FoundFile> found_files;
+
+// walk: threads share a queue of directories; each one they take is read
+// and every entry in it lstat'ed. One sample per entry.
+static void walkTree(const string &top) {
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<string> queue;
+  int busy = 0;
+
+  queue.push_back(top);
+  found_files.clear();
+
+  runThreads("walk", "entry", opts.threads, [&](int, Samples *s) {
+    for (;;) {
+      string dir;
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        while (queue.empty() && busy > 0)
+          cv.wait(guard);
+        if (queue.empty())
+          return;
+        dir = queue.front();
+        queue.pop_front();
+        busy++;
+      }
+
+      vector<string> subdirs;
+      vector<FoundFile> files;
+      DIR *d = opendir(dir.c_str());
+      if (d) {
+        for (;;) {
+          uint64_t begin = nowNs();
+          struct dirent *e = readdir(d);
+          if (!e)
+            break;
+          if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+            continue;
+          string child(dir + "/" + e->d_name);
+          struct stat sb;
+          if (lstat(child.c_str(), &sb) != 0)
+            continue;
+          s->add(begin);
+          if (S_ISDIR(sb.st_mode))
+            subdirs.push_back(child);
+          else if (S_ISREG(sb.st_mode) && sb.st_size > 0) {
+            FoundFile f = { child, sb.st_size };
+            files.push_back(f);
+          }
+        }
+        closedir(d);
+      }
+
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        queue.insert(queue.end(), subdirs.begin(), subdirs.end());
+        found_files.insert(found_files.end(), files.begin(), files.end());
+        busy--;
+      }
+      cv.notify_all();
+    }
+  });
+}
+
+static void walk() {
+  if (read_only) {
+    walkTree(opts.path);
+    return;
+  }
+  string top(opts.path + "/walk");
+  buildTree(top, opts.depth);
+  walkTree(top);
+  removeTree(top);
+}
+
+// seq: each thread streams its own file out, fsyncs it, and reads it back
+// checking every byte. On a read-only mount the found files are read.
+static void sequential() {
+  if (read_only) {
+    std::atomic<size_t> next(0);
+    runThreads("seq", "read", opts.threads, [&](int, Samples *s) {
+      vector<char> buf(opts.seq_iosize);
+      size_t i;
+      while ((i = next++) < found_files.size()) {
+        int fd = open(found_files[i].path.c_str(), O_RDONLY);
+        if (fd < 0)
+          continue;
+        for (;;) {
+          uint64_t begin = nowNs();
+          size_t n = readAll(fd, &buf[0], buf.size());
+          if (n == 0)
+            break;
+          s->add(begin, n);
+        }
+        close(fd);
+      }
+    });
+    return;
+  }
+
+  runThreads("seq", "write", opts.threads, [&](int t, Samples *s) {
+    vector<char> buf(opts.seq_iosize);
+    uint32_t lfsr = t + 1;
+    int fd = open(fileName(opts.path, t).c_str(),
+                  O_CREAT | O_EXCL | O_WRONLY, 0644);
+    ASSERT_GE(fd, 0);
+    for (size_t done = 0; done < opts.seq_bytes; done += buf.size()) {
+      fillBufferWithDeterministicBytes(&buf[0], buf.size(), &lfsr);
+      uint64_t begin = nowNs();
+      writeAll(fd, &buf[0], buf.size());
+      s->add(begin, buf.size());
+    }
+    ASSERT_EQ(fsync(fd), 0);
+    ASSERT_EQ(close(fd), 0);
+  });
+
+  runThreads("seq", "read", opts.threads, [&](int t, Samples *s) {
+    vector<char> buf(opts.seq_iosize), expected(opts.seq_iosize);
+    uint32_t lfsr = t + 1;
+    int fd = open(fileName(opts.path, t).c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    for (size_t done = 0; done < opts.seq_bytes; done += buf.size()) {
+      uint64_t begin = nowNs();
+      ASSERT_EQ(readAll(fd, &buf[0], buf.size()), buf.size());
+      s->add(begin, buf.size());
+      fillBufferWithDeterministicBytes(&expected[0], expected.size(), &lfsr);
+      ASSERT_EQ(memcmp(&buf[0], &expected[0], buf.size()), 0);// data differ
+    }
+    ASSERT_EQ(close(fd), 0);
+  });
+
+  for (int t = 0; t < opts.threads; t++)
+    unlink(fileName(opts.path, t).c_str());
+}
+
+// rand: 4 KB aligned preads, then pwrites, at random offsets of a file per
+// thread. Read-only mounts get the preads only, spread over found files.
+static void random4k() {
+  const size_t kIoSize = 4096;
+
+  if (read_only) {
+    if (found_files.empty())
+      return;
+    runThreads("rand", "read", opts.threads, [&](int t, Samples *s) {
+      char buf[kIoSize];
+      uint64_t seed = t + 1;
+      for (int i = 0; i < opts.rand_ops; i++) {
+        const FoundFile &f = found_files[xorshift64(&seed) %
+                                         found_files.size()];
+        off_t off = (off_t)(xorshift64(&seed) %
+                            ((f.size + kIoSize - 1) / kIoSize)) * kIoSize;
+        int fd = open(f.path.c_str(), O_RDONLY);
+        if (fd < 0)
+          continue;
+        uint64_t begin = nowNs();
+        ssize_t n = pread(fd, buf, kIoSize, off);
+        if (n > 0)
+          s->add(begin, n);
+        close(fd);
+      }
+    });
+    return;
+  }
+
+  size_t nblocks = opts.rand_bytes / kIoSize;
+
+  for (int t = 0; t < opts.threads; t++) {
+    vector<char> buf(opts.seq_iosize);
+    uint32_t lfsr = t + 1;
+    int fd = open(fileName(opts.path, t).c_str(),
+                  O_CREAT | O_EXCL | O_WRONLY, 0644);
+    ASSERT_GE(fd, 0);
+    for (size_t done = 0; done < opts.rand_bytes; done += buf.size()) {
+      fillBufferWithDeterministicBytes(&buf[0], buf.size(), &lfsr);
+      writeAll(fd, &buf[0], std::min(buf.size(), opts.rand_bytes - done));
+    }
+    ASSERT_EQ(close(fd), 0);
+  }
+
+  runThreads("rand", "read", opts.threads, [&](int t, Samples *s) {
+    char buf[kIoSize];
+    uint64_t seed = t + 1;
+    int fd = open(fileName(opts.path, t).c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    for (int i = 0; i < opts.rand_ops; i++) {
+      off_t off = (off_t)(xorshift64(&seed) % nblocks) * kIoSize;
+      uint64_t begin = nowNs();
+      ASSERT_EQ(pread(fd, buf, kIoSize, off), (ssize_t)kIoSize);
+      s->add(begin, kIoSize);
+    }
+    close(fd);
+  });
+
+  runThreads("rand", "write", opts.threads, [&](int t, Samples *s) {
+    char buf[kIoSize];
+    uint64_t seed = t + 1;
+    uint32_t lfsr = t + 1;
+    int fd = open(fileName(opts.path, t).c_str(), O_WRONLY);
+    ASSERT_GE(fd, 0);
+    for (int i = 0; i < opts.rand_ops; i++) {
+      off_t off = (off_t)(xorshift64(&seed) % nblocks) * kIoSize;
+      fillBufferWithDeterministicBytes(buf, kIoSize, &lfsr);
+      uint64_t begin = nowNs();
+      ASSERT_EQ(pwrite(fd, buf, kIoSize, off), (ssize_t)kIoSize);
+      s->add(begin, kIoSize);
+    }
+    close(fd);
+  });
+
+  for (int t = 0; t < opts.threads; t++)
+    unlink(fileName(opts.path, t).c_str());
+}
+
+// mixed: readers and writers work on a shared set of files at the same
+// time, in 64 KB requests, until the time runs out. Readers and writers
+// are reported separately; both results span the same interval.
+static void mixed() {
+  const size_t kIoSize = 65536;
+  const size_t kFileSize = 16 << 20;
+  size_t nblocks = kFileSize / kIoSize;
+  string dir(opts.path + "/mixed");
+
+  ASSERT_EQ(mkdir(dir.c_str(), 0755), 0);
+  for (int i = 0; i < opts.mixed_files; i++) {
+    vector<char> buf(kIoSize);
+    uint32_t lfsr = i + 1;
+    int fd = open(fileName(dir, i).c_str(), O_CREAT | O_EXCL | O_WRONLY,
+                  0644);
+    ASSERT_GE(fd, 0);
+    for (size_t done = 0; done < kFileSize; done += kIoSize) {
+      fillBufferWithDeterministicBytes(&buf[0], kIoSize, &lfsr);
+      writeAll(fd, &buf[0], kIoSize);
+    }
+    ASSERT_EQ(close(fd), 0);
+  }
+
+  uint64_t deadline = nowNs() + (uint64_t)(opts.mixed_seconds * 1.0e9);
+  int nthreads = opts.mixed_readers + opts.mixed_writers;
+  vector<Samples> samples(nthreads);
+  vector<std::thread> threads;
+  uint64_t begin = nowNs();
+
+  for (int t = 0; t < nthreads; t++) {
+    bool writer = (t >= opts.mixed_readers);
+    threads.push_back(std::thread([&, t, writer]() {
+      vector<char> buf(kIoSize);
+      vector<int> fds(opts.mixed_files);
+      uint64_t seed = t + 1;
+      uint32_t lfsr = t + 1;
+      for (int i = 0; i < opts.mixed_files; i++) {
+        fds[i] = open(fileName(dir, i).c_str(), writer ? O_WRONLY : O_RDONLY);
+        ASSERT_GE(fds[i], 0);
+      }
+      while (nowNs() < deadline) {
+        int fd = fds[xorshift64(&seed) % fds.size()];
+        off_t off = (off_t)(xorshift64(&seed) % nblocks) * kIoSize;
+        if (writer)
+          fillBufferWithDeterministicBytes(&buf[0], kIoSize, &lfsr);
+        uint64_t b = nowNs();
+        ssize_t n = writer ? pwrite(fd, &buf[0], kIoSize, off)
+                           : pread(fd, &buf[0], kIoSize, off);
+        ASSERT_EQ(n, (ssize_t)kIoSize);
+        samples[t].add(b, n);
+      }
+      for (int i = 0; i < opts.mixed_files; i++)
+        close(fds[i]);
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+
+  double seconds = (double)(nowNs() - begin) / 1.0e9;
+  for (int w = 0; w < 2; w++) {
+    Result r;
+    r.workload = "mixed";
+    r.op = w ? "write" : "read";
+    r.threads = w ? opts.mixed_writers : opts.mixed_readers;
+    r.bytes = 0;
+    r.seconds = seconds;
+    for (int t = w ? opts.mixed_readers : 0;
+         t < (w ? nthreads : opts.mixed_readers); t++) {
+      r.ns.insert(r.ns.end(), samples[t].ns.begin(), samples[t].ns.end());
+      r.bytes += samples[t].bytes;
+    }
+    std::sort(r.ns.begin(), r.ns.end());
+    results.push_back(r);
+
+    cerr << "mixed/" << r.op << ": " << r.ns.size() << " ops in "
+         << r.seconds << " s" << endl;
+  }
+
+  removeTree(dir);
+}
+
+static double percentileUs(const vector<uint64_t> &ns, double p) {
+  if (ns.empty())
+    return 0;
+  return (double)ns[(size_t)(p * (double)(ns.size() - 1) + 0.5)] / 1000.0;
+}
+
+static string jsonString(const string &s) {
+  string out("\"");
+  for (size_t i = 0; i < s.size(); i++) {
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c < 0x20) {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", c);
+      out += esc;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+static void writeJson(std::ostream &os) {
+  os << "{\n"
+     << "  \"path\": " << jsonString(opts.path) << ",\n"
+     << "  \"read_only\": " << (read_only ? "true" : "false") << ",\n"
+     << "  \"threads\": " << opts.threads << ",\n"
+     << "  \"results\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &r = results[i];
+    char line[512];
+    snprintf(line, sizeof(line),
+             "\"threads\": %d, \"ops\": %zu, \"seconds\": %.6f, "
+             "\"ops_per_sec\": %.1f, \"mb_per_sec\": %.2f, "
+             "\"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f",
+             r.threads, r.ns.size(), r.seconds,
+             r.seconds > 0 ? (double)r.ns.size() / r.seconds : 0.0,
+             r.seconds > 0 ? (double)r.bytes / r.seconds / 1.0e6 : 0.0,
+             percentileUs(r.ns, 0.50), percentileUs(r.ns, 0.99),
+             percentileUs(r.ns, 0.999));
+    os << (i ? ",\n" : "\n") << "    { \"workload\": "
+       << jsonString(r.workload) << ", \"op\": " << jsonString(r.op)
+       << ", " << line << " }";
+  }
+  os << "\n  ]\n}\n";
+}
+
+static void usage(const string &me) {
+  cerr << "usage: " << me << " [-t threads] [-n files] [-d depth] [-f fanout]"
+       << endl
+       << "       [-s seq_bytes] [-r rand_ops] [-R readers] [-W writers]"
+       << endl
+       << "       [-T mixed_seconds] [-w workloads] [-o out.json]"
+       << " /path/to/mount/dir" << endl
+       << "  workloads: comma-separated subset of "
+       << "metadata,walk,seq,rand,mixed" << endl
+       << "  the directory must be empty unless the mount is read-only"
+       << endl;
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  int ch;
+  while ((ch = getopt(argc, argv, "d:f:n:o:r:R:s:t:T:w:W:")) != -1) {
+    switch (ch) {
+      case 'd': opts.depth = atoi(optarg); break;
+      case 'f': opts.fanout = atoi(optarg); break;
+      case 'n': opts.files = atoi(optarg); break;
+      case 'o': opts.output = optarg; break;
+      case 'r': opts.rand_ops = atoi(optarg); break;
+      case 'R': opts.mixed_readers = atoi(optarg); break;
+      case 's': opts.seq_bytes = strtoull(optarg, NULL, 0); break;
+      case 't': opts.threads = atoi(optarg); break;
+      case 'T': opts.mixed_seconds = atof(optarg); break;
+      case 'w': opts.workloads = optarg; break;
+      case 'W': opts.mixed_writers = atoi(optarg); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || opts.threads < 1 || opts.fanout < 1 ||
+      opts.seq_bytes < opts.seq_iosize)
+    usage(argv[0]);
+  opts.path = argv[optind];
+  opts.seq_bytes -= opts.seq_bytes % opts.seq_iosize;
+
+  string probe(opts.path + "/.fs_perf_test");
+  int fd = open(probe.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+  if (fd < 0) {
+    if (errno != EROFS && errno != EACCES && errno != EPERM &&
+        errno != ENOSYS) {
+      cerr << "cannot write to " << opts.path << ": " << strerror(errno)
+           << endl;
+      return 1;
+    }
+    read_only = true;
+    cerr << opts.path << " is read-only; running the read workloads" << endl;
+  } else {
+    close(fd);
+    unlink(probe.c_str());
+    if (!isEmptyDir(opts.path)) {
+      cerr << opts.path << " is not an empty directory" << endl;
+      return 1;
+    }
+  }
+
+  // The read-only workloads read what the walk found.
+  if (read_only && opts.workloads.find("walk") == string::npos)
+    opts.workloads = "walk," + opts.workloads;
+
+  std::istringstream list(opts.workloads);
+  string w;
+  while (std::getline(list, w, ',')) {
+    if (w == "metadata") {
+      if (!read_only)
+        metadataStorm();
+    } else if (w == "walk") {
+      walk();
+    } else if (w == "seq") {
+      sequential();
+    } else if (w == "rand") {
+      random4k();
+    } else if (w == "mixed") {
+      if (!read_only)
+        mixed();
+    } else {
+      cerr << "unknown workload " << w << endl;
+      return 1;
+    }
+  }
+
+  if (opts.output.empty()) {
+    writeJson(cout);
+  } else {
+    std::ofstream out(opts.output.c_str());
+    writeJson(out);
+  }
+  return 0;
+}